@@ -293,6 +293,7 @@ int initConfigDefaults(Config *cfg)
     cfg->font.height = 11;
     cfg->font.isbold = 0;
     cfg->font.charset = 0;
+    cfg->refresh_rate = 60;
 
     // colors
     cfg->ansi_colour = 1;
@@ -359,19 +360,25 @@ int initConfigDefaults(Config *cfg)
     cfg->x11_auth = 1;
 
     // ssh options
-    cfg->ssh_cipherlist[0] = 3;
-    cfg->ssh_cipherlist[1] = 2;
-    cfg->ssh_cipherlist[2] = 1;
-    cfg->ssh_cipherlist[3] = 0;
-    cfg->ssh_cipherlist[4] = 5;
-    cfg->ssh_cipherlist[5] = 4;
-    cfg->ssh_kexlist[0] = 3;
-    cfg->ssh_kexlist[1] = 2;
-    cfg->ssh_kexlist[2] = 1;
-    cfg->ssh_kexlist[3] = 4;
-    cfg->ssh_kexlist[4] = 0;
+    cfg->ssh_cipherlist[0] = CIPHER_AESGCM;
+    cfg->ssh_cipherlist[1] = CIPHER_CHACHA20;
+    cfg->ssh_cipherlist[2] = 3;
+    cfg->ssh_cipherlist[3] = 2;
+    cfg->ssh_cipherlist[4] = 1;
+    cfg->ssh_cipherlist[5] = 0;
+    cfg->ssh_cipherlist[6] = 5;
+    cfg->ssh_cipherlist[7] = 4;
+    cfg->ssh_kexlist[0] = KEX_ECDH;
+    cfg->ssh_kexlist[1] = 3;
+    cfg->ssh_kexlist[2] = 2;
+    cfg->ssh_kexlist[3] = 1;
+    cfg->ssh_kexlist[4] = 4;
+    cfg->ssh_kexlist[5] = 0;
+    cfg->compression_level = 6;
     cfg->ssh_rekey_time = 60;
     strcpy(cfg->ssh_rekey_data, "1G");
+    cfg->ssh_winsize = 16384;
+    cfg->ssh_maxpkt = 16384;
     cfg->sshprot = 2;
     cfg->ssh_show_banner = 1;
     cfg->try_ki_auth = 1;
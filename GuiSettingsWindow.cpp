@@ -323,6 +323,7 @@ void GuiSettingsWindow::setConfig(Config *_cfg)
 
     /* ssh options */
     ui->le_remote_cmd->setText(cfg.remote_cmd);
+    ui->chb_ssh_share->setChecked(cfg.ssh_share);
 
     /* ssh auth options */
     ui->chb_ssh_no_userauth->setChecked(cfg.ssh_no_userauth);
@@ -424,6 +425,7 @@ Config *GuiSettingsWindow::getConfig()
 
     /* ssh options */
     qstring_to_char(cfg->remote_cmd, ui->le_remote_cmd->text(), sizeof(cfg->remote_cmd));
+    cfg->ssh_share = ui->chb_ssh_share->isChecked();
 
     /* ssh auth options */
     cfg->ssh_no_userauth = ui->chb_ssh_no_userauth->isChecked();
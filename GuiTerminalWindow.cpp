@@ -11,12 +11,18 @@
 #include <QClipboard>
 #include <QScrollBar>
 #include <QMessageBox>
+#include <QVarLengthArray>
 #include "GuiMainWindow.h"
 #include "GuiTerminalWindow.h"
 #include "GuiSplitter.h"
 #include "GuiMenu.h"
 #include "GuiTabWidget.h"
 #include "GuiFindToolBar.h"
+
+// socket reads: size of one read and how many to do per readyRead()
+#define READ_BUFFER_SIZE (64*1024)
+#define READ_MAX_CHUNKS 16
+
 GuiTerminalWindow::GuiTerminalWindow(QWidget *parent, GuiMainWindow *mainWindow) :
     QAbstractScrollArea(parent),
     clipboard_contents(NULL),
@@ -40,12 +46,16 @@ GuiTerminalWindow::GuiTerminalWindow(QWidget *parent, GuiMainWindow *mainWindow)
     setFocusPolicy(Qt::StrongFocus);
     _any_update = false;
 
-    termrgn = QRegion();
+    repaintTimer.setSingleShot(true);
+    connect(&repaintTimer, SIGNAL(timeout()), this, SLOT(flushRepaint()));
+
+    readBuffer.resize(READ_BUFFER_SIZE);
+
     term = NULL;
     ldisc = NULL;
     backend = NULL;
     backhandle = NULL;
-    qtsock = NULL;
+    as = NULL;
     userClosingTab = false;
     isSockDisconnected = false;
 
@@ -76,11 +86,12 @@ GuiTerminalWindow::~GuiTerminalWindow()
         backhandle = NULL;
         backend = NULL;
         term_provide_resize_fn(term, NULL, NULL);
+        term_provide_unthrottle_fn(term, NULL, NULL);
         term_free(term);
-        if (qtsock)
-            qtsock->close();
+        if (qtsock())
+            qtsock()->close();
         term = NULL;
-        qtsock = NULL;
+        as = NULL;
     }
 }
 
@@ -101,6 +112,9 @@ int GuiTerminalWindow::initTerminal()
     cfgtopalette(&cfg);
 
     backend = backend_from_proto(cfg.protocol);
+    // another tab may already be connected where we're going
+    if (backend == &ssh_backend && ssh_share_available(&cfg))
+        backend = &ssh_share_backend;
     const char * error = backend->init(this, &backhandle, &cfg, (char*)ip_addr, cfg.port, &realhost, 1, 0);
     if (realhost)
         sfree(realhost);
@@ -130,23 +144,35 @@ int GuiTerminalWindow::initTerminal()
         as = (Actual_Socket)get_telnet_socket(backhandle);
         break;
     case PROT_SSH:
-        as = (Actual_Socket)get_ssh_socket(backhandle);
+        // a shared session reads through the tab that owns the socket
+        as = backend == &ssh_share_backend ? NULL :
+                (Actual_Socket)get_ssh_socket(backhandle);
         break;
     default:
         assert(0);
     }
-    qtsock = as->qtsock;
-    QObject::connect(as->qtsock, SIGNAL(readyRead()), this, SLOT(readyRead()));
-    QObject::connect(as->qtsock, SIGNAL(error(QAbstractSocket::SocketError)),
-                     this, SLOT(sockError(QAbstractSocket::SocketError)));
-    QObject::connect(as->qtsock, SIGNAL(disconnected()),
-                     this, SLOT(sockDisconnected()));
+    if (as) {
+        as->frontend_reads = 1;
+        // via the socket's events object: the QTcpSocket we end up on
+        // may not be the one there is now
+        QObject::connect(as->events, SIGNAL(readyRead()), this, SLOT(readyRead()));
+        QObject::connect(as->events, SIGNAL(error(QAbstractSocket::SocketError)),
+                         this, SLOT(sockError(QAbstractSocket::SocketError)));
+        QObject::connect(as->events, SIGNAL(disconnected()),
+                         this, SLOT(sockDisconnected()));
+    }
 
     /*
      * Connect the terminal to the backend for resize purposes.
      */
     term_provide_resize_fn(term, backend->size, backhandle);
 
+    /*
+     * Let the backend reopen its flow-control window as the terminal
+     * works through queued output (async_term_out mode).
+     */
+    term_provide_unthrottle_fn(term, backend->unthrottle, backhandle);
+
     /*
      * Set up a line discipline.
      */
@@ -174,10 +200,12 @@ int GuiTerminalWindow::restartTerminal()
         backhandle = NULL;
         backend = NULL;
         term_provide_resize_fn(term, NULL, NULL);
+        term_provide_unthrottle_fn(term, NULL, NULL);
         term_free(term);
-        qtsock->close();
+        if (qtsock())
+            qtsock()->close();
         term = NULL;
-        qtsock = NULL;
+        as = NULL;
     }
     isSockDisconnected = false;
     return initTerminal();
@@ -278,7 +306,6 @@ TmuxWindowPane *GuiTerminalWindow::initTmuxClientTerminal(TmuxGateway *gateway,
     tmuxPane->height = height;
 
     as = NULL;
-    qtsock = NULL;
 
     /*
      * Connect the terminal to the backend for resize purposes.
@@ -351,12 +378,26 @@ void GuiTerminalWindow::keyReleaseEvent ( QKeyEvent * e )
 
 void GuiTerminalWindow::readyRead ()
 {
-    char buf[20480];
-    int len = qtsock->read(buf, sizeof(buf));
-    noise_ultralight(len);
-    (*as->plug)->receive(as->plug, 0, buf, len);
+    // hand at most READ_MAX_CHUNKS buffers to the backend per call, so
+    // a busy connection can't keep painting and input waiting
+    for (int i = 0; i < READ_MAX_CHUNKS; i++) {
+        if (!qtsock() || qtsock()->bytesAvailable() <= 0)
+            return;
+        if (as->frozen) {
+            // sk_tcp_set_frozen will call us again once thawed
+            as->frozen_readable = 1;
+            return;
+        }
+        int len = qtsock()->read(readBuffer.data(), readBuffer.size());
+        if (len <= 0)
+            return;
+        noise_ultralight(len);
+        (*as->plug)->receive(as->plug, 0, readBuffer.data(), len);
+    }
 
-    if(qtsock->bytesAvailable()>0) readyRead();
+    // Qt won't signal again for data it already has; come back later
+    if (qtsock() && qtsock()->bytesAvailable() > 0)
+        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
 }
 
 void GuiTerminalWindow::highlightSearchedText(QPainter &painter)
@@ -392,6 +433,17 @@ void GuiTerminalWindow::highlightSearchedText(QPainter &painter)
 
 }
 
+static inline void spanAdd(int &left, int &right, int l, int r)
+{
+    if (left >= right) {
+        left = l;
+        right = r;
+    } else {
+        if (l < left) left = l;
+        if (r > right) right = r;
+    }
+}
+
 void GuiTerminalWindow::paintEvent (QPaintEvent *e)
 {
     QPainter painter(viewport());
@@ -401,38 +453,95 @@ void GuiTerminalWindow::paintEvent (QPaintEvent *e)
 
     painter.fillRect(e->rect(), colours[258]);
 
-    for(int i=0; i<e->region().rects().size(); i++) {
-        const QRect &r = e->region().rects().at(i);
-        int row = r.top()/fontHeight;
+    resizeSpans();
+
+    // Qt clips to the event region, so each of its rects is taken as a
+    // cell range: every cell it touches was just cleared and is painted
+    // again, whether we asked for it or Qt exposed it on its own. Only
+    // the columns a rect fully covers are dropped from the row's span;
+    // the rest waits for the paint event Qt still owes us for it.
+    const QVector<QRect> rects = e->region().rects();
+    for (int i = 0; i < rects.size(); i++) {
+        const QRect &r = rects[i];
         int colstart = r.left()/fontWidth;
-        int rowend = (r.bottom()+1)/fontHeight;
-        int colend = (r.right()+1)/fontWidth;
-        for(; row<rowend && row<term->rows; row++) {
-            for(int col=colstart; col<colend && col<term->cols; ) {
-                uint attr = term->dispstr_attr[row*term->cols + col];
-                int coldiff = col+1;
-                for(;attr==term->dispstr_attr[row*term->cols + coldiff];
-                    coldiff++);
-                if (coldiff >= term->cols)
-                    coldiff = term->cols;
-                QString str = QString::fromWCharArray(&term->dispstr[row*term->cols + col], coldiff-col);
-                paintText(painter, row, col, str, attr);
-
-                // paint cursor
-                if (attr & (TATTR_ACTCURS | TATTR_PASCURS))
-                    paintCursor(painter, row, col, str, attr);
-                col = coldiff;
-            }
+        int colend = r.right()/fontWidth + 1;
+        int rowstart = r.top()/fontHeight;
+        int rowend = r.bottom()/fontHeight + 1;
+        if (colend > term->cols)
+            colend = term->cols;
+        if (rowend > term->rows)
+            rowend = term->rows;
+        if (colstart >= colend)
+            continue;
+
+        // columns and rows lying wholly inside the rect
+        int coverLeft = (r.left() + fontWidth - 1)/fontWidth;
+        int coverRight = (r.right() + 1)/fontWidth;
+        int coverTop = (r.top() + fontHeight - 1)/fontHeight;
+        int coverBottom = (r.bottom() + 1)/fontHeight;
+
+        for (int row = rowstart; row < rowend; row++) {
+            paintRow(painter, row, colstart, colend);
+
+            DirtySpan &span = paintSpans[row];
+            if (span.left >= span.right || row < coverTop ||
+                row >= coverBottom || coverLeft >= coverRight)
+                continue;
+            if (coverLeft <= span.left && coverRight >= span.right)
+                span.left = span.right = 0;
+            else if (coverLeft <= span.left && coverRight > span.left)
+                span.left = coverRight;
+            else if (coverRight >= span.right && coverLeft < span.right)
+                span.right = coverLeft;
         }
-        if(mainWindow->findToolBar && mainWindow->findToolBar->findTextFlag)
-        {
-            highlightSearchedText(painter);
+    }
+    if(mainWindow->findToolBar && mainWindow->findToolBar->findTextFlag)
+    {
+        highlightSearchedText(painter);
+    }
+}
+
+/*
+ * Blit the cells [colstart, colend) of a display row from the glyph
+ * atlas in one drawPixmapFragments() call.
+ */
+void GuiTerminalWindow::paintRow(QPainter &painter, int row, int colstart, int colend)
+{
+    QVarLengthArray<QPainter::PixmapFragment, 256> frags;
+    const wchar_t *chars = &term->dispstr[row*term->cols];
+    const unsigned long *attrs = &term->dispstr_attr[row*term->cols];
+    qreal y = row*fontHeight + fontHeight/2.0;
+
+    // a cache eviction while collecting invalidates earlier rects, so
+    // gather the row a second time if the atlas generation changed
+    for (int pass = 0; pass < 2; pass++) {
+        int gen = glyphAtlas.generation();
+        frags.clear();
+        for (int col=colstart; col<colend; col++) {
+            unsigned long attr = attrs[col];
+            int nfg, nbg;
+            attrToColours(attr, &nfg, &nbg);
+            QRect src = glyphAtlas.glyph(chars[col], nfg, nbg, attr & ATTR_WIDE);
+            frags.append(QPainter::PixmapFragment::create(
+                             QPointF(col*fontWidth + src.width()/2.0, y), src));
+            if (attr & ATTR_WIDE)
+                col++;
         }
+        if (gen == glyphAtlas.generation())
+            break;
+    }
+    painter.drawPixmapFragments(frags.constData(), frags.size(), glyphAtlas.pixmap());
+
+    // paint cursor
+    for (int col=colstart; col<colend; col++) {
+        unsigned long attr = attrs[col];
+        if (attr & (TATTR_ACTCURS | TATTR_PASCURS))
+            paintCursor(painter, row, col,
+                        QString::fromWCharArray(&chars[col], 1), attr);
     }
 }
 
-void GuiTerminalWindow::paintText(QPainter &painter, int row, int col,
-                                  const QString &str, unsigned long attr)
+void GuiTerminalWindow::attrToColours(unsigned long attr, int *nfg, int *nbg)
 {
     if ((attr & TATTR_ACTCURS) && (cfg.cursor_type == 0 || term->big_cursor)) {
     attr &= ~(ATTR_REVERSE|ATTR_BLINK|ATTR_COLOURS);
@@ -443,21 +552,28 @@ void GuiTerminalWindow::paintText(QPainter &painter, int row, int col,
     attr |= (260 << ATTR_FGSHIFT) | (261 << ATTR_BGSHIFT);
     }
 
-    int nfg = ((attr & ATTR_FGMASK) >> ATTR_FGSHIFT);
-    int nbg = ((attr & ATTR_BGMASK) >> ATTR_BGSHIFT);
+    *nfg = ((attr & ATTR_FGMASK) >> ATTR_FGSHIFT);
+    *nbg = ((attr & ATTR_BGMASK) >> ATTR_BGSHIFT);
     if (attr & ATTR_REVERSE) {
-        int t = nfg;
-        nfg = nbg;
-        nbg = t;
+        int t = *nfg;
+        *nfg = *nbg;
+        *nbg = t;
     }
     if (bold_mode == BOLD_COLOURS && (attr & ATTR_BOLD)) {
-        if (nfg < 16) nfg |= 8;
-        else if (nfg >= 256) nfg |= 1;
+        if (*nfg < 16) *nfg |= 8;
+        else if (*nfg >= 256) *nfg |= 1;
     }
     if (bold_mode == BOLD_COLOURS && (attr & ATTR_BLINK)) {
-        if (nbg < 16) nbg |= 8;
-        else if (nbg >= 256) nbg |= 1;
+        if (*nbg < 16) *nbg |= 8;
+        else if (*nbg >= 256) *nbg |= 1;
     }
+}
+
+void GuiTerminalWindow::paintText(QPainter &painter, int row, int col,
+                                  const QString &str, unsigned long attr)
+{
+    int nfg, nbg;
+    attrToColours(attr, &nfg, &nbg);
     painter.fillRect(QRect(col*fontWidth, row*fontHeight,
                           fontWidth*str.length(), fontHeight),
                           colours[nbg]);
@@ -543,14 +659,61 @@ int GuiTerminalWindow::from_backend(int is_stderr, const char *data, size_t len)
     return term_data(term, is_stderr, data, (int)len);
 }
 
+void GuiTerminalWindow::resizeSpans()
+{
+    if (!term || dirtySpans.size() == term->rows)
+        return;
+    DirtySpan clean = { 0, 0 };
+    dirtySpans.fill(clean, term->rows);
+    paintSpans.fill(clean, term->rows);
+}
+
 void GuiTerminalWindow::preDrawTerm()
 {
-    termrgn = QRegion();
+    resizeSpans();
 }
 
 void GuiTerminalWindow::drawTerm()
 {
-    this->viewport()->update(termrgn);
+    if (!_any_update || repaintTimer.isActive())
+        return;
+
+    int interval = 1000 / (cfg.refresh_rate > 0 ? cfg.refresh_rate : 60);
+    qint64 since = lastRepaint.isValid() ? lastRepaint.elapsed() : interval;
+    int delay = since >= interval ? 0 : (int)(interval - since);
+
+    // more input is already queued on the socket; skip this frame, the
+    // next one shows the newer screen anyway. Never starve the display
+    // for more than a few frames though.
+    if (qtsock() && qtsock()->bytesAvailable() > 0 && since < 4 * interval)
+        delay = interval;
+
+    repaintTimer.start(delay);
+}
+
+void GuiTerminalWindow::flushRepaint()
+{
+    QVarLengthArray<QRect, 128> rects;
+
+    // one rect per dirty row, already in the y-x banded order that
+    // QRegion::setRects() expects
+    for (int row = 0; row < dirtySpans.size(); row++) {
+        DirtySpan &span = dirtySpans[row];
+        if (span.left >= span.right)
+            continue;
+        rects.append(QRect(span.left*fontWidth, row*fontHeight,
+                           (span.right-span.left)*fontWidth, fontHeight));
+        spanAdd(paintSpans[row].left, paintSpans[row].right,
+                span.left, span.right);
+        span.left = span.right = 0;
+    }
+    _any_update = false;
+
+    QRegion rgn;
+    rgn.setRects(rects.constData(), rects.size());
+
+    lastRepaint.start();
+    viewport()->update(rgn);
 }
 
 void GuiTerminalWindow::drawText(int row, int col, wchar_t * /*ch*/, int len, unsigned long attr, int /*lattr*/)
@@ -559,7 +722,12 @@ void GuiTerminalWindow::drawText(int row, int col, wchar_t * /*ch*/, int len, un
         // TODO NOT_YET_IMPLEMENTED
         return;
     }
-    termrgn |= QRect(col*fontWidth, row*fontHeight, fontWidth*len, fontHeight);
+    if (row < 0 || row >= dirtySpans.size())
+        return;
+    if (attr & ATTR_WIDE)
+        len *= 2;
+    spanAdd(dirtySpans[row].left, dirtySpans[row].right, col, col + len);
+    _any_update = true;
 }
 
 void GuiTerminalWindow::setTermFont(Config *cfg)
@@ -578,6 +746,8 @@ void GuiTerminalWindow::setTermFont(Config *cfg)
     fontWidth = fontMetrics.width(QChar('a'));
     fontHeight = fontMetrics.height();
     fontAscent = fontMetrics.ascent();
+
+    glyphAtlas.reset(_font, fontWidth, fontHeight, fontAscent, colours);
 }
 
 void GuiTerminalWindow::cfgtopalette(Config *cfg)
@@ -609,6 +779,9 @@ void GuiTerminalWindow::cfgtopalette(Config *cfg)
     /* Override with system colours if appropriate * /
     if (cfg.system_colour)
         systopalette();*/
+
+    // cached glyphs have the old colours baked in
+    glyphAtlas.reset(_font, fontWidth, fontHeight, fontAscent, colours);
 }
 
 /*
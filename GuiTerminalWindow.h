@@ -13,12 +13,15 @@
 #include <QtNetwork/QTcpSocket>
 #include <QAbstractScrollArea>
 #include <QElapsedTimer>
+#include <QVector>
+#include <QTimer>
 #include "QtCommon.h"
 #include "tmux/tmux.h"
 #include "tmux/TmuxGateway.h"
 #include "tmux/TmuxWindowPane.h"
 #include "GuiDrag.h"
 #include "GuiBase.h"
+#include "QtGlyphAtlas.h"
 extern "C" {
 #include "terminal.h"
 #include "putty.h"
@@ -46,10 +49,24 @@ private:
     int fontWidth, fontHeight, fontAscent;
     struct unicode_data ucsdata;
     Actual_Socket as;
-    QTcpSocket *qtsock;
+    // as's QTcpSocket; not fixed until a connection attempt has won
+    QTcpSocket *qtsock() const { return as ? as->qtsock : NULL; }
+    QByteArray readBuffer;  // reused by every readyRead()
     bool _any_update;
-    QRegion termrgn;
+
+    // dirty column range [left, right) of one display row
+    struct DirtySpan {
+        int left, right;
+    };
+    // spans touched by do_paint since the last repaint request; the
+    // repaint itself is rate limited to cfg.refresh_rate per second
+    QVector<DirtySpan> dirtySpans;
+    // spans handed to Qt and not yet painted by paintEvent
+    QVector<DirtySpan> paintSpans;
+    QTimer repaintTimer;
+    QElapsedTimer lastRepaint;
     QColor colours[NALLCOLOURS];
+    QtGlyphAtlas glyphAtlas;
 
     // to detect mouse double/triple clicks
     Mouse_Action mouseButtonAction;
@@ -115,6 +132,9 @@ public:
     void requestPaste();
     void getClip(wchar_t **p, int *len);
     void writeClip(wchar_t * data, int *attr, int len, int must_deselect);
+    void attrToColours(unsigned long attr, int *nfg, int *nbg);
+    void resizeSpans();
+    void paintRow(QPainter &painter, int row, int colstart, int colend);
     void paintText(QPainter &painter, int row, int col,
                    const QString &str, unsigned long attr);
     void paintCursor(QPainter &painter, int row, int col,
@@ -179,6 +199,7 @@ public slots:
     void sockError(QAbstractSocket::SocketError socketError);
     void sockDisconnected();
     void on_sessionTitleChange(bool force=false);
+    void flushRepaint();
 
 };
 
@@ -9,7 +9,11 @@
 
 #include <stdlib.h>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QHostInfo>
+#include <QHash>
 #include <QKeyEvent>
 extern "C" {
 #include "putty.h"
@@ -27,6 +31,9 @@ extern long timing_next_time;
 
 typedef struct Socket_tag *Actual_Socket;
 
+class QtSocketEvents;
+class QtListener;
+
 struct Socket_tag {
     const struct socket_function_table *fn;
     /* the above variable absolutely *must* be the first in this structure */
@@ -56,6 +63,152 @@ struct Socket_tag {
      */
     Actual_Socket parent, child;
     QTcpSocket *qtsock;
+    QtSocketEvents *events;
+    int resolving;		       /* waiting for addr's name lookup */
+    int connecting;		       /* racing connection attempts */
+    int frontend_reads;		       /* a terminal reads it, not events */
+    QtListener *listener;	       /* for listening sockets */
+};
+
+/*
+ * Qt-side helper owned by each Socket_tag. sk_tcp_write only queues
+ * data in output_data; the queue is handed to the QTcpSocket in one
+ * write once control gets back to the event loop, so the many small
+ * packets produced while handling one event go out together. It also
+ * reports the send backlog to the plug as QTcpSocket drains it, and
+ * restarts reading when a frozen socket is thawed.
+ *
+ * When a name resolves to several addresses it also runs the
+ * connection race (RFC 8305 "Happy Eyeballs"): each address gets its
+ * own QTcpSocket, started QTNET_CONNECT_DELAY after the previous one
+ * or as soon as that one fails, and the first to connect becomes
+ * s->qtsock. The front end listens to this object's signals rather
+ * than to any one QTcpSocket, since which one wins isn't known when
+ * it connects to them.
+ *
+ * Only a terminal's own connection is read by the front end. For the
+ * rest (forwarded ports, X11) this object feeds the plug itself, and
+ * once such a socket is closed it frees it when it is safe to.
+ */
+class QtSocketEvents : public QObject
+{
+    Q_OBJECT
+
+    struct Attempt {
+        QTcpSocket *sock;
+        int addr;               // index into s->addr's addresses
+        QElapsedTimer started;
+    };
+
+    Actual_Socket s;
+    bool flushPending;
+    QList<Attempt> attempts;    // still connecting
+    int nextAddr;               // next address to try
+    QTimer attemptTimer;
+    bool released;              // closed by the plug; s goes with us
+    bool closePending;          // peer has gone; tell the plug once read
+    QByteArray errorText;       // s->error points here after writeFailed()
+
+    void startAttempt();
+    void dropAttempt(const Attempt &a);
+
+public:
+    QtSocketEvents(Actual_Socket s);
+    ~QtSocketEvents();
+
+    void scheduleFlush()
+    {
+        if (flushPending)
+            return;
+        flushPending = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+
+    void startConnecting();
+    void adopt(QTcpSocket *sock);
+    void release();
+    void writeFailed();
+
+signals:
+    void readyRead();
+    void error(QAbstractSocket::SocketError socketError);
+    void disconnected();
+
+public slots:
+    void flush();
+    void bytesWritten(qint64 bytes);
+    void resumeReading();
+    void lookupFailed();
+
+private slots:
+    void attemptConnected();
+    void attemptFailed(QAbstractSocket::SocketError socketError);
+    void attemptDelayed();
+    void receive();
+    void failed(QAbstractSocket::SocketError socketError);
+    void peerClosed();
+    void reportWriteError();
+};
+
+/*
+ * Qt side of a listening socket from sk_newlistener(): one QTcpServer,
+ * or two when listening on loopback for both IPv4 and IPv6. Each
+ * connection accepted is offered to the plug, which takes it on with
+ * sk_register(); until then it stays the server's child, and one the
+ * plug turns down is dropped. Freezing the socket pauses accepting,
+ * leaving new connections in the kernel's backlog.
+ */
+class QtListener : public QObject
+{
+    Q_OBJECT
+
+    Actual_Socket s;
+    QList<QTcpServer *> servers;
+    QByteArray errorText;       // s->error points here
+
+public:
+    QtListener(Actual_Socket s);
+    ~QtListener();
+
+    bool listen(const QHostAddress &address, int port);
+    void setPaused(bool paused);
+    void close();
+
+private slots:
+    void newConnection();
+};
+
+/*
+ * Host name lookups for sk_namelookup() and sk_new(), done with
+ * QHostInfo::lookupHost so that they run on Qt's resolver threads
+ * and never block the GUI: a folder of sessions opened at once all
+ * resolve in parallel. Answers are remembered for QTNET_DNS_TTL, and
+ * a name already being looked up isn't looked up again; every
+ * SockAddr waiting for it is filled in when the answer arrives, and
+ * any socket waiting on such a SockAddr then connects.
+ */
+class QtNameResolver : public QObject
+{
+    Q_OBJECT
+
+    struct CacheEntry {
+        QList<QHostAddress> addresses;
+        qint64 expires;
+    };
+    QHash<QString, CacheEntry> cache;
+    QHash<QString, QList<SockAddr> > waiting;   // by lower-cased name
+    QHash<int, QString> lookups;                // lookupHost id -> name
+    QList<SockAddr> answering;                  // lookedUp() working through
+
+public:
+    static QtNameResolver *instance();
+
+    bool cached(const char *host, QList<QHostAddress> *addresses);
+    void resolve(SockAddr addr);
+    void cancel(SockAddr addr);
+
+private slots:
+    void lookedUp(const QHostInfo &info);
 };
 
 typedef struct telnet_tag {
@@ -22,12 +22,47 @@ QtConfig::QtConfig()
 {
 }
 
+/*
+ * Repair a cipher/kex preference list read from a config saved by an
+ * older version: drop unknown and duplicate ids, and put any ids the
+ * saved list doesn't mention (i.e. algorithms added since) at the
+ * front, in the order they have in the default list. This mirrors
+ * what gprefs() does for the registry.
+ */
+static void fixupPreferenceList(int *list, int n, const int *defaults)
+{
+    int *out = new int[n];
+    bool *seen = new bool[n];
+    int i, nout = 0, nnew = 0;
+
+    for (i = 0; i < n; i++)
+        seen[i] = false;
+    for (i = 0; i < n; i++) {
+        if (list[i] >= 0 && list[i] < n && !seen[list[i]]) {
+            seen[list[i]] = true;
+            out[nout++] = list[i];
+        }
+    }
+    if (nout < n) {
+        memmove(out + (n - nout), out, nout * sizeof(int));
+        for (i = 0; i < n; i++)
+            if (!seen[defaults[i]])
+                out[nnew++] = defaults[i];
+    }
+    memcpy(list, out, n * sizeof(int));
+    delete[] out;
+    delete[] seen;
+}
+
 int QtConfig::readFromXML(QIODevice *device)
 {
     QXmlStreamReader xml;
     int i;
     char *tmpbuf;
 
+    Config defcfg;
+    initConfigDefaults(&defcfg);
+
     xml.setDevice(device);
     if (!xml.readNextStartElement() || xml.name() != "qutty" ||
             xml.attributes().value("version") != "1.0") {
@@ -39,6 +74,10 @@ int QtConfig::readFromXML(QIODevice *device)
         if (xml.name() == "config" && xml.attributes().value("version") == "1.0") {
             Config cfg;
             memset(&cfg, 0, sizeof(Config));
+            for (i = 0; i < CIPHER_MAX; i++)
+                cfg.ssh_cipherlist[i] = -1;
+            for (i = 0; i < KEX_MAX; i++)
+                cfg.ssh_kexlist[i] = -1;
             while (xml.readNextStartElement()) {
                 if (xml.name() == "dataelement") {
                     QStringRef tmptype = xml.attributes().value("datatype");
@@ -62,7 +101,7 @@ int QtConfig::readFromXML(QIODevice *device)
             }}
 #define QUTTY_SERIALIZE_ELEMENT_ARRAY_int(name, arr) \
             if (tmpname==#name) \
-                for(i=0; i<arr; i++) \
+                for(i=0; i<arr && i*9<tmpbarr.length(); i++) \
                     sscanf(tmpbuf+i*9, "%08X ", &cfg.name[i]);
 #define QUTTY_SERIALIZE_ELEMENT_ARRAY_short(name, arr) \
             QUTTY_SERIALIZE_ELEMENT_ARRAY_int(name, arr)
@@ -94,6 +133,13 @@ int QtConfig::readFromXML(QIODevice *device)
                     xml.skipCurrentElement();
                 }
             }
+            fixupPreferenceList(cfg.ssh_cipherlist, CIPHER_MAX,
+                                defcfg.ssh_cipherlist);
+            fixupPreferenceList(cfg.ssh_kexlist, KEX_MAX,
+                                defcfg.ssh_kexlist);
+            // sessions saved before there was a level say nothing
+            if (cfg.compression_level < 1 || cfg.compression_level > 9)
+                cfg.compression_level = defcfg.compression_level;
             config_list[QString(cfg.config_name)] = cfg;
         } else if (xml.name() == "sshhostkeys" && xml.attributes().value("version") == "1.0") {
             while (xml.readNextStartElement()) {
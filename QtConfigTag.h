@@ -35,9 +35,15 @@ struct config_tag
     QUTTY_SERIALIZE_ELEMENT_ARRAY(char, remote_cmd, 512) \
     int(nopty) \
     int(compression) \
+    int(compression_level)	       /* zlib level, 1 (fast) to 9 (small) */ \
     QUTTY_SERIALIZE_ELEMENT_ARRAY(int, ssh_kexlist, KEX_MAX) \
     int(ssh_rekey_time)		       /* in minutes */ \
     QUTTY_SERIALIZE_ELEMENT_ARRAY(char, ssh_rekey_data, 16) \
+    int(ssh_winsize)		       /* initial SSH-2 channel window */ \
+    int(ssh_maxpkt)		       /* largest SSH-2 data message we accept */ \
+    int(ssh_no_win_tuning)	       /* don't grow windows by measured RTT */ \
+    int(ssh_crypto_thread)	       /* SSH-2 packet crypto on a worker thread */ \
+    int(ssh_share)		       /* share connections between tabs */ \
     int(tryagent) \
     int(agentfwd) \
     int(change_username)	       /* allow username switching in SSH-2 */ \
@@ -128,6 +134,8 @@ struct config_tag
     int(width) int(height) \
     FontSpec(font) \
     int(font_quality) \
+    int(refresh_rate)		       /* max window repaints per second */ \
+    int(async_term_out)		       /* parse output off the receive path */ \
     Filename(logfilename) \
     int(logtype) \
     int(logxfovr) \
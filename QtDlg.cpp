@@ -99,6 +99,13 @@ int verify_host_key(const char *hostname, int port,
     return 0;
 }
 
+int have_ssh_host_key(const char *host, int port, const char *keytype)
+{
+    char buf[200];
+    hostkey_regname(buf, sizeof(buf), host, port, keytype);
+    return qutty_config.ssh_host_keys.find(buf) != qutty_config.ssh_host_keys.end();
+}
+
 int verify_ssh_host_key(void *frontend, char *host, int port, char *keytype,
                         char *keystr, char *fingerprint,
                         void (* /*callback*/)(void *ctx, int result), void * /*ctx*/)
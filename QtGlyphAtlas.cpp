@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include <QPainter>
+#include "QtGlyphAtlas.h"
+
+// edge length of the square atlas pixmap in pixels
+#define GLYPH_ATLAS_SIZE 2048
+
+QtGlyphAtlas::QtGlyphAtlas() :
+    cellWidth(0),
+    cellHeight(0),
+    cellAscent(0),
+    palette(NULL),
+    slotsPerRow(0),
+    slotsTotal(0),
+    slotsUsed(0),
+    gen(0)
+{
+}
+
+void QtGlyphAtlas::reset(const QFont &font, int width, int height, int ascent,
+                         const QColor *palette)
+{
+    this->font = font;
+    this->cellWidth = width;
+    this->cellHeight = height;
+    this->cellAscent = ascent;
+    this->palette = palette;
+
+    glyphs.clear();
+    slotsUsed = 0;
+    gen++;
+
+    if (width <= 0 || height <= 0) {
+        atlas = QPixmap();
+        slotsPerRow = slotsTotal = 0;
+        return;
+    }
+
+    // every slot is wide enough to hold a double-width character
+    slotsPerRow = GLYPH_ATLAS_SIZE / (2 * width);
+    slotsTotal = slotsPerRow * (GLYPH_ATLAS_SIZE / height);
+    if (atlas.isNull())
+        atlas = QPixmap(GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE);
+}
+
+QRect QtGlyphAtlas::rasterise(wchar_t ch, int nfg, int nbg, bool wide)
+{
+    if (!isValid() || slotsTotal <= 0)
+        return QRect();
+
+    if (slotsUsed >= slotsTotal) {
+        // atlas is full; throw everything away and refill on demand
+        glyphs.clear();
+        slotsUsed = 0;
+        gen++;
+    }
+
+    int slot = slotsUsed++;
+    QRect r((slot % slotsPerRow) * 2 * cellWidth,
+            (slot / slotsPerRow) * cellHeight,
+            wide ? 2 * cellWidth : cellWidth, cellHeight);
+
+    QPainter painter(&atlas);
+    painter.setFont(font);
+    painter.setClipRect(r);
+    painter.fillRect(r, palette[nbg]);
+    painter.setPen(palette[nfg]);
+    painter.drawText(r.left(), r.top() + cellAscent,
+                     QString::fromWCharArray(&ch, 1));
+
+    glyphs.insert(makeKey(ch, nfg, nbg, wide), r);
+    return r;
+}
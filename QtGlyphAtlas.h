@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTGLYPHATLAS_H
+#define QTGLYPHATLAS_H
+
+#include <QFont>
+#include <QColor>
+#include <QPixmap>
+#include <QHash>
+#include <QRect>
+
+/*
+ * Cache of pre-rasterised terminal cells.
+ *
+ * Each entry is one character cell (or two, for wide characters)
+ * rendered with its background already filled, so painting a row
+ * becomes a sequence of pixmap blits from a single atlas pixmap
+ * instead of one fillRect + drawText per attribute run.
+ *
+ * Entries are keyed by (character, foreground, background, wide).
+ * The atlas is only valid for one font and one palette; callers
+ * must reset() it whenever either changes.
+ */
+class QtGlyphAtlas
+{
+    QFont font;
+    int cellWidth, cellHeight, cellAscent;
+    const QColor *palette;
+
+    QPixmap atlas;
+    int slotsPerRow, slotsTotal, slotsUsed;
+    QHash<quint64, QRect> glyphs;
+    int gen;
+
+    static quint64 makeKey(wchar_t ch, int nfg, int nbg, bool wide) {
+        return ((quint64)(unsigned)ch) |
+               ((quint64)(nfg & 0x3FF) << 32) |
+               ((quint64)(nbg & 0x3FF) << 42) |
+               ((quint64)(wide ? 1 : 0) << 52);
+    }
+
+    QRect rasterise(wchar_t ch, int nfg, int nbg, bool wide);
+
+public:
+    QtGlyphAtlas();
+
+    /*
+     * Drop every cached glyph and start over with the given font,
+     * cell metrics and palette (an array of at least NALLCOLOURS).
+     */
+    void reset(const QFont &font, int width, int height, int ascent,
+               const QColor *palette);
+
+    bool isValid() const { return palette != NULL && !atlas.isNull(); }
+
+    const QPixmap &pixmap() const { return atlas; }
+
+    /*
+     * Bumped whenever previously returned rectangles become stale
+     * (reset, or eviction when the atlas fills up).
+     */
+    int generation() const { return gen; }
+
+    /*
+     * Return the source rectangle of the requested cell within
+     * pixmap(), rasterising it on a cache miss.
+     */
+    QRect glyph(wchar_t ch, int nfg, int nbg, bool wide) {
+        QHash<quint64, QRect>::const_iterator it =
+                glyphs.constFind(makeKey(ch, nfg, nbg, wide));
+        if (it != glyphs.constEnd())
+            return it.value();
+        return rasterise(ch, nfg, nbg, wide);
+    }
+};
+
+#endif // QTGLYPHATLAS_H
@@ -14,13 +14,449 @@ extern "C" {
 #include <QHostAddress>
 #include <QHostInfo>
 #include <QNetworkInterface>
+#include <QDateTime>
 
+/*
+ * A SockAddr starts out as just a name unless the name is an address
+ * literal or is in the resolver's cache; addresses is filled in when
+ * QtNameResolver gets an answer, in the order sk_new() tries them.
+ */
 struct SockAddr_tag {
-    QHostAddress *qtaddr;
+    QList<QHostAddress> addresses;     /* empty until resolved */
+    int curr;			       /* the one being reported on */
     const char *error;
+    char *hostname;		       /* as given, or NULL */
+    int family;			       /* ADDRTYPE_* asked for */
+    int resolving;		       /* queued with QtNameResolver */
+    Actual_Socket sock;		       /* sk_new() socket waiting for us */
 };
 
-static void sk_tcp_flush(Socket /*s*/) {}
+/* How long a name lookup's answer is reused for. */
+#define QTNET_DNS_TTL (60*1000)
+
+/*
+ * RFC 8305's Connection Attempt Delay: how long one connection attempt
+ * has to itself before the next address is tried alongside it.
+ */
+#define QTNET_CONNECT_DELAY 250
+
+static void sk_tcp_resolved(Actual_Socket s);
+
+static const QHostAddress *sk_addr_curr(SockAddr addr)
+{
+    if (addr->curr >= addr->addresses.size())
+        return NULL;
+    return &addr->addresses.at(addr->curr);
+}
+
+/*
+ * Upper bound on data QTcpSocket pulls off the wire ahead of us. With
+ * a bound, a frozen socket stops reading and TCP flow control pushes
+ * back on the sender instead of the buffer growing without limit.
+ */
+#define QTSOCK_READ_BUFFER_SIZE (256*1024)
+
+/*
+ * The same for connections accepted on a forwarded port, which may be
+ * many at once (a browser behind dynamic forwarding, say); the SSH
+ * channel window limits how fast they can be drained anyway.
+ */
+#define QTSOCK_FWD_READ_BUFFER_SIZE (64*1024)
+
+/* Largest read handed to a plug by QtSocketEvents, and reads per call. */
+#define QTNET_READ_CHUNK 16384
+#define QTNET_READ_MAX_CHUNKS 16
+
+/*
+ * How long a closed socket may go on sending what was queued before
+ * it's dropped regardless: a peer that stops reading mustn't keep it
+ * alive for ever.
+ */
+#define QTNET_CLOSE_LINGER (30*1000)
+
+/*
+ * Everything written by the plug but not yet sent: our own queue
+ * plus what QTcpSocket is still holding.
+ */
+static int sk_tcp_bufsize(Actual_Socket s)
+{
+    return bufchain_size(&s->output_data) + (int)s->qtsock->bytesToWrite();
+}
+
+/*
+ * Hand everything queued in output_data over to the QTcpSocket. If it
+ * won't take it, the data stays queued and the plug is told.
+ */
+static void sk_tcp_try_send(Actual_Socket s)
+{
+    if (s->resolving || s->connecting)
+        return;                 // stays queued until we connect
+    if (s->error)
+        return;                 // already failed; the plug knows
+    while (bufchain_size(&s->output_data) > 0) {
+        void *data;
+        int len;
+        bufchain_prefix(&s->output_data, &data, &len);
+        qint64 ret = s->qtsock->write((const char *)data, len);
+        if (ret < 0) {
+            if (s->events)
+                s->events->writeFailed();
+            break;
+        }
+        if (ret == 0)
+            break;
+        bufchain_consume(&s->output_data, (int)ret);
+    }
+}
+
+QtSocketEvents::QtSocketEvents(Actual_Socket s) :
+    s(s),
+    flushPending(false),
+    nextAddr(0),
+    released(false),
+    closePending(false)
+{
+    attemptTimer.setSingleShot(true);
+    connect(&attemptTimer, SIGNAL(timeout()), this, SLOT(attemptDelayed()));
+
+    // for sockets no front end reads (see receive())
+    connect(this, SIGNAL(readyRead()), this, SLOT(receive()));
+    connect(this, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(failed(QAbstractSocket::SocketError)));
+    connect(this, SIGNAL(disconnected()), this, SLOT(peerClosed()));
+}
+
+QtSocketEvents::~QtSocketEvents()
+{
+    foreach(const Attempt &a, attempts)
+        dropAttempt(a);
+    attempts.clear();
+    s->connecting = 0;
+    if (released) {
+        sk_addr_free(s->addr);
+        bufchain_clear(&s->output_data);
+        sfree(s);
+    }
+}
+
+/*
+ * The plug has closed a socket the front end doesn't own. Nothing may
+ * touch it from now on, but a slot of ours may be on the stack or
+ * queued, so s is freed along with this object, from the event loop.
+ * The QTcpSocket stays behind until it has sent what it has.
+ */
+void QtSocketEvents::release()
+{
+    QTcpSocket *sock = s->qtsock;
+
+    released = true;
+    attemptTimer.stop();
+    foreach(const Attempt &a, attempts)
+        dropAttempt(a);
+    attempts.clear();
+    s->connecting = 0;
+
+    if (sock) {
+        sock->disconnect(this);
+        if (sock->state() == QAbstractSocket::UnconnectedState) {
+            sock->deleteLater();
+        } else {
+            connect(sock, SIGNAL(disconnected()), sock, SLOT(deleteLater()));
+            connect(sock, SIGNAL(error(QAbstractSocket::SocketError)),
+                    sock, SLOT(deleteLater()));
+            QTimer::singleShot(QTNET_CLOSE_LINGER, sock, SLOT(deleteLater()));
+        }
+        s->qtsock = NULL;
+    }
+    deleteLater();
+}
+
+/*
+ * Take `sock' on as the connection: its data and state changes are
+ * ours from now on. Anything the plug wrote before it connected goes
+ * out now.
+ */
+void QtSocketEvents::adopt(QTcpSocket *sock)
+{
+    s->qtsock = sock;
+    connect(sock, SIGNAL(readyRead()), this, SIGNAL(readyRead()));
+    connect(sock, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SIGNAL(error(QAbstractSocket::SocketError)));
+    connect(sock, SIGNAL(disconnected()), this, SIGNAL(disconnected()));
+    connect(sock, SIGNAL(bytesWritten(qint64)),
+            this, SLOT(bytesWritten(qint64)));
+
+    if (s->nodelay)
+        sock->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    if (bufchain_size(&s->output_data) > 0)
+        scheduleFlush();
+}
+
+/*
+ * Start racing connections to s->addr's addresses. The first attempt
+ * uses the QTcpSocket sk_new() made; later ones get their own.
+ */
+void QtSocketEvents::startConnecting()
+{
+    s->connecting = 1;
+    nextAddr = 0;
+    startAttempt();
+}
+
+void QtSocketEvents::startAttempt()
+{
+    SockAddr addr = s->addr;
+    Attempt a;
+
+    if (nextAddr == 0) {
+        a.sock = s->qtsock;
+    } else {
+        a.sock = new QTcpSocket();
+        a.sock->setReadBufferSize(QTSOCK_READ_BUFFER_SIZE);
+    }
+    a.addr = nextAddr++;
+    connect(a.sock, SIGNAL(connected()), this, SLOT(attemptConnected()));
+    connect(a.sock, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(attemptFailed(QAbstractSocket::SocketError)));
+
+    addr->curr = a.addr;
+    plug_log(s->plug, 0, addr, s->port, NULL, 0);
+
+    if (nextAddr < addr->addresses.size())
+        attemptTimer.start(QTNET_CONNECT_DELAY);
+    a.started.start();
+    attempts.append(a);
+    a.sock->connectToHost(addr->addresses.at(a.addr), s->port);
+}
+
+void QtSocketEvents::dropAttempt(const Attempt &a)
+{
+    a.sock->disconnect(this);
+    a.sock->abort();
+    if (a.sock != s->qtsock)
+        a.sock->deleteLater();
+}
+
+void QtSocketEvents::attemptDelayed()
+{
+    if (released)
+        return;
+    if (s->connecting && nextAddr < s->addr->addresses.size())
+        startAttempt();
+}
+
+void QtSocketEvents::attemptConnected()
+{
+    QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+    Attempt won;
+    int i;
+
+    for (i = 0; i < attempts.size(); i++)
+        if (attempts.at(i).sock == sock)
+            break;
+    if (i == attempts.size())
+        return;
+    won = attempts.takeAt(i);
+    sock->disconnect(this);
+
+    // the rest have lost
+    attemptTimer.stop();
+    QTcpSocket *first = s->qtsock;
+    foreach(const Attempt &a, attempts)
+        dropAttempt(a);
+    attempts.clear();
+    if (first != won.sock)
+        first->deleteLater();
+    s->connecting = 0;
+
+    s->addr->curr = won.addr;
+    plug_log(s->plug, 2, s->addr, s->port, NULL, (int)won.started.elapsed());
+    adopt(won.sock);
+}
+
+void QtSocketEvents::attemptFailed(QAbstractSocket::SocketError socketError)
+{
+    QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+    char errStr[256];
+    Attempt lost;
+    int i;
+
+    for (i = 0; i < attempts.size(); i++)
+        if (attempts.at(i).sock == sock)
+            break;
+    if (i == attempts.size())
+        return;
+    lost = attempts.takeAt(i);
+    sock->disconnect(this);
+
+    qstring_to_char(errStr, QString("%1 (after %2 ms)")
+                    .arg(sock->errorString())
+                    .arg(lost.started.elapsed()), sizeof(errStr));
+    s->addr->curr = lost.addr;
+    plug_log(s->plug, 1, s->addr, s->port, errStr, socketError);
+
+    if (nextAddr < s->addr->addresses.size()) {
+        // don't wait out the delay for an address that has failed
+        if (sock != s->qtsock)
+            sock->deleteLater();
+        attemptTimer.stop();
+        startAttempt();
+        return;
+    }
+    if (!attempts.isEmpty()) {
+        if (sock != s->qtsock)
+            sock->deleteLater();
+        return;                 // others are still trying
+    }
+
+    /*
+     * Every address has failed. Report the last failure as the
+     * socket's error, the same way a single connection's would be.
+     */
+    s->connecting = 0;
+    if (sock != s->qtsock) {
+        s->qtsock->deleteLater();
+        s->qtsock = sock;
+    }
+    adopt(sock);
+    emit error(socketError);
+}
+
+void QtSocketEvents::flush()
+{
+    flushPending = false;
+    if (released)
+        return;
+    sk_tcp_try_send(s);
+    plug_sent(s->plug, sk_tcp_bufsize(s));
+}
+
+/*
+ * The QTcpSocket refused data. The plug hears about it from the event
+ * loop, since we may be inside one of its own calls.
+ */
+void QtSocketEvents::writeFailed()
+{
+    errorText = s->qtsock->errorString().toUtf8();
+    s->error = errorText.constData();
+    QMetaObject::invokeMethod(this, "reportWriteError", Qt::QueuedConnection);
+}
+
+void QtSocketEvents::reportWriteError()
+{
+    if (released)
+        return;
+    plug_closing(s->plug, s->error, 0, 0);
+}
+
+void QtSocketEvents::bytesWritten(qint64 /*bytes*/)
+{
+    if (released)
+        return;
+    plug_sent(s->plug, sk_tcp_bufsize(s));
+}
+
+/*
+ * Queued by QtNameResolver when the name this socket was waiting for
+ * didn't resolve, so that the plug hears about it from the event
+ * loop rather than from inside the resolver.
+ */
+void QtSocketEvents::lookupFailed()
+{
+    if (released)
+        return;
+    plug_log(s->plug, 1, s->addr, s->port, s->error, 0);
+    plug_closing(s->plug, s->error, 0, 0);
+}
+
+void QtSocketEvents::resumeReading()
+{
+    if (released || s->frozen || !s->qtsock)
+        return;
+    if (s->frozen_readable || s->qtsock->bytesAvailable() > 0) {
+        s->frozen_readable = 0;
+        emit readyRead();
+    }
+}
+
+/*
+ * Reading for sockets that don't belong to a terminal: hand what has
+ * arrived to the plug, a chunk at a time, for as long as it leaves
+ * the socket thawed. A forwarded connection throttled by its channel
+ * stops here, and QTcpSocket's bounded buffer then stops reading the
+ * wire.
+ */
+void QtSocketEvents::receive()
+{
+    static char buf[QTNET_READ_CHUNK];
+
+    if (s->frontend_reads || released)
+        return;
+    for (int i = 0; i < QTNET_READ_MAX_CHUNKS; i++) {
+        if (s->qtsock->bytesAvailable() <= 0)
+            break;
+        if (s->frozen) {
+            // sk_tcp_set_frozen will call us again once thawed
+            s->frozen_readable = 1;
+            return;
+        }
+        qint64 len = s->qtsock->read(buf, sizeof(buf));
+        if (len <= 0)
+            break;
+        noise_ultralight((unsigned long)len);
+        plug_receive(s->plug, 0, buf, (int)len);
+        if (released)
+            return;             // the plug closed us
+    }
+
+    // Qt won't signal again for data it already has; come back later
+    if (s->qtsock->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, "receive", Qt::QueuedConnection);
+        return;
+    }
+    if (closePending) {
+        closePending = false;
+        plug_closing(s->plug, NULL, 0, 0);
+    }
+}
+
+void QtSocketEvents::failed(QAbstractSocket::SocketError socketError)
+{
+    char errStr[256];
+
+    if (s->frontend_reads || released)
+        return;
+    if (socketError == QAbstractSocket::RemoteHostClosedError)
+        return;                 // an ordinary close; peerClosed() has it
+    qstring_to_char(errStr, s->qtsock->errorString(), sizeof(errStr));
+    plug_closing(s->plug, errStr, socketError, 0);
+}
+
+/*
+ * The peer has closed its end. Data it sent first may still be
+ * buffered, perhaps behind a freeze; the plug hears about the close
+ * after it has had that.
+ */
+void QtSocketEvents::peerClosed()
+{
+    if (s->frontend_reads || released)
+        return;
+    if (s->qtsock->bytesAvailable() > 0) {
+        closePending = true;
+        receive();
+        return;
+    }
+    plug_closing(s->plug, NULL, 0, 0);
+}
+
+static void sk_tcp_flush(Socket sock)
+{
+    Actual_Socket s = (Actual_Socket) sock;
+    if (!s->qtsock)
+        return;
+    sk_tcp_try_send(s);
+    s->qtsock->flush();
+}
 
 /*
  * Each socket abstraction contains a `void *' private field in
@@ -47,36 +483,59 @@ static const char *sk_tcp_socket_error(Socket sock)
 static int sk_tcp_write (Socket sock, const char *data, int len)
 {
     Actual_Socket s = (Actual_Socket) sock;
-    int i,j;
-    char pr[10000];
-    for(i=0, j=0; i<len; i++)
-            j+= sprintf(pr+j, "%u ", (unsigned char)data[i]);
-    //qDebug()<<"sk_tcp_write"<<len<<pr;
-    int ret = s->qtsock->write(data, len);
+    if (!s->events)
+        return 0;               // no connection, or already closed
+    bufchain_add(&s->output_data, data, len);
     noise_ultralight(len);
-    if(ret<=0)
-        qDebug()<<"tcp_write ret "<<ret;
-    return ret;
+    s->events->scheduleFlush();
+    return sk_tcp_bufsize(s);
 }
 
 static int sk_tcp_write_oob (Socket sock, const char *data, int len)
 {
     Actual_Socket s = (Actual_Socket) sock;
-    int ret = s->qtsock->write(data, len);
-    qDebug()<<"tcp_write_oob ret "<<ret<<"\n";
-    return ret;
+    if (!s->events)
+        return 0;               // no connection, or already closed
+    // urgent data must not overtake what is already queued
+    bufchain_add(&s->output_data, data, len);
+    sk_tcp_try_send(s);
+    return sk_tcp_bufsize(s);
 }
 
 static void sk_tcp_close (Socket sock)
 {
     Actual_Socket s = (Actual_Socket) sock;
-    if (s->qtsock)
+    if (s->resolving && s->addr)
+        s->addr->sock = NULL;   // never mind connecting
+    if (s->qtsock) {
+        sk_tcp_try_send(s);
         s->qtsock->disconnectFromHost();
+    }
+    if (!s->events)
+        return;
+    if (s->frontend_reads) {
+        // drops any flush still queued for this socket
+        delete s->events;
+    } else {
+        s->events->release();   // frees s too, later
+    }
+    s->events = NULL;
 }
 
-static void sk_tcp_set_frozen (Socket /*sock*/, int /*is_frozen*/)
+/*
+ * A frozen socket has its readyRead notifications ignored (the reader
+ * sets frozen_readable instead). Thawing it replays a notification
+ * from the event loop if data arrived in the meantime.
+ */
+static void sk_tcp_set_frozen (Socket sock, int is_frozen)
 {
-    qDebug()<<"sk_tcp_set_frozen() NOT IMPL\n";
+    Actual_Socket s = (Actual_Socket) sock;
+    if (s->frozen == is_frozen)
+        return;
+    s->frozen = is_frozen;
+    if (!is_frozen && s->events)
+        QMetaObject::invokeMethod(s->events, "resumeReading",
+                                  Qt::QueuedConnection);
 }
 
 static Plug sk_tcp_plug (Socket sock, Plug p)
@@ -135,18 +594,24 @@ Socket sk_new(char *addr, int port, int privport, int oobinline,
         err = try_connect(ret);
     } while (err && sk_nextaddr(ret->addr, &ret->step));
     */
+    ret->resolving = 0;
+    ret->connecting = 0;
+    ret->frontend_reads = 0;
+    ret->listener = NULL;
     ret->qtsock = new QTcpSocket();
     ret->qtsock->connectToHost(QString(addr), port);
-
-    if(nodelay)
-        ret->qtsock->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    ret->qtsock->setReadBufferSize(QTSOCK_READ_BUFFER_SIZE);
+    ret->events = new QtSocketEvents(ret);
+    ret->events->adopt(ret->qtsock);
 
     return (Socket) ret;
 }
 
 int sk_addrtype(SockAddr addr)
 {
-    const QHostAddress *a = addr->qtaddr;
+    const QHostAddress *a = sk_addr_curr(addr);
+    if (!a)
+        return ADDRTYPE_NAME;
     switch(a->protocol()) {
     case QAbstractSocket::IPv4Protocol:
         return ADDRTYPE_IPV4;
@@ -157,21 +622,89 @@ int sk_addrtype(SockAddr addr)
     }
 }
 
+/*
+ * The address in network byte order, as proxy.c puts it in a SOCKS
+ * request: 4 bytes for IPv4, 16 for IPv6.
+ */
 void sk_addrcopy(SockAddr addr, char *buf)
 {
-    QHostAddress *a = addr->qtaddr;
-    QString str = a->toString();
-    QByteArray bstr = str.toUtf8();
-    const char* cstr = bstr.constData();
-    memcpy(buf, cstr, bstr.length());
+    const QHostAddress *a = sk_addr_curr(addr);
+    if (a->protocol() == QAbstractSocket::IPv4Protocol) {
+        PUT_32BIT_MSB_FIRST(buf, a->toIPv4Address());
+    } else {
+        Q_IPV6ADDR v6 = a->toIPv6Address();
+        memcpy(buf, v6.c, 16);
+    }
+}
+
+static SockAddr sk_addr_new(const char *host, int family)
+{
+    SockAddr ret = new SockAddr_tag;
+    ret->curr = 0;
+    ret->error = NULL;
+    ret->hostname = host ? dupstr(host) : NULL;
+    ret->family = family;
+    ret->resolving = 0;
+    ret->sock = NULL;
+    return ret;
+}
+
+/*
+ * Fill in a SockAddr from a lookup's answer, in the order sk_new()
+ * will try them: only the family asked for, if there are any of it,
+ * and otherwise alternating IPv6 and IPv4 starting with whichever the
+ * resolver put first (RFC 8305 section 4), so that one family being
+ * unreachable costs a single attempt rather than one per address.
+ */
+static void sk_addr_set(SockAddr addr, const QList<QHostAddress> &addresses)
+{
+    QList<QHostAddress> v4, v6, other;
+    foreach(const QHostAddress &address, addresses) {
+        switch(address.protocol()) {
+        case QAbstractSocket::IPv4Protocol:
+            v4.append(address);
+            break;
+        case QAbstractSocket::IPv6Protocol:
+            v6.append(address);
+            break;
+        default:
+            other.append(address);
+            break;
+        }
+    }
+    if (addr->family == ADDRTYPE_IPV4 && !v4.isEmpty()) {
+        v6.clear();
+        other.clear();
+    } else if (addr->family == ADDRTYPE_IPV6 && !v6.isEmpty()) {
+        v4.clear();
+        other.clear();
+    }
+
+    bool v6first = !v6.isEmpty() && addresses.at(0) == v6.at(0);
+    const QList<QHostAddress> &first = v6first ? v6 : v4;
+    const QList<QHostAddress> &second = v6first ? v4 : v6;
+    addr->addresses.clear();
+    for (int i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size())
+            addr->addresses.append(first.at(i));
+        if (i < second.size())
+            addr->addresses.append(second.at(i));
+    }
+    addr->addresses += other;
+    addr->curr = 0;
+    if (addr->addresses.isEmpty())
+        addr->error = "No IP address found";
 }
 
 SockAddr sk_addr_dup(SockAddr addr)
 {
     if(!addr) return NULL;
-    SockAddr ret = new SockAddr_tag;
-    ret->qtaddr = new QHostAddress(*addr->qtaddr);
+    SockAddr ret = sk_addr_new(addr->hostname, addr->family);
+    ret->addresses = addr->addresses;
+    ret->curr = addr->curr;
     ret->error = addr->error;
+    if (addr->resolving)
+        QtNameResolver::instance()->resolve(ret);
     return ret;
 }
 
@@ -179,63 +712,44 @@ void sk_addr_free(SockAddr addr)
 {
     if (!addr)
         return;
-    if (addr->qtaddr)
-        delete addr->qtaddr;
-    addr->qtaddr = NULL;
-    addr->error = NULL;
+    if (addr->resolving)
+        QtNameResolver::instance()->cancel(addr);
+    sfree(addr->hostname);
+    delete addr;
 }
 
+/*
+ * Never blocks. Unless `host' is an address literal or was looked up
+ * recently, this starts the lookup and returns a SockAddr that is
+ * still only a name; sk_new() connects once the answer arrives. An
+ * error in the lookup then reaches the plug through closing().
+ */
 SockAddr sk_namelookup(const char *host, char **canonicalname,
                int address_family)
 {
-     SockAddr ret = new SockAddr_tag;
-     ret->error = NULL;
-     QHostInfo info = QHostInfo::fromName(host);
-     if (info.error() == QHostInfo::NoError) {
-         foreach(const QHostAddress &address, info.addresses()) {
-             int this_addrtype = address.protocol() == QAbstractSocket::IPv4Protocol ? ADDRTYPE_IPV4 :
-                                 address.protocol() == QAbstractSocket::IPv6Protocol ? ADDRTYPE_IPV6 :
-                                 ADDRTYPE_UNSPEC;
-             if (this_addrtype == address_family) {
-                 QHostAddress *a = new QHostAddress(address);
-                 QString str = info.hostName();
-                 QByteArray bstr = str.toUtf8();
-                 const char* cstr = bstr.constData();
-                 *canonicalname = snewn(1+strlen(cstr), char);
-                 strcpy(*canonicalname, cstr);
-                 ret->qtaddr = a;
-                 return ret;
-             }
-         }
-     }
-     if (info.addresses().size()>0) {
-         QHostAddress *a = new QHostAddress(info.addresses().at(0));
-         QString str = info.hostName();
-         QByteArray bstr = str.toUtf8();
-         const char* cstr = bstr.constData();
-         *canonicalname = snewn(1+strlen(cstr), char);
-         strcpy(*canonicalname, cstr);
-         ret->qtaddr = a;
-         return ret;
-     }
-     *canonicalname = snewn(1, char);
-     *canonicalname[0] = '\0';
-     ret->qtaddr = new QHostAddress();
-     ret->error = info.error()==QHostInfo::HostNotFound ? "Host not found" :
-                  info.error()==QHostInfo::UnknownError ? "Unknown error" :
-                  "No IP address found";
-     return ret;
-}
-
-SockAddr sk_nonamelookup(const char * /*host*/)
-{
-    // TODO not supported for now
-    SockAddr ret = new SockAddr_tag;
-    ret->qtaddr = new QHostAddress();
-    ret->error = "Not supported";
+    SockAddr ret = sk_addr_new(host, address_family);
+    QHostAddress literal;
+    QList<QHostAddress> addresses;
+
+    *canonicalname = dupstr(host);
+    if (literal.setAddress(QString::fromUtf8(host)))
+        ret->addresses.append(literal);
+    else if (QtNameResolver::instance()->cached(host, &addresses))
+        sk_addr_set(ret, addresses);
+    else
+        QtNameResolver::instance()->resolve(ret);
     return ret;
 }
 
+/*
+ * A name left for a proxy to resolve. sk_new() would look it up
+ * itself, but proxy.c only ever passes it on by name.
+ */
+SockAddr sk_nonamelookup(const char *host)
+{
+    return sk_addr_new(host, ADDRTYPE_NAME);
+}
+
 const char *sk_addr_error(SockAddr addr)
 {
     if (!addr) return NULL;
@@ -251,18 +765,25 @@ int sk_hostname_is_local(char *name)
 
 void sk_getaddr(SockAddr addr, char *buf, int buflen)
 {
-    QHostAddress *a = addr->qtaddr;
+    const QHostAddress *a = sk_addr_curr(addr);
+    if (!a) {
+        strncpy(buf, addr->hostname ? addr->hostname : "", buflen);
+        buf[buflen-1] = '\0';
+        return;
+    }
     QString str = a->toString();
     QByteArray bstr = str.toUtf8();
     const char* cstr = bstr.constData();
-    if(buflen>bstr.length()) buflen = bstr.length();
+    if(buflen>bstr.length()+1) buflen = bstr.length()+1;
     strncpy(buf, cstr, buflen);
     buf[buflen-1] = '\0';
 }
 
 int sk_address_is_local(SockAddr addr)
 {
-    const QHostAddress *a = addr->qtaddr;
+    const QHostAddress *a = sk_addr_curr(addr);
+    if (!a)
+        return addr->hostname && sk_hostname_is_local(addr->hostname);
     if (*a==QHostAddress::LocalHost || *a==QHostAddress::LocalHostIPv6)
         return 1;
     foreach(const QHostAddress &locaddr, QNetworkInterface::allAddresses()) {
@@ -272,6 +793,118 @@ int sk_address_is_local(SockAddr addr)
     return 0;
 }
 
+QtNameResolver *QtNameResolver::instance()
+{
+    static QtNameResolver *resolver = new QtNameResolver;
+    return resolver;
+}
+
+bool QtNameResolver::cached(const char *host, QList<QHostAddress> *addresses)
+{
+    QString name = QString::fromUtf8(host).toLower();
+    QHash<QString, CacheEntry>::iterator it = cache.find(name);
+
+    if (it == cache.end())
+        return false;
+    if (it->expires - QDateTime::currentMSecsSinceEpoch() <= 0) {
+        cache.erase(it);
+        return false;
+    }
+    *addresses = it->addresses;
+    return true;
+}
+
+/*
+ * Queue `addr' to be filled in when its name has been looked up,
+ * starting the lookup unless one for the same name is under way.
+ */
+void QtNameResolver::resolve(SockAddr addr)
+{
+    QString name = QString::fromUtf8(addr->hostname).toLower();
+    QList<SockAddr> &list = waiting[name];
+
+    addr->resolving = 1;
+    list.append(addr);
+    if (list.size() == 1)
+        lookups.insert(QHostInfo::lookupHost(name, this,
+                                             SLOT(lookedUp(QHostInfo))),
+                       name);
+}
+
+void QtNameResolver::cancel(SockAddr addr)
+{
+    QString name = QString::fromUtf8(addr->hostname).toLower();
+    QHash<QString, QList<SockAddr> >::iterator it = waiting.find(name);
+
+    addr->resolving = 0;
+    if (it != waiting.end())
+        it->removeAll(addr);
+    answering.removeAll(addr);  // freed from inside lookedUp()
+    // an unwanted lookup runs to completion, and still fills the cache
+}
+
+void QtNameResolver::lookedUp(const QHostInfo &info)
+{
+    QString name = lookups.take(info.lookupId());
+    QList<QHostAddress> addresses;
+    const char *error = NULL;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if (info.error() == QHostInfo::NoError && !info.addresses().isEmpty()) {
+        addresses = info.addresses();
+        CacheEntry entry = { addresses, now + QTNET_DNS_TTL };
+        cache.insert(name, entry);
+    } else {
+        error = info.error() == QHostInfo::HostNotFound ? "Host not found" :
+                info.error() == QHostInfo::UnknownError ? "Unknown error" :
+                "No IP address found";
+    }
+
+    // drop anything else that has gone stale
+    for (QHash<QString, CacheEntry>::iterator it = cache.begin();
+         it != cache.end(); ) {
+        if (it->expires - now <= 0)
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+
+    /*
+     * A socket told of its address may free others on the list (its
+     * plug closing another connection, say); cancel() takes those off
+     * answering, so we never touch one that has gone.
+     */
+    answering = waiting.take(name);
+    while (!answering.isEmpty()) {
+        SockAddr addr = answering.takeFirst();
+        Actual_Socket s = addr->sock;
+        if (!addr->resolving)
+            continue;
+        addr->resolving = 0;
+        addr->sock = NULL;
+        if (error)
+            addr->error = error;
+        else
+            sk_addr_set(addr, addresses);
+        if (s)
+            sk_tcp_resolved(s);
+    }
+}
+
+static void sk_tcp_resolved(Actual_Socket s)
+{
+    s->resolving = 0;
+    if (!s->events)
+        return;                 // closed while we were looking it up
+    if (!s->addr->addresses.isEmpty()) {
+        s->events->startConnecting();
+    } else {
+        s->error = s->addr->error;
+        QMetaObject::invokeMethod(s->events, "lookupFailed",
+                                  Qt::QueuedConnection);
+    }
+}
+
 Socket sk_new(SockAddr addr, int port, int privport, int oobinline,
           int nodelay, int keepalive, Plug plug)
 {
@@ -312,27 +945,226 @@ Socket sk_new(SockAddr addr, int port, int privport, int oobinline,
     ret->port = port;
     ret->addr = addr;
     ret->qtsock = NULL;
+    ret->events = NULL;
+    ret->resolving = 0;
+    ret->connecting = 0;
+    ret->frontend_reads = 0;
+    ret->listener = NULL;
 
-    if (!addr || !addr->qtaddr) {
+    if (!addr || (addr->addresses.isEmpty() && !addr->hostname)) {
         ret->error = "Cannot create socket";
         goto cu0;
     }
+    if (addr->error) {
+        ret->error = addr->error;
+        goto cu0;
+    }
 
+    /*
+     * The socket and its events object exist from the start, so that
+     * the front end can connect to the signals even if we have to
+     * wait for the name lookup. This QTcpSocket makes the first
+     * connection attempt; if another wins, that replaces it.
+     */
     ret->qtsock = new QTcpSocket();
-    ret->qtsock->connectToHost(*addr->qtaddr, port);
+    ret->qtsock->setReadBufferSize(QTSOCK_READ_BUFFER_SIZE);
+    ret->events = new QtSocketEvents(ret);
 
-    if(nodelay)
-        ret->qtsock->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    if (!addr->addresses.isEmpty()) {
+        ret->events->startConnecting();
+    } else {
+        ret->resolving = 1;
+        addr->sock = ret;
+        if (!addr->resolving)
+            QtNameResolver::instance()->resolve(addr);
+    }
 
 cu0:
     return (Socket) ret;
 }
 
-Socket sk_newlistener(char * /*srcaddr*/, int /*port*/, Plug /*plug*/, int /*local_host_only*/,
-              int /*orig_address_family*/)
+QtListener::QtListener(Actual_Socket s) :
+    s(s)
 {
-    // TODO not implemented
-    return NULL;
+}
+
+QtListener::~QtListener()
+{
+    close();
+    sfree(s);
+}
+
+bool QtListener::listen(const QHostAddress &address, int port)
+{
+    QTcpServer *server = new QTcpServer(this);
+
+    if (!server->listen(address, port)) {
+        errorText = server->errorString().toUtf8();
+        s->error = errorText.constData();
+        delete server;
+        return false;
+    }
+    connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    servers.append(server);
+    s->error = NULL;            // one failure is fine if another listens
+    return true;
+}
+
+void QtListener::setPaused(bool paused)
+{
+    foreach(QTcpServer *server, servers) {
+        if (paused)
+            server->pauseAccepting();
+        else
+            server->resumeAccepting();
+    }
+}
+
+void QtListener::close()
+{
+    // with any connections not yet taken on; newConnection() may be
+    // running for one of them
+    foreach(QTcpServer *server, servers) {
+        server->close();
+        server->deleteLater();
+    }
+    servers.clear();
+}
+
+void QtListener::newConnection()
+{
+    QTcpServer *server = qobject_cast<QTcpServer *>(sender());
+    QTcpSocket *sock;
+
+    while (!servers.isEmpty() && server->isListening() &&
+           (sock = server->nextPendingConnection()) != NULL) {
+        noise_ultralight(sock->peerPort());
+        if (plug_accepting(s->plug, (OSSocket) sock) &&
+            sock->parent() == server) {
+            // turned down before sk_register took it on
+            sock->abort();
+            sock->deleteLater();
+        }
+    }
+}
+
+static Plug sk_listener_plug(Socket sock, Plug p)
+{
+    Actual_Socket s = (Actual_Socket) sock;
+    Plug ret = s->plug;
+    if (p)
+        s->plug = p;
+    return ret;
+}
+
+static void sk_listener_close(Socket sock)
+{
+    Actual_Socket s = (Actual_Socket) sock;
+    // stop accepting now; a newConnection() may still be on the stack
+    s->listener->close();
+    s->listener->deleteLater();     // frees s too
+}
+
+static int sk_listener_write(Socket /*sock*/, const char * /*data*/, int /*len*/)
+{
+    return 0;                   // nothing to write to
+}
+
+static void sk_listener_flush(Socket /*sock*/)
+{
+}
+
+static void sk_listener_set_frozen(Socket sock, int is_frozen)
+{
+    Actual_Socket s = (Actual_Socket) sock;
+    if (s->frozen == is_frozen)
+        return;
+    s->frozen = is_frozen;
+    s->listener->setPaused(is_frozen);
+}
+
+/*
+ * Listen on srcaddr:port, or on every interface, or only on loopback
+ * if local_host_only. srcaddr must be an address literal or a local
+ * name: a lookup here would block.
+ */
+Socket sk_newlistener(char *srcaddr, int port, Plug plug, int local_host_only,
+              int orig_address_family)
+{
+    static const struct socket_function_table fn_table = {
+        sk_listener_plug,
+        sk_listener_close,
+        sk_listener_write,
+        sk_listener_write,
+        sk_listener_flush,
+        sk_tcp_set_private_ptr,
+        sk_tcp_get_private_ptr,
+        sk_listener_set_frozen,
+        sk_tcp_socket_error
+    };
+
+    Actual_Socket ret;
+    QHostAddress address;
+    int v4 = orig_address_family != ADDRTYPE_IPV6;
+    int v6 = orig_address_family != ADDRTYPE_IPV4;
+
+    /*
+     * Create Socket structure.
+     */
+    ret = snew(struct Socket_tag);
+    ret->fn = &fn_table;
+    ret->error = NULL;
+    ret->plug = plug;
+    bufchain_init(&ret->output_data);
+    ret->connected = 0;
+    ret->writable = 0;
+    ret->sending_oob = 0;
+    ret->frozen = 0;
+    ret->frozen_readable = 0;
+    ret->localhost_only = local_host_only;
+    ret->pending_error = 0;
+    ret->parent = ret->child = NULL;
+    ret->oobinline = 0;
+    ret->nodelay = 0;
+    ret->keepalive = 0;
+    ret->privport = 0;
+    ret->port = port;
+    ret->addr = NULL;
+    ret->qtsock = NULL;
+    ret->events = NULL;
+    ret->resolving = 0;
+    ret->connecting = 0;
+    ret->frontend_reads = 0;
+    ret->listener = new QtListener(ret);
+
+    if (srcaddr && *srcaddr && !address.setAddress(QString::fromUtf8(srcaddr))) {
+        if (sk_hostname_is_local(srcaddr))
+            local_host_only = 1;        // "localhost"
+        else
+            ret->error = "Source address must be an IP address";
+    }
+
+    if (ret->error) {
+        /* nothing to listen on */
+    } else if (!address.isNull()) {
+        ret->listener->listen(address, port);
+    } else if (local_host_only) {
+        /*
+         * Loopback only: there is no dual-stack loopback address, so
+         * this takes a server for each family, and either will do.
+         */
+        bool ok = v4 && ret->listener->listen(QHostAddress::LocalHost, port);
+        if (v6)
+            ok = ret->listener->listen(QHostAddress::LocalHostIPv6, port) || ok;
+        if (ok)
+            ret->error = NULL;
+    } else {
+        ret->listener->listen(!v6 ? QHostAddress::AnyIPv4 :
+                              !v4 ? QHostAddress::AnyIPv6 :
+                              QHostAddress::Any, port);
+    }
+
+    return (Socket) ret;
 }
 
 char *get_hostname(void)
@@ -351,10 +1183,64 @@ int net_service_lookup(char * /*service*/)
     return 0;
 }
 
-Socket sk_register(void * /*sock*/, Plug /*plug*/)
+/*
+ * Take on a connection QtListener accepted. Like PuTTY's other
+ * platforms it starts out frozen: nothing is read until the plug is
+ * ready for it, which for a port forward means the server has opened
+ * the channel.
+ */
+Socket sk_register(OSSocket sock, Plug plug)
 {
-    // TODO not implemented
-    return NULL;
+    static const struct socket_function_table fn_table = {
+        sk_tcp_plug,
+        sk_tcp_close,
+        sk_tcp_write,
+        sk_tcp_write_oob,
+        sk_tcp_flush,
+        sk_tcp_set_private_ptr,
+        sk_tcp_get_private_ptr,
+        sk_tcp_set_frozen,
+        sk_tcp_socket_error
+    };
+
+    QTcpSocket *qsock = (QTcpSocket *) sock;
+    Actual_Socket ret;
+
+    /*
+     * Create Socket structure.
+     */
+    ret = snew(struct Socket_tag);
+    ret->fn = &fn_table;
+    ret->error = NULL;
+    ret->plug = plug;
+    bufchain_init(&ret->output_data);
+    ret->connected = 1;
+    ret->writable = 1;
+    ret->sending_oob = 0;
+    ret->frozen = 1;
+    ret->frozen_readable = 0;
+    ret->localhost_only = 0;	       /* unused, but best init anyway */
+    ret->pending_error = 0;
+    ret->parent = ret->child = NULL;
+    ret->oobinline = 0;
+    ret->nodelay = 1;
+    ret->keepalive = 0;
+    ret->privport = 0;
+    ret->port = qsock->peerPort();
+    ret->addr = NULL;
+    ret->resolving = 0;
+    ret->connecting = 0;
+    ret->frontend_reads = 0;
+    ret->listener = NULL;
+
+    // ours now, and no longer to go when the listener does
+    qsock->setParent(NULL);
+    qsock->setReadBufferSize(QTSOCK_FWD_READ_BUFFER_SIZE);
+    ret->qtsock = qsock;
+    ret->events = new QtSocketEvents(ret);
+    ret->events->adopt(qsock);
+
+    return (Socket) ret;
 }
 
 SockAddr platform_get_x11_unix_address(const char * /*path*/, int /*displaynum*/)
@@ -374,6 +1260,6 @@ Socket platform_new_connection(SockAddr /*addr*/, char * /*hostname*/,
                    int /*oobinline*/, int /*nodelay*/, int /*keepalive*/,
                    Plug /*plug*/, const Config * /*cfg*/)
 {
-    // TODO not yet implemented
+    // no local proxy commands here: proxy.c makes a TCP connection
     return NULL;
 }
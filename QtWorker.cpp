@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtWorker.h"
+
+QtWorkerQueue::QtWorkerQueue(void (*work)(void *),
+                             void (*done)(void *, void *),
+                             void (*ready)(void *), void *ctx) :
+    work(work),
+    done(done),
+    ready(ready),
+    ctx(ctx),
+    busy(false),
+    quitting(false),
+    collectPending(false),
+    pending(0)
+{
+    start();
+}
+
+QtWorkerQueue::~QtWorkerQueue()
+{
+    sync();
+    lock.lock();
+    quitting = true;
+    wake.wakeAll();
+    lock.unlock();
+    wait();
+}
+
+/*
+ * Worker thread: take jobs one at a time, in order, and pass each
+ * finished one back to the GUI thread. Only one collect() is ever
+ * queued at once; it picks up everything finished by the time it
+ * runs.
+ */
+void QtWorkerQueue::run()
+{
+    lock.lock();
+    for (;;) {
+        while (todo.isEmpty() && !quitting) {
+            idle.wakeAll();
+            wake.wait(&lock);
+        }
+        if (todo.isEmpty())
+            break;
+        void *job = todo.dequeue();
+        busy = true;
+        lock.unlock();
+
+        work(job);
+
+        lock.lock();
+        busy = false;
+        finished.enqueue(job);
+        if (!collectPending) {
+            collectPending = true;
+            QMetaObject::invokeMethod(this, "collect", Qt::QueuedConnection);
+        }
+    }
+    lock.unlock();
+}
+
+void QtWorkerQueue::runDone(QQueue<void *> &jobs)
+{
+    while (!jobs.isEmpty()) {
+        pending--;
+        done(ctx, jobs.dequeue());
+    }
+}
+
+void QtWorkerQueue::submit(void *job)
+{
+    pending++;
+    lock.lock();
+    todo.enqueue(job);
+    wake.wakeAll();
+    lock.unlock();
+}
+
+void QtWorkerQueue::collect()
+{
+    QQueue<void *> jobs;
+
+    lock.lock();
+    collectPending = false;
+    jobs.swap(finished);
+    lock.unlock();
+
+    runDone(jobs);
+    if (ready)
+        ready(ctx);
+}
+
+void QtWorkerQueue::sync()
+{
+    QQueue<void *> jobs;
+
+    lock.lock();
+    while (!todo.isEmpty() || busy)
+        idle.wait(&lock);
+    jobs.swap(finished);
+    lock.unlock();
+
+    // a collect() may still be queued; it will find nothing to do
+    runDone(jobs);
+}
+
+void QtWorkerQueue::notify()
+{
+    lock.lock();
+    if (!collectPending) {
+        collectPending = true;
+        QMetaObject::invokeMethod(this, "collect", Qt::QueuedConnection);
+    }
+    lock.unlock();
+}
+
+WorkerQueue workq_new(void (*work)(void *job),
+                      void (*done)(void *ctx, void *job),
+                      void (*ready)(void *ctx), void *ctx)
+{
+    return (WorkerQueue) new QtWorkerQueue(work, done, ready, ctx);
+}
+
+void workq_submit(WorkerQueue q, void *job)
+{
+    ((QtWorkerQueue *) q)->submit(job);
+}
+
+int workq_pending(WorkerQueue q)
+{
+    return ((QtWorkerQueue *) q)->pendingJobs();
+}
+
+void workq_sync(WorkerQueue q)
+{
+    ((QtWorkerQueue *) q)->sync();
+}
+
+void workq_notify(WorkerQueue q)
+{
+    ((QtWorkerQueue *) q)->notify();
+}
+
+void workq_free(WorkerQueue q)
+{
+    delete (QtWorkerQueue *) q;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTWORKER_H
+#define QTWORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+extern "C" {
+#include "putty.h"
+}
+
+/*
+ * Qt side of a WorkerQueue (see putty.h). Each queue owns one thread
+ * which runs work() on the jobs in order. The QThread object itself
+ * lives on the GUI thread, so the queued collect() calls the worker
+ * posts are delivered there.
+ */
+class QtWorkerQueue : public QThread
+{
+    Q_OBJECT
+
+    void (*work)(void *job);
+    void (*done)(void *ctx, void *job);
+    void (*ready)(void *ctx);
+    void *ctx;
+
+    QMutex lock;
+    QWaitCondition wake;        // worker: todo has jobs, or quitting
+    QWaitCondition idle;        // GUI: worker has emptied todo
+    QQueue<void *> todo;        // submitted, waiting for the worker
+    QQueue<void *> finished;    // worked, waiting for done()
+    bool busy;                  // worker is inside work()
+    bool quitting;
+    bool collectPending;        // a collect() is queued for the GUI
+    int pending;                // submitted jobs not yet through done()
+
+    void runDone(QQueue<void *> &jobs);
+
+public:
+    QtWorkerQueue(void (*work)(void *), void (*done)(void *, void *),
+                  void (*ready)(void *), void *ctx);
+    ~QtWorkerQueue();
+
+    void submit(void *job);
+    int pendingJobs() const { return pending; }
+    void sync();
+    void notify();
+
+protected:
+    void run();
+
+public slots:
+    void collect();
+};
+
+#endif // QTWORKER_H
@@ -43,6 +43,8 @@ SOURCES +=  \
     GuiCompactSettingsWindow.cpp \
     QtSessionTreeModel.cpp \
     QtCompleterWithAdvancedCompletion.cpp \
+    QtGlyphAtlas.cpp \
+    QtWorker.cpp \
     puttysrc/WINDOWS/winnoise.c \
     puttysrc/WINDOWS/winstore.c \
     puttysrc/WINDOWS/windefs.c \
@@ -70,10 +72,13 @@ SOURCES +=  \
     puttysrc/pinger.c \
     puttysrc/sshmd5.c \
     puttysrc/sshaes.c \
+    puttysrc/sshccp.c \
     puttysrc/sshdes.c \
     puttysrc/sshzlib.c \
     puttysrc/sshdh.c \
+    puttysrc/sshecc.c \
     puttysrc/sshblowf.c \
+    puttysrc/sshbcrypt.c \
     puttysrc/ssharcf.c \
     puttysrc/sshcrcda.c \
     puttysrc/sshdss.c \
@@ -105,6 +110,7 @@ HEADERS +=  \
     QtConfig.h \
     QtConfigTag.h \
     QtTimer.h \
+    QtWorker.h \
     GuiTabWidget.h \
     GuiMenu.h \
     GuiBase.h \
@@ -118,6 +124,7 @@ HEADERS +=  \
     QtSessionTreeItem.h \
     QtComboBoxWithTreeView.h \
     QtCompleterWithAdvancedCompletion.h \
+    QtGlyphAtlas.h \
     puttysrc/WINDOWS/STORAGE.H \
     puttysrc/TREE234.H \
     puttysrc/TERMINAL.H \
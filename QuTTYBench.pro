@@ -0,0 +1,51 @@
+#--------------------------------------------------------
+# Copyright (C) 2012 Rajendran Thirupugalsamy
+# See LICENSE for full copyright and license information.
+# See COPYING for distribution information.
+#--------------------------------------------------------
+
+#-------------------------------------------------
+#
+# Crypto micro-benchmarks: a console program that
+# times the SSH-2 ciphers, MACs, hashes, zlib,
+# public-key code and terminal output parsing from
+# puttysrc/ and prints CSV.
+#
+#-------------------------------------------------
+
+TARGET = QuTTYBench
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= qt app_bundle
+
+SOURCES +=  \
+    bench/cryptbench.c \
+    bench/termstubs.c \
+    puttysrc/misc.c \
+    puttysrc/sshbn.c \
+    puttysrc/sshrsa.c \
+    puttysrc/sshdss.c \
+    puttysrc/sshecc.c \
+    puttysrc/sshdh.c \
+    puttysrc/sshsh256.c \
+    puttysrc/sshsh512.c \
+    puttysrc/sshsha.c \
+    puttysrc/sshmd5.c \
+    puttysrc/sshaes.c \
+    puttysrc/sshccp.c \
+    puttysrc/sshdes.c \
+    puttysrc/sshblowf.c \
+    puttysrc/ssharcf.c \
+    puttysrc/sshzlib.c \
+    puttysrc/terminal.c \
+    puttysrc/minibidi.c \
+    puttysrc/wcwidth.c \
+    puttysrc/tree234.c \
+    puttysrc/timing.c
+
+INCLUDEPATH += ./ puttysrc/
+
+win32-msvc* {
+    QMAKE_CFLAGS    += -D_CRT_SECURE_NO_WARNINGS
+}
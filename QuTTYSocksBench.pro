@@ -0,0 +1,31 @@
+#--------------------------------------------------------
+# Copyright (C) 2012 Rajendran Thirupugalsamy
+# See LICENSE for full copyright and license information.
+# See COPYING for distribution information.
+#--------------------------------------------------------
+
+#-------------------------------------------------
+#
+# Dynamic forwarding stress test: a console program
+# that pushes many concurrent connections through a
+# SOCKS 5 proxy (a -D forwarding) to an echo server
+# of its own, and checks what comes back.
+#
+#-------------------------------------------------
+
+TARGET = QuTTYSocksBench
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= qt app_bundle
+
+SOURCES +=  \
+    bench/socksbench.c
+
+win32 {
+    LIBS += -lws2_32
+}
+
+win32-msvc* {
+    QMAKE_CFLAGS    += -D_CRT_SECURE_NO_WARNINGS
+}
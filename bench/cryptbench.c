@@ -0,0 +1,1032 @@
+/*
+ * cryptbench: throughput benchmarks for the SSH-2 primitives and the
+ * terminal emulator in puttysrc, built as a console program by
+ * QuTTYBench.pro.
+ *
+ * Every SSH-2 cipher, MAC and hash, and zlib compression in both
+ * directions, are run over each buffer size from 64 bytes to 1MB, for
+ * at least `-t' seconds apiece. The ciphers are also timed on single
+ * keystroke-sized packets (kind "latency"). Bare modpow(), the
+ * sign/verify operation of every host key type and the client side
+ * of each key exchange method (kind "kex") are timed per operation.
+ * Kind "term" feeds screenfuls of text through terminal.c's output
+ * parser. The results go to stdout as CSV, one row per test:
+ *
+ *   kind,algorithm,bytes,iterations,seconds,MB/s,ops/s
+ *
+ * where MB/s counts 10^6 bytes of input. Lines starting with `#' are
+ * comments describing the machine. Any other arguments are patterns;
+ * if there are some, only tests whose kind or algorithm name contains
+ * one of them are run.
+ *
+ * Usage: QuTTYBench [-t seconds] [-s bytes] [pattern...]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "putty.h"
+#include "ssh.h"
+
+static const int bench_sizes[] = {
+    64, 256, 1024, 8192, 65536, 1048576
+};
+#define BENCH_NSIZES (sizeof(bench_sizes) / sizeof(*bench_sizes))
+#define BENCH_MAXSIZE 1048576
+
+/* Room after the buffer for a MAC or AEAD tag and a packet length. */
+#define BENCH_SLACK 128
+
+static double bench_mintime = 0.25;
+static int bench_onesize = 0;
+static char **bench_patterns;
+static int bench_npatterns;
+
+/*
+ * The primitives call random_byte() for RSA blinding and the like.
+ * A benchmark doesn't need real entropy, only a cheap and repeatable
+ * stream, so this replaces sshrand.c with a xorshift generator.
+ */
+static unsigned long bench_rng_state = 0x2545F491UL;
+
+int random_byte(void)
+{
+    unsigned long x = bench_rng_state;
+    x ^= (x << 13) & 0xFFFFFFFFUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFUL;
+    bench_rng_state = x;
+    return (int)(x >> 8) & 0xFF;
+}
+
+/*
+ * fatalbox(), modalfatalbox() and assert() all end up here; the GUI
+ * version in QtDlg.cpp puts up a message box.
+ */
+void qt_message_box_no_frontend(const char *title, const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "%s: ", title);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static void bench_fill(unsigned char *buf, int len)
+{
+    while (len-- > 0)
+	*buf++ = random_byte();
+}
+
+static double bench_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static int bench_wanted(const char *kind, const char *name)
+{
+    int i;
+
+    if (!bench_npatterns)
+	return TRUE;
+    for (i = 0; i < bench_npatterns; i++)
+	if (strstr(kind, bench_patterns[i]) || strstr(name, bench_patterns[i]))
+	    return TRUE;
+    return FALSE;
+}
+
+static int bench_size_wanted(int size)
+{
+    return !bench_onesize || size == bench_onesize;
+}
+
+/*
+ * Run fn(ctx, buf, len) in ever larger batches until at least
+ * bench_mintime has gone by, and print a result row. `len' is the
+ * amount of input one call processes, or 0 for operations (modpow)
+ * where a byte rate means nothing.
+ */
+typedef void (*bench_fn) (void *ctx, unsigned char *buf, int len);
+
+static void bench_report(const char *kind, const char *name, int len,
+			 long iters, double elapsed)
+{
+    printf("%s,%s,%d,%ld,%.6f,%.2f,%.1f\n", kind, name, len, iters, elapsed,
+	   (double)len * iters / elapsed / 1e6, iters / elapsed);
+    fflush(stdout);
+}
+
+static void bench_run(const char *kind, const char *name, int len,
+		      bench_fn fn, void *ctx, unsigned char *buf)
+{
+    long iters = 0, batch = 1, i;
+    double start, elapsed;
+
+    fn(ctx, buf, len);		       /* warm caches and lazy setup */
+
+    start = bench_now();
+    do {
+	for (i = 0; i < batch; i++)
+	    fn(ctx, buf, len);
+	iters += batch;
+	elapsed = bench_now() - start;
+	if (elapsed < bench_mintime / 8)
+	    batch *= 2;
+    } while (elapsed < bench_mintime);
+
+    bench_report(kind, name, len, iters, elapsed);
+}
+
+/* ----------------------------------------------------------------------
+ * Ciphers.
+ */
+
+struct cipher_bench {
+    const struct ssh2_cipher *cipher;
+    void *ctx, *ctx2;
+};
+
+static void cipher_encrypt_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct cipher_bench *cb = (struct cipher_bench *)vctx;
+    cb->cipher->encrypt(cb->ctx, buf, len);
+}
+
+static void cipher_decrypt_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct cipher_bench *cb = (struct cipher_bench *)vctx;
+    cb->cipher->decrypt(cb->ctx, buf, len);
+}
+
+/*
+ * An AEAD cipher seals a whole packet, starting with its 4-byte length
+ * field, and writes the tag after it. Only the payload is counted.
+ */
+static void cipher_seal_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct cipher_bench *cb = (struct cipher_bench *)vctx;
+    PUT_32BIT_MSB_FIRST(buf, len);
+    cb->cipher->aead_encrypt(cb->ctx, buf, len + 4, 0);
+}
+
+/*
+ * Opening a packet whose tag is wrong isn't representative (it wipes
+ * the buffer), so each packet is sealed by one context and opened by
+ * a second one keyed to match: this measures the round trip.
+ */
+static void cipher_roundtrip_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct cipher_bench *cb = (struct cipher_bench *)vctx;
+    PUT_32BIT_MSB_FIRST(buf, len);
+    cb->cipher->aead_encrypt(cb->ctx, buf, len + 4, 0);
+    if (!cb->cipher->aead_decrypt(cb->ctx2, buf, len + 4, 0)) {
+	fprintf(stderr, "%s: packet failed to authenticate\n",
+		cb->cipher->name);
+	exit(1);
+    }
+}
+
+static void *cipher_context(const struct ssh2_cipher *cipher,
+			    unsigned char *key, unsigned char *iv)
+{
+    void *ctx = cipher->make_context();
+    cipher->setkey(ctx, key);
+    cipher->setiv(ctx, iv);
+    return ctx;
+}
+
+static const struct ssh2_ciphers *const bench_cipher_lists[] = {
+    &ssh2_aesgcm, &ssh2_ccp, &ssh2_aes, &ssh2_blowfish,
+    &ssh2_3des, &ssh2_des, &ssh2_arcfour
+};
+#define BENCH_NLISTS (sizeof(bench_cipher_lists) / sizeof(*bench_cipher_lists))
+
+static void bench_ciphers(unsigned char *buf)
+{
+    const struct ssh2_ciphers *const *lists = bench_cipher_lists;
+    unsigned char key[64], iv[32];
+    int i, j, s;
+
+    bench_fill(key, sizeof(key));
+    bench_fill(iv, sizeof(iv));
+
+    for (i = 0; i < (int)BENCH_NLISTS; i++) {
+	for (j = 0; j < lists[i]->nciphers; j++) {
+	    struct cipher_bench cb;
+	    int aead;
+
+	    cb.cipher = lists[i]->list[j];
+	    aead = (cb.cipher->flags & SSH_CIPHER_IS_AEAD) != 0;
+	    if (!bench_wanted(aead ? "seal" : "encrypt", cb.cipher->name) &&
+		!bench_wanted(aead ? "roundtrip" : "decrypt",
+			      cb.cipher->name))
+		continue;
+
+	    cb.ctx = cipher_context(cb.cipher, key, iv);
+	    cb.ctx2 = aead ? cipher_context(cb.cipher, key, iv) : NULL;
+
+	    for (s = 0; s < (int)BENCH_NSIZES; s++) {
+		int len = bench_sizes[s];
+		if (!bench_size_wanted(len))
+		    continue;
+		if (aead) {
+		    if (bench_wanted("seal", cb.cipher->name))
+			bench_run("seal", cb.cipher->name, len,
+				  cipher_seal_fn, &cb, buf);
+		    if (bench_wanted("roundtrip", cb.cipher->name)) {
+			/* Both ends have to start from the same nonce. */
+			cb.cipher->setiv(cb.ctx, iv);
+			cb.cipher->setiv(cb.ctx2, iv);
+			bench_run("roundtrip", cb.cipher->name, len,
+				  cipher_roundtrip_fn, &cb, buf);
+		    }
+		} else {
+		    if (bench_wanted("encrypt", cb.cipher->name))
+			bench_run("encrypt", cb.cipher->name, len,
+				  cipher_encrypt_fn, &cb, buf);
+		    if (bench_wanted("decrypt", cb.cipher->name))
+			bench_run("decrypt", cb.cipher->name, len,
+				  cipher_decrypt_fn, &cb, buf);
+		}
+	    }
+
+	    cb.cipher->free_context(cb.ctx);
+	    if (cb.ctx2)
+		cb.cipher->free_context(cb.ctx2);
+	}
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Keystroke latency.
+ *
+ * A key press goes out as one small packet, and what counts is how
+ * long that packet spends being encrypted. This times encrypt() on
+ * keystroke-sized packets in bursts of a few, first as they come and
+ * then (as "name+precompute") with the cipher's precompute() run
+ * between bursts and left out of the timing, as ssh.c runs it when
+ * idle. ops/s is packets per second: its inverse is the latency.
+ */
+
+#define LATENCY_PKT 32		       /* CHANNEL_DATA with one byte, padded */
+#define LATENCY_BURST 8
+
+static void latency_run(const struct ssh2_cipher *cipher, void *ctx,
+			int precompute, unsigned char *buf)
+{
+    char name[64];
+    long iters = 0;
+    double start, elapsed = 0;
+    int i;
+
+    do {
+	if (precompute)
+	    cipher->precompute(ctx);
+	start = bench_now();
+	for (i = 0; i < LATENCY_BURST; i++)
+	    cipher->encrypt(ctx, buf + i * LATENCY_PKT, LATENCY_PKT);
+	elapsed += bench_now() - start;
+	iters += LATENCY_BURST;
+    } while (elapsed < bench_mintime);
+
+    sprintf(name, "%s%s", cipher->name, precompute ? "+precompute" : "");
+    bench_report("latency", name, LATENCY_PKT, iters, elapsed);
+}
+
+static void bench_latency(unsigned char *buf)
+{
+    unsigned char key[64], iv[32];
+    int i, j;
+
+    bench_fill(key, sizeof(key));
+    bench_fill(iv, sizeof(iv));
+
+    for (i = 0; i < (int)BENCH_NLISTS; i++) {
+	for (j = 0; j < bench_cipher_lists[i]->nciphers; j++) {
+	    const struct ssh2_cipher *cipher = bench_cipher_lists[i]->list[j];
+	    void *ctx;
+
+	    if ((cipher->flags & SSH_CIPHER_IS_AEAD) ||
+		!bench_wanted("latency", cipher->name))
+		continue;
+	    ctx = cipher_context(cipher, key, iv);
+	    latency_run(cipher, ctx, FALSE, buf);
+	    if (cipher->precompute)
+		latency_run(cipher, ctx, TRUE, buf);
+	    cipher->free_context(ctx);
+	}
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * MACs and hashes.
+ */
+
+struct mac_bench {
+    const struct ssh_mac *mac;
+    void *ctx;
+};
+
+static void mac_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct mac_bench *mb = (struct mac_bench *)vctx;
+    mb->mac->generate(mb->ctx, buf, len, 0);
+}
+
+static void bench_macs(unsigned char *buf)
+{
+    static const struct ssh_mac *const macs[] = {
+	&ssh_hmac_sha2_256, &ssh_hmac_sha2_512, &ssh_hmac_sha1,
+	&ssh_hmac_sha1_96, &ssh_hmac_md5
+    };
+    unsigned char key[64];
+    int i, s;
+
+    bench_fill(key, sizeof(key));
+
+    for (i = 0; i < (int)(sizeof(macs) / sizeof(*macs)); i++) {
+	struct mac_bench mb;
+
+	mb.mac = macs[i];
+	if (!bench_wanted("mac", mb.mac->name))
+	    continue;
+	mb.ctx = mb.mac->make_context();
+	mb.mac->setkey(mb.ctx, key);
+	for (s = 0; s < (int)BENCH_NSIZES; s++)
+	    if (bench_size_wanted(bench_sizes[s]))
+		bench_run("mac", mb.mac->name, bench_sizes[s],
+			  mac_fn, &mb, buf);
+	mb.mac->free_context(mb.ctx);
+    }
+}
+
+static void hash_fn(void *vctx, unsigned char *buf, int len)
+{
+    const struct ssh_hash *h = (const struct ssh_hash *)vctx;
+    unsigned char digest[64];
+    void *state = h->init();
+    h->bytes(state, buf, len);
+    h->final(state, digest);
+}
+
+static void bench_hashes(unsigned char *buf)
+{
+    static const struct ssh_hash *const hashes[] = {
+	&ssh_sha256, &ssh_sha1
+    };
+    int i, s;
+
+    for (i = 0; i < (int)(sizeof(hashes) / sizeof(*hashes)); i++) {
+	if (!bench_wanted("hash", hashes[i]->text_name))
+	    continue;
+	for (s = 0; s < (int)BENCH_NSIZES; s++)
+	    if (bench_size_wanted(bench_sizes[s]))
+		bench_run("hash", hashes[i]->text_name, bench_sizes[s],
+			  hash_fn, (void *)hashes[i], buf);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Compression.
+ *
+ * SSH compresses each packet as the next chunk of one long stream, so
+ * the benchmark does the same: successive chunks of a text-like corpus
+ * go through one compressor, and the decompressor is fed the matching
+ * chunks of one precompressed stream. Either wraps round to a fresh
+ * context when it runs off the end of the corpus. Compression is timed
+ * at levels 1, 6 (the default) and 9, as zlib-1, zlib-6 and zlib-9.
+ */
+
+extern const struct ssh_compress ssh_zlib;
+
+#define ZLIB_CORPUS (4 * BENCH_MAXSIZE)
+
+struct zlib_bench {
+    const struct ssh_compress *comp;
+    unsigned char *corpus;
+    void *ctx;
+    int level, pos, nchunks;
+    unsigned char **chunks;
+    int *chunklens;
+};
+
+static void make_corpus(unsigned char *corpus, int len)
+{
+    static const char *const words[] = {
+	"the", "session", "terminal", "window", "ls", "-l", "drwxr-xr-x",
+	"root", "2012", "Jan", "config", "/usr/bin/", "make", "error:",
+	"warning:", "0x7fff", "ssh", "channel", "QuTTY", "tmux", "\n",
+	"\t", "    ", "=", ";", "{", "}", "()", "int", "return"
+    };
+    int nwords = sizeof(words) / sizeof(*words);
+    int pos = 0;
+
+    while (pos < len) {
+	const char *w = words[(random_byte() << 8 | random_byte()) % nwords];
+	int n = strlen(w);
+	if (n > len - pos)
+	    n = len - pos;
+	memcpy(corpus + pos, w, n);
+	pos += n;
+	if (pos < len && random_byte() < 200)
+	    corpus[pos++] = ' ';
+    }
+}
+
+static void zlib_compress_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct zlib_bench *zb = (struct zlib_bench *)vctx;
+    unsigned char *out;
+    int outlen;
+
+    if (zb->pos + len > ZLIB_CORPUS) {
+	zb->comp->compress_cleanup(zb->ctx);
+	zb->ctx = zb->comp->compress_init();
+	zlib_compress_level(zb->ctx, zb->level);
+	zb->pos = 0;
+    }
+    zb->comp->compress(zb->ctx, zb->corpus + zb->pos, len, &out, &outlen);
+    zb->pos += len;
+    sfree(out);
+}
+
+static void zlib_decompress_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct zlib_bench *zb = (struct zlib_bench *)vctx;
+    unsigned char *out;
+    int outlen;
+
+    if (zb->pos == zb->nchunks) {
+	zb->comp->decompress_cleanup(zb->ctx);
+	zb->ctx = zb->comp->decompress_init();
+	zb->pos = 0;
+    }
+    if (!zb->comp->decompress(zb->ctx, zb->chunks[zb->pos],
+			      zb->chunklens[zb->pos], &out, &outlen) ||
+	outlen != len) {
+	fprintf(stderr, "%s: decompression failed\n", zb->comp->name);
+	exit(1);
+    }
+    zb->pos++;
+    sfree(out);
+}
+
+static void bench_zlib(void)
+{
+    static const int levels[] = { 1, 6, 9 };
+    struct zlib_bench zb;
+    char name[64];
+    int s, i, l;
+
+    if (!bench_wanted("compress", ssh_zlib.name) &&
+	!bench_wanted("decompress", ssh_zlib.name))
+	return;
+
+    zb.comp = &ssh_zlib;
+    zb.corpus = snewn(ZLIB_CORPUS, unsigned char);
+    make_corpus(zb.corpus, ZLIB_CORPUS);
+
+    for (s = 0; s < (int)BENCH_NSIZES; s++) {
+	int len = bench_sizes[s];
+	if (!bench_size_wanted(len))
+	    continue;
+
+	for (l = 0; l < (int)lenof(levels); l++) {
+	    sprintf(name, "%s-%d", zb.comp->name, levels[l]);
+	    if (!bench_wanted("compress", name))
+		continue;
+	    zb.ctx = zb.comp->compress_init();
+	    zb.level = levels[l];
+	    zlib_compress_level(zb.ctx, zb.level);
+	    zb.pos = 0;
+	    bench_run("compress", name, len, zlib_compress_fn, &zb, NULL);
+	    zb.comp->compress_cleanup(zb.ctx);
+	}
+
+	if (bench_wanted("decompress", zb.comp->name)) {
+	    void *cctx = zb.comp->compress_init();
+	    zb.nchunks = ZLIB_CORPUS / len;
+	    zb.chunks = snewn(zb.nchunks, unsigned char *);
+	    zb.chunklens = snewn(zb.nchunks, int);
+	    for (i = 0; i < zb.nchunks; i++)
+		zb.comp->compress(cctx, zb.corpus + i * len, len,
+				  &zb.chunks[i], &zb.chunklens[i]);
+	    zb.comp->compress_cleanup(cctx);
+
+	    zb.ctx = zb.comp->decompress_init();
+	    zb.pos = 0;
+	    bench_run("decompress", zb.comp->name, len,
+		      zlib_decompress_fn, &zb, NULL);
+	    zb.comp->decompress_cleanup(zb.ctx);
+
+	    for (i = 0; i < zb.nchunks; i++)
+		sfree(zb.chunks[i]);
+	    sfree(zb.chunks);
+	    sfree(zb.chunklens);
+	}
+    }
+
+    sfree(zb.corpus);
+}
+
+/* ----------------------------------------------------------------------
+ * Public-key operations.
+ */
+
+struct modpow_bench {
+    Bignum base, exp, mod;
+};
+
+static void modpow_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct modpow_bench *mb = (struct modpow_bench *)vctx;
+    freebn(modpow(mb->base, mb->exp, mb->mod));
+}
+
+static void bench_modpow(void)
+{
+    static const int bits[] = { 1024, 2048, 3072, 4096 };
+    unsigned char data[512];
+    char name[32];
+    int i;
+
+    for (i = 0; i < (int)(sizeof(bits) / sizeof(*bits)); i++) {
+	struct modpow_bench mb;
+	int nbytes = bits[i] / 8;
+
+	sprintf(name, "modpow-%d", bits[i]);
+	if (!bench_wanted("modpow", name))
+	    continue;
+
+	/* A full-length odd modulus, and a full-length exponent. */
+	bench_fill(data, nbytes);
+	data[0] |= 0x80;
+	data[nbytes - 1] |= 1;
+	mb.mod = bignum_from_bytes(data, nbytes);
+	bench_fill(data, nbytes);
+	data[0] &= 0x7F;
+	mb.base = bignum_from_bytes(data, nbytes);
+	bench_fill(data, nbytes);
+	data[0] |= 0x80;
+	mb.exp = bignum_from_bytes(data, nbytes);
+
+	bench_run("modpow", name, 0, modpow_fn, &mb, NULL);
+
+	freebn(mb.base);
+	freebn(mb.exp);
+	freebn(mb.mod);
+    }
+}
+
+/*
+ * Fixed keys for the sign and verify tests, in the private key format
+ * of openssh_createkey(). They were generated for this file and guard
+ * nothing.
+ */
+static const unsigned char bench_rsa2048[] = {
+    0x00,0x00,0x01,0x01,0x00,0xa6,0x14,0x23,0xc8,0x24,0x8e,0xa6,
+    0xbe,0x22,0x73,0xb7,0xdb,0xec,0x38,0x64,0xc8,0xfc,0xda,0x74,
+    0x63,0xfb,0xbb,0x65,0xfa,0xbb,0x30,0xc6,0x6c,0xbe,0x1b,0xd9,
+    0xaa,0x41,0xf1,0xd7,0xed,0x66,0x5b,0x3e,0x39,0xe6,0xae,0x48,
+    0x7e,0xf2,0x08,0x24,0x64,0x6e,0xa7,0x56,0x79,0x11,0x38,0x6b,
+    0xf8,0xfe,0x18,0x1a,0x6c,0x23,0xce,0xfd,0xa0,0xd8,0x6f,0x61,
+    0x7c,0x93,0xdb,0xdd,0x24,0x46,0x2a,0x26,0xb1,0xe4,0x3f,0xd0,
+    0x77,0x6d,0x02,0x1b,0x3f,0x7e,0xd4,0xe2,0x1e,0x20,0x85,0x49,
+    0xd5,0x75,0xb6,0x53,0xd0,0x91,0xeb,0xac,0xa1,0x03,0x44,0xab,
+    0x0e,0xcf,0x0e,0x6b,0xfd,0x8f,0x38,0x80,0xcd,0x2f,0xf2,0x50,
+    0x87,0xb0,0xc6,0xee,0xdb,0x0c,0xd0,0x40,0xbb,0x40,0x51,0x88,
+    0x73,0x64,0x42,0x03,0xa1,0xf8,0x94,0x8c,0xce,0x13,0x8a,0x58,
+    0xd3,0xc2,0xe5,0xaf,0x47,0x64,0x57,0x44,0xc6,0x9f,0x71,0x87,
+    0x12,0xa2,0xcd,0x46,0xb7,0xa5,0x76,0xee,0x7c,0x31,0x44,0xd7,
+    0x97,0xd1,0x93,0x36,0x47,0x80,0x3e,0x36,0x94,0xa9,0xb1,0xe5,
+    0x83,0x64,0x21,0x2e,0x1b,0xb3,0x53,0x34,0x9d,0x08,0x69,0x88,
+    0x8b,0xe2,0xd2,0xbc,0xae,0xc1,0xfd,0x67,0x5e,0x9d,0x68,0x93,
+    0x81,0xc4,0xc0,0x5e,0xa6,0xc9,0xc9,0x4a,0xa3,0xeb,0x2a,0xfd,
+    0x23,0x92,0xb7,0xb4,0xbc,0x84,0xd0,0xd3,0x0a,0x74,0x8b,0x98,
+    0x9a,0x27,0x9e,0xe8,0xd0,0xb2,0xf4,0x69,0x9f,0x64,0xd8,0x7e,
+    0x6e,0x5a,0xeb,0x61,0x52,0x18,0x10,0xd2,0xbc,0xd5,0x5b,0x1b,
+    0xcb,0xa9,0xc2,0x14,0x53,0x3d,0x18,0x55,0xa1,0x00,0x00,0x00,
+    0x03,0x01,0x00,0x01,0x00,0x00,0x01,0x00,0x4e,0xca,0x24,0x35,
+    0x99,0xde,0x51,0x4d,0xc7,0xc3,0x75,0x58,0xf1,0x06,0xca,0x0d,
+    0xae,0x23,0xa7,0x6f,0x1d,0xa8,0x88,0x97,0x7c,0x82,0x05,0xc8,
+    0xe6,0x22,0x09,0x50,0x24,0x2b,0xeb,0x80,0x35,0x7c,0x99,0x17,
+    0x58,0x10,0x9b,0xd5,0x19,0xd6,0xf2,0x08,0xf1,0x94,0x12,0xca,
+    0xa9,0xf8,0x46,0x05,0x20,0xea,0xe7,0x72,0x21,0x44,0xdc,0x7f,
+    0x97,0xde,0xb3,0x75,0xaa,0x21,0xf7,0x16,0x73,0xf1,0x20,0x5d,
+    0x69,0xc7,0x3a,0x8b,0xc5,0xdb,0xe7,0x78,0x66,0x9f,0xf1,0x4c,
+    0x50,0xaa,0x5b,0x5e,0x59,0x13,0x70,0x4c,0xf5,0x45,0x45,0x27,
+    0x38,0x09,0x36,0x4b,0xf6,0xc0,0x45,0x4c,0x4c,0x4b,0x86,0x93,
+    0x91,0xa9,0x18,0x3a,0x5f,0x8b,0xe9,0x1a,0x63,0xc8,0x52,0xc5,
+    0x63,0x1c,0xab,0x2a,0x2a,0xd4,0x9b,0x06,0x9b,0xf8,0xb4,0x89,
+    0x81,0xce,0x2b,0x82,0xd4,0xfe,0x16,0xcc,0xf2,0xcc,0xa2,0xdc,
+    0xa8,0xaf,0x20,0x5c,0xcd,0x00,0x9b,0xde,0x6c,0x55,0x4e,0x3d,
+    0x7f,0xa1,0x9a,0x7f,0x5b,0x2a,0x08,0x33,0xa1,0x49,0x01,0x02,
+    0xf1,0x51,0xf1,0x70,0x82,0xd0,0xad,0x6d,0x6e,0x94,0x02,0x51,
+    0xc2,0x72,0xd2,0xa9,0xb1,0x6f,0x20,0x27,0x40,0xf3,0x05,0x74,
+    0xa6,0xbd,0x18,0x71,0x98,0xff,0x33,0x36,0x03,0x59,0xf4,0x02,
+    0x58,0x8e,0x59,0xc8,0x07,0x06,0xd3,0xe2,0xce,0x53,0xbc,0x94,
+    0x51,0xab,0x76,0x53,0x89,0xda,0xd8,0x01,0xce,0x65,0x4f,0x08,
+    0xbc,0x47,0x29,0x47,0x65,0x25,0x16,0x0d,0xe2,0x53,0xfe,0xb6,
+    0xda,0xc6,0x3e,0x9f,0xe8,0xd2,0xf6,0xcd,0xcc,0x0c,0x67,0xc7,
+    0x00,0x00,0x00,0x80,0x73,0xf1,0xcf,0xc6,0x52,0x25,0x1d,0xcc,
+    0x7e,0xd1,0xec,0x8f,0xa4,0xc5,0xab,0xca,0xd0,0x43,0xcd,0xec,
+    0x7f,0x16,0x2b,0x2e,0xc0,0x61,0x9f,0xc5,0x40,0xb3,0xda,0xdd,
+    0x59,0x2b,0x0f,0x40,0xf3,0xdb,0x81,0xa8,0x2c,0x94,0x73,0x9e,
+    0xd2,0xe6,0x15,0xb9,0x2e,0xa7,0xe0,0xe2,0xe0,0xe9,0xff,0x42,
+    0x7f,0x81,0x62,0x28,0x9c,0x42,0xac,0x0e,0x1d,0xf1,0x57,0x6c,
+    0x8a,0x8d,0xec,0x0c,0x30,0x72,0xee,0x0a,0x92,0x45,0x64,0x48,
+    0x1c,0x0b,0x7c,0xe1,0xa4,0x9e,0x35,0x84,0x56,0xa9,0xcb,0x6f,
+    0x6a,0x9c,0x98,0x88,0xc7,0x4c,0xb0,0x55,0xc4,0x01,0x5c,0xd6,
+    0xb3,0xaf,0x0f,0xb6,0x9a,0xd8,0x54,0x79,0xe8,0xe4,0xb7,0xe6,
+    0xd4,0x52,0x00,0xa9,0x94,0x4c,0xcc,0xe7,0x8e,0x64,0xff,0x84,
+    0x00,0x00,0x00,0x81,0x00,0xe1,0xd0,0xb5,0xd2,0x22,0x26,0xb0,
+    0xa4,0x75,0x89,0x9a,0xcf,0x2f,0xe1,0xd8,0x61,0xee,0xe2,0x8c,
+    0xac,0x4e,0x8e,0xc5,0x31,0x96,0xee,0xd4,0x50,0x1f,0x16,0x9a,
+    0xfc,0xc0,0xbb,0xc7,0x40,0x80,0xc4,0xe9,0x8a,0xab,0xc8,0xae,
+    0xf9,0x1d,0xf6,0x96,0xbb,0xc2,0xee,0x81,0xa5,0xdc,0xee,0x34,
+    0xe3,0xc1,0xe6,0x61,0x5c,0x23,0x22,0xbf,0xa1,0xf4,0x3d,0x1c,
+    0xc1,0x2e,0xc6,0x16,0xd7,0x24,0x79,0x30,0x61,0xd5,0xa8,0x4a,
+    0xfc,0xb2,0x79,0x10,0xbd,0xe6,0x3b,0x4e,0xd5,0x5a,0xeb,0x31,
+    0x41,0xee,0x48,0xa8,0x23,0xd0,0x1c,0x06,0x61,0x43,0xb1,0x24,
+    0x50,0x9c,0xec,0x3f,0x67,0xa4,0xe7,0x4f,0xb1,0x32,0x6e,0x0a,
+    0xde,0x11,0x7a,0x53,0xa4,0x1a,0xf7,0x57,0xf5,0xc4,0x09,0x83,
+    0x33,0x00,0x00,0x00,0x81,0x00,0xbc,0x47,0x45,0x93,0x8a,0xb3,
+    0x5d,0x80,0x38,0xa0,0x9b,0x3a,0xee,0xfc,0x9c,0xa5,0x71,0xd1,
+    0xed,0x99,0x67,0x58,0x59,0xfe,0x8b,0x80,0x4f,0xb5,0x01,0xce,
+    0x84,0x9b,0x07,0x22,0x59,0xc8,0x4e,0x64,0xf0,0x01,0xf5,0xef,
+    0xbc,0xa4,0x46,0x66,0x74,0xe9,0x25,0xb0,0xa1,0xbb,0x16,0x65,
+    0x63,0x02,0x22,0x40,0x09,0xec,0x70,0xeb,0xb0,0xd5,0xcf,0x40,
+    0x64,0xa2,0xe7,0xf0,0xd1,0x3f,0x09,0x38,0x10,0xe2,0xaa,0xad,
+    0x00,0xa7,0xbf,0x75,0xa1,0x01,0x77,0x63,0x39,0x5b,0x73,0x91,
+    0x77,0x9c,0x09,0x0f,0x8a,0x42,0xbd,0x47,0x04,0x99,0x9c,0xe4,
+    0xb1,0xb7,0x9a,0x36,0xc6,0x0c,0x0e,0x2a,0xac,0xe2,0x72,0x6b,
+    0xfd,0x23,0xc5,0xbb,0xe4,0x2d,0x46,0xcc,0x05,0xf9,0x09,0xe6,
+    0x83,0xdb
+};
+
+static const unsigned char bench_dss1024[] = {
+    0x00,0x00,0x00,0x81,0x00,0xd9,0xcb,0x37,0x37,0xed,0xb2,0x1b,
+    0x5d,0x18,0x18,0x08,0x83,0x33,0x8b,0x60,0xc8,0xea,0x8c,0x01,
+    0x70,0x43,0xbe,0x3b,0x72,0x7e,0xb1,0x94,0xaf,0x1f,0x5b,0xf1,
+    0x56,0x9b,0x2c,0xa9,0xdb,0xa0,0x75,0xb8,0xea,0xc7,0xa9,0xa8,
+    0xcf,0x79,0x58,0x65,0x41,0x07,0xc1,0xfa,0xac,0x73,0x3e,0x82,
+    0xe7,0xb2,0xa7,0x57,0x27,0xef,0x7d,0x43,0x9e,0xcf,0xd1,0x8f,
+    0x37,0xc5,0x09,0x95,0xe8,0xb1,0x05,0xb7,0x98,0x64,0x14,0x85,
+    0xfc,0x2e,0x12,0xca,0x00,0x92,0x9d,0xee,0x7d,0xa8,0x90,0xf7,
+    0x2f,0xa1,0x95,0xf2,0x2b,0x22,0xc4,0xe6,0x22,0xe7,0x7a,0x25,
+    0x33,0x2b,0xed,0x68,0xfa,0x56,0x0a,0xd5,0xf0,0x76,0x9f,0xe9,
+    0x09,0x3a,0x86,0xfb,0x92,0xf9,0x5d,0x3f,0x15,0xc1,0x40,0xf3,
+    0xa3,0x00,0x00,0x00,0x15,0x00,0xb2,0x7a,0xdc,0x56,0x26,0x85,
+    0x73,0x1d,0x15,0xe5,0x7a,0x04,0x40,0xf9,0x5b,0x8b,0x45,0x71,
+    0x39,0x95,0x00,0x00,0x00,0x81,0x00,0xa6,0xc2,0x50,0xe4,0x54,
+    0xdc,0xa2,0xfb,0xe0,0x04,0x92,0xe6,0x33,0x9e,0x8b,0xc5,0xc0,
+    0x0e,0xea,0x58,0x4b,0x56,0xad,0x67,0xcb,0xa1,0xd1,0x85,0x16,
+    0x70,0x4d,0x9c,0x12,0x23,0x26,0x17,0x2c,0x7b,0x49,0x8a,0xaa,
+    0xbc,0x9f,0x13,0x1a,0x9c,0x58,0xee,0x29,0xbc,0x01,0xcb,0x58,
+    0xfc,0xa7,0xd8,0xee,0x4a,0xc5,0xf7,0xa5,0x99,0x7f,0xc9,0x5c,
+    0xaa,0xa5,0x42,0x30,0x02,0x33,0x88,0xab,0x98,0x9b,0x74,0xac,
+    0xcf,0x12,0x08,0x4c,0x19,0x2a,0x32,0x87,0x4b,0xdb,0xf5,0xdf,
+    0xdf,0x60,0xf5,0x04,0x68,0x56,0x27,0x4e,0xae,0x9f,0x60,0xef,
+    0xf2,0x2f,0xbf,0x4b,0xdb,0x73,0x5c,0x57,0x4c,0x29,0x41,0xf6,
+    0xcf,0x4c,0xe3,0x90,0x2d,0xea,0x8d,0x2b,0x94,0x42,0x6f,0xdc,
+    0x53,0x36,0x2f,0x00,0x00,0x00,0x80,0x52,0xa9,0xa0,0x0e,0x4a,
+    0xb7,0xcc,0x61,0xb1,0xaa,0xdd,0xeb,0x78,0xdb,0x06,0x1c,0x06,
+    0xfe,0x18,0x54,0xb0,0x11,0x3e,0xb8,0x65,0xed,0xbe,0xd4,0x13,
+    0xeb,0x4a,0xf4,0x6b,0xf8,0x5d,0x5b,0xf5,0x41,0x60,0x8a,0x2e,
+    0x3f,0x19,0xd6,0xb0,0xc4,0xbe,0xec,0x0b,0xac,0x56,0x72,0x45,
+    0x69,0x28,0x1f,0x8f,0x89,0x3e,0x4b,0x46,0x72,0x3c,0x0e,0xd4,
+    0x9f,0x89,0x7a,0x76,0x7a,0x3b,0x54,0x30,0x61,0x97,0xb2,0x26,
+    0x61,0x44,0x03,0x29,0xce,0x04,0x55,0x4b,0x7b,0xdc,0x62,0x07,
+    0x0a,0x2d,0x09,0x09,0xa7,0x71,0x24,0x72,0xb2,0x18,0xd1,0x5f,
+    0x72,0xba,0x21,0x9e,0x2e,0x7d,0xa8,0xc7,0x61,0x41,0x8e,0x6f,
+    0xbc,0x2c,0xf7,0x81,0x28,0x38,0xaf,0xce,0xc6,0xd3,0x25,0xe1,
+    0x29,0x45,0x71,0x00,0x00,0x00,0x15,0x00,0x8c,0x2c,0xa5,0xc7,
+    0x32,0x4c,0x44,0x68,0x5e,0x5d,0x12,0x4c,0x6b,0x12,0x66,0x8f,
+    0x26,0xc1,0x4a,0xd4
+};
+
+static const unsigned char bench_ed25519[] = {
+    0x00,0x00,0x00,0x20,0xd5,0xc6,0x23,0x5d,0xc2,0x35,0xe9,0x13,
+    0x56,0x63,0x4f,0x5c,0x73,0x58,0x8b,0xa6,0xe8,0x03,0xfb,0x6e,
+    0x8b,0x7e,0xa9,0x03,0xd5,0x41,0x53,0x5c,0xfc,0x16,0x36,0xf4,
+    0x00,0x00,0x00,0x40,0x18,0xcb,0x36,0x91,0x49,0x0f,0x8c,0xd3,
+    0xb8,0xeb,0x8a,0x41,0xbf,0x30,0x65,0x65,0x1f,0x7b,0x67,0x2b,
+    0x2f,0x46,0x6a,0x7a,0x9e,0xc6,0x03,0x42,0xd2,0x9b,0x42,0xdc,
+    0xd5,0xc6,0x23,0x5d,0xc2,0x35,0xe9,0x13,0x56,0x63,0x4f,0x5c,
+    0x73,0x58,0x8b,0xa6,0xe8,0x03,0xfb,0x6e,0x8b,0x7e,0xa9,0x03,
+    0xd5,0x41,0x53,0x5c,0xfc,0x16,0x36,0xf4
+};
+
+static const unsigned char bench_nistp256[] = {
+    0x00,0x00,0x00,0x08,0x6e,0x69,0x73,0x74,0x70,0x32,0x35,0x36,
+    0x00,0x00,0x00,0x41,0x04,0x17,0x75,0xab,0x71,0x65,0xa0,0x5c,
+    0xdf,0xba,0x54,0x74,0xba,0x8d,0x5a,0xb1,0xb0,0x1c,0x00,0x14,
+    0xa9,0x06,0x21,0x35,0x0a,0x82,0x25,0x9a,0x94,0xad,0x92,0xc5,
+    0xa0,0x20,0xdb,0xde,0xcc,0xe1,0x75,0xd0,0x1a,0x7e,0x6c,0x57,
+    0x72,0x67,0xfd,0x1d,0xca,0xb1,0x78,0x68,0xe0,0x97,0x57,0xca,
+    0x39,0x5b,0xf9,0xa1,0x45,0xbd,0x29,0xb2,0xef,0x00,0x00,0x00,
+    0x21,0x00,0x9b,0xe4,0xad,0x73,0x52,0x0f,0xab,0x4d,0x7c,0x78,
+    0xc6,0xd4,0xe9,0x5a,0xa8,0x48,0x0a,0x7a,0xf3,0xd7,0x2c,0x6a,
+    0x55,0x22,0x25,0x8c,0x6a,0xf9,0x73,0xce,0x03,0xfc
+};
+
+struct sign_bench {
+    const struct ssh_signkey *alg;
+    void *key;
+    unsigned char *sig;
+    int siglen;
+};
+
+static void sign_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct sign_bench *sb = (struct sign_bench *)vctx;
+    int siglen;
+    sfree(sb->alg->sign(sb->key, (char *)buf, len, &siglen));
+}
+
+static void verify_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct sign_bench *sb = (struct sign_bench *)vctx;
+    if (!sb->alg->verifysig(sb->key, (char *)sb->sig, sb->siglen,
+			    (char *)buf, len)) {
+	fprintf(stderr, "%s: signature failed to verify\n", sb->alg->name);
+	exit(1);
+    }
+}
+
+static void bench_signkeys(unsigned char *buf)
+{
+    static const struct {
+	const struct ssh_signkey *alg;
+	const char *name;
+	const unsigned char *blob;
+	int bloblen;
+    } keys[] = {
+	{ &ssh_ecdsa_ed25519, "ssh-ed25519",
+	  bench_ed25519, sizeof(bench_ed25519) },
+	{ &ssh_ecdsa_nistp256, "ecdsa-sha2-nistp256",
+	  bench_nistp256, sizeof(bench_nistp256) },
+	{ &ssh_rsa, "ssh-rsa-2048", bench_rsa2048, sizeof(bench_rsa2048) },
+	{ &ssh_dss, "ssh-dss-1024", bench_dss1024, sizeof(bench_dss1024) },
+    };
+    /* About the size of a userauth request, the largest thing signed. */
+    const int len = 256;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(keys) / sizeof(*keys)); i++) {
+	struct sign_bench sb;
+	unsigned char *blob = (unsigned char *)keys[i].blob;
+	int bloblen = keys[i].bloblen;
+
+	if (!bench_wanted("sign", keys[i].name) &&
+	    !bench_wanted("verify", keys[i].name))
+	    continue;
+
+	sb.alg = keys[i].alg;
+	sb.key = sb.alg->openssh_createkey(&blob, &bloblen);
+	if (!sb.key) {
+	    fprintf(stderr, "%s: unable to load test key\n", keys[i].name);
+	    exit(1);
+	}
+	sb.sig = sb.alg->sign(sb.key, (char *)buf, len, &sb.siglen);
+
+	if (bench_wanted("sign", keys[i].name))
+	    bench_run("sign", keys[i].name, len, sign_fn, &sb, buf);
+	if (bench_wanted("verify", keys[i].name))
+	    bench_run("verify", keys[i].name, len, verify_fn, &sb, buf);
+
+	sfree(sb.sig);
+	sb.alg->freekey(sb.key);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Key exchange: the client's half of one exchange, from making its
+ * ephemeral key to arriving at the shared secret K, with a fixed value
+ * standing in for the server's.
+ */
+
+struct kex_bench {
+    const struct ssh_kex *kex;
+    char *remote;		       /* server's ECDH public value */
+    int remotelen;
+    Bignum f;			       /* server's DH public value */
+    int nbits;
+};
+
+static void ecdh_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct kex_bench *kb = (struct kex_bench *)vctx;
+    void *key = ssh_ecdhkex_newkey(kb->kex);
+    Bignum K = ssh_ecdhkex_getkey(key, kb->remote, kb->remotelen);
+
+    if (!K) {
+	fprintf(stderr, "%s: key exchange failed\n", kb->kex->name);
+	exit(1);
+    }
+    freebn(K);
+    ssh_ecdhkex_freekey(key);
+}
+
+static void dh_fn(void *vctx, unsigned char *buf, int len)
+{
+    struct kex_bench *kb = (struct kex_bench *)vctx;
+    void *ctx = dh_setup_group(kb->kex);
+
+    dh_create_e(ctx, kb->nbits);       /* e belongs to ctx */
+    freebn(dh_find_K(ctx, kb->f));
+    dh_cleanup(ctx);
+}
+
+static void bench_kex(void)
+{
+    static const struct ssh_kexes *const lists[] = {
+	&ssh_ecdh_kex, &ssh_diffiehellman_group14, &ssh_diffiehellman_group1,
+    };
+    int i, j;
+
+    for (i = 0; i < (int)(sizeof(lists) / sizeof(*lists)); i++) {
+	for (j = 0; j < lists[i]->nkexes; j++) {
+	    struct kex_bench kb;
+
+	    kb.kex = lists[i]->list[j];
+	    /* curve25519-sha256@libssh.org is the same exchange again. */
+	    if (j > 0 && kb.kex->main_type == KEXTYPE_ECDH &&
+		kb.kex->extra == lists[i]->list[j - 1]->extra)
+		continue;
+	    if (!bench_wanted("kex", kb.kex->name))
+		continue;
+
+	    if (kb.kex->main_type == KEXTYPE_ECDH) {
+		void *server = ssh_ecdhkex_newkey(kb.kex);
+		kb.remote = ssh_ecdhkex_getpublic(server, &kb.remotelen);
+		bench_run("kex", kb.kex->name, 0, ecdh_fn, &kb, NULL);
+		ssh_ecdhkex_freekey(server);
+	    } else {
+		void *server = dh_setup_group(kb.kex);
+		/*
+		 * ssh.c asks for an exponent of twice the bits of key
+		 * it needs, which is at most the exchange hash length.
+		 */
+		kb.nbits = 2 * 8 * kb.kex->hash->hlen;
+		kb.f = dh_create_e(server, kb.nbits);
+		bench_run("kex", kb.kex->name, 0, dh_fn, &kb, NULL);
+		dh_cleanup(server);	       /* frees kb.f too */
+	    }
+	}
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Terminal output: term_data() parsing 64KB of text at a time into a
+ * 200x50 screen with scrollback, as when a build log scrolls past.
+ * termstubs.c stands in for the window, so nothing is drawn.
+ */
+
+#define TERM_BENCH_LEN 65536
+
+static void term_fn(void *vctx, unsigned char *buf, int len)
+{
+    term_data((Terminal *)vctx, 0, (char *)buf, len);
+}
+
+/*
+ * Fill buf with lines of 20 to 169 printable ASCII characters. With
+ * `sgr' set, about one character in ten is preceded by an SGR colour
+ * change, so the text comes in short runs between escape sequences.
+ * Returns the length used.
+ */
+static int make_term_text(unsigned char *buf, int len, int sgr)
+{
+    int n = 0;
+
+    while (n < len - 1024) {
+	int linelen = 20 + random_byte() % 150, i;
+	for (i = 0; i < linelen; i++) {
+	    int c = random_byte();
+	    if (sgr && c < 24)
+		n += sprintf((char *)buf + n, "\033[%dm",
+			     c < 8 ? 0 : 30 + c % 8);
+	    buf[n++] = 32 + c % 95;
+	}
+	buf[n++] = '\r';
+	buf[n++] = '\n';
+    }
+    return n;
+}
+
+static void bench_terminal(void)
+{
+    static const struct {
+	const char *name;
+	int sgr;
+    } loads[] = {
+	{ "ascii-200col", FALSE },
+	{ "sgr-200col", TRUE },
+    };
+    static struct unicode_data ucsdata;
+    unsigned char *text;
+    Config cfg;
+    int i, len;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.savelines = 2000;
+    cfg.wrap_mode = TRUE;
+    cfg.ansi_colour = TRUE;
+    cfg.bce = TRUE;
+
+    /* ISO 8859-1 straight through, with the C0 and C1 controls. */
+    for (i = 0; i < 256; i++) {
+	ucsdata.unitab_line[i] = ucsdata.unitab_font[i] = i;
+	ucsdata.unitab_xterm[i] = ucsdata.unitab_scoacs[i] = i;
+	ucsdata.unitab_ctrl[i] = (i < 32 || (i >= 0x7F && i < 0xA0)) ? i : 0xFF;
+    }
+
+    text = snewn(TERM_BENCH_LEN, unsigned char);
+    for (i = 0; i < (int)(sizeof(loads) / sizeof(*loads)); i++) {
+	Terminal *term;
+
+	if (!bench_wanted("term", loads[i].name))
+	    continue;
+
+	len = make_term_text(text, TERM_BENCH_LEN, loads[i].sgr);
+	term = term_init(&cfg, &ucsdata, NULL);
+	term_size(term, 50, 200, cfg.savelines);
+	bench_run("term", loads[i].name, len, term_fn, term, text);
+	term_free(term);
+    }
+    sfree(text);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: QuTTYBench [-t seconds] [-s bytes] "
+	    "[pattern...]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *buf;
+    int i;
+
+    bench_patterns = snewn(argc, char *);
+    bench_npatterns = 0;
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+	    bench_mintime = atof(argv[++i]);
+	    if (bench_mintime <= 0)
+		usage();
+	} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+	    bench_onesize = atoi(argv[++i]);
+	    if (bench_onesize <= 0 || bench_onesize > BENCH_MAXSIZE)
+		usage();
+	} else if (argv[i][0] == '-') {
+	    usage();
+	} else {
+	    bench_patterns[bench_npatterns++] = argv[i];
+	}
+    }
+
+    buf = snewn(BENCH_MAXSIZE + BENCH_SLACK, unsigned char);
+    bench_fill(buf, BENCH_MAXSIZE + BENCH_SLACK);
+
+    printf("# QuTTY crypto benchmark, %g s per test\n", bench_mintime);
+    printf("# sha-ni: %s\n", sha_ni_available() ? "yes" : "no");
+    printf("kind,algorithm,bytes,iterations,seconds,MB/s,ops/s\n");
+
+    bench_ciphers(buf);
+    bench_latency(buf);
+    bench_macs(buf);
+    bench_hashes(buf);
+    bench_zlib();
+    bench_modpow();
+    bench_signkeys(buf);
+    bench_kex();
+    bench_terminal();
+
+    sfree(buf);
+    sfree(bench_patterns);
+    return 0;
+}
@@ -0,0 +1,628 @@
+/*
+ * socksbench: stress test for dynamic (-D) port forwarding, built as
+ * a console program by QuTTYSocksBench.pro.
+ *
+ * It runs a TCP echo server of its own, then makes many connections
+ * to it at once through a SOCKS 5 proxy, such as a QuTTY session
+ * with a dynamic forwarding on 127.0.0.1:1080. Each connection sends
+ * its own pattern of bytes and checks that exactly the same bytes
+ * come back. At the end it prints how many connections got through,
+ * the throughput of the tunnel, and how long SOCKS set-up took, from
+ * starting the TCP connect to the proxy's reply to CONNECT.
+ *
+ * The SSH server has to be able to reach the echo server at the
+ * address the CONNECT requests name. That is 127.0.0.1 by default,
+ * which is right when the server is this machine. Otherwise give -a
+ * an address of this machine that the server can reach; the echo
+ * server then listens on all interfaces.
+ *
+ * Every live connection costs two sockets here, one at each end.
+ *
+ * Usage: QuTTYSocksBench [-p [host:]port] [-a address] [-c concurrent]
+ *                        [-n connections] [-b bytes] [-w seconds]
+ *
+ * The exit status is 0 only if every connection succeeded.
+ */
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600	       /* WSAPoll */
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+typedef SOCKET sock_t;
+#define poll WSAPoll
+#define sock_close closesocket
+#define sock_error() WSAGetLastError()
+#define sock_would_block(e) ((e) == WSAEWOULDBLOCK)
+#define sock_in_progress(e) ((e) == WSAEWOULDBLOCK)
+#else
+typedef int sock_t;
+#define INVALID_SOCKET (-1)
+#define sock_close close
+#define sock_error() errno
+#define sock_would_block(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#define sock_in_progress(e) ((e) == EINPROGRESS)
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define CHUNK 16384		       /* most read or written at once */
+
+enum {
+    ST_CONNECT,			       /* TCP connect to the proxy */
+    ST_GREETING,		       /* waiting for method selection */
+    ST_REQUEST,			       /* waiting for CONNECT's reply */
+    ST_DATA,			       /* sending and checking the echo */
+    ST_ECHO			       /* echo server's end */
+};
+
+struct conn {
+    sock_t s;
+    int state;
+    int id;			       /* client number, for the pattern */
+    double started;
+    /* Client: SOCKS reply so far, then the payload counters. */
+    unsigned char reply[262];
+    int replylen;
+    long sent, received;
+    /* Echo server: bytes read and not yet written back. */
+    unsigned char *pending;
+    int pendpos, pendlen;
+    int dead;
+};
+
+static struct sockaddr_in proxy_addr;
+static struct in_addr echo_addr;
+static unsigned short echo_port;
+static int concurrency = 1000;
+static int total = -1;
+static long payload = 65536;
+static double stall_limit = 30;
+
+static struct conn **conns;
+static struct pollfd *fds;	       /* fds[0] is the echo listener */
+static int nconns, connsize;
+
+static int started, succeeded, failed, active;
+static double *setup_times;
+static int nsetup;
+static double last_progress;
+
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/* The byte client `id' sends at offset `off' of its payload. */
+static unsigned char pattern(int id, long off)
+{
+    return (unsigned char)(off * 31 + id * 7 + (off >> 8));
+}
+
+static void set_nonblocking(sock_t s)
+{
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(s, FIONBIO, &on);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+static struct conn *new_conn(sock_t s, int state)
+{
+    struct conn *c = (struct conn *)calloc(1, sizeof(struct conn));
+
+    if (!c) {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+    }
+    c->s = s;
+    c->state = state;
+    if (nconns >= connsize) {
+	connsize = connsize * 3 / 2 + 64;
+	conns = (struct conn **)realloc(conns, connsize * sizeof(*conns));
+	fds = (struct pollfd *)realloc(fds, (connsize + 1) * sizeof(*fds));
+	if (!conns || !fds) {
+	    fprintf(stderr, "out of memory\n");
+	    exit(1);
+	}
+    }
+    conns[nconns++] = c;
+    return c;
+}
+
+static void client_failed(struct conn *c, const char *why, int err)
+{
+    /* Only the first few; a broken tunnel fails thousands at once. */
+    if (failed < 10) {
+	if (err)
+	    fprintf(stderr, "connection %d: %s (error %d)\n",
+		    c->id, why, err);
+	else
+	    fprintf(stderr, "connection %d: %s\n", c->id, why);
+    }
+    failed++;
+    active--;
+    c->dead = TRUE;
+    last_progress = now();
+}
+
+static void start_client(void)
+{
+    sock_t s = socket(AF_INET, SOCK_STREAM, 0);
+    struct conn *c;
+    int on = 1;
+
+    if (s == INVALID_SOCKET) {
+	fprintf(stderr, "socket: error %d; raise the open file limit, "
+		"or lower -c\n", sock_error());
+	exit(1);
+    }
+    set_nonblocking(s);
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+
+    c = new_conn(s, ST_CONNECT);
+    c->id = started++;
+    c->started = now();
+    active++;
+    if (connect(s, (struct sockaddr *)&proxy_addr, sizeof(proxy_addr)) < 0 &&
+	!sock_in_progress(sock_error()))
+	client_failed(c, "connect to proxy failed", sock_error());
+}
+
+/* Short SOCKS messages go in one send() or not at all. */
+static int send_all(struct conn *c, const unsigned char *data, int len)
+{
+    if (send(c->s, (const char *)data, len, 0) != len) {
+	client_failed(c, "short write to proxy", sock_error());
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Read more of a SOCKS reply into c->reply, until it holds `want'
+ * bytes. Returns TRUE once it does.
+ */
+static int read_reply(struct conn *c, int want)
+{
+    int n;
+
+    if (c->replylen >= want)
+	return TRUE;
+    n = recv(c->s, (char *)c->reply + c->replylen, want - c->replylen, 0);
+    if (n == 0) {
+	client_failed(c, "proxy closed the connection", 0);
+	return FALSE;
+    }
+    if (n < 0) {
+	if (!sock_would_block(sock_error()))
+	    client_failed(c, "read from proxy failed", sock_error());
+	return FALSE;
+    }
+    c->replylen += n;
+    return c->replylen >= want;
+}
+
+static void client_event(struct conn *c, short revents)
+{
+    static unsigned char buf[CHUNK];
+    int n, err;
+
+    switch (c->state) {
+      case ST_CONNECT: {
+	socklen_t errlen = sizeof(err);
+	static const unsigned char greeting[] = { 5, 1, 0 };
+
+	err = 0;
+	getsockopt(c->s, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen);
+	if (err) {
+	    client_failed(c, "connect to proxy failed", err);
+	    return;
+	}
+	if (!send_all(c, greeting, sizeof(greeting)))
+	    return;
+	c->state = ST_GREETING;
+	break;
+      }
+
+      case ST_GREETING: {
+	unsigned char req[10];
+
+	if (!read_reply(c, 2))
+	    return;
+	if (c->reply[0] != 5 || c->reply[1] != 0) {
+	    client_failed(c, "proxy wants authentication", 0);
+	    return;
+	}
+	req[0] = 5;		       /* VER */
+	req[1] = 1;		       /* CMD = CONNECT */
+	req[2] = 0;
+	req[3] = 1;		       /* ATYP = IPv4 */
+	memcpy(req + 4, &echo_addr, 4);
+	req[8] = echo_port >> 8;
+	req[9] = echo_port & 0xFF;
+	if (!send_all(c, req, sizeof(req)))
+	    return;
+	c->replylen = 0;
+	c->state = ST_REQUEST;
+	break;
+      }
+
+      case ST_REQUEST: {
+	int want;
+
+	if (!read_reply(c, 5))
+	    return;
+	if (c->reply[1] != 0) {
+	    char why[40];
+	    sprintf(why, "proxy refused CONNECT (reply %d)", c->reply[1]);
+	    client_failed(c, why, 0);
+	    return;
+	}
+	/* The rest of the reply depends on the bound address type. */
+	want = (c->reply[3] == 3 ? 7 + c->reply[4] :
+		c->reply[3] == 4 ? 22 : 10);
+	if (!read_reply(c, want))
+	    return;
+	setup_times[nsetup++] = now() - c->started;
+	c->state = ST_DATA;
+	last_progress = now();
+	if (payload == 0) {
+	    succeeded++;
+	    active--;
+	    c->dead = TRUE;
+	}
+	break;
+      }
+
+      case ST_DATA:
+	if ((revents & POLLOUT) && c->sent < payload) {
+	    int len = (int)(payload - c->sent < CHUNK ? payload - c->sent
+			    : CHUNK);
+	    for (n = 0; n < len; n++)
+		buf[n] = pattern(c->id, c->sent + n);
+	    n = send(c->s, (const char *)buf, len, 0);
+	    if (n < 0 && !sock_would_block(sock_error())) {
+		client_failed(c, "write through tunnel failed", sock_error());
+		return;
+	    }
+	    if (n > 0) {
+		c->sent += n;
+		last_progress = now();
+	    }
+	}
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+	    n = recv(c->s, (char *)buf, CHUNK, 0);
+	    if (n == 0) {
+		client_failed(c, "tunnel closed before the echo was back", 0);
+		return;
+	    }
+	    if (n < 0) {
+		if (!sock_would_block(sock_error()))
+		    client_failed(c, "read through tunnel failed",
+				  sock_error());
+		return;
+	    }
+	    if (c->received + n > c->sent) {
+		client_failed(c, "more came back than was sent", 0);
+		return;
+	    }
+	    for (err = 0; err < n; err++)
+		if (buf[err] != pattern(c->id, c->received + err)) {
+		    client_failed(c, "echoed data differs", 0);
+		    return;
+		}
+	    c->received += n;
+	    last_progress = now();
+	    if (c->received == payload) {
+		succeeded++;
+		active--;
+		c->dead = TRUE;
+	    }
+	}
+	break;
+    }
+}
+
+static void echo_event(struct conn *c)
+{
+    int n;
+
+    if (c->pendlen == 0) {
+	n = recv(c->s, (char *)c->pending, CHUNK, 0);
+	if (n == 0 || (n < 0 && !sock_would_block(sock_error()))) {
+	    c->dead = TRUE;
+	    return;
+	}
+	if (n < 0)
+	    return;
+	c->pendpos = 0;
+	c->pendlen = n;
+    }
+    n = send(c->s, (const char *)c->pending + c->pendpos, c->pendlen, 0);
+    if (n < 0 && !sock_would_block(sock_error())) {
+	c->dead = TRUE;
+	return;
+    }
+    if (n > 0) {
+	c->pendpos += n;
+	c->pendlen -= n;
+    }
+}
+
+static void accept_echo(sock_t listener)
+{
+    for (;;) {
+	sock_t s = accept(listener, NULL, NULL);
+	struct conn *c;
+	int on = 1;
+
+	if (s == INVALID_SOCKET)
+	    return;
+	set_nonblocking(s);
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on,
+		   sizeof(on));
+	c = new_conn(s, ST_ECHO);
+	c->pending = (unsigned char *)malloc(CHUNK);
+	if (!c->pending) {
+	    fprintf(stderr, "out of memory\n");
+	    exit(1);
+	}
+    }
+}
+
+static sock_t start_echo_server(int any)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    sock_t s = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(any ? INADDR_ANY : INADDR_LOOPBACK);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+    if (s == INVALID_SOCKET ||
+	bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	listen(s, SOMAXCONN) < 0 ||
+	getsockname(s, (struct sockaddr *)&sin, &len) < 0) {
+	fprintf(stderr, "echo server: error %d\n", sock_error());
+	exit(1);
+    }
+    set_nonblocking(s);
+    echo_port = ntohs(sin.sin_port);
+    return s;
+}
+
+static int cmp_double(const void *av, const void *bv)
+{
+    double a = *(const double *)av, b = *(const double *)bv;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static double percentile(double p)
+{
+    int i = (int)(p * (nsetup - 1) + 0.5);
+    return setup_times[i] * 1000;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: QuTTYSocksBench [-p [host:]port] [-a address] "
+	    "[-c concurrent]\n"
+	    "                       [-n connections] [-b bytes] "
+	    "[-w seconds]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *proxy = "127.0.0.1:1080", *echo_host = NULL;
+    sock_t listener;
+    double t0, elapsed;
+    char host[256];
+    const char *colon;
+    int i, j, n;
+
+    for (i = 1; i < argc; i++) {
+	if (i + 1 >= argc)
+	    usage();
+	if (!strcmp(argv[i], "-p"))
+	    proxy = argv[++i];
+	else if (!strcmp(argv[i], "-a"))
+	    echo_host = argv[++i];
+	else if (!strcmp(argv[i], "-c"))
+	    concurrency = atoi(argv[++i]);
+	else if (!strcmp(argv[i], "-n"))
+	    total = atoi(argv[++i]);
+	else if (!strcmp(argv[i], "-b"))
+	    payload = atol(argv[++i]);
+	else if (!strcmp(argv[i], "-w"))
+	    stall_limit = atof(argv[++i]);
+	else
+	    usage();
+    }
+    if (total < 0)
+	total = concurrency;
+    if (concurrency <= 0 || total <= 0 || payload < 0 || stall_limit <= 0)
+	usage();
+
+#ifdef _WIN32
+    {
+	WSADATA wsadata;
+	if (WSAStartup(MAKEWORD(2, 2), &wsadata)) {
+	    fprintf(stderr, "WSAStartup failed\n");
+	    return 1;
+	}
+    }
+#else
+    {
+	/* Two sockets per connection soon runs past the usual 1024. */
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+	    rl.rlim_cur = rl.rlim_max;
+	    setrlimit(RLIMIT_NOFILE, &rl);
+	}
+    }
+#endif
+
+    memset(&proxy_addr, 0, sizeof(proxy_addr));
+    proxy_addr.sin_family = AF_INET;
+    colon = strrchr(proxy, ':');
+    if (colon) {
+	n = (int)(colon - proxy);
+	if (n >= (int)sizeof(host))
+	    usage();
+	memcpy(host, proxy, n);
+	host[n] = '\0';
+	proxy_addr.sin_port = htons((unsigned short)atoi(colon + 1));
+    } else {
+	strcpy(host, "127.0.0.1");
+	proxy_addr.sin_port = htons((unsigned short)atoi(proxy));
+    }
+    proxy_addr.sin_addr.s_addr = inet_addr(host);
+    echo_addr.s_addr = inet_addr(echo_host ? echo_host : "127.0.0.1");
+    if (proxy_addr.sin_addr.s_addr == INADDR_NONE ||
+	echo_addr.s_addr == INADDR_NONE) {
+	fprintf(stderr, "addresses must be numeric IPv4\n");
+	return 1;
+    }
+
+    listener = start_echo_server(echo_host != NULL);
+    fds = (struct pollfd *)malloc(sizeof(*fds));
+    setup_times = (double *)malloc(total * sizeof(double));
+    if (!fds || !setup_times) {
+	fprintf(stderr, "out of memory\n");
+	return 1;
+    }
+
+    printf("echo server on %s:%d, proxy %s, %d connections of %ld bytes, "
+	   "%d at a time\n", inet_ntoa(echo_addr), echo_port, proxy,
+	   total, payload, concurrency);
+    fflush(stdout);
+
+    t0 = last_progress = now();
+    while (succeeded + failed < total) {
+	/* Keep `concurrency' clients going. */
+	while (active < concurrency && started < total)
+	    start_client();
+
+	fds[0].fd = listener;
+	fds[0].events = POLLIN;
+	for (i = 0; i < nconns; i++) {
+	    struct conn *c = conns[i];
+	    fds[i + 1].fd = c->s;
+	    switch (c->state) {
+	      case ST_CONNECT:
+		fds[i + 1].events = POLLOUT;
+		break;
+	      case ST_DATA:
+		fds[i + 1].events = POLLIN |
+		    (c->sent < payload ? POLLOUT : 0);
+		break;
+	      case ST_ECHO:
+		fds[i + 1].events = c->pendlen ? POLLOUT : POLLIN;
+		break;
+	      default:
+		fds[i + 1].events = POLLIN;
+		break;
+	    }
+	    fds[i + 1].revents = 0;
+	}
+
+	n = poll(fds, nconns + 1, 1000);
+	if (n < 0) {
+	    fprintf(stderr, "poll: error %d\n", sock_error());
+	    return 1;
+	}
+
+	if (now() - last_progress > stall_limit) {
+	    fprintf(stderr, "no progress for %g seconds; giving up on %d "
+		    "connections\n", stall_limit, active);
+	    failed += active;
+	    break;
+	}
+	if (n == 0)
+	    continue;
+
+	for (i = 0; i < nconns; i++) {
+	    struct conn *c = conns[i];
+	    short revents = fds[i + 1].revents;
+	    if (!revents || c->dead)
+		continue;
+	    if (c->state == ST_ECHO)
+		echo_event(c);
+	    else
+		client_event(c, revents);
+	}
+	if (fds[0].revents & POLLIN)
+	    accept_echo(listener);
+
+	/* Drop finished connections, keeping the rest in order. */
+	for (i = j = 0; i < nconns; i++) {
+	    struct conn *c = conns[i];
+	    if (c->dead) {
+		sock_close(c->s);
+		free(c->pending);
+		free(c);
+	    } else
+		conns[j++] = c;
+	}
+	nconns = j;
+    }
+    elapsed = now() - t0;
+
+    printf("%d succeeded, %d failed in %.2f s\n", succeeded, failed,
+	   elapsed);
+    printf("%.2f MB/s each way, %.1f connections/s\n",
+	   (double)payload * succeeded / elapsed / 1e6,
+	   succeeded / elapsed);
+    if (nsetup > 0) {
+	qsort(setup_times, nsetup, sizeof(double), cmp_double);
+	printf("SOCKS set-up ms: min %.1f median %.1f 90%% %.1f "
+	       "99%% %.1f max %.1f\n", percentile(0), percentile(0.5),
+	       percentile(0.9), percentile(0.99), percentile(1));
+    }
+
+    for (i = 0; i < nconns; i++)
+	sock_close(conns[i]->s);
+    sock_close(listener);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return failed != 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * termstubs: do-nothing front end, so that terminal.c can be linked
+ * into QuTTYBench and fed data with no window behind it.
+ *
+ * Nothing here draws, beeps, logs or talks to the back end; the
+ * benchmark only wants the cost of parsing output into the screen
+ * and scrollback.
+ */
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "putty.h"
+#include "tmux/tmux.h"
+
+#ifndef _WIN32
+unsigned long GetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#endif
+
+/* timing.c keeps the terminal's timers; nobody needs waking. */
+void timer_change_notify(long next)
+{
+}
+
+Context get_ctx(void *frontend)
+{
+    return (Context)frontend;
+}
+
+void free_ctx(Context ctx)
+{
+}
+
+void do_text(Context ctx, int x, int y, wchar_t *text, int len,
+	     unsigned long attr, int lattr)
+{
+}
+
+void do_cursor(Context ctx, int x, int y, wchar_t *text, int len,
+	       unsigned long attr, int lattr)
+{
+}
+
+int char_width(Context ctx, int uc)
+{
+    return 1;
+}
+
+void do_beep(void *frontend, int mode)
+{
+}
+
+void sys_cursor(void *frontend, int x, int y)
+{
+}
+
+void set_title(void *frontend, const char *title)
+{
+}
+
+void set_icon(void *frontend, char *title)
+{
+}
+
+void set_sbar(void *frontend, int total, int start, int page)
+{
+}
+
+void set_raw_mouse_mode(void *frontend, int activate)
+{
+}
+
+void set_iconic(void *frontend, int iconic)
+{
+}
+
+void set_zoomed(void *frontend, int zoomed)
+{
+}
+
+void set_zorder(void *frontend, int top)
+{
+}
+
+void move_window(void *frontend, int x, int y)
+{
+}
+
+void refresh_window(void *frontend)
+{
+}
+
+void request_resize(void *frontend, int w, int h)
+{
+}
+
+void request_paste(void *frontend)
+{
+}
+
+int is_iconic(void *frontend)
+{
+    return FALSE;
+}
+
+void get_window_pos(void *frontend, int *x, int *y)
+{
+    *x = *y = 0;
+}
+
+void get_window_pixels(void *frontend, int *x, int *y)
+{
+    *x = *y = 0;
+}
+
+char *get_window_title(void *frontend, int icon)
+{
+    return "";
+}
+
+void palette_set(void *frontend, int n, int r, int g, int b)
+{
+}
+
+void palette_reset(void *frontend)
+{
+}
+
+void write_clip(void *frontend, wchar_t *data, int *attr, int len,
+		int must_deselect)
+{
+}
+
+void get_clip(void *frontend, wchar_t **p, int *len)
+{
+    *p = NULL;
+    *len = 0;
+}
+
+void ldisc_send(void *handle, char *buf, int len, int interactive)
+{
+}
+
+void lpage_send(void *ldisc, int codepage, char *buf, int len,
+		int interactive)
+{
+}
+
+void luni_send(void *ldisc, wchar_t *widebuf, int len, int interactive)
+{
+}
+
+void logtraffic(void *logctx, unsigned char c, int logmode)
+{
+}
+
+void logtraffic_buf(void *logctx, const void *data, int len, int logmode)
+{
+}
+
+void logflush(void *logctx)
+{
+}
+
+int is_dbcs_leadbyte(int codepage, char byte)
+{
+    return FALSE;
+}
+
+int mb_to_wc(int codepage, int flags, char *mbstr, int mblen,
+	     wchar_t *wcstr, int wclen, struct unicode_data *ucsdata)
+{
+    return 0;
+}
+
+printer_job *printer_start_job(char *printer)
+{
+    return NULL;
+}
+
+void printer_job_data(printer_job *pj, void *data, int len)
+{
+}
+
+void printer_finish_job(printer_job *pj)
+{
+}
+
+int tmux_init_tmux_mode(void *frontend, char *tmux_version)
+{
+    return 1;			       /* refuse, as if it failed */
+}
+
+size_t tmux_from_backend(void *frontend, int is_stderr, const char *data,
+			 int len)
+{
+    return 0;
+}
@@ -25,6 +25,8 @@ const struct keyvalwhere gsslibkeywords[] = {
 
 /* The cipher order given here is the default order. */
 static const struct keyvalwhere ciphernames[] = {
+    { "aesgcm",     CIPHER_AESGCM,          -1, +1 },
+    { "chacha20",   CIPHER_CHACHA20,        CIPHER_AESGCM, +1 },
     { "aes",        CIPHER_AES,             -1, -1 },
     { "blowfish",   CIPHER_BLOWFISH,        -1, -1 },
     { "3des",       CIPHER_3DES,            -1, -1 },
@@ -34,6 +36,7 @@ static const struct keyvalwhere ciphernames[] = {
 };
 
 static const struct keyvalwhere kexnames[] = {
+    { "ecdh",               KEX_ECDH,       -1, +1 },
     { "dh-gex-sha1",        KEX_DHGEX,      -1, -1 },
     { "dh-group14-sha1",    KEX_DHGROUP14,  -1, -1 },
     { "dh-group1-sha1",     KEX_DHGROUP1,   -1, -1 },
@@ -414,6 +417,7 @@ void save_open_settings(void *sesskey, Config *cfg)
     write_setting_s(sesskey, "LocalUserName", cfg->localusername);
     write_setting_i(sesskey, "NoPTY", cfg->nopty);
     write_setting_i(sesskey, "Compression", cfg->compression);
+    write_setting_i(sesskey, "CompressionLevel", cfg->compression_level);
     write_setting_i(sesskey, "TryAgent", cfg->tryagent);
     write_setting_i(sesskey, "AgentFwd", cfg->agentfwd);
     write_setting_i(sesskey, "GssapiFwd", cfg->gssapifwd);
@@ -423,6 +427,11 @@ void save_open_settings(void *sesskey, Config *cfg)
     wprefs(sesskey, "KEX", kexnames, KEX_MAX, cfg->ssh_kexlist);
     write_setting_i(sesskey, "RekeyTime", cfg->ssh_rekey_time);
     write_setting_s(sesskey, "RekeyBytes", cfg->ssh_rekey_data);
+    write_setting_i(sesskey, "SshWindowSize", cfg->ssh_winsize);
+    write_setting_i(sesskey, "SshMaxPacket", cfg->ssh_maxpkt);
+    write_setting_i(sesskey, "SshNoWinTuning", cfg->ssh_no_win_tuning);
+    write_setting_i(sesskey, "SshCryptoThread", cfg->ssh_crypto_thread);
+    write_setting_i(sesskey, "ConnectionSharing", cfg->ssh_share);
     write_setting_i(sesskey, "SshNoAuth", cfg->ssh_no_userauth);
     write_setting_i(sesskey, "SshBanner", cfg->ssh_show_banner);
     write_setting_i(sesskey, "AuthTIS", cfg->try_tis_auth);
@@ -501,6 +510,8 @@ void save_open_settings(void *sesskey, Config *cfg)
     write_setting_i(sesskey, "TermHeight", cfg->height);
     write_setting_fontspec(sesskey, "Font", cfg->font);
     write_setting_i(sesskey, "FontQuality", cfg->font_quality);
+    write_setting_i(sesskey, "RefreshRate", cfg->refresh_rate);
+    write_setting_i(sesskey, "AsyncTermOut", cfg->async_term_out);
     write_setting_i(sesskey, "FontVTMode", cfg->vtmode);
     write_setting_i(sesskey, "UseSystemColours", cfg->system_colour);
     write_setting_i(sesskey, "TryPalette", cfg->try_palette);
@@ -698,6 +709,7 @@ void load_open_settings(void *sesskey, Config *cfg)
 	 sizeof(cfg->localusername));
     gppi(sesskey, "NoPTY", 0, &cfg->nopty);
     gppi(sesskey, "Compression", 0, &cfg->compression);
+    gppi(sesskey, "CompressionLevel", 6, &cfg->compression_level);
     gppi(sesskey, "TryAgent", 1, &cfg->tryagent);
     gppi(sesskey, "AgentFwd", 0, &cfg->agentfwd);
     gppi(sesskey, "ChangeUsername", 0, &cfg->change_username);
@@ -721,6 +733,11 @@ void load_open_settings(void *sesskey, Config *cfg)
     gppi(sesskey, "RekeyTime", 60, &cfg->ssh_rekey_time);
     gpps(sesskey, "RekeyBytes", "1G", cfg->ssh_rekey_data,
 	 sizeof(cfg->ssh_rekey_data));
+    gppi(sesskey, "SshWindowSize", 16384, &cfg->ssh_winsize);
+    gppi(sesskey, "SshMaxPacket", 16384, &cfg->ssh_maxpkt);
+    gppi(sesskey, "SshNoWinTuning", 0, &cfg->ssh_no_win_tuning);
+    gppi(sesskey, "SshCryptoThread", 0, &cfg->ssh_crypto_thread);
+    gppi(sesskey, "ConnectionSharing", 0, &cfg->ssh_share);
     gppi(sesskey, "SshProt", 2, &cfg->sshprot);
     gpps(sesskey, "LogHost", "", cfg->loghost, sizeof(cfg->loghost));
     gppi(sesskey, "SSH2DES", 0, &cfg->ssh2_des_cbc);
@@ -822,6 +839,8 @@ void load_open_settings(void *sesskey, Config *cfg)
     gppi(sesskey, "TermHeight", 24, &cfg->height);
     gppfont(sesskey, "Font", &cfg->font);
     gppi(sesskey, "FontQuality", FQ_DEFAULT, &cfg->font_quality);
+    gppi(sesskey, "RefreshRate", 60, &cfg->refresh_rate);
+    gppi(sesskey, "AsyncTermOut", 0, &cfg->async_term_out);
     gppi(sesskey, "FontVTMode", VT_UNICODE, (int *) &cfg->vtmode);
     gppi(sesskey, "UseSystemColours", 0, &cfg->system_colour);
     gppi(sesskey, "TryPalette", 0, &cfg->try_palette);
@@ -19,17 +19,78 @@ struct LogContext {
     Filename currlogfilename;
     void *frontend;
     Config cfg;
+    /*
+     * Output destined for an open log file is collected here and
+     * handed to stdio in large blocks, either when the buffer fills
+     * or LOG_FLUSH_TICKS after the first byte went into it. Only
+     * allocated while the file is open.
+     */
+    char *wbuf;
+    int wlen;
+    int flush_pending;
+    long next_flush;
 };
 
+#define LOG_WBUF_SIZE 65536
+#define LOG_FLUSH_TICKS (TICKSPERSEC / 4)
+
 static void xlatlognam(Filename *d, Filename s, char *hostname, struct tm *tm);
 
+/*
+ * Write straight through to the log file, disabling logging on
+ * failure.
+ */
+static void logfwrite(struct LogContext *ctx, const void *data, int len)
+{
+    assert(ctx->lgfp);
+    if (fwrite(data, 1, len, ctx->lgfp) < (size_t)len) {
+	ctx->wlen = 0;
+	logfclose(ctx);
+	ctx->state = L_ERROR;
+	/* Log state is L_ERROR so this won't cause a loop */
+	logevent(ctx->frontend,
+		 "Disabled writing session log due to error while writing");
+    }
+}
+
+/*
+ * Hand everything in the write buffer to the log file.
+ */
+static void logdrain(struct LogContext *ctx)
+{
+    int len = ctx->wlen;
+
+    ctx->wlen = 0;
+    if (len > 0 && ctx->state == L_OPEN)
+	logfwrite(ctx, ctx->wbuf, len);
+}
+
+static void logflush_timer(void *handle, long now)
+{
+    struct LogContext *ctx = (struct LogContext *)handle;
+
+    if (!ctx->flush_pending || now != ctx->next_flush)
+	return;
+    ctx->flush_pending = FALSE;
+    logdrain(ctx);
+    /*
+     * SSH packet and event logs are read after a connection has gone
+     * wrong, so they always reach the disk at this point, as they
+     * did when each entry was flushed as it was written.
+     */
+    if (ctx->state == L_OPEN &&
+	(ctx->cfg.logflush || ctx->cfg.logtype == LGTYP_PACKETS ||
+	 ctx->cfg.logtype == LGTYP_SSHRAW))
+	fflush(ctx->lgfp);
+}
+
 /*
  * Internal wrapper function which must be called for _all_ output
  * to the log file. It takes care of opening the log file if it
  * isn't open, buffering data if it's in the process of being
  * opened asynchronously, etc.
  */
-static void logwrite(struct LogContext *ctx, void *data, int len)
+static void logwrite(struct LogContext *ctx, const void *data, int len)
 {
     /*
      * In state L_CLOSED, we call logfopen, which will set the state
@@ -42,13 +103,20 @@ static void logwrite(struct LogContext *ctx, void *data, int len)
     if (ctx->state == L_OPENING) {
 	bufchain_add(&ctx->queue, data, len);
     } else if (ctx->state == L_OPEN) {
-	assert(ctx->lgfp);
-	if (fwrite(data, 1, len, ctx->lgfp) < (size_t)len) {
-	    logfclose(ctx);
-	    ctx->state = L_ERROR;
-	    /* Log state is L_ERROR so this won't cause a loop */
-	    logevent(ctx->frontend,
-		     "Disabled writing session log due to error while writing");
+	if (ctx->wlen + len > LOG_WBUF_SIZE)
+	    logdrain(ctx);
+	if (ctx->state != L_OPEN)
+	    return;		       /* draining failed */
+	if (len >= LOG_WBUF_SIZE) {
+	    logfwrite(ctx, data, len);
+	    return;
+	}
+	memcpy(ctx->wbuf + ctx->wlen, data, len);
+	ctx->wlen += len;
+	if (!ctx->flush_pending) {
+	    ctx->next_flush = schedule_timer(LOG_FLUSH_TICKS,
+					     logflush_timer, ctx);
+	    ctx->flush_pending = TRUE;
 	}
     }				       /* else L_ERROR, so ignore the write */
 }
@@ -75,9 +143,11 @@ static void logprintf(struct LogContext *ctx, const char *fmt, ...)
  */
 void logflush(void *handle) {
     struct LogContext *ctx = (struct LogContext *)handle;
-    if (ctx->cfg.logtype > 0)
+    if (ctx->cfg.logtype > 0) {
+	logdrain(ctx);
 	if (ctx->state == L_OPEN)
 	    fflush(ctx->lgfp);
+    }
 }
 
 static void logfopen_callback(void *handle, int mode)
@@ -92,9 +162,11 @@ static void logfopen_callback(void *handle, int mode)
     } else {
 	fmode = (mode == 1 ? "ab" : "wb");
 	ctx->lgfp = f_open(ctx->currlogfilename, fmode, FALSE);
-	if (ctx->lgfp)
+	if (ctx->lgfp) {
 	    ctx->state = L_OPEN;
-	else
+	    if (!ctx->wbuf)
+		ctx->wbuf = snewn(LOG_WBUF_SIZE, char);
+	} else
 	    ctx->state = L_ERROR;
     }
 
@@ -176,10 +248,13 @@ void logfopen(void *handle)
 void logfclose(void *handle)
 {
     struct LogContext *ctx = (struct LogContext *)handle;
+    logdrain(ctx);
     if (ctx->lgfp) {
 	fclose(ctx->lgfp);
 	ctx->lgfp = NULL;
     }
+    sfree(ctx->wbuf);
+    ctx->wbuf = NULL;
     ctx->state = L_CLOSED;
 }
 
@@ -195,6 +270,18 @@ void logtraffic(void *handle, unsigned char c, int logmode)
     }
 }
 
+/*
+ * Log a whole buffer of session traffic at once.
+ */
+void logtraffic_buf(void *handle, const void *data, int len, int logmode)
+{
+    struct LogContext *ctx = (struct LogContext *)handle;
+    if (ctx->cfg.logtype > 0 && len > 0) {
+	if (ctx->cfg.logtype == logmode)
+	    logwrite(ctx, data, len);
+    }
+}
+
 /*
  * Log an Event Log entry. Used in SSH packet logging mode; this is
  * also as convenient a place as any to put the output of Event Log
@@ -218,7 +305,6 @@ void log_eventlog(void *handle, const char *event)
 	ctx->cfg.logtype != LGTYP_SSHRAW)
 	return;
     logprintf(ctx, "Event Log: %s\r\n", event);
-    logflush(ctx);
 }
 
 /*
@@ -323,7 +409,6 @@ void log_packet(void *handle, int direction, int type,
     if (omitted)
 	logprintf(ctx, "  (%d byte%s omitted)\r\n",
 		  omitted, (omitted==1?"":"s"));
-    logflush(ctx);
 }
 
 void *log_init(void *frontend, Config *cfg)
@@ -334,6 +419,9 @@ void *log_init(void *frontend, Config *cfg)
     ctx->frontend = frontend;
     ctx->cfg = *cfg;		       /* STRUCTURE COPY */
     bufchain_init(&ctx->queue);
+    ctx->wbuf = NULL;
+    ctx->wlen = 0;
+    ctx->flush_pending = FALSE;
     return ctx;
 }
 
@@ -342,6 +430,7 @@ void log_free(void *handle)
     struct LogContext *ctx = (struct LogContext *)handle;
 
     logfclose(ctx);
+    expire_timer_context(ctx);
     bufchain_clear(&ctx->queue);
     sfree(ctx);
 }
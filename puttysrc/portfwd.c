@@ -48,6 +48,14 @@ struct PFwdPrivate {
      */
     void *buffer;
     int buflen;
+    /*
+     * The reply to a SOCKS request waits for the server to open or
+     * refuse the channel, so that a client hears about a refusal
+     * instead of having its connection accepted and then dropped.
+     * pfd_confirm() sends it; pfd_close() sends it as a failure.
+     */
+    char reply[10];
+    int replylen;
 };
 
 static void pfd_log(Plug plug, int type, SockAddr addr, int port,
@@ -61,6 +69,8 @@ static int pfd_closing(Plug plug, const char *error_msg, int error_code,
 {
     struct PFwdPrivate *pr = (struct PFwdPrivate *) plug;
 
+    pr->replylen = 0;		       /* nobody left to reply to */
+
     /*
      * We have no way to communicate down the forwarded connection,
      * so if an error occurred on the socket, we just ignore it
@@ -140,7 +150,8 @@ static int pfd_receive(Plug plug, int urgent, char *data, int len)
 		    }
 		    pr->hostname[0] = 0;   /* reply version code */
 		    pr->hostname[1] = 90;   /* request granted */
-		    sk_write(pr->s, pr->hostname, 8);
+		    memcpy(pr->reply, pr->hostname, 8);
+		    pr->replylen = 8;
 		    len= pr->port - 8;
 		    pr->port = GET_16BIT_MSB_FIRST(pr->hostname+2);
 		    memmove(pr->hostname, pr->hostname + 8, len);
@@ -153,7 +164,8 @@ static int pfd_receive(Plug plug, int urgent, char *data, int len)
 		     */
 		    pr->hostname[0] = 0;   /* reply version code */
 		    pr->hostname[1] = 90;   /* request granted */
-		    sk_write(pr->s, pr->hostname, 8);
+		    memcpy(pr->reply, pr->hostname, 8);
+		    pr->replylen = 8;
 		    pr->port = GET_16BIT_MSB_FIRST(pr->hostname+2);
 		    sprintf(pr->hostname, "%d.%d.%d.%d",
 			    (unsigned char)pr->hostname[4],
@@ -200,7 +212,7 @@ static int pfd_receive(Plug plug, int urgent, char *data, int len)
 		     * We're receiving a SOCKS request.
 		     */
 		    unsigned char reply[10]; /* SOCKS5 atyp=1 reply */
-		    int atype, alen = 0;
+		    int atype, alen = 0, i;
 
 		    /*
 		     * Pre-fill reply packet.
@@ -236,7 +248,8 @@ static int pfd_receive(Plug plug, int urgent, char *data, int len)
 		    pr->port = GET_16BIT_MSB_FIRST(pr->hostname+4+alen);
 		    if (atype == 1) {
 			/* REP=0 (success) already */
-			sk_write(pr->s, (char *) reply, lenof(reply));
+			memcpy(pr->reply, reply, lenof(reply));
+			pr->replylen = lenof(reply);
 			sprintf(pr->hostname, "%d.%d.%d.%d",
 				(unsigned char)pr->hostname[4],
 				(unsigned char)pr->hostname[5],
@@ -245,13 +258,24 @@ static int pfd_receive(Plug plug, int urgent, char *data, int len)
 			goto connect;
 		    } else if (atype == 3) {
 			/* REP=0 (success) already */
-			sk_write(pr->s, (char *) reply, lenof(reply));
+			memcpy(pr->reply, reply, lenof(reply));
+			pr->replylen = lenof(reply);
 			memmove(pr->hostname, pr->hostname + 5, alen-1);
 			pr->hostname[alen-1] = '\0';
 			goto connect;
+		    } else if (atype == 4) {
+			/* the server gets it as an IPv6 literal */
+			unsigned g[8];
+			for (i = 0; i < 8; i++)
+			    g[i] = GET_16BIT_MSB_FIRST(pr->hostname+4+2*i);
+			memcpy(pr->reply, reply, lenof(reply));
+			pr->replylen = lenof(reply);
+			sprintf(pr->hostname, "%x:%x:%x:%x:%x:%x:%x:%x",
+				g[0], g[1], g[2], g[3], g[4], g[5], g[6], g[7]);
+			goto connect;
 		    } else {
 			/*
-			 * Unknown address type. (FIXME: support IPv6!)
+			 * Unknown address type.
 			 */
 			reply[1] = 8;	/* atype not supported */
 			sk_write(pr->s, (char *) reply, lenof(reply));
@@ -354,6 +378,7 @@ const char *pfd_newconnect(Socket *s, char *hostname, int port,
      */
     pr = snew(struct PFwdPrivate);
     pr->buffer = NULL;
+    pr->replylen = 0;
     pr->fn = &fn_table;
     pr->throttled = pr->throttle_override = 0;
     pr->ready = 1;
@@ -392,6 +417,7 @@ static int pfd_accepting(Plug p, OSSocket sock)
     org = (struct PFwdPrivate *)p;
     pr = snew(struct PFwdPrivate);
     pr->buffer = NULL;
+    pr->replylen = 0;
     pr->fn = &fn_table;
 
     pr->c = NULL;
@@ -419,7 +445,7 @@ static int pfd_accepting(Plug p, OSSocket sock)
 	pr->c = new_sock_channel(org->backhandle, s);
 
 	if (pr->c == NULL) {
-	    sfree(pr);
+	    pfd_close(s);	       /* frees pr too */
 	    return 1;
 	} else {
 	    /* asks to forward to the specified host/port for this */
@@ -455,6 +481,7 @@ const char *pfd_addforward(char *desthost, int destport, char *srcaddr,
      */
     pr = snew(struct PFwdPrivate);
     pr->buffer = NULL;
+    pr->replylen = 0;
     pr->fn = &fn_table;
     pr->c = NULL;
     if (desthost) {
@@ -490,12 +517,49 @@ void pfd_close(Socket s)
 
     pr = (struct PFwdPrivate *) sk_get_private_ptr(s);
 
+    if (pr->replylen) {
+	/* the channel never opened; refuse the SOCKS request */
+	if (pr->replylen == 8)
+	    pr->reply[1] = 91;	       /* SOCKS 4: request rejected */
+	else if (!pr->reply[1])
+	    pr->reply[1] = 1;	       /* SOCKS 5: general failure */
+	sk_write(s, pr->reply, pr->replylen);
+    }
+
     sfree(pr->buffer);
     sfree(pr);
 
     sk_close(s);
 }
 
+/*
+ * The server wouldn't open the channel for a forwarded connection:
+ * give a SOCKS client the nearest reason there is, then close.
+ */
+void pfd_refused(Socket s, int reason_code)
+{
+    struct PFwdPrivate *pr;
+
+    if (!s)
+	return;
+    pr = (struct PFwdPrivate *) sk_get_private_ptr(s);
+
+    if (pr->replylen == 10) {
+	switch (reason_code) {
+	  case 1:		       /* SSH2_OPEN_ADMINISTRATIVELY_PROHIBITED */
+	    pr->reply[1] = 2;	       /* not allowed by ruleset */
+	    break;
+	  case 2:		       /* SSH2_OPEN_CONNECT_FAILED */
+	    pr->reply[1] = 5;	       /* connection refused */
+	    break;
+	  default:
+	    pr->reply[1] = 1;	       /* general failure */
+	    break;
+	}
+    }
+    pfd_close(s);
+}
+
 /*
  * Terminate a listener.
  */
@@ -546,6 +610,10 @@ void pfd_confirm(Socket s)
 
     pr = (struct PFwdPrivate *) sk_get_private_ptr(s);
     pr->ready = 1;
+    if (pr->replylen) {
+	sk_write(s, pr->reply, pr->replylen);
+	pr->replylen = 0;
+    }
     sk_set_frozen(s, 0);
     sk_write(s, NULL, 0);
     if (pr->buffer) {
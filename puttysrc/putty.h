@@ -257,6 +257,7 @@ enum {
     KEX_DHGROUP14,
     KEX_DHGEX,
     KEX_RSA,
+    KEX_ECDH,
     KEX_MAX
 };
 
@@ -270,6 +271,8 @@ enum {
     CIPHER_AES,			       /* (SSH-2 only) */
     CIPHER_DES,
     CIPHER_ARCFOUR,
+    CIPHER_AESGCM,		       /* (SSH-2 only) */
+    CIPHER_CHACHA20,		       /* (SSH-2 only) */
     CIPHER_MAX			       /* no. ciphers (inc warn) */
 };
 
@@ -505,9 +508,15 @@ struct config_tag_not_used {
                         * but never for loading/saving */
     int nopty;
     int compression;
+    int compression_level;	       /* zlib level, 1 (fast) to 9 (small) */
     int ssh_kexlist[KEX_MAX];
     int ssh_rekey_time;		       /* in minutes */
     char ssh_rekey_data[16];
+    int ssh_winsize;		       /* initial SSH-2 channel window */
+    int ssh_maxpkt;		       /* largest SSH-2 data message we accept */
+    int ssh_no_win_tuning;	       /* don't grow windows by measured RTT */
+    int ssh_crypto_thread;	       /* SSH-2 packet crypto on a worker thread */
+    int ssh_share;		       /* share connections between tabs */
     int tryagent;
     int agentfwd;
     int change_username;	       /* allow username switching in SSH-2 */
@@ -598,6 +607,8 @@ struct config_tag_not_used {
     int width, height;
     FontSpec font;
     int font_quality;
+    int refresh_rate;		       /* max window repaints per second */
+    int async_term_out;		       /* parse output off the receive path */
     Filename logfilename;
     int logtype;
     int logxfovr;
@@ -919,6 +930,9 @@ int term_data_untrusted(Terminal *, const char *data, int len);
 void term_provide_resize_fn(Terminal *term,
 			    void (*resize_fn)(void *, int, int),
 			    void *resize_ctx);
+void term_provide_unthrottle_fn(Terminal *term,
+				void (*unthrottle_fn)(void *, int),
+				void *unthrottle_ctx);
 void term_provide_logctx(Terminal *term, void *logctx);
 void term_set_focus(Terminal *term, int has_focus);
 char *term_get_ttymode(Terminal *term, const char *mode);
@@ -936,6 +950,7 @@ void log_reconfig(void *logctx, Config *cfg);
 void logfopen(void *logctx);
 void logfclose(void *logctx);
 void logtraffic(void *logctx, unsigned char c, int logmode);
+void logtraffic_buf(void *logctx, const void *data, int len, int logmode);
 void logflush(void *logctx);
 void log_eventlog(void *logctx, const char *string);
 enum { PKT_INCOMING, PKT_OUTGOING };
@@ -979,6 +994,8 @@ extern Backend telnet_backend;
  * Exports from ssh.c.
  */
 extern Backend ssh_backend;
+extern Backend ssh_share_backend;
+int ssh_share_available(Config *cfg);
 
 /*
  * Exports from ldisc.c.
@@ -1115,6 +1132,12 @@ void pgp_fingerprints(void);
 int verify_ssh_host_key(void *frontend, char *host, int port, char *keytype,
                         char *keystr, char *fingerprint,
                         void (*callback)(void *ctx, int result), void *ctx);
+/*
+ * have_ssh_host_key() returns nonzero if a key of the given type is
+ * already cached for host:port, so the SSH-2 transport can prefer a
+ * host key algorithm the user has already verified.
+ */
+int have_ssh_host_key(const char *host, int port, const char *keytype);
 /*
  * askalg has the same set of return values as verify_ssh_host_key.
  */
@@ -1302,6 +1325,40 @@ void expire_timer_context(void *ctx);
 int run_timers(long now, long *next);
 void timer_change_notify(long next);
 
+/*
+ * Exports from the front end's worker queues (QtWorker.cpp).
+ *
+ * A worker queue runs work() on each submitted job in a background
+ * thread, strictly in submission order and never two at once, so a
+ * job may use state (a cipher context, say) that the previous job
+ * left behind. Each finished job is then handed back to done() on
+ * the GUI thread, again in order; after a batch of those the queue
+ * calls ready() (if not NULL) from the event loop, which is a safe
+ * place to act on the results.
+ *
+ * workq_pending() counts jobs whose done() hasn't run yet. While it
+ * is nonzero, anything work() touches belongs to the worker.
+ *
+ * workq_sync() waits for the worker to go idle and runs done() for
+ * every outstanding job before returning, without calling ready().
+ * Use it before touching the worker's state from the GUI thread.
+ *
+ * workq_notify() asks for a ready() callback even if no job has
+ * finished, for when something other than the worker has made the
+ * results actionable again.
+ *
+ * workq_free() syncs and then frees the queue.
+ */
+typedef struct worker_queue_tag *WorkerQueue;
+WorkerQueue workq_new(void (*work)(void *job),
+		      void (*done)(void *ctx, void *job),
+		      void (*ready)(void *ctx), void *ctx);
+void workq_submit(WorkerQueue q, void *job);
+int workq_pending(WorkerQueue q);
+void workq_sync(WorkerQueue q);
+void workq_notify(WorkerQueue q);
+void workq_free(WorkerQueue q);
+
 /*
  * Define no-op macros for the jump list functions, on platforms that
  * don't support them. (This is a bit of a hack, and it'd be nicer to
@@ -94,6 +94,8 @@
 #define SSH2_MSG_KEXRSA_PUBKEY                    30    /* 0x1e */
 #define SSH2_MSG_KEXRSA_SECRET                    31    /* 0x1f */
 #define SSH2_MSG_KEXRSA_DONE                      32    /* 0x20 */
+#define SSH2_MSG_KEX_ECDH_INIT                    30    /* 0x1e */
+#define SSH2_MSG_KEX_ECDH_REPLY                   31    /* 0x1f */
 #define SSH2_MSG_USERAUTH_REQUEST                 50	/* 0x32 */
 #define SSH2_MSG_USERAUTH_FAILURE                 51	/* 0x33 */
 #define SSH2_MSG_USERAUTH_SUCCESS                 52	/* 0x34 */
@@ -131,7 +133,8 @@ typedef enum {
     SSH2_PKTCTX_NOKEX,
     SSH2_PKTCTX_DHGROUP,
     SSH2_PKTCTX_DHGEX,
-    SSH2_PKTCTX_RSAKEX
+    SSH2_PKTCTX_RSAKEX,
+    SSH2_PKTCTX_ECDHKEX
 } Pkt_KCtx;
 typedef enum {
     SSH2_PKTCTX_NOAUTH,
@@ -374,6 +377,8 @@ static char *ssh2_pkt_type(Pkt_KCtx pkt_kctx, Pkt_ACtx pkt_actx, int type)
     translatek(SSH2_MSG_KEXRSA_PUBKEY, SSH2_PKTCTX_RSAKEX);
     translatek(SSH2_MSG_KEXRSA_SECRET, SSH2_PKTCTX_RSAKEX);
     translatek(SSH2_MSG_KEXRSA_DONE, SSH2_PKTCTX_RSAKEX);
+    translatek(SSH2_MSG_KEX_ECDH_INIT, SSH2_PKTCTX_ECDHKEX);
+    translatek(SSH2_MSG_KEX_ECDH_REPLY, SSH2_PKTCTX_ECDHKEX);
     translate(SSH2_MSG_USERAUTH_REQUEST);
     translate(SSH2_MSG_USERAUTH_FAILURE);
     translate(SSH2_MSG_USERAUTH_SUCCESS);
@@ -450,6 +455,7 @@ enum {
 #define crWaitUntilV(c)	do { crReturnV; } while (!(c))
 
 typedef struct ssh_tag *Ssh;
+typedef struct ssh_share_tag *SshShare;
 struct Packet;
 
 static struct Packet *ssh1_pkt_init(int pkt_type);
@@ -492,7 +498,17 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
  *    of the connection), so we set this high as well.
  * 
  *  - OUR_V2_WINSIZE is the maximum window size we present on SSH-2
- *    channels.
+ *    channels, unless the session configures a different one
+ *    (cfg.ssh_winsize). The window then grows on its own while it
+ *    is what limits throughput; see ssh2_tune_window().
+ *
+ *  - OUR_V2_TUNEDWIN is the largest window that automatic tuning
+ *    will grow a channel to.
+ *
+ *  - OUR_V2_FWDWIN is the same limit for forwarded connections.
+ *    There may be thousands of those at once (a browser behind
+ *    dynamic forwarding), and the window is also the most we buffer
+ *    for a local socket that isn't reading, so it's kept lower.
  *
  *  - OUR_V2_BIGWIN is the window size we advertise for the only
  *    channel in a simple connection.  It must be <= INT_MAX.
@@ -501,26 +517,39 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
  *    to the remote side. This actually has nothing to do with the
  *    size of the _packet_, but is instead a limit on the amount
  *    of data we're willing to receive in a single SSH2 channel
- *    data message.
+ *    data message. cfg.ssh_maxpkt can raise it, up to
+ *    OUR_V2_MAXPKT_LIMIT.
  *
  *  - OUR_V2_PACKETLIMIT is actually the maximum size of SSH
  *    _packet_ we're prepared to cope with.  It must be a multiple
  *    of the cipher block size, and must be at least 35000.
+ *
+ *  - SSH2_CRYPTO_THREAD_MIN is the smallest SSH-2 packet whose
+ *    encryption or decryption we hand to a worker thread when
+ *    cfg.ssh_crypto_thread is set. Smaller ones (keystrokes,
+ *    window adjusts) aren't worth the trip.
  */
 
 #define SSH1_BUFFER_LIMIT 32768
 #define SSH_MAX_BACKLOG 32768
 #define OUR_V2_WINSIZE 16384
+#define OUR_V2_TUNEDWIN 0x1000000
+#define OUR_V2_FWDWIN 0x100000
 #define OUR_V2_BIGWIN 0x7fffffff
 #define OUR_V2_MAXPKT 0x4000UL
+#define OUR_V2_MAXPKT_LIMIT 0x8000UL
 #define OUR_V2_PACKETLIMIT 0x9000UL
+#define SSH2_CRYPTO_THREAD_MIN 4096
 
 /* Maximum length of passwords/passphrases (arbitrary) */
 #define SSH_MAX_PASSWORD_LEN 100
 
-const static struct ssh_signkey *hostkey_algs[] = { &ssh_rsa, &ssh_dss };
+const static struct ssh_signkey *hostkey_algs[] = {
+    &ssh_ecdsa_ed25519, &ssh_ecdsa_nistp256, &ssh_rsa, &ssh_dss
+};
 
 const static struct ssh_mac *macs[] = {
+    &ssh_hmac_sha2_256, &ssh_hmac_sha2_512,
     &ssh_hmac_sha1, &ssh_hmac_sha1_96, &ssh_hmac_md5
 };
 const static struct ssh_mac *buggymacs[] = {
@@ -559,7 +588,8 @@ enum {				       /* channel types */
     CHAN_X11,
     CHAN_AGENT,
     CHAN_SOCKDATA,
-    CHAN_SOCKDATA_DORMANT	       /* one the remote hasn't confirmed */
+    CHAN_SOCKDATA_DORMANT,	       /* one the remote hasn't confirmed */
+    CHAN_SHARED			       /* session of a tab sharing the connection */
 };
 
 /*
@@ -568,6 +598,7 @@ enum {				       /* channel types */
 struct winadj {
     struct winadj *next;
     unsigned size;
+    long sent;			       /* GETTICKCOUNT() when sent */
 };
 
 /*
@@ -624,6 +655,12 @@ struct ssh_channel {
 	     */
 	    struct winadj *winadj_head, *winadj_tail;
 	    enum { THROTTLED, UNTHROTTLING, UNTHROTTLED } throttle_state;
+	    /*
+	     * Data received since tune_start, for estimating the rate
+	     * at which the channel is being consumed.
+	     */
+	    int tune_bytes;
+	    long tune_start;
 	} v2;
     } v;
     union {
@@ -638,6 +675,11 @@ struct ssh_channel {
 	struct ssh_pfd_channel {
 	    Socket s;
 	} pfd;
+	struct ssh_share_channel {
+	    SshShare ss;	       /* NULL once that tab has gone */
+	    int pty_reply;	       /* awaiting reply to pty-req */
+	    int start_reply;	       /* awaiting reply to shell/exec */
+	} sh;
     } u;
 };
 
@@ -737,6 +779,16 @@ static unsigned long ssh_pkt_getuint32(struct Packet *pkt);
 static int ssh2_pkt_getbool(struct Packet *pkt);
 static void ssh_pkt_getstring(struct Packet *pkt, char **p, int *length);
 static void ssh2_timer(void *ctx, long now);
+static void ssh2_schedule_precompute(Ssh ssh);
+static void ssh_share_confirmed(struct ssh_channel *c);
+static void ssh_share_refused(struct ssh_channel *c, const char *reason);
+static void ssh_share_reply(struct ssh_channel *c, int success);
+static void ssh_share_closed(struct ssh_channel *c);
+static void ssh_share_lost(struct ssh_channel *c);
+static int ssh_share_count(Ssh ssh);
+static void ssh_share_exitcode(SshShare ss, int exitcode,
+			       const char *sig, int siglen);
+static Ssh ssh_shareable = NULL;       /* every live Ssh, for sharing */
 static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 			     struct Packet *pktin);
 
@@ -750,13 +802,34 @@ struct rdpkt1_state_tag {
 };
 
 struct rdpkt2_state_tag {
-    long len, pad, payload, packetlen, maclen;
+    long len, packetlen, maclen;
     int i;
     int cipherblk;
     unsigned long incoming_sequence;
     struct Packet *pktin;
 };
 
+/*
+ * One SSH-2 packet's worth of symmetric crypto, detached from the
+ * Ssh so that it can be done on a worker thread (see
+ * ssh2_crypto_threaded). The cipher and MAC pointers are copied at
+ * submission time; the key-change code syncs the queue before it
+ * frees the contexts they point at.
+ */
+struct ssh2_crypto_job {
+    struct Packet *pkt;
+    int len;			       /* length field to end of padding */
+    int total;			       /* len plus MAC */
+    unsigned long seq;
+    const struct ssh2_cipher *cipher;
+    void *cipher_ctx;
+    const struct ssh_mac *mac;
+    void *mac_ctx;
+    int etm;
+    const char *error;		       /* set by an incoming job on failure */
+    struct ssh2_crypto_job *next;
+};
+
 typedef void (*handler_fn_t)(Ssh ssh, struct Packet *pktin);
 typedef void (*chandler_fn_t)(Ssh ssh, struct Packet *pktin, void *ctx);
 
@@ -793,9 +866,12 @@ struct ssh_tag {
     const struct ssh2_cipher *cscipher, *sccipher;
     void *cs_cipher_ctx, *sc_cipher_ctx;
     const struct ssh_mac *csmac, *scmac;
+    int csmac_etm, scmac_etm;
     void *cs_mac_ctx, *sc_mac_ctx;
     const struct ssh_compress *cscomp, *sccomp;
     void *cs_comp_ctx, *sc_comp_ctx;
+    /* delayed methods negotiated but waiting for USERAUTH_SUCCESS */
+    const struct ssh_compress *cscomp_delayed, *sccomp_delayed;
     const struct ssh_kex *kex;
     const struct ssh_signkey *hostkey;
     unsigned char v2_session_id[SSH2_KEX_MAX_HASH_LEN];
@@ -814,6 +890,7 @@ struct ssh_tag {
 
     tree234 *channels;		       /* indexed by local id */
     struct ssh_channel *mainchan;      /* primary session channel */
+    Ssh share_next;		       /* list of connections to share */
     int ncmode;			       /* is primary channel direct-tcpip? */
     int exitcode;
     int close_expected;
@@ -856,6 +933,11 @@ struct ssh_tag {
     int conn_throttle_count;
     int overall_bufsize;
     int throttled_all;
+    /*
+     * Smoothed round-trip time in ticks, measured from the replies
+     * to winadj@putty requests; 0 until the first sample arrives.
+     */
+    long v2_rtt;
     int v1_stdout_throttling;
     unsigned long v2_outgoing_sequence;
 
@@ -910,6 +992,22 @@ struct ssh_tag {
     int frozen;
     bufchain queued_incoming_data;
 
+    /*
+     * Worker queues for SSH-2 packet crypto, created on first use
+     * if cfg.ssh_crypto_thread is set. Packets come back from
+     * sc_workq already decrypted and are held on the pktin list
+     * until they can be passed to the protocol in order.
+     */
+    WorkerQueue cs_workq, sc_workq;
+    struct ssh2_crypto_job *pktin_head, *pktin_tail;
+    int dispatching;
+
+    /*
+     * Set while an ssh2_precompute_timer() is scheduled to let the
+     * ciphers get ahead once the current burst of packets is done.
+     */
+    int precompute_pending;
+
     /*
      * Dispatch table for packet types that we may have to deal
      * with at any time.
@@ -950,6 +1048,27 @@ struct ssh_tag {
 #endif
 };
 
+/*
+ * A session carried over another Ssh's connection (cfg.ssh_share):
+ * the backend handle of ssh_share_backend. Its session channel lives
+ * in the master Ssh's channel tree like any other; everything about
+ * the connection itself belongs to the master.
+ */
+struct ssh_share_tag {
+    Ssh master;			       /* NULL once the connection's gone */
+    struct ssh_channel *c;	       /* our session channel, or NULL */
+    Config cfg;
+    void *frontend;
+    void *ldisc;
+    void *logctx;
+    int term_width, term_height;
+    int started;		       /* shell or command is running */
+    int exitcode;
+    int send_ok;
+    int echoing, editing;
+    long opened;		       /* GETTICKCOUNT() at init */
+};
+
 #define logevent(s) logevent(ssh->frontend, s)
 
 /* logevent, only printf-formatted. */
@@ -994,7 +1113,7 @@ static void end_log_omission(Ssh ssh, struct Packet *pkt)
 }
 
 /* Helper function for common bits of parsing cfg.ttymodes. */
-static void parse_ttymodes(Ssh ssh, char *modes,
+static void parse_ttymodes(void *frontend, char *modes,
 			   void (*do_mode)(void *data, char *mode, char *val),
 			   void *data)
 {
@@ -1005,7 +1124,7 @@ static void parse_ttymodes(Ssh ssh, char *modes,
 	strncpy(m, modes, t-modes);
 	m[t-modes] = '\0';
 	if (*(t+1) == 'A')
-	    val = get_ttymode(ssh->frontend, m);
+	    val = get_ttymode(frontend, m);
 	else
 	    val = dupstr(t+2);
 	if (val)
@@ -1175,17 +1294,42 @@ static void c_write_str(Ssh ssh, const char *buf)
     c_write(ssh, buf, strlen(buf));
 }
 
+/*
+ * Freed packets are kept on a short free list together with their
+ * data buffers, so that the steady state of a busy connection does
+ * not go through the allocator for every packet sent or received.
+ * Buffers that grew beyond what a normal packet needs are released.
+ */
+#define PACKET_POOL_SIZE 16
+#define PACKET_POOL_MAXLEN (OUR_V2_PACKETLIMIT + 256 + 64)
+
+static struct Packet *packet_pool[PACKET_POOL_SIZE];
+static int packet_pool_len;
+
 static void ssh_free_packet(struct Packet *pkt)
 {
+    sfree(pkt->blanks);
+    if (packet_pool_len < PACKET_POOL_SIZE &&
+	pkt->maxlen <= PACKET_POOL_MAXLEN) {
+	packet_pool[packet_pool_len++] = pkt;
+	return;
+    }
     sfree(pkt->data);
     sfree(pkt);
 }
 static struct Packet *ssh_new_packet(void)
 {
-    struct Packet *pkt = snew(struct Packet);
+    struct Packet *pkt;
+
+    if (packet_pool_len > 0) {
+	pkt = packet_pool[--packet_pool_len];
+    } else {
+	pkt = snew(struct Packet);
+	pkt->data = NULL;
+	pkt->maxlen = 0;
+    }
 
-    pkt->body = pkt->data = NULL;
-    pkt->maxlen = 0;
+    pkt->body = NULL;
     pkt->logmode = PKTLOG_EMIT;
     pkt->nblanks = 0;
     pkt->blanks = NULL;
@@ -1229,8 +1373,7 @@ static struct Packet *ssh1_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
         crStop(NULL);
     }
 
-    st->pktin->maxlen = st->biglen;
-    st->pktin->data = snewn(st->biglen + APIEXTRA, unsigned char);
+    ssh_pkt_ensure(st->pktin, st->biglen);
 
     st->to_read = st->biglen;
     st->p = st->pktin->data;
@@ -1326,6 +1469,202 @@ static struct Packet *ssh1_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
     crFinish(st->pktin);
 }
 
+/*
+ * Move up to `want' bytes of received data into a packet buffer,
+ * returning how many were taken.
+ */
+static int ssh_rdpkt_take(unsigned char *dest, long want,
+			  unsigned char **data, int *datalen)
+{
+    int n = (want < *datalen ? (int)want : *datalen);
+    memcpy(dest, *data, n);
+    *data += n;
+    *datalen -= n;
+    return n;
+}
+
+/*
+ * Decide whether an SSH-2 packet's crypto should go through the
+ * worker queue `q'. Once anything is queued, everything else in that
+ * direction has to follow it, to keep the packets in order. Beyond
+ * that we only start using the worker in an established session
+ * with no key exchange under way, so that the keys can't change
+ * under a packet that's been read ahead.
+ */
+static int ssh2_crypto_threaded(Ssh ssh, WorkerQueue q, int len)
+{
+    if (q && workq_pending(q))
+	return TRUE;
+    return (ssh->cfg.ssh_crypto_thread && len >= SSH2_CRYPTO_THREAD_MIN &&
+	    ssh->state == SSH_STATE_SESSION && !ssh->kex_in_progress);
+}
+
+/*
+ * Check the MAC on, and decrypt, a received AEAD or
+ * encrypt-then-MAC packet. Like ssh2_pkt_seal(), this touches only
+ * the job, so it may run on a worker thread.
+ */
+static void ssh2_pkt_open(void *vjob)
+{
+    struct ssh2_crypto_job *job = (struct ssh2_crypto_job *)vjob;
+    unsigned char *data = job->pkt->data;
+
+    if (job->cipher && (job->cipher->flags & SSH_CIPHER_IS_AEAD)) {
+	if (!job->cipher->aead_decrypt(job->cipher_ctx, data, job->len,
+				       job->seq))
+	    job->error = "Incorrect MAC received on packet";
+    } else {
+	if (!job->mac->verify(job->mac_ctx, data, job->len, job->seq))
+	    job->error = "Incorrect MAC received on packet";
+	else if (job->cipher)
+	    job->cipher->decrypt(job->cipher_ctx, data + 4, job->len - 4);
+    }
+}
+
+/*
+ * Finish off a received and decrypted SSH-2 packet: check the
+ * padding, decompress it and log it. `len' is the value of its
+ * length field. Returns an error message, or NULL if all is well.
+ */
+static const char *ssh2_rdpkt_finish(Ssh ssh, struct Packet *pktin, long len)
+{
+    long pad, payload;
+
+    /* Get and sanity-check the amount of random padding. */
+    pad = pktin->data[4];
+    if (pad < 4 || len - pad < 1)
+	return "Invalid padding length on received packet";
+    /*
+     * This enables us to deduce the payload length.
+     */
+    payload = len - pad - 1;
+
+    pktin->length = payload + 5;
+    pktin->encrypted_len = len + 4;
+
+    /*
+     * Decompress packet payload.
+     */
+    {
+	unsigned char *newpayload;
+	int newlen;
+	if (ssh->sccomp &&
+	    ssh->sccomp->decompress(ssh->sc_comp_ctx,
+				    pktin->data + 5, pktin->length - 5,
+				    &newpayload, &newlen)) {
+	    ssh_pkt_ensure(pktin, newlen + 5);
+	    pktin->length = 5 + newlen;
+	    memcpy(pktin->data + 5, newpayload, newlen);
+	    sfree(newpayload);
+	}
+    }
+
+    pktin->savedpos = 6;
+    pktin->body = pktin->data;
+    pktin->type = pktin->data[5];
+    ssh2_schedule_precompute(ssh);
+
+    /*
+     * The server compresses everything after USERAUTH_SUCCESS with
+     * a delayed method, so switch before decompressing another
+     * packet rather than waiting for authconn to see this one.
+     */
+    if (ssh->sccomp_delayed && pktin->type == SSH2_MSG_USERAUTH_SUCCESS) {
+	ssh->sccomp->decompress_cleanup(ssh->sc_comp_ctx);
+	ssh->sccomp = ssh->sccomp_delayed;
+	ssh->sccomp_delayed = NULL;
+	ssh->sc_comp_ctx = ssh->sccomp->decompress_init();
+	logeventf(ssh, "Initialised %s decompression",
+		  ssh->sccomp->text_name);
+    }
+
+    /*
+     * Log incoming packet, possibly omitting sensitive fields.
+     */
+    if (ssh->logctx) {
+	int nblanks = 0;
+	struct logblank_t blank;
+	if (ssh->cfg.logomitdata) {
+	    int do_blank = FALSE, blank_prefix = 0;
+	    /* "Session data" packets - omit the data field */
+	    if (pktin->type == SSH2_MSG_CHANNEL_DATA) {
+		do_blank = TRUE; blank_prefix = 8;
+	    } else if (pktin->type == SSH2_MSG_CHANNEL_EXTENDED_DATA) {
+		do_blank = TRUE; blank_prefix = 12;
+	    }
+	    if (do_blank) {
+		blank.offset = blank_prefix;
+		blank.len = (pktin->length-6) - blank_prefix;
+		blank.type = PKTLOG_OMIT;
+		nblanks = 1;
+	    }
+	}
+	log_packet(ssh->logctx, PKT_INCOMING, pktin->type,
+		   ssh2_pkt_type(ssh->pkt_kctx, ssh->pkt_actx,
+				 pktin->type),
+		   pktin->data+6, pktin->length-6,
+		   nblanks, &blank, &pktin->sequence);
+    }
+
+    return NULL;
+}
+
+/*
+ * Called back on the GUI thread, in order, for each packet the
+ * sc_workq worker has opened. The packet goes on the end of the
+ * pktin list; ssh2_dispatch_queued() passes it on when it can.
+ */
+static void ssh2_pkt_opened(void *vssh, void *vjob)
+{
+    Ssh ssh = (Ssh) vssh;
+    struct ssh2_crypto_job *job = (struct ssh2_crypto_job *)vjob;
+
+    if (ssh->state == SSH_STATE_CLOSED) {
+	ssh_free_packet(job->pkt);
+	sfree(job);
+	return;
+    }
+    if (!job->error)
+	job->error = ssh2_rdpkt_finish(ssh, job->pkt, job->len - 4);
+    job->next = NULL;
+    if (ssh->pktin_tail)
+	ssh->pktin_tail->next = job;
+    else
+	ssh->pktin_head = job;
+    ssh->pktin_tail = job;
+}
+
+/*
+ * Hand the packets on the pktin list to the protocol, in order,
+ * until it runs dry or the session is frozen or closed.
+ */
+static void ssh2_dispatch_queued(void *vssh)
+{
+    Ssh ssh = (Ssh) vssh;
+    struct ssh2_crypto_job *job;
+
+    if (ssh->dispatching)
+	return;			       /* a protocol handler is reentering */
+    ssh->dispatching = TRUE;
+    while ((job = ssh->pktin_head) != NULL && !ssh->frozen &&
+	   ssh->state != SSH_STATE_CLOSED) {
+	ssh->pktin_head = job->next;
+	if (!ssh->pktin_head)
+	    ssh->pktin_tail = NULL;
+	if (job->error) {
+	    const char *error = job->error;
+	    ssh_free_packet(job->pkt);
+	    sfree(job);
+	    bombout(("%s", error));
+	    break;
+	}
+	ssh->protocol(ssh, NULL, 0, job->pkt);
+	ssh_free_packet(job->pkt);
+	sfree(job);
+    }
+    ssh->dispatching = FALSE;
+}
+
 static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 {
     struct rdpkt2_state_tag *st = &ssh->rdpkt2_state;
@@ -1344,8 +1683,94 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 	st->cipherblk = 8;
     st->maclen = ssh->scmac ? ssh->scmac->len : 0;
 
-    if (ssh->sccipher && (ssh->sccipher->flags & SSH_CIPHER_IS_CBC) &&
-	ssh->scmac) {
+    if ((ssh->sccipher && (ssh->sccipher->flags & SSH_CIPHER_IS_AEAD)) ||
+	(ssh->scmac && ssh->scmac_etm)) {
+	/*
+	 * An AEAD cipher gives us the packet length from the first
+	 * four bytes alone (either in clear, or encrypted separately
+	 * from the rest); with an encrypt-then-MAC MAC the length is
+	 * sent in clear and the MAC covers the ciphertext. Either way
+	 * we can read exactly one packet and its tag, and then check
+	 * it before we decrypt any of it - which means the checking
+	 * and decrypting can be left to a worker thread while we go
+	 * on reading.
+	 */
+	if (ssh->sccipher && (ssh->sccipher->flags & SSH_CIPHER_IS_AEAD))
+	    st->maclen = ssh->sccipher->authlen;
+	ssh_pkt_ensure(st->pktin, 4);
+	for (st->i = 0; st->i < 4;) {
+	    while ((*datalen) == 0)
+		crReturn(NULL);
+	    st->i += ssh_rdpkt_take(st->pktin->data + st->i, 4 - st->i,
+				    data, datalen);
+	}
+	if (ssh->sccipher && (ssh->sccipher->flags & SSH_CIPHER_IS_AEAD)) {
+	    unsigned long len =
+		ssh->sccipher->aead_length(ssh->sc_cipher_ctx,
+					   st->pktin->data,
+					   st->incoming_sequence);
+	    /* The length field itself is outside the cipher blocks. */
+	    if (len > OUR_V2_PACKETLIMIT || len % st->cipherblk != 0) {
+		bombout(("Incoming packet was garbled on decryption"));
+		ssh_free_packet(st->pktin);
+		crStop(NULL);
+	    }
+	    st->len = len;
+	} else {
+	    st->len = GET_32BIT(st->pktin->data);
+	    if (st->len < 0 || st->len > OUR_V2_PACKETLIMIT ||
+		st->len % st->cipherblk != 0) {
+		bombout(("Incoming packet length field was garbled"));
+		ssh_free_packet(st->pktin);
+		crStop(NULL);
+	    }
+	}
+	st->packetlen = st->len + 4;
+	ssh_pkt_ensure(st->pktin, st->packetlen + st->maclen);
+	for (st->i = 4; st->i < st->packetlen + st->maclen;) {
+	    while ((*datalen) == 0)
+		crReturn(NULL);
+	    st->i += ssh_rdpkt_take(st->pktin->data + st->i,
+				    st->packetlen + st->maclen - st->i,
+				    data, datalen);
+	}
+	{
+	    struct ssh2_crypto_job job, *jobp = &job;
+	    int aead = ssh->sccipher &&
+		(ssh->sccipher->flags & SSH_CIPHER_IS_AEAD);
+	    int threaded = ssh2_crypto_threaded(ssh, ssh->sc_workq,
+						st->packetlen);
+	    if (threaded)
+		jobp = snew(struct ssh2_crypto_job);
+	    jobp->pkt = st->pktin;
+	    jobp->len = st->packetlen;
+	    jobp->total = st->packetlen + st->maclen;
+	    jobp->seq = st->incoming_sequence;
+	    jobp->cipher = ssh->sccipher;
+	    jobp->cipher_ctx = ssh->sc_cipher_ctx;
+	    jobp->mac = aead ? NULL : ssh->scmac;
+	    jobp->mac_ctx = ssh->sc_mac_ctx;
+	    jobp->etm = !aead;
+	    jobp->error = NULL;
+	    jobp->next = NULL;
+	    if (threaded) {
+		/* The rest happens in ssh2_pkt_opened(). */
+		st->pktin->sequence = st->incoming_sequence++;
+		if (!ssh->sc_workq)
+		    ssh->sc_workq = workq_new(ssh2_pkt_open, ssh2_pkt_opened,
+					      ssh2_dispatch_queued, ssh);
+		workq_submit(ssh->sc_workq, jobp);
+		crStop(NULL);
+	    }
+	    ssh2_pkt_open(&job);
+	    if (job.error) {
+		bombout(("%s", job.error));
+		ssh_free_packet(st->pktin);
+		crStop(NULL);
+	    }
+	}
+    } else if (ssh->sccipher && (ssh->sccipher->flags & SSH_CIPHER_IS_CBC) &&
+	       ssh->scmac) {
 	/*
 	 * When dealing with a CBC-mode cipher, we want to avoid the
 	 * possibility of an attacker's tweaking the ciphertext stream
@@ -1360,15 +1785,14 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 	 */
 
 	/* May as well allocate the whole lot now. */
-	st->pktin->data = snewn(OUR_V2_PACKETLIMIT + st->maclen + APIEXTRA,
-				unsigned char);
+	ssh_pkt_ensure(st->pktin, OUR_V2_PACKETLIMIT + st->maclen);
 
 	/* Read an amount corresponding to the MAC. */
-	for (st->i = 0; st->i < st->maclen; st->i++) {
+	for (st->i = 0; st->i < st->maclen;) {
 	    while ((*datalen) == 0)
 		crReturn(NULL);
-	    st->pktin->data[st->i] = *(*data)++;
-	    (*datalen)--;
+	    st->i += ssh_rdpkt_take(st->pktin->data + st->i,
+				    st->maclen - st->i, data, datalen);
 	}
 
 	st->packetlen = 0;
@@ -1381,11 +1805,12 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 
 	for (;;) { /* Once around this loop per cipher block. */
 	    /* Read another cipher-block's worth, and tack it onto the end. */
-	    for (st->i = 0; st->i < st->cipherblk; st->i++) {
+	    for (st->i = 0; st->i < st->cipherblk;) {
 		while ((*datalen) == 0)
 		    crReturn(NULL);
-		st->pktin->data[st->packetlen+st->maclen+st->i] = *(*data)++;
-		(*datalen)--;
+		st->i += ssh_rdpkt_take(st->pktin->data + st->packetlen +
+					st->maclen + st->i,
+					st->cipherblk - st->i, data, datalen);
 	    }
 	    /* Decrypt one more block (a little further back in the stream). */
 	    ssh->sccipher->decrypt(ssh->sc_cipher_ctx,
@@ -1406,22 +1831,18 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 		crStop(NULL);
 	    }	    
 	}
-	st->pktin->maxlen = st->packetlen + st->maclen;
-	st->pktin->data = sresize(st->pktin->data,
-				  st->pktin->maxlen + APIEXTRA,
-				  unsigned char);
     } else {
-	st->pktin->data = snewn(st->cipherblk + APIEXTRA, unsigned char);
+	ssh_pkt_ensure(st->pktin, st->cipherblk);
 
 	/*
 	 * Acquire and decrypt the first block of the packet. This will
 	 * contain the length and padding details.
 	 */
-	for (st->i = st->len = 0; st->i < st->cipherblk; st->i++) {
+	for (st->i = st->len = 0; st->i < st->cipherblk;) {
 	    while ((*datalen) == 0)
 		crReturn(NULL);
-	    st->pktin->data[st->i] = *(*data)++;
-	    (*datalen)--;
+	    st->i += ssh_rdpkt_take(st->pktin->data + st->i,
+				    st->cipherblk - st->i, data, datalen);
 	}
 
 	if (ssh->sccipher)
@@ -1450,22 +1871,19 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 	st->packetlen = st->len + 4;
 
 	/*
-	 * Allocate memory for the rest of the packet.
+	 * Make room for the rest of the packet.
 	 */
-	st->pktin->maxlen = st->packetlen + st->maclen;
-	st->pktin->data = sresize(st->pktin->data,
-				  st->pktin->maxlen + APIEXTRA,
-				  unsigned char);
+	ssh_pkt_ensure(st->pktin, st->packetlen + st->maclen);
 
 	/*
 	 * Read and decrypt the remainder of the packet.
 	 */
-	for (st->i = st->cipherblk; st->i < st->packetlen + st->maclen;
-	     st->i++) {
+	for (st->i = st->cipherblk; st->i < st->packetlen + st->maclen;) {
 	    while ((*datalen) == 0)
 		crReturn(NULL);
-	    st->pktin->data[st->i] = *(*data)++;
-	    (*datalen)--;
+	    st->i += ssh_rdpkt_take(st->pktin->data + st->i,
+				    st->packetlen + st->maclen - st->i,
+				    data, datalen);
 	}
 	/* Decrypt everything _except_ the MAC. */
 	if (ssh->sccipher)
@@ -1484,75 +1902,15 @@ static struct Packet *ssh2_rdpkt(Ssh ssh, unsigned char **data, int *datalen)
 	    crStop(NULL);
 	}
     }
-    /* Get and sanity-check the amount of random padding. */
-    st->pad = st->pktin->data[4];
-    if (st->pad < 4 || st->len - st->pad < 1) {
-	bombout(("Invalid padding length on received packet"));
-	ssh_free_packet(st->pktin);
-	crStop(NULL);
-    }
-    /*
-     * This enables us to deduce the payload length.
-     */
-    st->payload = st->len - st->pad - 1;
-
-    st->pktin->length = st->payload + 5;
-    st->pktin->encrypted_len = st->packetlen;
-
     st->pktin->sequence = st->incoming_sequence++;
 
-    /*
-     * Decompress packet payload.
-     */
     {
-	unsigned char *newpayload;
-	int newlen;
-	if (ssh->sccomp &&
-	    ssh->sccomp->decompress(ssh->sc_comp_ctx,
-				    st->pktin->data + 5, st->pktin->length - 5,
-				    &newpayload, &newlen)) {
-	    if (st->pktin->maxlen < newlen + 5) {
-		st->pktin->maxlen = newlen + 5;
-		st->pktin->data = sresize(st->pktin->data,
-					  st->pktin->maxlen + APIEXTRA,
-					  unsigned char);
-	    }
-	    st->pktin->length = 5 + newlen;
-	    memcpy(st->pktin->data + 5, newpayload, newlen);
-	    sfree(newpayload);
-	}
-    }
-
-    st->pktin->savedpos = 6;
-    st->pktin->body = st->pktin->data;
-    st->pktin->type = st->pktin->data[5];
-
-    /*
-     * Log incoming packet, possibly omitting sensitive fields.
-     */
-    if (ssh->logctx) {
-	int nblanks = 0;
-	struct logblank_t blank;
-	if (ssh->cfg.logomitdata) {
-	    int do_blank = FALSE, blank_prefix = 0;
-	    /* "Session data" packets - omit the data field */
-	    if (st->pktin->type == SSH2_MSG_CHANNEL_DATA) {
-		do_blank = TRUE; blank_prefix = 8;
-	    } else if (st->pktin->type == SSH2_MSG_CHANNEL_EXTENDED_DATA) {
-		do_blank = TRUE; blank_prefix = 12;
-	    }
-	    if (do_blank) {
-		blank.offset = blank_prefix;
-		blank.len = (st->pktin->length-6) - blank_prefix;
-		blank.type = PKTLOG_OMIT;
-		nblanks = 1;
-	    }
+	const char *error = ssh2_rdpkt_finish(ssh, st->pktin, st->len);
+	if (error) {
+	    bombout(("%s", error));
+	    ssh_free_packet(st->pktin);
+	    crStop(NULL);
 	}
-	log_packet(ssh->logctx, PKT_INCOMING, st->pktin->type,
-		   ssh2_pkt_type(ssh->pkt_kctx, ssh->pkt_actx,
-				 st->pktin->type),
-		   st->pktin->data+6, st->pktin->length-6,
-		   nblanks, &blank, &st->pktin->sequence);
     }
 
     crFinish(st->pktin);
@@ -1889,13 +2247,17 @@ static struct Packet *ssh2_pkt_init(int pkt_type)
 }
 
 /*
- * Construct an SSH-2 final-form packet: compress it, encrypt it,
- * put the MAC on it. Final packet, ready to be sent, is stored in
- * pkt->data. Total length is returned.
+ * Get an SSH-2 packet ready for encryption: log it, compress it,
+ * pad it, and give it a sequence number. The cipher and MAC that
+ * will seal it are recorded in `job', so the sealing itself can
+ * happen later, and elsewhere.
  */
-static int ssh2_pkt_construct(Ssh ssh, struct Packet *pkt)
+static void ssh2_pkt_prepare(Ssh ssh, struct Packet *pkt,
+			     struct ssh2_crypto_job *job)
 {
-    int cipherblk, maclen, padding, i;
+    int cipherblk, maclen, padding, aadlen, i;
+    int aead = ssh->cscipher && (ssh->cscipher->flags & SSH_CIPHER_IS_AEAD);
+    int etm = !aead && ssh->csmac && ssh->csmac_etm;
 
     if (ssh->logctx)
 	log_packet(ssh->logctx, PKT_OUTGOING, pkt->data[5],
@@ -1923,38 +2285,87 @@ static int ssh2_pkt_construct(Ssh ssh, struct Packet *pkt)
 
     /*
      * Add padding. At least four bytes, and must also bring total
-     * length (minus MAC) up to a multiple of the block size.
+     * length (minus MAC) up to a multiple of the block size. (For an
+     * AEAD cipher or an encrypt-then-MAC MAC, the length field is
+     * not encrypted and doesn't count towards that.)
      * If pkt->forcepad is set, make sure the packet is at least that size
      * after padding.
      */
     cipherblk = ssh->cscipher ? ssh->cscipher->blksize : 8;  /* block size */
     cipherblk = cipherblk < 8 ? 8 : cipherblk;	/* or 8 if blksize < 8 */
+    aadlen = (aead || etm) ? 4 : 0;
     padding = 4;
     if (pkt->length + padding < pkt->forcepad)
 	padding = pkt->forcepad - pkt->length;
     padding +=
-	(cipherblk - (pkt->length + padding) % cipherblk) % cipherblk;
+	(cipherblk - (pkt->length - aadlen + padding) % cipherblk) % cipherblk;
     assert(padding <= 255);
-    maclen = ssh->csmac ? ssh->csmac->len : 0;
+    maclen = aead ? ssh->cscipher->authlen : ssh->csmac ? ssh->csmac->len : 0;
     ssh2_pkt_ensure(pkt, pkt->length + padding + maclen);
     pkt->data[4] = padding;
     for (i = 0; i < padding; i++)
 	pkt->data[pkt->length + i] = random_byte();
     PUT_32BIT(pkt->data, pkt->length + padding - 4);
-    if (ssh->csmac)
-	ssh->csmac->generate(ssh->cs_mac_ctx, pkt->data,
-			     pkt->length + padding,
-			     ssh->v2_outgoing_sequence);
-    ssh->v2_outgoing_sequence++;       /* whether or not we MACed */
-
-    if (ssh->cscipher)
-	ssh->cscipher->encrypt(ssh->cs_cipher_ctx,
-			       pkt->data, pkt->length + padding);
 
     pkt->encrypted_len = pkt->length + padding;
 
+    job->pkt = pkt;
+    job->len = pkt->length + padding;
+    job->total = job->len + maclen;
+    job->seq = ssh->v2_outgoing_sequence++;   /* whether or not we MAC */
+    job->cipher = ssh->cscipher;
+    job->cipher_ctx = ssh->cs_cipher_ctx;
+    job->mac = ssh->csmac;
+    job->mac_ctx = ssh->cs_mac_ctx;
+    job->etm = etm;
+    job->error = NULL;
+    job->next = NULL;
+}
+
+/*
+ * Encrypt a prepared packet and put the MAC on it. This touches
+ * nothing but the job, so it is safe to run on a worker thread.
+ */
+static void ssh2_pkt_seal(void *vjob)
+{
+    struct ssh2_crypto_job *job = (struct ssh2_crypto_job *)vjob;
+    unsigned char *data = job->pkt->data;
+
+    if (job->cipher && (job->cipher->flags & SSH_CIPHER_IS_AEAD)) {
+	/* Encrypt and append the tag in one go. */
+	job->cipher->aead_encrypt(job->cipher_ctx, data, job->len, job->seq);
+    } else if (job->etm) {
+	/* Encrypt all but the length, then MAC the ciphertext. */
+	if (job->cipher)
+	    job->cipher->encrypt(job->cipher_ctx, data + 4, job->len - 4);
+	job->mac->generate(job->mac_ctx, data, job->len, job->seq);
+    } else {
+	if (job->mac)
+	    job->mac->generate(job->mac_ctx, data, job->len, job->seq);
+	if (job->cipher)
+	    job->cipher->encrypt(job->cipher_ctx, data, job->len);
+    }
+}
+
+/*
+ * Construct an SSH-2 final-form packet: compress it, encrypt it,
+ * put the MAC on it. Final packet, ready to be sent, is stored in
+ * pkt->data. Total length is returned.
+ */
+static int ssh2_pkt_construct(Ssh ssh, struct Packet *pkt)
+{
+    struct ssh2_crypto_job job;
+
+    /* Anything still with the worker must reach the wire first. */
+    if (ssh->cs_workq)
+	workq_sync(ssh->cs_workq);
+
+    ssh2_pkt_prepare(ssh, pkt, &job);
+    ssh2_pkt_seal(&job);
+    ssh2_schedule_precompute(ssh);
+
     /* Ready-to-send packet starts at pkt->data. We return length. */
-    return pkt->length + padding + maclen;
+    return job.total;
 }
 
 /*
@@ -1997,6 +2408,24 @@ static int ssh2_pkt_construct(Ssh ssh, struct Packet *pkt)
 static void ssh2_pkt_defer_noqueue(Ssh, struct Packet *, int);
 static void ssh_pkt_defersend(Ssh);
 
+/*
+ * Called back on the GUI thread, in order, for each packet the
+ * cs_workq worker has sealed.
+ */
+static void ssh2_pkt_sealed(void *vssh, void *vjob)
+{
+    Ssh ssh = (Ssh) vssh;
+    struct ssh2_crypto_job *job = (struct ssh2_crypto_job *)vjob;
+
+    if (ssh->s) {
+	int backlog = s_write(ssh, job->pkt->data, job->total);
+	if (backlog > SSH_MAX_BACKLOG)
+	    ssh_throttle_all(ssh, 1, backlog);
+    }
+    ssh_free_packet(job->pkt);
+    sfree(job);
+}
+
 /*
  * Send an SSH-2 packet immediately, without queuing or deferring.
  */
@@ -2010,18 +2439,27 @@ static void ssh2_pkt_send_noqueue(Ssh ssh, struct Packet *pkt)
 	ssh_pkt_defersend(ssh);
 	return;
     }
-    len = ssh2_pkt_construct(ssh, pkt);
-    backlog = s_write(ssh, pkt->data, len);
-    if (backlog > SSH_MAX_BACKLOG)
-	ssh_throttle_all(ssh, 1, backlog);
+    if (ssh2_crypto_threaded(ssh, ssh->cs_workq, pkt->length)) {
+	struct ssh2_crypto_job *job = snew(struct ssh2_crypto_job);
+	if (!ssh->cs_workq)
+	    ssh->cs_workq = workq_new(ssh2_pkt_seal, ssh2_pkt_sealed,
+				      NULL, ssh);
+	ssh2_pkt_prepare(ssh, pkt, job);
+	ssh->outgoing_data_size += pkt->encrypted_len;
+	workq_submit(ssh->cs_workq, job);
+    } else {
+	len = ssh2_pkt_construct(ssh, pkt);
+	backlog = s_write(ssh, pkt->data, len);
+	if (backlog > SSH_MAX_BACKLOG)
+	    ssh_throttle_all(ssh, 1, backlog);
+	ssh->outgoing_data_size += pkt->encrypted_len;
+	ssh_free_packet(pkt);
+    }
 
-    ssh->outgoing_data_size += pkt->encrypted_len;
     if (!ssh->kex_in_progress &&
 	ssh->max_data_size != 0 &&
 	ssh->outgoing_data_size > ssh->max_data_size)
 	do_ssh2_transport(ssh, "too much data sent", -1, NULL);
-
-    ssh_free_packet(pkt);
 }
 
 /*
@@ -2735,8 +3173,35 @@ static void ssh_process_incoming_data(Ssh ssh,
 {
     struct Packet *pktin;
 
+    /*
+     * If SSH-2 packets are being decrypted on a worker thread, make
+     * sure any it has finished get to the protocol before this one,
+     * and don't read ahead at all if the keys might be about to
+     * change.
+     */
+    if (ssh->sc_workq) {
+	if (ssh->ssh2_rdpkt_crstate == 0 &&
+	    !ssh2_crypto_threaded(ssh, NULL, SSH2_CRYPTO_THREAD_MIN))
+	    workq_sync(ssh->sc_workq);
+	if (ssh->pktin_head) {
+	    ssh2_dispatch_queued(ssh);
+	    if (ssh->frozen || ssh->state == SSH_STATE_CLOSED)
+		return;
+	}
+    }
+
     pktin = ssh->s_rdpkt(ssh, data, datalen);
     if (pktin) {
+	if (ssh->pktin_head) {
+	    struct ssh2_crypto_job *job = snew(struct ssh2_crypto_job);
+	    job->pkt = pktin;
+	    job->error = NULL;
+	    job->next = NULL;
+	    ssh->pktin_tail->next = job;
+	    ssh->pktin_tail = job;
+	    ssh2_dispatch_queued(ssh);
+	    return;
+	}
 	ssh->protocol(ssh, NULL, 0, pktin);
 	ssh_free_packet(pktin);
     }
@@ -2774,6 +3239,9 @@ static void ssh_set_frozen(Ssh ssh, int frozen)
     if (ssh->s)
 	sk_set_frozen(ssh->s, frozen);
     ssh->frozen = frozen;
+    /* Packets already decrypted won't wait for more network data. */
+    if (!frozen && ssh->pktin_head && ssh->sc_workq)
+	workq_notify(ssh->sc_workq);
 }
 
 static void ssh_gotdata(Ssh ssh, unsigned char *data, int datalen)
@@ -2865,6 +3333,9 @@ static int ssh_do_close(Ssh ssh, int notify_exit)
 	      case CHAN_SOCKDATA_DORMANT:
 		pfd_close(c->u.pfd.s);
 		break;
+	      case CHAN_SHARED:
+		ssh_share_lost(c);
+		break;
 	    }
 	    del234(ssh->channels, c); /* moving next one to index 0 */
 	    if (ssh->version == 2)
@@ -2902,6 +3373,8 @@ static void ssh_log(Plug plug, int type, SockAddr addr, int port,
 
     if (type == 0)
 	msg = dupprintf("Connecting to %s port %d", addrbuf, port);
+    else if (type == 2)
+	msg = dupprintf("Connected to %s after %d ms", addrbuf, error_code);
     else
 	msg = dupprintf("Failed to connect to %s: %s", addrbuf, error_msg);
 
@@ -5132,7 +5605,7 @@ static void do_ssh1_connection(Ssh ssh, unsigned char *in, int inlen,
 	ssh_pkt_adduint32(pkt, ssh->term_width);
 	ssh_pkt_adduint32(pkt, 0); /* width in pixels */
 	ssh_pkt_adduint32(pkt, 0); /* height in pixels */
-	parse_ttymodes(ssh, ssh->cfg.ttymodes,
+	parse_ttymodes(ssh->frontend, ssh->cfg.ttymodes,
 		       ssh1_send_ttymode, (void *)pkt);
 	ssh_pkt_addbyte(pkt, SSH1_TTY_OP_ISPEED);
 	ssh_pkt_adduint32(pkt, ssh->ispeed);
@@ -5159,7 +5632,8 @@ static void do_ssh1_connection(Ssh ssh, unsigned char *in, int inlen,
     }
 
     if (ssh->cfg.compression) {
-	send_packet(ssh, SSH1_CMSG_REQUEST_COMPRESSION, PKT_INT, 6, PKT_END);
+	send_packet(ssh, SSH1_CMSG_REQUEST_COMPRESSION,
+		    PKT_INT, ssh->cfg.compression_level, PKT_END);
 	do {
 	    crReturnV;
 	} while (!pktin);
@@ -5173,6 +5647,7 @@ static void do_ssh1_connection(Ssh ssh, unsigned char *in, int inlen,
 	logevent("Started compression");
 	ssh->v1_compressing = TRUE;
 	ssh->cs_comp_ctx = zlib_compress_init();
+	zlib_compress_level(ssh->cs_comp_ctx, ssh->cfg.compression_level);
 	logevent("Initialised zlib (RFC1950) compression");
 	ssh->sc_comp_ctx = zlib_decompress_init();
 	logevent("Initialised zlib (RFC1950) decompression");
@@ -5367,15 +5842,18 @@ static int first_in_commasep_string(char *needle, char *haystack, int haylen)
 
 /*
  * SSH-2 key creation method.
- * (Currently assumes 2 lots of any hash are sufficient to generate
- * keys/IVs for any cipher/MAC. SSH2_MKKEY_ITERS documents this assumption.)
+ * (Currently assumes 4 lots of any hash are sufficient to generate
+ * keys/IVs for any cipher/MAC: the largest is chacha20-poly1305's 64
+ * bytes of key, which is four SHA-1s. SSH2_MKKEY_ITERS documents this
+ * assumption.)
  */
-#define SSH2_MKKEY_ITERS (2)
+#define SSH2_MKKEY_ITERS (4)
 static void ssh2_mkkey(Ssh ssh, Bignum K, unsigned char *H, char chr,
 		       unsigned char *keyspace)
 {
     const struct ssh_hash *h = ssh->kex->hash;
     void *s;
+    int i;
     /* First hlen bytes. */
     s = h->init();
     if (!(ssh->remote_bugs & BUG_SSH2_DERIVEKEY))
@@ -5384,22 +5862,34 @@ static void ssh2_mkkey(Ssh ssh, Bignum K, unsigned char *H, char chr,
     h->bytes(s, &chr, 1);
     h->bytes(s, ssh->v2_session_id, ssh->v2_session_id_len);
     h->final(s, keyspace);
-    /* Next hlen bytes. */
-    s = h->init();
-    if (!(ssh->remote_bugs & BUG_SSH2_DERIVEKEY))
-	hash_mpint(h, s, K);
-    h->bytes(s, H, h->hlen);
-    h->bytes(s, keyspace, h->hlen);
-    h->final(s, keyspace + h->hlen);
+    /* Each further hlen bytes is a hash of all the ones before. */
+    for (i = 1; i < SSH2_MKKEY_ITERS; i++) {
+	s = h->init();
+	if (!(ssh->remote_bugs & BUG_SSH2_DERIVEKEY))
+	    hash_mpint(h, s, K);
+	h->bytes(s, H, h->hlen);
+	h->bytes(s, keyspace, h->hlen * i);
+	h->final(s, keyspace + h->hlen * i);
+    }
 }
 
 /*
- * Handle the SSH-2 transport layer.
+ * Apply the configured zlib level to a freshly made client->server
+ * compressor. Other methods have no level to set.
  */
-static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
-			     struct Packet *pktin)
+static void ssh2_comp_setlevel(Ssh ssh)
 {
-    unsigned char *in = (unsigned char *)vin;
+    if (ssh->cscomp == &ssh_zlib)
+	zlib_compress_level(ssh->cs_comp_ctx, ssh->cfg.compression_level);
+}
+
+/*
+ * Handle the SSH-2 transport layer.
+ */
+static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
+			     struct Packet *pktin)
+{
+    unsigned char *in = (unsigned char *)vin;
     struct do_ssh2_transport_state {
 	int nbits, pbits, warn_kex, warn_cscipher, warn_sccipher;
 	Bignum p, g, e, f, K;
@@ -5412,20 +5902,24 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	const struct ssh2_cipher *sccipher_tobe;
 	const struct ssh_mac *csmac_tobe;
 	const struct ssh_mac *scmac_tobe;
+	int csmac_etm_tobe, scmac_etm_tobe;
 	const struct ssh_compress *cscomp_tobe;
 	const struct ssh_compress *sccomp_tobe;
+	int cscomp_delayed_tobe, sccomp_delayed_tobe;
 	char *hostkeydata, *sigdata, *rsakeydata, *keystr, *fingerprint;
 	int hostkeylen, siglen, rsakeylen;
 	void *hkey;		       /* actual host key */
 	void *rsakey;		       /* for RSA kex */
+	void *eckey;		       /* for ECDH kex */
 	unsigned char exchange_hash[SSH2_KEX_MAX_HASH_LEN];
 	int n_preferred_kex;
 	const struct ssh_kexes *preferred_kex[KEX_MAX];
 	int n_preferred_ciphers;
 	const struct ssh2_ciphers *preferred_ciphers[CIPHER_MAX];
 	const struct ssh_compress *preferred_comp;
+	int n_preferred_hostkeys;
+	const struct ssh_signkey *preferred_hostkeys[lenof(hostkey_algs)];
 	int userauth_succeeded;	    /* for delayed compression */
-	int pending_compression;
 	int got_session_id, activated_authconn;
 	struct Packet *pktout;
         int dlgret;
@@ -5439,10 +5933,10 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
     s->cscipher_tobe = s->sccipher_tobe = NULL;
     s->csmac_tobe = s->scmac_tobe = NULL;
     s->cscomp_tobe = s->sccomp_tobe = NULL;
+    s->cscomp_delayed_tobe = s->sccomp_delayed_tobe = FALSE;
 
     s->got_session_id = s->activated_authconn = FALSE;
     s->userauth_succeeded = FALSE;
-    s->pending_compression = FALSE;
 
     /*
      * Be prepared to work around the buggy MAC problem.
@@ -5455,7 +5949,7 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
   begin_key_exchange:
     ssh->pkt_kctx = SSH2_PKTCTX_NOKEX;
     {
-	int i, j, commalist_started;
+	int i, j, k, commalist_started;
 
 	/*
 	 * Set up the preferred key exchange. (NULL => warn below here)
@@ -5479,6 +5973,10 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 		s->preferred_kex[s->n_preferred_kex++] =
 		    &ssh_rsa_kex;
 		break;
+	      case KEX_ECDH:
+		s->preferred_kex[s->n_preferred_kex++] =
+		    &ssh_ecdh_kex;
+		break;
 	      case KEX_WARN:
 		/* Flag for later. Don't bother if it's the last in
 		 * the list. */
@@ -5512,6 +6010,12 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	      case CIPHER_ARCFOUR:
 		s->preferred_ciphers[s->n_preferred_ciphers++] = &ssh2_arcfour;
 		break;
+	      case CIPHER_AESGCM:
+		s->preferred_ciphers[s->n_preferred_ciphers++] = &ssh2_aesgcm;
+		break;
+	      case CIPHER_CHACHA20:
+		s->preferred_ciphers[s->n_preferred_ciphers++] = &ssh2_ccp;
+		break;
 	      case CIPHER_WARN:
 		/* Flag for later. Don't bother if it's the last in
 		 * the list. */
@@ -5522,6 +6026,24 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	    }
 	}
 
+	/*
+	 * Set up the preferred host key algorithms. Any type for which
+	 * we already hold a cached key goes to the front, so that
+	 * adding a newer algorithm doesn't make a server we already
+	 * know present an unfamiliar key and a fresh warning.
+	 */
+	s->n_preferred_hostkeys = 0;
+	for (i = 0; i < lenof(hostkey_algs); i++)
+	    if (have_ssh_host_key(ssh->savedhost, ssh->savedport,
+				  hostkey_algs[i]->keytype))
+		s->preferred_hostkeys[s->n_preferred_hostkeys++] =
+		    hostkey_algs[i];
+	for (i = 0; i < lenof(hostkey_algs); i++)
+	    if (!have_ssh_host_key(ssh->savedhost, ssh->savedport,
+				   hostkey_algs[i]->keytype))
+		s->preferred_hostkeys[s->n_preferred_hostkeys++] =
+		    hostkey_algs[i];
+
 	/*
 	 * Set up preferred compression.
 	 */
@@ -5562,9 +6084,9 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	}
 	/* List server host key algorithms. */
 	ssh2_pkt_addstring_start(s->pktout);
-	for (i = 0; i < lenof(hostkey_algs); i++) {
-	    ssh2_pkt_addstring_str(s->pktout, hostkey_algs[i]->name);
-	    if (i < lenof(hostkey_algs) - 1)
+	for (i = 0; i < s->n_preferred_hostkeys; i++) {
+	    ssh2_pkt_addstring_str(s->pktout, s->preferred_hostkeys[i]->name);
+	    if (i < s->n_preferred_hostkeys - 1)
 		ssh2_pkt_addstring_str(s->pktout, ",");
 	}
 	/* List client->server encryption algorithms. */
@@ -5593,19 +6115,24 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 		commalist_started = 1;
 	    }
 	}
-	/* List client->server MAC algorithms. */
-	ssh2_pkt_addstring_start(s->pktout);
-	for (i = 0; i < s->nmacs; i++) {
-	    ssh2_pkt_addstring_str(s->pktout, s->maclist[i]->name);
-	    if (i < s->nmacs - 1)
-		ssh2_pkt_addstring_str(s->pktout, ",");
-	}
-	/* List server->client MAC algorithms. */
-	ssh2_pkt_addstring_start(s->pktout);
-	for (i = 0; i < s->nmacs; i++) {
-	    ssh2_pkt_addstring_str(s->pktout, s->maclist[i]->name);
-	    if (i < s->nmacs - 1)
-		ssh2_pkt_addstring_str(s->pktout, ",");
+	/* List client->server MAC algorithms, then server->client MAC
+	 * algorithms. (We use the same set twice.) Encrypt-then-MAC
+	 * variants come first, since they let us check a packet before
+	 * decrypting any of it. */
+	for (k = 0; k < 2; k++) {
+	    ssh2_pkt_addstring_start(s->pktout);
+	    commalist_started = 0;
+	    for (j = 0; j < 2; j++) {
+		for (i = 0; i < s->nmacs; i++) {
+		    char *name = (j == 0 ? s->maclist[i]->etm_name :
+				  s->maclist[i]->name);
+		    if (!name) continue;
+		    if (commalist_started)
+			ssh2_pkt_addstring_str(s->pktout, ",");
+		    ssh2_pkt_addstring_str(s->pktout, name);
+		    commalist_started = 1;
+		}
+	    }
 	}
 	/* List client->server compression algorithms,
 	 * then server->client compression algorithms. (We use the
@@ -5615,10 +6142,7 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	    assert(lenof(compressions) > 1);
 	    /* Prefer non-delayed versions */
 	    ssh2_pkt_addstring_str(s->pktout, s->preferred_comp->name);
-	    /* We don't even list delayed versions of algorithms until
-	     * they're allowed to be used, to avoid a race. See the end of
-	     * this function. */
-	    if (s->userauth_succeeded && s->preferred_comp->delayed_name) {
+	    if (s->preferred_comp->delayed_name) {
 		ssh2_pkt_addstring_str(s->pktout, ",");
 		ssh2_pkt_addstring_str(s->pktout,
 				       s->preferred_comp->delayed_name);
@@ -5628,7 +6152,7 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 		if (c != s->preferred_comp) {
 		    ssh2_pkt_addstring_str(s->pktout, ",");
 		    ssh2_pkt_addstring_str(s->pktout, c->name);
-		    if (s->userauth_succeeded && c->delayed_name) {
+		    if (c->delayed_name) {
 			ssh2_pkt_addstring_str(s->pktout, ",");
 			ssh2_pkt_addstring_str(s->pktout, c->delayed_name);
 		    }
@@ -5672,6 +6196,7 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	s->sccipher_tobe = NULL;
 	s->csmac_tobe = NULL;
 	s->scmac_tobe = NULL;
+	s->csmac_etm_tobe = s->scmac_etm_tobe = FALSE;
 	s->cscomp_tobe = NULL;
 	s->sccomp_tobe = NULL;
 	s->warn_kex = s->warn_cscipher = s->warn_sccipher = FALSE;
@@ -5708,14 +6233,14 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	 */
 	s->guessok = first_in_commasep_string(preferred, str, len);
 	ssh_pkt_getstring(pktin, &str, &len);    /* host key algorithms */
-	for (i = 0; i < lenof(hostkey_algs); i++) {
-	    if (in_commasep_string(hostkey_algs[i]->name, str, len)) {
-		ssh->hostkey = hostkey_algs[i];
+	for (i = 0; i < s->n_preferred_hostkeys; i++) {
+	    if (in_commasep_string(s->preferred_hostkeys[i]->name, str, len)) {
+		ssh->hostkey = s->preferred_hostkeys[i];
 		break;
 	    }
 	}
 	s->guessok = s->guessok &&
-	    first_in_commasep_string(hostkey_algs[0]->name, str, len);
+	    first_in_commasep_string(s->preferred_hostkeys[0]->name, str, len);
 	ssh_pkt_getstring(pktin, &str, &len);    /* client->server cipher */
 	for (i = 0; i < s->n_preferred_ciphers; i++) {
 	    const struct ssh2_ciphers *c = s->preferred_ciphers[i];
@@ -5760,18 +6285,46 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	    crStop(0);
 	}
 
+	/*
+	 * An AEAD cipher authenticates its own packets, and whatever
+	 * MAC is negotiated alongside it goes unused.
+	 */
 	ssh_pkt_getstring(pktin, &str, &len);    /* client->server mac */
-	for (i = 0; i < s->nmacs; i++) {
-	    if (in_commasep_string(s->maclist[i]->name, str, len)) {
-		s->csmac_tobe = s->maclist[i];
-		break;
+	if (!(s->cscipher_tobe->flags & SSH_CIPHER_IS_AEAD)) {
+	    for (j = 0; j < 2 && !s->csmac_tobe; j++) {
+		for (i = 0; i < s->nmacs; i++) {
+		    char *name = (j == 0 ? s->maclist[i]->etm_name :
+				  s->maclist[i]->name);
+		    if (name && in_commasep_string(name, str, len)) {
+			s->csmac_tobe = s->maclist[i];
+			s->csmac_etm_tobe = (j == 0);
+			break;
+		    }
+		}
+	    }
+	    if (!s->csmac_tobe) {
+		bombout(("Couldn't agree a client-to-server MAC"
+			 " (available: %s)", str ? str : "(null)"));
+		crStop(0);
 	    }
 	}
 	ssh_pkt_getstring(pktin, &str, &len);    /* server->client mac */
-	for (i = 0; i < s->nmacs; i++) {
-	    if (in_commasep_string(s->maclist[i]->name, str, len)) {
-		s->scmac_tobe = s->maclist[i];
-		break;
+	if (!(s->sccipher_tobe->flags & SSH_CIPHER_IS_AEAD)) {
+	    for (j = 0; j < 2 && !s->scmac_tobe; j++) {
+		for (i = 0; i < s->nmacs; i++) {
+		    char *name = (j == 0 ? s->maclist[i]->etm_name :
+				  s->maclist[i]->name);
+		    if (name && in_commasep_string(name, str, len)) {
+			s->scmac_tobe = s->maclist[i];
+			s->scmac_etm_tobe = (j == 0);
+			break;
+		    }
+		}
+	    }
+	    if (!s->scmac_tobe) {
+		bombout(("Couldn't agree a server-to-client MAC"
+			 " (available: %s)", str ? str : "(null)"));
+		crStop(0);
 	    }
 	}
 	ssh_pkt_getstring(pktin, &str, &len);  /* client->server compression */
@@ -5780,14 +6333,12 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 		i == 0 ? s->preferred_comp : compressions[i - 1];
 	    if (in_commasep_string(c->name, str, len)) {
 		s->cscomp_tobe = c;
+		s->cscomp_delayed_tobe = FALSE;
 		break;
 	    } else if (in_commasep_string(c->delayed_name, str, len)) {
-		if (s->userauth_succeeded) {
-		    s->cscomp_tobe = c;
-		    break;
-		} else {
-		    s->pending_compression = TRUE;  /* try this later */
-		}
+		s->cscomp_tobe = c;
+		s->cscomp_delayed_tobe = !s->userauth_succeeded;
+		break;
 	    }
 	}
 	ssh_pkt_getstring(pktin, &str, &len);  /* server->client compression */
@@ -5796,19 +6347,17 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 		i == 0 ? s->preferred_comp : compressions[i - 1];
 	    if (in_commasep_string(c->name, str, len)) {
 		s->sccomp_tobe = c;
+		s->sccomp_delayed_tobe = FALSE;
 		break;
 	    } else if (in_commasep_string(c->delayed_name, str, len)) {
-		if (s->userauth_succeeded) {
-		    s->sccomp_tobe = c;
-		    break;
-		} else {
-		    s->pending_compression = TRUE;  /* try this later */
-		}
+		s->sccomp_tobe = c;
+		s->sccomp_delayed_tobe = !s->userauth_succeeded;
+		break;
 	    }
 	}
-	if (s->pending_compression) {
-	    logevent("Server supports delayed compression; "
-		     "will try this later");
+	if (s->cscomp_delayed_tobe || s->sccomp_delayed_tobe) {
+	    logevent("Server requested delayed compression; "
+		     "will enable it after authentication");
 	}
 	ssh_pkt_getstring(pktin, &str, &len);  /* client->server language */
 	ssh_pkt_getstring(pktin, &str, &len);  /* server->client language */
@@ -6007,6 +6556,64 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
             freebn(s->g);
             freebn(s->p);
         }
+    } else if (ssh->kex->main_type == KEXTYPE_ECDH) {
+        logeventf(ssh, "Doing ECDH key exchange with curve %s and hash %s",
+                  ssh->kex->groupname, ssh->kex->hash->text_name);
+        ssh->pkt_kctx = SSH2_PKTCTX_ECDHKEX;
+
+        s->eckey = ssh_ecdhkex_newkey(ssh->kex);
+
+        {
+            char *publicPoint;
+            int publicPointLength;
+            publicPoint = ssh_ecdhkex_getpublic(s->eckey, &publicPointLength);
+            s->pktout = ssh2_pkt_init(SSH2_MSG_KEX_ECDH_INIT);
+            ssh2_pkt_addstring_start(s->pktout);
+            ssh2_pkt_addstring_data(s->pktout, publicPoint, publicPointLength);
+            ssh2_pkt_send_noqueue(ssh, s->pktout);
+        }
+
+        crWaitUntil(pktin);
+        if (pktin->type != SSH2_MSG_KEX_ECDH_REPLY) {
+            ssh_ecdhkex_freekey(s->eckey);
+            bombout(("expected ECDH reply packet from server"));
+            crStop(0);
+        }
+
+        ssh_pkt_getstring(pktin, &s->hostkeydata, &s->hostkeylen);
+        hash_string(ssh->kex->hash, ssh->exhash,
+                    s->hostkeydata, s->hostkeylen);
+        s->hkey = ssh->hostkey->newkey(s->hostkeydata, s->hostkeylen);
+
+        {
+            char *publicPoint;
+            int publicPointLength;
+            publicPoint = ssh_ecdhkex_getpublic(s->eckey, &publicPointLength);
+            hash_string(ssh->kex->hash, ssh->exhash,
+                        publicPoint, publicPointLength);
+        }
+
+        {
+            char *keydata;
+            int keylen;
+            ssh_pkt_getstring(pktin, &keydata, &keylen);
+            if (!keydata) {
+                ssh_ecdhkex_freekey(s->eckey);
+                bombout(("unable to parse ECDH reply packet"));
+                crStop(0);
+            }
+            hash_string(ssh->kex->hash, ssh->exhash, keydata, keylen);
+            s->K = ssh_ecdhkex_getkey(s->eckey, keydata, keylen);
+            if (!s->K) {
+                ssh_ecdhkex_freekey(s->eckey);
+                bombout(("Received invalid elliptic curve point in ECDH reply"));
+                crStop(0);
+            }
+        }
+
+        ssh_pkt_getstring(pktin, &s->sigdata, &s->siglen);
+
+        ssh_ecdhkex_freekey(s->eckey);
     } else {
 	logeventf(ssh, "Doing RSA key exchange with hash %s",
 		  ssh->kex->hash->text_name);
@@ -6188,8 +6795,11 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 
     /*
      * We've sent client NEWKEYS, so create and initialise
-     * client-to-server session keys.
+     * client-to-server session keys. The worker must be done with
+     * the old ones first.
      */
+    if (ssh->cs_workq)
+	workq_sync(ssh->cs_workq);
     if (ssh->cs_cipher_ctx)
 	ssh->cscipher->free_context(ssh->cs_cipher_ctx);
     ssh->cscipher = s->cscipher_tobe;
@@ -6198,12 +6808,20 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
     if (ssh->cs_mac_ctx)
 	ssh->csmac->free_context(ssh->cs_mac_ctx);
     ssh->csmac = s->csmac_tobe;
-    ssh->cs_mac_ctx = ssh->csmac->make_context();
+    ssh->csmac_etm = s->csmac_etm_tobe;
+    ssh->cs_mac_ctx = ssh->csmac ? ssh->csmac->make_context() : NULL;
 
     if (ssh->cs_comp_ctx)
 	ssh->cscomp->compress_cleanup(ssh->cs_comp_ctx);
-    ssh->cscomp = s->cscomp_tobe;
+    if (s->cscomp_delayed_tobe) {
+	ssh->cscomp_delayed = s->cscomp_tobe;
+	ssh->cscomp = &ssh_comp_none;
+    } else {
+	ssh->cscomp_delayed = NULL;
+	ssh->cscomp = s->cscomp_tobe;
+    }
     ssh->cs_comp_ctx = ssh->cscomp->compress_init();
+    ssh2_comp_setlevel(ssh);
 
     /*
      * Set IVs on client-to-server keys. Here we use the exchange
@@ -6220,17 +6838,21 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	assert(ssh->cscipher->blksize <=
 	       ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
 	ssh->cscipher->setiv(ssh->cs_cipher_ctx, keyspace);
-	ssh2_mkkey(ssh,s->K,s->exchange_hash,'E',keyspace);
-	assert(ssh->csmac->len <=
-	       ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
-	ssh->csmac->setkey(ssh->cs_mac_ctx, keyspace);
+	if (ssh->csmac) {
+	    ssh2_mkkey(ssh,s->K,s->exchange_hash,'E',keyspace);
+	    assert(ssh->csmac->len <=
+		   ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
+	    ssh->csmac->setkey(ssh->cs_mac_ctx, keyspace);
+	}
 	memset(keyspace, 0, sizeof(keyspace));
     }
 
     logeventf(ssh, "Initialised %.200s client->server encryption",
 	      ssh->cscipher->text_name);
-    logeventf(ssh, "Initialised %.200s client->server MAC algorithm",
-	      ssh->csmac->text_name);
+    if (ssh->csmac)
+	logeventf(ssh, "Initialised %.200s client->server MAC algorithm%s",
+		  ssh->csmac->text_name,
+		  ssh->csmac_etm ? " (in ETM mode)" : "");
     if (ssh->cscomp->text_name)
 	logeventf(ssh, "Initialised %s compression",
 		  ssh->cscomp->text_name);
@@ -6254,8 +6876,11 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 
     /*
      * We've seen server NEWKEYS, so create and initialise
-     * server-to-client session keys.
+     * server-to-client session keys. The worker must be done with
+     * the old ones first.
      */
+    if (ssh->sc_workq)
+	workq_sync(ssh->sc_workq);
     if (ssh->sc_cipher_ctx)
 	ssh->sccipher->free_context(ssh->sc_cipher_ctx);
     ssh->sccipher = s->sccipher_tobe;
@@ -6264,11 +6889,18 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
     if (ssh->sc_mac_ctx)
 	ssh->scmac->free_context(ssh->sc_mac_ctx);
     ssh->scmac = s->scmac_tobe;
-    ssh->sc_mac_ctx = ssh->scmac->make_context();
+    ssh->scmac_etm = s->scmac_etm_tobe;
+    ssh->sc_mac_ctx = ssh->scmac ? ssh->scmac->make_context() : NULL;
 
     if (ssh->sc_comp_ctx)
 	ssh->sccomp->decompress_cleanup(ssh->sc_comp_ctx);
-    ssh->sccomp = s->sccomp_tobe;
+    if (s->sccomp_delayed_tobe) {
+	ssh->sccomp_delayed = s->sccomp_tobe;
+	ssh->sccomp = &ssh_comp_none;
+    } else {
+	ssh->sccomp_delayed = NULL;
+	ssh->sccomp = s->sccomp_tobe;
+    }
     ssh->sc_comp_ctx = ssh->sccomp->decompress_init();
 
     /*
@@ -6286,20 +6918,27 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	assert(ssh->sccipher->blksize <=
 	       ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
 	ssh->sccipher->setiv(ssh->sc_cipher_ctx, keyspace);
-	ssh2_mkkey(ssh,s->K,s->exchange_hash,'F',keyspace);
-	assert(ssh->scmac->len <=
-	       ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
-	ssh->scmac->setkey(ssh->sc_mac_ctx, keyspace);
+	if (ssh->scmac) {
+	    ssh2_mkkey(ssh,s->K,s->exchange_hash,'F',keyspace);
+	    assert(ssh->scmac->len <=
+		   ssh->kex->hash->hlen * SSH2_MKKEY_ITERS);
+	    ssh->scmac->setkey(ssh->sc_mac_ctx, keyspace);
+	}
 	memset(keyspace, 0, sizeof(keyspace));
     }
     logeventf(ssh, "Initialised %.200s server->client encryption",
 	      ssh->sccipher->text_name);
-    logeventf(ssh, "Initialised %.200s server->client MAC algorithm",
-	      ssh->scmac->text_name);
+    if (ssh->scmac)
+	logeventf(ssh, "Initialised %.200s server->client MAC algorithm%s",
+		  ssh->scmac->text_name,
+		  ssh->scmac_etm ? " (in ETM mode)" : "");
     if (ssh->sccomp->text_name)
 	logeventf(ssh, "Initialised %s decompression",
 		  ssh->sccomp->text_name);
 
+    /* Have keystream ready for the first packets under the new keys. */
+    ssh2_schedule_precompute(ssh);
+
     /*
      * Free shared secret.
      */
@@ -6350,8 +6989,8 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
      * giving the reason for the rekey.
      *
      * inlen==-1 means always initiate a rekey;
-     * inlen==-2 means that userauth has completed successfully and
-     *   we should consider rekeying (for delayed compression).
+     * inlen==-2 means that userauth has completed successfully, so
+     *   any delayed compression should start now (no rekey).
      */
     while (!((pktin && pktin->type == SSH2_MSG_KEXINIT) ||
 	     (!pktin && inlen < 0))) {
@@ -6362,31 +7001,31 @@ static int do_ssh2_transport(Ssh ssh, void *vin, int inlen,
 	logevent("Server initiated key re-exchange");
     } else {
 	if (inlen == -2) {
-	    /* 
-	     * authconn has seen a USERAUTH_SUCCEEDED. Time to enable
-	     * delayed compression, if it's available.
-	     *
-	     * draft-miller-secsh-compression-delayed-00 says that you
-	     * negotiate delayed compression in the first key exchange, and
-	     * both sides start compressing when the server has sent
-	     * USERAUTH_SUCCESS. This has a race condition -- the server
-	     * can't know when the client has seen it, and thus which incoming
-	     * packets it should treat as compressed.
+	    /*
+	     * authconn has seen a USERAUTH_SUCCESS. Time to enable
+	     * delayed compression, if we negotiated it.
 	     *
-	     * Instead, we do the initial key exchange without offering the
-	     * delayed methods, but note if the server offers them; when we
-	     * get here, if a delayed method was available that was higher
-	     * on our list than what we got, we initiate a rekey in which we
-	     * _do_ list the delayed methods (and hopefully get it as a
-	     * result). Subsequent rekeys will do the same.
+	     * draft-miller-secsh-compression-delayed-00 says that both
+	     * sides start compressing straight after USERAUTH_SUCCESS,
+	     * so we offer the delayed methods in the first key exchange
+	     * and switch here, as OpenSSH does. The incoming direction
+	     * has already been switched by ssh2_rdpkt_finish(), before
+	     * the packet after USERAUTH_SUCCESS was decompressed; we
+	     * have sent nothing since, so the outgoing one can switch
+	     * now.
 	     */
 	    assert(!s->userauth_succeeded); /* should only happen once */
 	    s->userauth_succeeded = TRUE;
-	    if (!s->pending_compression)
-		/* Can't see any point rekeying. */
-		goto wait_for_rekey;       /* this is utterly horrid */
-	    /* else fall through to rekey... */
-	    s->pending_compression = FALSE;
+	    if (ssh->cscomp_delayed) {
+		ssh->cscomp->compress_cleanup(ssh->cs_comp_ctx);
+		ssh->cscomp = ssh->cscomp_delayed;
+		ssh->cscomp_delayed = NULL;
+		ssh->cs_comp_ctx = ssh->cscomp->compress_init();
+		ssh2_comp_setlevel(ssh);
+		logeventf(ssh, "Initialised %s compression",
+			  ssh->cscomp->text_name);
+	    }
+	    goto wait_for_rekey;       /* this is utterly horrid */
 	}
         /*
 	 * Now we've decided to rekey.
@@ -6470,6 +7109,7 @@ static void ssh2_try_send_and_unthrottle(Ssh ssh, struct ssh_channel *c)
     if (bufsize == 0) {
 	switch (c->type) {
 	  case CHAN_MAINSESSION:
+	  case CHAN_SHARED:
 	    /* stdin need not receive an unthrottle
 	     * notification since it will be polled */
 	    break;
@@ -6500,6 +7140,34 @@ static void ssh2_try_send_and_unthrottle(Ssh ssh, struct ssh_channel *c)
     }
 }
 
+/*
+ * Initial channel window and maximum data message size we offer,
+ * from the session configuration.
+ */
+static int ssh2_our_winsize(Ssh ssh)
+{
+    int w = ssh->cfg.ssh_winsize;
+    if (w <= 0)
+	return OUR_V2_WINSIZE;
+    if (w < 1024)
+	return 1024;
+    if (w > OUR_V2_TUNEDWIN)
+	return OUR_V2_TUNEDWIN;
+    return w;
+}
+
+static unsigned long ssh2_our_maxpkt(Ssh ssh)
+{
+    int p = ssh->cfg.ssh_maxpkt;
+    if (p <= 0)
+	return OUR_V2_MAXPKT;
+    if (p < 1024)
+	return 1024;
+    if ((unsigned long)p > OUR_V2_MAXPKT_LIMIT)
+	return OUR_V2_MAXPKT_LIMIT;
+    return p;
+}
+
 /*
  * Set up most of a new ssh_channel for SSH-2.
  */
@@ -6511,12 +7179,58 @@ static void ssh2_channel_init(struct ssh_channel *c)
     c->pending_close = FALSE;
     c->throttling_conn = FALSE;
     c->v.v2.locwindow = c->v.v2.locmaxwin = c->v.v2.remlocwin =
-	ssh->cfg.ssh_simple ? OUR_V2_BIGWIN : OUR_V2_WINSIZE;
+	ssh->cfg.ssh_simple ? OUR_V2_BIGWIN : ssh2_our_winsize(ssh);
     c->v.v2.winadj_head = c->v.v2.winadj_tail = NULL;
     c->v.v2.throttle_state = UNTHROTTLED;
+    c->v.v2.tune_bytes = 0;
+    c->v.v2.tune_start = GETTICKCOUNT();
     bufchain_init(&c->v.v2.outbuffer);
 }
 
+/*
+ * The remote end has used up the window we gave it, so the window
+ * rather than the consumer is what limits this channel. Grow the
+ * window towards twice the bandwidth-delay product, estimated from
+ * the measured round-trip time and the rate at which data arrived,
+ * but never by more than doubling it at once.
+ */
+static void ssh2_tune_window(struct ssh_channel *c)
+{
+    Ssh ssh = c->ssh;
+    long now = GETTICKCOUNT(), elapsed = now - c->v.v2.tune_start;
+    int step = ssh2_our_winsize(ssh);
+    int limit = OUR_V2_TUNEDWIN;
+    int newmax;
+
+    if (c->type == CHAN_SOCKDATA)
+	limit = step > OUR_V2_FWDWIN ? step : OUR_V2_FWDWIN;
+
+    if (ssh->cfg.ssh_no_win_tuning || ssh->v2_rtt <= 0 || elapsed <= 0) {
+	/* no measurements to go on; just grow it a step at a time */
+	if (c->v.v2.locmaxwin < (c->type == CHAN_SOCKDATA ? limit : 0x40000000))
+	    c->v.v2.locmaxwin += step;
+	return;
+    }
+
+    if (c->v.v2.locmaxwin >= limit)
+	return;
+    newmax = c->v.v2.locmaxwin + step;
+    if (elapsed >= ssh->v2_rtt) {
+	double rate = (double)c->v.v2.tune_bytes / elapsed;
+	double bdp = rate * ssh->v2_rtt;
+	if (2 * bdp > newmax)
+	    newmax = 2 * bdp > limit ? limit : (int)(2 * bdp);
+	c->v.v2.tune_bytes = 0;
+	c->v.v2.tune_start = now;
+    }
+    if (newmax > 2 * c->v.v2.locmaxwin)
+	newmax = 2 * c->v.v2.locmaxwin;
+    if (newmax > limit)
+	newmax = limit;
+    if (newmax > c->v.v2.locmaxwin)
+	c->v.v2.locmaxwin = newmax;
+}
+
 /*
  * Potentially enlarge the window on an SSH-2 channel.
  */
@@ -6537,9 +7251,10 @@ static void ssh2_set_window(struct ssh_channel *c, int newwin)
      * window so that it has no choice (assuming it doesn't ignore the
      * window as well).
      */
-    if ((ssh->remote_bugs & BUG_SSH2_MAXPKT) && newwin > OUR_V2_MAXPKT)
-	newwin = OUR_V2_MAXPKT;
-	
+    if ((ssh->remote_bugs & BUG_SSH2_MAXPKT) &&
+	newwin > (int)ssh2_our_maxpkt(ssh))
+	newwin = ssh2_our_maxpkt(ssh);
+
 
     /*
      * Only send a WINDOW_ADJUST if there's significantly more window
@@ -6582,6 +7297,7 @@ static void ssh2_set_window(struct ssh_channel *c, int newwin)
 	     */
 	    wa = snew(struct winadj);
 	    wa->size = newwin - c->v.v2.locwindow;
+	    wa->sent = GETTICKCOUNT();
 	    wa->next = NULL;
 	    if (!c->v.v2.winadj_head)
 		c->v.v2.winadj_head = wa;
@@ -6630,10 +7346,18 @@ static struct ssh_channel *ssh2_channel_msg(Ssh ssh, struct Packet *pktin)
 static int ssh2_handle_winadj_response(struct ssh_channel *c)
 {
     struct winadj *wa = c->v.v2.winadj_head;
+    long rtt;
     if (!wa)
 	return FALSE;
     c->v.v2.winadj_head = wa->next;
     c->v.v2.remlocwin += wa->size;
+    rtt = GETTICKCOUNT() - wa->sent;
+    if (rtt <= 0)
+	rtt = 1;
+    if (c->ssh->v2_rtt <= 0)
+	c->ssh->v2_rtt = rtt;
+    else
+	c->ssh->v2_rtt = (7 * c->ssh->v2_rtt + rtt) / 8;
     sfree(wa);
     /*
      * winadj messages are only sent when the window is fully open, so
@@ -6664,6 +7388,11 @@ static void ssh2_msg_channel_success(Ssh ssh, struct Packet *pktin)
     c = ssh2_channel_msg(ssh, pktin);
     if (!c)
 	return;
+    if (c->type == CHAN_SHARED &&
+	(c->u.sh.pty_reply || c->u.sh.start_reply)) {
+	ssh_share_reply(c, TRUE);
+	return;
+    }
     if (!ssh2_handle_winadj_response(c))
 	ssh_disconnect(ssh, NULL,
 		       "Received unsolicited SSH_MSG_CHANNEL_SUCCESS",
@@ -6674,8 +7403,9 @@ static void ssh2_msg_channel_failure(Ssh ssh, struct Packet *pktin)
 {
     /*
      * The only time this should get called is for "winadj@putty"
-     * messages sent above.  All other channel requests are either
-     * sent with want_reply false or are sent before this handler gets
+     * messages sent above, and for the requests that start a shared
+     * session.  All other channel requests are either sent with
+     * want_reply false or are sent before this handler gets
      * installed.
      */
     struct ssh_channel *c;
@@ -6683,6 +7413,11 @@ static void ssh2_msg_channel_failure(Ssh ssh, struct Packet *pktin)
     c = ssh2_channel_msg(ssh, pktin);
     if (!c)
 	return;
+    if (c->type == CHAN_SHARED &&
+	(c->u.sh.pty_reply || c->u.sh.start_reply)) {
+	ssh_share_reply(c, FALSE);
+	return;
+    }
     if (!ssh2_handle_winadj_response(c))
 	ssh_disconnect(ssh, NULL,
 		       "Received unsolicited SSH_MSG_CHANNEL_FAILURE",
@@ -6717,6 +7452,7 @@ static void ssh2_msg_channel_data(Ssh ssh, struct Packet *pktin)
 	int bufsize = 0;
 	c->v.v2.locwindow -= length;
 	c->v.v2.remlocwin -= length;
+	c->v.v2.tune_bytes += length;
 	switch (c->type) {
 	  case CHAN_MAINSESSION:
 	    bufsize =
@@ -6724,6 +7460,13 @@ static void ssh2_msg_channel_data(Ssh ssh, struct Packet *pktin)
 			     SSH2_MSG_CHANNEL_EXTENDED_DATA,
 			     data, length);
 	    break;
+	  case CHAN_SHARED:
+	    if (c->u.sh.ss)
+		bufsize =
+		    from_backend(c->u.sh.ss->frontend, pktin->type ==
+				 SSH2_MSG_CHANNEL_EXTENDED_DATA,
+				 data, length);
+	    break;
 	  case CHAN_X11:
 	    bufsize = x11_send(c->u.x11.s, data, length);
 	    break;
@@ -6778,9 +7521,8 @@ static void ssh2_msg_channel_data(Ssh ssh, struct Packet *pktin)
 	 * and we didn't want it to do that, think about using a
 	 * larger window.
 	 */
-	if (c->v.v2.remlocwin <= 0 && c->v.v2.throttle_state == UNTHROTTLED &&
-	    c->v.v2.locmaxwin < 0x40000000)
-	    c->v.v2.locmaxwin += OUR_V2_WINSIZE;
+	if (c->v.v2.remlocwin <= 0 && c->v.v2.throttle_state == UNTHROTTLED)
+	    ssh2_tune_window(c);
 	/*
 	 * If we are not buffering too much data,
 	 * enlarge the window again at the remote side.
@@ -6842,6 +7584,15 @@ static void ssh2_msg_channel_close(Ssh ssh, struct Packet *pktin)
       case CHAN_MAINSESSION:
 	ssh->mainchan = NULL;
 	update_specials_menu(ssh->frontend);
+	if (ssh_share_count(ssh) > 0) {
+	    logevent("Main session closed; keeping the connection "
+		     "for the sessions sharing it");
+	    c_write_str(ssh, "\r\nSession closed. The connection stays "
+			"open while other tabs share it.\r\n");
+	}
+	break;
+      case CHAN_SHARED:
+	ssh_share_closed(c);
 	break;
       case CHAN_X11:
 	if (c->u.x11.s != NULL)
@@ -6895,6 +7646,14 @@ static void ssh2_msg_channel_open_confirmation(Ssh ssh, struct Packet *pktin)
     c = ssh2_channel_msg(ssh, pktin);
     if (!c)
 	return;
+    if (c->type == CHAN_SHARED && c->halfopen) {
+	c->remoteid = ssh_pkt_getuint32(pktin);
+	c->halfopen = FALSE;
+	c->v.v2.remwindow = ssh_pkt_getuint32(pktin);
+	c->v.v2.remmaxpkt = ssh_pkt_getuint32(pktin);
+	ssh_share_confirmed(c);
+	return;
+    }
     if (c->type != CHAN_SOCKDATA_DORMANT)
 	return;			       /* dunno why they're confirming this */
     c->remoteid = ssh_pkt_getuint32(pktin);
@@ -6933,6 +7692,15 @@ static void ssh2_msg_channel_open_failure(Ssh ssh, struct Packet *pktin)
     c = ssh2_channel_msg(ssh, pktin);
     if (!c)
 	return;
+    if (c->type == CHAN_SHARED && c->halfopen) {
+	reason_code = ssh_pkt_getuint32(pktin);
+	if (reason_code >= lenof(reasons))
+	    reason_code = 0;
+	ssh_share_refused(c, reasons[reason_code]);
+	del234(ssh->channels, c);
+	sfree(c);
+	return;
+    }
     if (c->type != CHAN_SOCKDATA_DORMANT)
 	return;			       /* dunno why they're failing this */
 
@@ -6943,7 +7711,7 @@ static void ssh2_msg_channel_open_failure(Ssh ssh, struct Packet *pktin)
     logeventf(ssh, "Forwarded connection refused by server: %s [%.*s]",
 	      reasons[reason_code], reason_length, reason_string);
 
-    pfd_close(c->u.pfd.s);
+    pfd_refused(c->u.pfd.s, reason_code);
 
     del234(ssh->channels, c);
     sfree(c);
@@ -7113,6 +7881,25 @@ static void ssh2_msg_channel_request(Ssh ssh, struct Packet *pktin)
 	    reply = SSH2_MSG_CHANNEL_SUCCESS;
 
 	}
+    } else if (c->type == CHAN_SHARED) {
+	/*
+	 * The same two on a shared session, belonging to its tab.
+	 * We don't try to decode the signal here.
+	 */
+	SshShare ss = c->u.sh.ss;
+	if (typelen == 11 && !memcmp(type, "exit-status", 11)) {
+	    int exitcode = ssh_pkt_getuint32(pktin);
+	    if (ss)
+		ssh_share_exitcode(ss, exitcode, NULL, 0);
+	    reply = SSH2_MSG_CHANNEL_SUCCESS;
+	} else if (typelen == 11 && !memcmp(type, "exit-signal", 11)) {
+	    char *sig;
+	    int siglen;
+	    ssh_pkt_getstring(pktin, &sig, &siglen);
+	    if (ss)
+		ssh_share_exitcode(ss, 128, sig, siglen);
+	    reply = SSH2_MSG_CHANNEL_SUCCESS;
+	}
     } else {
 	/*
 	 * This is a channel request we don't know
@@ -7257,7 +8044,7 @@ static void ssh2_msg_channel_open(Ssh ssh, struct Packet *pktin)
 	ssh2_pkt_adduint32(pktout, c->remoteid);
 	ssh2_pkt_adduint32(pktout, c->localid);
 	ssh2_pkt_adduint32(pktout, c->v.v2.locwindow);
-	ssh2_pkt_adduint32(pktout, OUR_V2_MAXPKT);	/* our max pkt size */
+	ssh2_pkt_adduint32(pktout, ssh2_our_maxpkt(ssh));	/* our max pkt size */
 	ssh2_pkt_send(ssh, pktout);
     }
 }
@@ -7413,7 +8200,8 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
 	    logeventf(ssh, "Reading private key file \"%.150s\"",
 		      filename_to_str(&ssh->cfg.keyfile));
 	    keytype = key_type(&ssh->cfg.keyfile);
-	    if (keytype == SSH_KEYTYPE_SSH2) {
+	    if (keytype == SSH_KEYTYPE_SSH2 ||
+		keytype == SSH_KEYTYPE_OPENSSH_NEW) {
 		const char *error;
 		s->publickey_blob =
 		    ssh2_userkey_loadpub(&ssh->cfg.keyfile,
@@ -8736,7 +9524,7 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
 	ssh2_pkt_addstring(s->pktout, "direct-tcpip");
 	ssh2_pkt_adduint32(s->pktout, ssh->mainchan->localid);
 	ssh2_pkt_adduint32(s->pktout, ssh->mainchan->v.v2.locwindow);/* our window size */
-	ssh2_pkt_adduint32(s->pktout, OUR_V2_MAXPKT);      /* our max pkt size */
+	ssh2_pkt_adduint32(s->pktout, ssh2_our_maxpkt(ssh));      /* our max pkt size */
 	ssh2_pkt_addstring(s->pktout, ssh->cfg.ssh_nc_host);
 	ssh2_pkt_adduint32(s->pktout, ssh->cfg.ssh_nc_port);
 	/*
@@ -8775,7 +9563,7 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
 	ssh2_pkt_addstring(s->pktout, "session");
 	ssh2_pkt_adduint32(s->pktout, ssh->mainchan->localid);
 	ssh2_pkt_adduint32(s->pktout, ssh->mainchan->v.v2.locwindow);/* our window size */
-	ssh2_pkt_adduint32(s->pktout, OUR_V2_MAXPKT);    /* our max pkt size */
+	ssh2_pkt_adduint32(s->pktout, ssh2_our_maxpkt(ssh));    /* our max pkt size */
 	ssh2_pkt_send(ssh, s->pktout);
 	crWaitUntilV(pktin);
 	if (pktin->type != SSH2_MSG_CHANNEL_OPEN_CONFIRMATION) {
@@ -8921,7 +9709,7 @@ static void do_ssh2_authconn(Ssh ssh, unsigned char *in, int inlen,
 	ssh2_pkt_adduint32(s->pktout, 0);	       /* pixel width */
 	ssh2_pkt_adduint32(s->pktout, 0);	       /* pixel height */
 	ssh2_pkt_addstring_start(s->pktout);
-	parse_ttymodes(ssh, ssh->cfg.ttymodes,
+	parse_ttymodes(ssh->frontend, ssh->cfg.ttymodes,
 		       ssh2_send_ttymode, (void *)s->pktout);
 	ssh2_pkt_addbyte(s->pktout, SSH2_TTY_OP_ISPEED);
 	ssh2_pkt_adduint32(s->pktout, ssh->ispeed);
@@ -9259,6 +10047,38 @@ static void ssh2_timer(void *ctx, long now)
     }
 }
 
+/*
+ * Let the ciphers do their precompute() work, typically generating
+ * CTR keystream, so that the next keystroke's packet needs only an
+ * XOR on its way out. A cipher context the worker still has jobs
+ * for is left alone.
+ */
+static void ssh2_precompute_timer(void *ctx, long now)
+{
+    Ssh ssh = (Ssh)ctx;
+
+    ssh->precompute_pending = FALSE;
+    if (ssh->state == SSH_STATE_CLOSED)
+	return;
+
+    if (ssh->cscipher && ssh->cscipher->precompute &&
+	!(ssh->cs_workq && workq_pending(ssh->cs_workq)))
+	ssh->cscipher->precompute(ssh->cs_cipher_ctx);
+    if (ssh->sccipher && ssh->sccipher->precompute &&
+	!(ssh->sc_workq && workq_pending(ssh->sc_workq)))
+	ssh->sccipher->precompute(ssh->sc_cipher_ctx);
+}
+
+static void ssh2_schedule_precompute(Ssh ssh)
+{
+    if (ssh->precompute_pending ||
+	!((ssh->cscipher && ssh->cscipher->precompute) ||
+	  (ssh->sccipher && ssh->sccipher->precompute)))
+	return;
+    ssh->precompute_pending = TRUE;
+    schedule_timer(1, ssh2_precompute_timer, ssh);
+}
+
 static void ssh2_protocol(Ssh ssh, void *vin, int inlen,
 			  struct Packet *pktin)
 {
@@ -9319,13 +10139,16 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
     ssh->sccipher = NULL;
     ssh->sc_cipher_ctx = NULL;
     ssh->csmac = NULL;
+    ssh->csmac_etm = FALSE;
     ssh->cs_mac_ctx = NULL;
     ssh->scmac = NULL;
+    ssh->scmac_etm = FALSE;
     ssh->sc_mac_ctx = NULL;
     ssh->cscomp = NULL;
     ssh->cs_comp_ctx = NULL;
     ssh->sccomp = NULL;
     ssh->sc_comp_ctx = NULL;
+    ssh->cscomp_delayed = ssh->sccomp_delayed = NULL;
     ssh->kex = NULL;
     ssh->kex_ctx = NULL;
     ssh->hostkey = NULL;
@@ -9361,7 +10184,9 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
     ssh->v_c = NULL;
     ssh->v_s = NULL;
     ssh->mainchan = NULL;
+    ssh->share_next = NULL;
     ssh->throttled_all = 0;
+    ssh->v2_rtt = 0;
     ssh->v1_stdout_throttling = 0;
     ssh->queue = NULL;
     ssh->queuelen = ssh->queuesize = 0;
@@ -9370,6 +10195,10 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
     ssh->deferred_rekey_reason = NULL;
     bufchain_init(&ssh->queued_incoming_data);
     ssh->frozen = FALSE;
+    ssh->cs_workq = ssh->sc_workq = NULL;
+    ssh->precompute_pending = FALSE;
+    ssh->pktin_head = ssh->pktin_tail = NULL;
+    ssh->dispatching = FALSE;
 
     *backend_handle = ssh;
 
@@ -9414,6 +10243,9 @@ static const char *ssh_init(void *frontend_handle, void **backend_handle,
 
     random_ref();
 
+    ssh->share_next = ssh_shareable;
+    ssh_shareable = ssh;
+
     return NULL;
 }
 
@@ -9422,6 +10254,25 @@ static void ssh_free(void *handle)
     Ssh ssh = (Ssh) handle;
     struct ssh_channel *c;
     struct ssh_rportfwd *pf;
+    Ssh *sp;
+
+    for (sp = &ssh_shareable; *sp; sp = &(*sp)->share_next)
+	if (*sp == ssh) {
+	    *sp = ssh->share_next;
+	    break;
+	}
+
+    /* Stop the crypto workers before the contexts they use go. */
+    if (ssh->cs_workq)
+	workq_free(ssh->cs_workq);
+    if (ssh->sc_workq)
+	workq_free(ssh->sc_workq);
+    while (ssh->pktin_head) {
+	struct ssh2_crypto_job *job = ssh->pktin_head;
+	ssh->pktin_head = job->next;
+	ssh_free_packet(job->pkt);
+	sfree(job);
+    }
 
     if (ssh->v1_cipher_ctx)
 	ssh->cipher->free_context(ssh->v1_cipher_ctx);
@@ -9472,6 +10323,9 @@ static void ssh_free(void *handle)
 		if (c->u.pfd.s != NULL)
 		    pfd_close(c->u.pfd.s);
 		break;
+	      case CHAN_SHARED:
+		ssh_share_lost(c);
+		break;
 	    }
 	    sfree(c);
 	}
@@ -9734,6 +10588,29 @@ static const struct telnet_special *ssh_get_specials(void *handle)
 #undef ADD_SPECIALS
 }
 
+/*
+ * The SSH-2 name of a POSIX signal special, or NULL. The protocol
+ * does in principle support arbitrary named signals, including
+ * signame@domain, but we don't support those.
+ */
+static char *ssh_signal_name(Telnet_Special code)
+{
+    if (code == TS_SIGABRT) return "ABRT";
+    if (code == TS_SIGALRM) return "ALRM";
+    if (code == TS_SIGFPE)  return "FPE";
+    if (code == TS_SIGHUP)  return "HUP";
+    if (code == TS_SIGILL)  return "ILL";
+    if (code == TS_SIGINT)  return "INT";
+    if (code == TS_SIGKILL) return "KILL";
+    if (code == TS_SIGPIPE) return "PIPE";
+    if (code == TS_SIGQUIT) return "QUIT";
+    if (code == TS_SIGSEGV) return "SEGV";
+    if (code == TS_SIGTERM) return "TERM";
+    if (code == TS_SIGUSR1) return "USR1";
+    if (code == TS_SIGUSR2) return "USR2";
+    return NULL;
+}
+
 /*
  * Send special codes. TS_EOF is useful for `plink', so you
  * can send an EOF and collect resulting output (e.g. `plink
@@ -9795,22 +10672,7 @@ static void ssh_special(void *handle, Telnet_Special code)
 	}
     } else {
 	/* Is is a POSIX signal? */
-	char *signame = NULL;
-	if (code == TS_SIGABRT) signame = "ABRT";
-	if (code == TS_SIGALRM) signame = "ALRM";
-	if (code == TS_SIGFPE)  signame = "FPE";
-	if (code == TS_SIGHUP)  signame = "HUP";
-	if (code == TS_SIGILL)  signame = "ILL";
-	if (code == TS_SIGINT)  signame = "INT";
-	if (code == TS_SIGKILL) signame = "KILL";
-	if (code == TS_SIGPIPE) signame = "PIPE";
-	if (code == TS_SIGQUIT) signame = "QUIT";
-	if (code == TS_SIGSEGV) signame = "SEGV";
-	if (code == TS_SIGTERM) signame = "TERM";
-	if (code == TS_SIGUSR1) signame = "USR1";
-	if (code == TS_SIGUSR2) signame = "USR2";
-	/* The SSH-2 protocol does in principle support arbitrary named
-	 * signals, including signame@domain, but we don't support those. */
+	char *signame = ssh_signal_name(code);
 	if (signame) {
 	    /* It's a signal. */
 	    if (ssh->version == 2 && ssh->mainchan) {
@@ -9894,7 +10756,7 @@ void ssh_send_port_open(void *channel, char *hostname, int port, char *org)
 	ssh2_pkt_addstring(pktout, "direct-tcpip");
 	ssh2_pkt_adduint32(pktout, c->localid);
 	ssh2_pkt_adduint32(pktout, c->v.v2.locwindow);/* our window size */
-	ssh2_pkt_adduint32(pktout, OUR_V2_MAXPKT);      /* our max pkt size */
+	ssh2_pkt_adduint32(pktout, ssh2_our_maxpkt(ssh));      /* our max pkt size */
 	ssh2_pkt_addstring(pktout, hostname);
 	ssh2_pkt_adduint32(pktout, port);
 	/*
@@ -10003,3 +10865,547 @@ Socket get_ssh_socket(void *handle)
     Ssh h = (Ssh) handle;
     return h->s;
 }
+
+/* ----------------------------------------------------------------------
+ * Connection sharing. With cfg.ssh_share set, a new SSH-2 session to
+ * the same user@host:port as one already running (a duplicated tab,
+ * say, or a split) doesn't make a connection of its own: the front
+ * end drives it through ssh_share_backend instead, which opens a
+ * session channel on the existing Ssh. That saves the TCP, key
+ * exchange and authentication round trips; the new session is up
+ * after one more for the channel open.
+ *
+ * The session that made the connection owns it. If that session ends
+ * the connection stays up for the others, but when its tab is closed,
+ * or the connection fails, the sessions sharing it end too. X11 and
+ * agent forwarding are only set up for the owner's session.
+ */
+
+static void share_logeventf(SshShare ss, const char *fmt, ...)
+{
+    va_list ap;
+    char *buf;
+
+    va_start(ap, fmt);
+    buf = dupvprintf(fmt, ap);
+    va_end(ap);
+    (logevent)(ss->frontend, buf);     /* the function, not our macro */
+    sfree(buf);
+}
+
+/*
+ * Find a connection that a new session with this configuration can
+ * share: one to the same place, through with authentication, and
+ * still up.
+ */
+static Ssh ssh_share_master(Config *cfg)
+{
+    Ssh ssh;
+
+    if (!cfg->ssh_share || cfg->protocol != PROT_SSH)
+	return NULL;
+    for (ssh = ssh_shareable; ssh; ssh = ssh->share_next) {
+	if (ssh->cfg.ssh_share && ssh->s && ssh->version == 2 &&
+	    ssh->state == SSH_STATE_SESSION && !ssh->ncmode &&
+	    ssh->cfg.port == cfg->port &&
+	    !strcmp(ssh->cfg.host, cfg->host) &&
+	    !strcmp(ssh->cfg.username, cfg->username))
+	    return ssh;
+    }
+    return NULL;
+}
+
+int ssh_share_available(Config *cfg)
+{
+    return ssh_share_master(cfg) != NULL;
+}
+
+static int ssh_share_count(Ssh ssh)
+{
+    struct ssh_channel *c;
+    int i, n = 0;
+
+    if (!ssh->channels)
+	return 0;
+    for (i = 0; NULL != (c = index234(ssh->channels, i)); i++)
+	if (c->type == CHAN_SHARED && c->u.sh.ss)
+	    n++;
+    return n;
+}
+
+/*
+ * The server has opened our channel: ask for a pty, environment and
+ * shell, all at once. Only the pty and shell requests want replies;
+ * they come back in order, to ssh_share_reply().
+ */
+static void ssh_share_confirmed(struct ssh_channel *c)
+{
+    Ssh ssh = c->ssh;
+    SshShare ss = c->u.sh.ss;
+    struct Packet *pktout;
+    char *cmd;
+
+    if (!ss) {
+	/* The tab went away while we were opening its channel. */
+	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_CLOSE);
+	ssh2_pkt_adduint32(pktout, c->remoteid);
+	ssh2_pkt_send(ssh, pktout);
+	c->closes = 1;
+	return;
+    }
+    share_logeventf(ss, "Opened shared session channel (%ld ms)",
+		    GETTICKCOUNT() - ss->opened);
+
+    if (!ss->cfg.nopty) {
+	int ospeed = 38400, ispeed = 38400;   /* last-resort defaults */
+	sscanf(ss->cfg.termspeed, "%d,%d", &ospeed, &ispeed);
+	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+	ssh2_pkt_adduint32(pktout, c->remoteid);
+	ssh2_pkt_addstring(pktout, "pty-req");
+	ssh2_pkt_addbool(pktout, 1);	       /* want reply */
+	ssh2_pkt_addstring(pktout, ss->cfg.termtype);
+	ssh2_pkt_adduint32(pktout, ss->term_width);
+	ssh2_pkt_adduint32(pktout, ss->term_height);
+	ssh2_pkt_adduint32(pktout, 0);	       /* pixel width */
+	ssh2_pkt_adduint32(pktout, 0);	       /* pixel height */
+	ssh2_pkt_addstring_start(pktout);
+	parse_ttymodes(ss->frontend, ss->cfg.ttymodes,
+		       ssh2_send_ttymode, (void *)pktout);
+	ssh2_pkt_addbyte(pktout, SSH2_TTY_OP_ISPEED);
+	ssh2_pkt_adduint32(pktout, ispeed);
+	ssh2_pkt_addbyte(pktout, SSH2_TTY_OP_OSPEED);
+	ssh2_pkt_adduint32(pktout, ospeed);
+	ssh2_pkt_addstring_data(pktout, "\0", 1); /* TTY_OP_END */
+	ssh2_pkt_send(ssh, pktout);
+	c->u.sh.pty_reply = TRUE;
+    } else {
+	ss->editing = ss->echoing = 1;
+    }
+
+    if (*ss->cfg.environmt) {
+	char *e = ss->cfg.environmt;
+	char *var, *varend, *val;
+
+	while (*e) {
+	    var = e;
+	    while (*e && *e != '\t') e++;
+	    varend = e;
+	    if (*e == '\t') e++;
+	    val = e;
+	    while (*e) e++;
+	    e++;
+
+	    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+	    ssh2_pkt_adduint32(pktout, c->remoteid);
+	    ssh2_pkt_addstring(pktout, "env");
+	    ssh2_pkt_addbool(pktout, 0);       /* no reply wanted */
+	    ssh2_pkt_addstring_start(pktout);
+	    ssh2_pkt_addstring_data(pktout, var, varend-var);
+	    ssh2_pkt_addstring(pktout, val);
+	    ssh2_pkt_send(ssh, pktout);
+	}
+    }
+
+    cmd = ss->cfg.remote_cmd_ptr;
+    if (!cmd) cmd = ss->cfg.remote_cmd;
+    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+    ssh2_pkt_adduint32(pktout, c->remoteid);
+    if (ss->cfg.ssh_subsys) {
+	ssh2_pkt_addstring(pktout, "subsystem");
+	ssh2_pkt_addbool(pktout, 1);	       /* want reply */
+	ssh2_pkt_addstring(pktout, cmd);
+    } else if (*cmd) {
+	ssh2_pkt_addstring(pktout, "exec");
+	ssh2_pkt_addbool(pktout, 1);	       /* want reply */
+	ssh2_pkt_addstring(pktout, cmd);
+    } else {
+	ssh2_pkt_addstring(pktout, "shell");
+	ssh2_pkt_addbool(pktout, 1);	       /* want reply */
+    }
+    ssh2_pkt_send(ssh, pktout);
+    c->u.sh.start_reply = TRUE;
+
+    /* anything typed while the channel was opening follows these */
+    ssh2_try_send_and_unthrottle(ssh, c);
+}
+
+static void ssh_share_reply(struct ssh_channel *c, int success)
+{
+    SshShare ss = c->u.sh.ss;
+    struct Packet *pktout;
+
+    if (c->u.sh.pty_reply) {
+	c->u.sh.pty_reply = FALSE;
+	if (!ss)
+	    return;
+	if (success) {
+	    share_logeventf(ss, "Allocated pty");
+	} else {
+	    from_backend(ss->frontend, 1, "Server refused to allocate pty\r\n",
+			 32);
+	    ss->editing = ss->echoing = 1;
+	}
+	return;
+    }
+
+    c->u.sh.start_reply = FALSE;
+    if (!ss)
+	return;
+    if (!success) {
+	share_logeventf(ss, "Server refused to start a shell/command");
+	if (!c->closes) {
+	    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_CLOSE);
+	    ssh2_pkt_adduint32(pktout, c->remoteid);
+	    ssh2_pkt_send(c->ssh, pktout);
+	    c->closes = 1;
+	}
+	connection_fatal(ss->frontend, "%s",
+			 "Server refused to start a shell/command");
+	return;
+    }
+
+    share_logeventf(ss, "Started a shell/command (%ld ms after opening)",
+		    GETTICKCOUNT() - ss->opened);
+    ss->started = TRUE;
+    ss->send_ok = 1;
+    update_specials_menu(ss->frontend);
+    if (ss->ldisc)
+	ldisc_send(ss->ldisc, NULL, 0, 0);/* cause ldisc to notice changes */
+}
+
+static void ssh_share_refused(struct ssh_channel *c, const char *reason)
+{
+    SshShare ss = c->u.sh.ss;
+
+    if (!ss)
+	return;
+    ss->c = NULL;
+    share_logeventf(ss, "Server refused to open a shared session: %s",
+		    reason);
+    connection_fatal(ss->frontend,
+		     "Server refused to open a session on the shared "
+		     "connection: %s", reason);
+}
+
+static void ssh_share_exitcode(SshShare ss, int exitcode,
+			       const char *sig, int siglen)
+{
+    ss->exitcode = exitcode;
+    if (sig)
+	share_logeventf(ss, "Server exited on signal \"%.*s\"", siglen, sig);
+    else
+	share_logeventf(ss, "Server sent command exit status %d", exitcode);
+}
+
+/*
+ * Our channel has closed; the caller is about to free it.
+ */
+static void ssh_share_closed(struct ssh_channel *c)
+{
+    SshShare ss = c->u.sh.ss;
+
+    if (c->throttling_conn) {
+	c->throttling_conn = 0;
+	ssh_throttle_conn(c->ssh, -1);
+    }
+    if (!ss)
+	return;
+    ss->c = NULL;
+    ss->send_ok = 0;
+    share_logeventf(ss, "Shared session closed");
+    notify_remote_exit(ss->frontend);
+}
+
+/*
+ * The whole connection is going; the caller is about to free our
+ * channel.
+ */
+static void ssh_share_lost(struct ssh_channel *c)
+{
+    SshShare ss = c->u.sh.ss;
+
+    if (!ss)
+	return;
+    c->u.sh.ss = NULL;
+    ss->c = NULL;
+    ss->master = NULL;
+    ss->send_ok = 0;
+    share_logeventf(ss, "Shared connection closed");
+    connection_fatal(ss->frontend, "%s",
+		     "The connection this session was sharing has closed");
+}
+
+static const char *ssh_share_init(void *frontend_handle, void **backend_handle,
+				  Config *cfg,
+				  char *host, int port, char **realhost,
+				  int nodelay, int keepalive)
+{
+    Ssh master = ssh_share_master(cfg);
+    SshShare ss;
+    struct ssh_channel *c;
+    struct Packet *pktout;
+
+    if (!master)
+	return "No connection to share";
+
+    ss = snew(struct ssh_share_tag);
+    ss->master = master;
+    ss->cfg = *cfg;		       /* STRUCTURE COPY */
+    ss->frontend = frontend_handle;
+    ss->ldisc = NULL;
+    ss->logctx = NULL;
+    ss->term_width = ss->cfg.width;
+    ss->term_height = ss->cfg.height;
+    ss->started = FALSE;
+    ss->exitcode = -1;
+    ss->send_ok = 0;
+    ss->echoing = ss->editing = 0;
+    ss->opened = GETTICKCOUNT();
+    *backend_handle = ss;
+
+    c = snew(struct ssh_channel);
+    c->ssh = master;
+    ssh2_channel_init(c);
+    c->halfopen = TRUE;
+    c->type = CHAN_SHARED;
+    c->u.sh.ss = ss;
+    c->u.sh.pty_reply = c->u.sh.start_reply = FALSE;
+    add234(master->channels, c);
+    ss->c = c;
+
+    share_logeventf(ss, "Sharing the existing connection to %s port %d",
+		    master->savedhost, master->savedport);
+    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_OPEN);
+    ssh2_pkt_addstring(pktout, "session");
+    ssh2_pkt_adduint32(pktout, c->localid);
+    ssh2_pkt_adduint32(pktout, c->v.v2.locwindow);/* our window size */
+    ssh2_pkt_adduint32(pktout, ssh2_our_maxpkt(master));/* our max pkt size */
+    ssh2_pkt_send(master, pktout);
+
+    *realhost = dupstr(master->savedhost);
+    random_ref();
+
+    return NULL;
+}
+
+static void ssh_share_free(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    struct ssh_channel *c = ss->c;
+    struct Packet *pktout;
+
+    if (c) {
+	/*
+	 * The channel outlives us until the server has closed it
+	 * too; ssh_share_confirmed() closes one still opening.
+	 */
+	c->u.sh.ss = NULL;
+	if (c->throttling_conn) {
+	    c->throttling_conn = 0;
+	    ssh_throttle_conn(c->ssh, -1);
+	}
+	if (!c->halfopen && !c->closes) {
+	    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_CLOSE);
+	    ssh2_pkt_adduint32(pktout, c->remoteid);
+	    ssh2_pkt_send(c->ssh, pktout);
+	    c->closes = 1;
+	}
+    }
+    sfree(ss);
+
+    random_unref();
+}
+
+static void ssh_share_reconfig(void *handle, Config *cfg)
+{
+    SshShare ss = (SshShare) handle;
+    ss->cfg = *cfg;		       /* STRUCTURE COPY */
+}
+
+static int ssh_share_sendbuffer(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    int override_value = 0;
+
+    if (!ss->c || ss->c->closes)
+	return 0;
+    if (ss->master->throttled_all)
+	override_value = ss->master->overall_bufsize;
+    return override_value + bufchain_size(&ss->c->v.v2.outbuffer);
+}
+
+static int ssh_share_send(void *handle, char *buf, int len)
+{
+    SshShare ss = (SshShare) handle;
+
+    if (!ss->c || ss->c->closes)
+	return 0;
+    ssh2_add_channel_data(ss->c, buf, len);
+    if (!ss->c->halfopen)
+	ssh2_try_send_and_unthrottle(ss->master, ss->c);
+
+    return ssh_share_sendbuffer(ss);
+}
+
+static void ssh_share_size(void *handle, int width, int height)
+{
+    SshShare ss = (SshShare) handle;
+    struct ssh_channel *c = ss->c;
+    struct Packet *pktout;
+
+    ss->term_width = width;
+    ss->term_height = height;
+
+    /* before the channel's open, the pty-req will carry the size */
+    if (!c || c->halfopen || c->closes || ss->cfg.nopty)
+	return;
+    pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+    ssh2_pkt_adduint32(pktout, c->remoteid);
+    ssh2_pkt_addstring(pktout, "window-change");
+    ssh2_pkt_addbool(pktout, 0);
+    ssh2_pkt_adduint32(pktout, ss->term_width);
+    ssh2_pkt_adduint32(pktout, ss->term_height);
+    ssh2_pkt_adduint32(pktout, 0);
+    ssh2_pkt_adduint32(pktout, 0);
+    ssh2_pkt_send(ss->master, pktout);
+}
+
+static const struct telnet_special *ssh_share_get_specials(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    return ss->master ? ssh_get_specials(ss->master) : NULL;
+}
+
+/*
+ * EOF, break and signals go to our channel; the rest are about the
+ * connection, so they go to its owner.
+ */
+static void ssh_share_special(void *handle, Telnet_Special code)
+{
+    SshShare ss = (SshShare) handle;
+    struct ssh_channel *c = ss->c;
+    struct Packet *pktout;
+    char *signame = ssh_signal_name(code);
+
+    if (!ss->master)
+	return;
+    if (code != TS_EOF && code != TS_BRK && !signame) {
+	ssh_special(ss->master, code);
+	return;
+    }
+    if (!c || c->halfopen || c->closes)
+	return;
+
+    if (code == TS_EOF) {
+	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_EOF);
+	ssh2_pkt_adduint32(pktout, c->remoteid);
+	ssh2_pkt_send(ss->master, pktout);
+	ss->send_ok = 0;	       /* now stop trying to read from stdin */
+	share_logeventf(ss, "Sent EOF message");
+    } else if (code == TS_BRK) {
+	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+	ssh2_pkt_adduint32(pktout, c->remoteid);
+	ssh2_pkt_addstring(pktout, "break");
+	ssh2_pkt_addbool(pktout, 0);
+	ssh2_pkt_adduint32(pktout, 0);   /* default break length */
+	ssh2_pkt_send(ss->master, pktout);
+    } else {
+	pktout = ssh2_pkt_init(SSH2_MSG_CHANNEL_REQUEST);
+	ssh2_pkt_adduint32(pktout, c->remoteid);
+	ssh2_pkt_addstring(pktout, "signal");
+	ssh2_pkt_addbool(pktout, 0);
+	ssh2_pkt_addstring(pktout, signame);
+	ssh2_pkt_send(ss->master, pktout);
+	share_logeventf(ss, "Sent signal SIG%s", signame);
+    }
+}
+
+static void ssh_share_unthrottle(void *handle, int bufsize)
+{
+    SshShare ss = (SshShare) handle;
+    struct ssh_channel *c = ss->c;
+    int buflimit;
+
+    if (!c)
+	return;
+    ssh2_set_window(c, bufsize < c->v.v2.locmaxwin ?
+		    c->v.v2.locmaxwin - bufsize : 0);
+    if (ss->master->cfg.ssh_simple)
+	buflimit = 0;
+    else
+	buflimit = c->v.v2.locmaxwin;
+    if (c->throttling_conn && bufsize <= buflimit) {
+	c->throttling_conn = 0;
+	ssh_throttle_conn(ss->master, -1);
+    }
+}
+
+static int ssh_share_connected(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    return ss->c != NULL;
+}
+
+static int ssh_share_return_exitcode(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    if (ss->c != NULL)
+        return -1;
+    else
+        return (ss->exitcode >= 0 ? ss->exitcode : INT_MAX);
+}
+
+static int ssh_share_sendok(void *handle)
+{
+    SshShare ss = (SshShare) handle;
+    return ss->send_ok;
+}
+
+static int ssh_share_ldisc(void *handle, int option)
+{
+    SshShare ss = (SshShare) handle;
+    if (option == LD_ECHO)
+	return ss->echoing;
+    if (option == LD_EDIT)
+	return ss->editing;
+    return FALSE;
+}
+
+static void ssh_share_provide_ldisc(void *handle, void *ldisc)
+{
+    SshShare ss = (SshShare) handle;
+    ss->ldisc = ldisc;
+}
+
+static void ssh_share_provide_logctx(void *handle, void *logctx)
+{
+    SshShare ss = (SshShare) handle;
+    ss->logctx = logctx;
+}
+
+static int ssh_share_cfg_info(void *handle)
+{
+    return 2;			       /* only SSH-2 connections are shared */
+}
+
+Backend ssh_share_backend = {
+    ssh_share_init,
+    ssh_share_free,
+    ssh_share_reconfig,
+    ssh_share_send,
+    ssh_share_sendbuffer,
+    ssh_share_size,
+    ssh_share_special,
+    ssh_share_get_specials,
+    ssh_share_connected,
+    ssh_share_return_exitcode,
+    ssh_share_sendok,
+    ssh_share_ldisc,
+    ssh_share_provide_ldisc,
+    ssh_share_provide_logctx,
+    ssh_share_unthrottle,
+    ssh_share_cfg_info,
+    "ssh",
+    PROT_SSH,
+    22
+};
@@ -95,6 +95,15 @@ void ssh_rsakex_encrypt(const struct ssh_hash *h, unsigned char *in, int inlen,
                         unsigned char *out, int outlen,
                         void *key);
 
+/*
+ * SSH2 ECDH key exchange functions
+ */
+struct ssh_kex;
+void *ssh_ecdhkex_newkey(const struct ssh_kex *kex);
+void ssh_ecdhkex_freekey(void *key);
+char *ssh_ecdhkex_getpublic(void *key, int *len);
+Bignum ssh_ecdhkex_getkey(void *key, char *remoteKey, int remoteKeyLen);
+
 typedef struct {
     uint32 h[4];
 } MD5_Core_State;
@@ -147,7 +156,7 @@ void SHA256_Final(SHA256_State * s, unsigned char *output);
 void SHA256_Simple(const void *p, int len, unsigned char *output);
 
 typedef struct {
-    uint64 h[8];
+    unsigned long long h[8];
     unsigned char block[128];
     int blkused;
     uint32 len[4];
@@ -179,7 +188,32 @@ struct ssh2_cipher {
     int keylen;
     unsigned int flags;
 #define SSH_CIPHER_IS_CBC	1
+#define SSH_CIPHER_IS_AEAD	2
     char *text_name;
+    /*
+     * AEAD ciphers (SSH_CIPHER_IS_AEAD) need no separate MAC and
+     * don't use encrypt() and decrypt(): they encrypt and
+     * authenticate a whole packet in one go. `blk' points at the
+     * packet length field, `len' runs from there to the end of the
+     * padding, and the `authlen'-byte tag follows at blk+len.
+     * aead_length() recovers the packet length from its first four
+     * bytes as received; aead_decrypt() returns FALSE if the tag is
+     * wrong.
+     */
+    int authlen;
+    unsigned long (*aead_length) (void *, unsigned char *blk,
+				  unsigned long seq);
+    void (*aead_encrypt) (void *, unsigned char *blk, int len,
+			  unsigned long seq);
+    int (*aead_decrypt) (void *, unsigned char *blk, int len,
+			 unsigned long seq);
+    /*
+     * Optional: do ahead of time whatever work the next encrypt() or
+     * decrypt() can be spared, such as generating CTR keystream.
+     * Called at idle moments, never while a worker is using the
+     * context.
+     */
+    void (*precompute) (void *);
 };
 
 struct ssh2_ciphers {
@@ -200,6 +234,12 @@ struct ssh_mac {
     void (*genresult) (void *, unsigned char *);
     int (*verresult) (void *, unsigned char const *);
     char *name;
+    /*
+     * Name of the encrypt-then-MAC variant, in which the MAC covers
+     * the ciphertext and the packet length is sent in clear, or NULL
+     * if there isn't one.
+     */
+    char *etm_name;
     int len;
     char *text_name;
 };
@@ -214,11 +254,13 @@ struct ssh_hash {
 
 struct ssh_kex {
     char *name, *groupname;
-    enum { KEXTYPE_DH, KEXTYPE_RSA } main_type;
+    enum { KEXTYPE_DH, KEXTYPE_RSA, KEXTYPE_ECDH } main_type;
     /* For DH */
     const unsigned char *pdata, *gdata; /* NULL means group exchange */
     int plen, glen;
     const struct ssh_hash *hash;
+    /* For ECDH: the curve (private to sshecc.c) */
+    const void *extra;
 };
 
 struct ssh_kexes {
@@ -280,19 +322,26 @@ extern const struct ssh2_ciphers ssh2_des;
 extern const struct ssh2_ciphers ssh2_aes;
 extern const struct ssh2_ciphers ssh2_blowfish;
 extern const struct ssh2_ciphers ssh2_arcfour;
+extern const struct ssh2_ciphers ssh2_aesgcm;
+extern const struct ssh2_ciphers ssh2_ccp;
 extern const struct ssh_hash ssh_sha1;
 extern const struct ssh_hash ssh_sha256;
 extern const struct ssh_kexes ssh_diffiehellman_group1;
 extern const struct ssh_kexes ssh_diffiehellman_group14;
 extern const struct ssh_kexes ssh_diffiehellman_gex;
 extern const struct ssh_kexes ssh_rsa_kex;
+extern const struct ssh_kexes ssh_ecdh_kex;
 extern const struct ssh_signkey ssh_dss;
 extern const struct ssh_signkey ssh_rsa;
+extern const struct ssh_signkey ssh_ecdsa_ed25519;
+extern const struct ssh_signkey ssh_ecdsa_nistp256;
 extern const struct ssh_mac ssh_hmac_md5;
 extern const struct ssh_mac ssh_hmac_sha1;
 extern const struct ssh_mac ssh_hmac_sha1_buggy;
 extern const struct ssh_mac ssh_hmac_sha1_96;
 extern const struct ssh_mac ssh_hmac_sha1_96_buggy;
+extern const struct ssh_mac ssh_hmac_sha2_256;
+extern const struct ssh_mac ssh_hmac_sha2_512;
 
 void *aes_make_context(void);
 void aes_free_context(void *handle);
@@ -302,6 +351,20 @@ void aes256_key(void *handle, unsigned char *key);
 void aes_iv(void *handle, unsigned char *iv);
 void aes_ssh2_encrypt_blk(void *handle, unsigned char *blk, int len);
 void aes_ssh2_decrypt_blk(void *handle, unsigned char *blk, int len);
+void aes_ssh2_sdctr(void *handle, unsigned char *blk, int len);
+void aes_ssh2_sdctr_precompute(void *handle);
+
+void *blowfish_make_context(void);
+void blowfish_free_context(void *handle);
+void blowfish_initkey(void *handle);
+void blowfish_expandkey(void *handle,
+			const unsigned char *key, short keybytes,
+			const unsigned char *salt, short saltbytes);
+void blowfish_msb_encrypt_ecb(unsigned char *blk, int len, void *handle);
+
+void bcrypt_pbkdf(const char *passphrase, int passlen,
+		  const unsigned char *salt, int saltlen, int rounds,
+		  unsigned char *out, int outlen);
 
 /*
  * PuTTY version number formatted as an SSH version string. 
@@ -317,6 +380,7 @@ extern int ssh_fallback_cmd(void *handle);
 
 #ifndef MSCRYPTOAPI
 void SHATransform(word32 * digest, word32 * data);
+int sha_ni_available(void);
 #endif
 
 int random_byte(void);
@@ -339,6 +403,7 @@ extern const char *pfd_addforward(char *desthost, int destport, char *srcaddr,
 				  const Config *cfg, void **sockdata,
 				  int address_family);
 extern void pfd_close(Socket s);
+extern void pfd_refused(Socket s, int reason_code);
 extern void pfd_terminate(void *sockdata);
 extern int pfd_send(Socket s, char *data, int len);
 extern void pfd_confirm(Socket s);
@@ -500,7 +565,8 @@ enum {
     SSH_KEYTYPE_UNOPENABLE,
     SSH_KEYTYPE_UNKNOWN,
     SSH_KEYTYPE_SSH1, SSH_KEYTYPE_SSH2,
-    SSH_KEYTYPE_OPENSSH, SSH_KEYTYPE_SSHCOM
+    SSH_KEYTYPE_OPENSSH, SSH_KEYTYPE_SSHCOM,
+    SSH_KEYTYPE_OPENSSH_NEW
 };
 int key_type(const Filename *filename);
 char *key_type_to_str(int type);
@@ -555,6 +621,7 @@ Bignum primegen(int bits, int modulus, int residue, Bignum factor,
  */
 void *zlib_compress_init(void);
 void zlib_compress_cleanup(void *);
+void zlib_compress_level(void *, int level);
 void *zlib_decompress_init(void);
 void zlib_decompress_cleanup(void *);
 int zlib_compress_block(void *, unsigned char *block, int len,
@@ -32,9 +32,34 @@
 
 #include "ssh.h"
 
+/*
+ * On x86 we can use the AES-NI instructions when the processor has
+ * them. The code for them is compiled with a per-function target
+ * attribute (GCC, clang) or unconditionally (MSVC), and only ever
+ * called once CPUID has said the instructions exist. Define NO_AES_NI
+ * to leave it out altogether.
+ */
+#if !defined(NO_AES_NI) && \
+    ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+#define AES_NI
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AES_NI_FUNC
+#define AES_NI_GCM_FUNC
+#else
+#include <cpuid.h>
+#define AES_NI_FUNC __attribute__((target("aes,sse2")))
+#define AES_NI_GCM_FUNC __attribute__((target("aes,pclmul,ssse3,sse2")))
+#endif
+#endif
+
 #define MAX_NR 14		       /* max no of rounds */
 #define MAX_NK 8		       /* max no of words in input key */
 #define MAX_NB 8		       /* max no of words in cipher blk */
+#define KSBUF 512		       /* bytes of SDCTR keystream kept ready */
 
 #define mulby2(x) ( ((x&0x7F) << 1) ^ (x & 0x80 ? 0x1B : 0) )
 
@@ -47,6 +72,23 @@ struct AESContext {
     void (*decrypt) (AESContext * ctx, word32 * block);
     word32 iv[MAX_NB];
     int Nb, Nr;
+#ifdef AES_NI
+    /*
+     * Byte-serialised copies of keysched and invkeysched, in the
+     * form the AESENC and AESDEC instructions take them. Only set up
+     * (and `hw' only set) for 128-bit blocks on capable processors.
+     */
+    unsigned char hwkeys[(MAX_NR + 1) * 16];
+    unsigned char hwinvkeys[(MAX_NR + 1) * 16];
+    int hw;
+#endif
+    /*
+     * SDCTR keystream made in advance by aes_ssh2_sdctr_precompute().
+     * ks[kspos..kslen) belongs to the counter values just before
+     * `iv', so aes_sdctr() uses it up before generating any more.
+     */
+    unsigned char ks[KSBUF];
+    int kspos, kslen;
 };
 
 static const unsigned char Sbox[256] = {
@@ -921,6 +963,214 @@ static void aes_decrypt_nb_8(AESContext * ctx, word32 * block)
 #undef LASTWORD
 
 
+#ifdef AES_NI
+
+#ifdef _MSC_VER
+typedef unsigned __int64 aes_ni_u64;
+#define AES_NI_BSWAP64(x) ((__int64)_byteswap_uint64(x))
+#else
+typedef unsigned long long aes_ni_u64;
+#define AES_NI_BSWAP64(x) ((long long)__builtin_bswap64(x))
+#endif
+
+/*
+ * AESENC has a latency of several cycles but can start a new one
+ * every cycle, so the bulk loops below keep several independent
+ * blocks in flight to hide the latency.
+ */
+
+static AES_NI_FUNC __m128i aes_ni_encrypt_block(const unsigned char *keys,
+						int Nr, __m128i b)
+{
+    int r;
+    b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)keys));
+    for (r = 1; r < Nr; r++)
+	b = _mm_aesenc_si128(b, _mm_loadu_si128((const __m128i *)
+						(keys + 16 * r)));
+    return _mm_aesenclast_si128(b, _mm_loadu_si128((const __m128i *)
+						   (keys + 16 * Nr)));
+}
+
+static AES_NI_FUNC __m128i aes_ni_decrypt_block(const unsigned char *keys,
+						int Nr, __m128i b)
+{
+    int r;
+    b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)keys));
+    for (r = 1; r < Nr; r++)
+	b = _mm_aesdec_si128(b, _mm_loadu_si128((const __m128i *)
+						(keys + 16 * r)));
+    return _mm_aesdeclast_si128(b, _mm_loadu_si128((const __m128i *)
+						   (keys + 16 * Nr)));
+}
+
+static void aes_ni_get_iv(AESContext *ctx, unsigned char *iv)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	PUT_32BIT_MSB_FIRST(iv + 4 * i, ctx->iv[i]);
+}
+
+static void aes_ni_set_iv(AESContext *ctx, const unsigned char *iv)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	ctx->iv[i] = GET_32BIT_MSB_FIRST(iv + 4 * i);
+}
+
+static AES_NI_FUNC void aes_ni_encrypt_cbc(unsigned char *blk, int len,
+					   AESContext *ctx)
+{
+    unsigned char ivbuf[16];
+    __m128i iv;
+
+    aes_ni_get_iv(ctx, ivbuf);
+    iv = _mm_loadu_si128((const __m128i *)ivbuf);
+    for (; len > 0; blk += 16, len -= 16) {
+	iv = _mm_xor_si128(iv, _mm_loadu_si128((const __m128i *)blk));
+	iv = aes_ni_encrypt_block(ctx->hwkeys, ctx->Nr, iv);
+	_mm_storeu_si128((__m128i *)blk, iv);
+    }
+    _mm_storeu_si128((__m128i *)ivbuf, iv);
+    aes_ni_set_iv(ctx, ivbuf);
+}
+
+static AES_NI_FUNC void aes_ni_decrypt_cbc(unsigned char *blk, int len,
+					   AESContext *ctx)
+{
+    const unsigned char *keys = ctx->hwinvkeys;
+    unsigned char ivbuf[16];
+    __m128i iv, c0, c1, c2, c3, p0, p1, p2, p3, k;
+    int r, Nr = ctx->Nr;
+
+    aes_ni_get_iv(ctx, ivbuf);
+    iv = _mm_loadu_si128((const __m128i *)ivbuf);
+
+    /* Unlike encryption, CBC decryption of several blocks can overlap. */
+    for (; len >= 64; blk += 64, len -= 64) {
+	c0 = _mm_loadu_si128((const __m128i *)blk);
+	c1 = _mm_loadu_si128((const __m128i *)(blk + 16));
+	c2 = _mm_loadu_si128((const __m128i *)(blk + 32));
+	c3 = _mm_loadu_si128((const __m128i *)(blk + 48));
+	k = _mm_loadu_si128((const __m128i *)keys);
+	p0 = _mm_xor_si128(c0, k);
+	p1 = _mm_xor_si128(c1, k);
+	p2 = _mm_xor_si128(c2, k);
+	p3 = _mm_xor_si128(c3, k);
+	for (r = 1; r < Nr; r++) {
+	    k = _mm_loadu_si128((const __m128i *)(keys + 16 * r));
+	    p0 = _mm_aesdec_si128(p0, k);
+	    p1 = _mm_aesdec_si128(p1, k);
+	    p2 = _mm_aesdec_si128(p2, k);
+	    p3 = _mm_aesdec_si128(p3, k);
+	}
+	k = _mm_loadu_si128((const __m128i *)(keys + 16 * Nr));
+	p0 = _mm_xor_si128(_mm_aesdeclast_si128(p0, k), iv);
+	p1 = _mm_xor_si128(_mm_aesdeclast_si128(p1, k), c0);
+	p2 = _mm_xor_si128(_mm_aesdeclast_si128(p2, k), c1);
+	p3 = _mm_xor_si128(_mm_aesdeclast_si128(p3, k), c2);
+	_mm_storeu_si128((__m128i *)blk, p0);
+	_mm_storeu_si128((__m128i *)(blk + 16), p1);
+	_mm_storeu_si128((__m128i *)(blk + 32), p2);
+	_mm_storeu_si128((__m128i *)(blk + 48), p3);
+	iv = c3;
+    }
+    for (; len > 0; blk += 16, len -= 16) {
+	c0 = _mm_loadu_si128((const __m128i *)blk);
+	p0 = aes_ni_decrypt_block(keys, Nr, c0);
+	_mm_storeu_si128((__m128i *)blk, _mm_xor_si128(p0, iv));
+	iv = c0;
+    }
+    _mm_storeu_si128((__m128i *)ivbuf, iv);
+    aes_ni_set_iv(ctx, ivbuf);
+}
+
+static AES_NI_FUNC void aes_ni_sdctr(unsigned char *blk, int len,
+				     AESContext *ctx)
+{
+    const unsigned char *keys = ctx->hwkeys;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7, k;
+    aes_ni_u64 hi, lo;
+    int r, Nr = ctx->Nr;
+
+    /* The 128-bit big-endian counter, as two native 64-bit halves. */
+    hi = ((aes_ni_u64)ctx->iv[0] << 32) | ctx->iv[1];
+    lo = ((aes_ni_u64)ctx->iv[2] << 32) | ctx->iv[3];
+
+#define CTR_NEXT(b) do {						\
+	b = _mm_set_epi64x(AES_NI_BSWAP64(lo), AES_NI_BSWAP64(hi));	\
+	if (++lo == 0)							\
+	    hi++;							\
+    } while (0)
+#define CTR_OUT(b, i) _mm_storeu_si128((__m128i *)(blk + 16 * (i)),	\
+	_mm_xor_si128(b, _mm_loadu_si128((const __m128i *)(blk + 16 * (i)))))
+
+    /* Eight blocks at a time keep the AES unit busy. */
+    for (; len >= 128; blk += 128, len -= 128) {
+	CTR_NEXT(b0); CTR_NEXT(b1); CTR_NEXT(b2); CTR_NEXT(b3);
+	CTR_NEXT(b4); CTR_NEXT(b5); CTR_NEXT(b6); CTR_NEXT(b7);
+	k = _mm_loadu_si128((const __m128i *)keys);
+	b0 = _mm_xor_si128(b0, k); b1 = _mm_xor_si128(b1, k);
+	b2 = _mm_xor_si128(b2, k); b3 = _mm_xor_si128(b3, k);
+	b4 = _mm_xor_si128(b4, k); b5 = _mm_xor_si128(b5, k);
+	b6 = _mm_xor_si128(b6, k); b7 = _mm_xor_si128(b7, k);
+	for (r = 1; r < Nr; r++) {
+	    k = _mm_loadu_si128((const __m128i *)(keys + 16 * r));
+	    b0 = _mm_aesenc_si128(b0, k); b1 = _mm_aesenc_si128(b1, k);
+	    b2 = _mm_aesenc_si128(b2, k); b3 = _mm_aesenc_si128(b3, k);
+	    b4 = _mm_aesenc_si128(b4, k); b5 = _mm_aesenc_si128(b5, k);
+	    b6 = _mm_aesenc_si128(b6, k); b7 = _mm_aesenc_si128(b7, k);
+	}
+	k = _mm_loadu_si128((const __m128i *)(keys + 16 * Nr));
+	CTR_OUT(_mm_aesenclast_si128(b0, k), 0);
+	CTR_OUT(_mm_aesenclast_si128(b1, k), 1);
+	CTR_OUT(_mm_aesenclast_si128(b2, k), 2);
+	CTR_OUT(_mm_aesenclast_si128(b3, k), 3);
+	CTR_OUT(_mm_aesenclast_si128(b4, k), 4);
+	CTR_OUT(_mm_aesenclast_si128(b5, k), 5);
+	CTR_OUT(_mm_aesenclast_si128(b6, k), 6);
+	CTR_OUT(_mm_aesenclast_si128(b7, k), 7);
+    }
+    for (; len > 0; blk += 16, len -= 16) {
+	CTR_NEXT(b0);
+	CTR_OUT(aes_ni_encrypt_block(keys, Nr, b0), 0);
+    }
+
+#undef CTR_NEXT
+#undef CTR_OUT
+
+    ctx->iv[0] = (word32)(hi >> 32);
+    ctx->iv[1] = (word32)hi;
+    ctx->iv[2] = (word32)(lo >> 32);
+    ctx->iv[3] = (word32)lo;
+}
+
+static int aes_ni_enabled(void);
+
+static void aes_ni_setup(AESContext *ctx)
+{
+    int i;
+    for (i = 0; i < (ctx->Nr + 1) * 4; i++) {
+	PUT_32BIT_MSB_FIRST(ctx->hwkeys + 4 * i, ctx->keysched[i]);
+	PUT_32BIT_MSB_FIRST(ctx->hwinvkeys + 4 * i, ctx->invkeysched[i]);
+    }
+}
+
+static int aes_ni_cpu_supported(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 25) & 1;
+#else
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+	return FALSE;
+    return (c & bit_AES) && (d & bit_SSE2);
+#endif
+}
+
+#endif /* AES_NI */
+
 /*
  * Set up an AESContext. `keylen' and `blocklen' are measured in
  * bytes; each can be either 16 (128-bit), 24 (192-bit), or 32
@@ -934,6 +1184,8 @@ static void aes_setup(AESContext * ctx, int blocklen,
     assert(blocklen == 16 || blocklen == 24 || blocklen == 32);
     assert(keylen == 16 || keylen == 24 || keylen == 32);
 
+    ctx->kspos = ctx->kslen = 0;
+
     /*
      * Basic parameters. Words per block, words in key, rounds.
      */
@@ -1013,8 +1265,20 @@ static void aes_setup(AESContext * ctx, int blocklen,
 	    ctx->invkeysched[i * ctx->Nb + j] = temp;
 	}
     }
+
+#ifdef AES_NI
+    /*
+     * The table code's schedules are exactly what AESENC and AESDEC
+     * expect (the inverse one already has InvMixColumns applied), so
+     * the hardware keys are just those words in byte order.
+     */
+    ctx->hw = (ctx->Nb == 4 && aes_ni_enabled());
+    if (ctx->hw)
+	aes_ni_setup(ctx);
+#endif
 }
 
+
 static void aes_encrypt(AESContext * ctx, word32 * block)
 {
     ctx->encrypt(ctx, block);
@@ -1032,6 +1296,13 @@ static void aes_encrypt_cbc(unsigned char *blk, int len, AESContext * ctx)
 
     assert((len & 15) == 0);
 
+#ifdef AES_NI
+    if (ctx->hw) {
+	aes_ni_encrypt_cbc(blk, len, ctx);
+	return;
+    }
+#endif
+
     memcpy(iv, ctx->iv, sizeof(iv));
 
     while (len > 0) {
@@ -1054,6 +1325,13 @@ static void aes_decrypt_cbc(unsigned char *blk, int len, AESContext * ctx)
 
     assert((len & 15) == 0);
 
+#ifdef AES_NI
+    if (ctx->hw) {
+	aes_ni_decrypt_cbc(blk, len, ctx);
+	return;
+    }
+#endif
+
     memcpy(iv, ctx->iv, sizeof(iv));
 
     while (len > 0) {
@@ -1078,6 +1356,31 @@ static void aes_sdctr(unsigned char *blk, int len, AESContext *ctx)
 
     assert((len & 15) == 0);
 
+    if (ctx->kspos < ctx->kslen) {
+	int n = ctx->kslen - ctx->kspos;
+	unsigned char *ks = ctx->ks + ctx->kspos;
+	if (n > len)
+	    n = len;
+	ctx->kspos += n;
+	len -= n;
+	for (; n > 0; n -= 4, blk += 4, ks += 4) {
+	    word32 x, k;
+	    memcpy(&x, blk, 4);
+	    memcpy(&k, ks, 4);
+	    x ^= k;
+	    memcpy(blk, &x, 4);
+	}
+	if (len == 0)
+	    return;
+    }
+
+#ifdef AES_NI
+    if (ctx->hw) {
+	aes_ni_sdctr(blk, len, ctx);
+	return;
+    }
+#endif
+
     memcpy(iv, ctx->iv, sizeof(iv));
 
     while (len > 0) {
@@ -1097,6 +1400,66 @@ static void aes_sdctr(unsigned char *blk, int len, AESContext *ctx)
     memcpy(ctx->iv, iv, sizeof(iv));
 }
 
+#ifdef AES_NI
+/*
+ * Use AES-NI only if CPUID advertises it and it reproduces the
+ * FIPS-197 appendix C example vectors, checked against the table
+ * code, the first time anyone asks.
+ */
+static int aes_ni_enabled(void)
+{
+    static int state = -1;
+    static const unsigned char pt[16] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+    };
+    static const unsigned char ct128[16] = {
+	0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+	0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+    };
+    static const unsigned char ct256[16] = {
+	0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+	0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+    };
+    unsigned char key[32], tab[16], hw[16];
+    AESContext ctx;
+    int i, k, ok;
+
+    if (state >= 0)
+	return state;
+
+    state = 0;			       /* aes_setup below uses the tables */
+    if (!aes_ni_cpu_supported())
+	return state;
+
+    for (i = 0; i < 32; i++)
+	key[i] = i;
+    ok = TRUE;
+    for (k = 16; k <= 32; k += 16) {
+	aes_setup(&ctx, 16, key, k);
+	aes_ni_setup(&ctx);
+
+	memcpy(tab, pt, 16);
+	memset(ctx.iv, 0, sizeof(ctx.iv));
+	aes_encrypt_cbc(tab, 16, &ctx);
+	memcpy(hw, pt, 16);
+	memset(ctx.iv, 0, sizeof(ctx.iv));
+	aes_ni_encrypt_cbc(hw, 16, &ctx);
+	if (memcmp(tab, k == 16 ? ct128 : ct256, 16) || memcmp(hw, tab, 16))
+	    ok = FALSE;
+
+	memset(ctx.iv, 0, sizeof(ctx.iv));
+	aes_ni_decrypt_cbc(hw, 16, &ctx);
+	if (memcmp(hw, pt, 16))
+	    ok = FALSE;
+    }
+    memset(&ctx, 0, sizeof(ctx));
+
+    state = ok;
+    return state;
+}
+#endif
+
 void *aes_make_context(void)
 {
     return snew(AESContext);
@@ -1131,6 +1494,7 @@ void aes_iv(void *handle, unsigned char *iv)
     int i;
     for (i = 0; i < 4; i++)
 	ctx->iv[i] = GET_32BIT_MSB_FIRST(iv + 4 * i);
+    ctx->kspos = ctx->kslen = 0;
 }
 
 void aes_ssh2_encrypt_blk(void *handle, unsigned char *blk, int len)
@@ -1145,12 +1509,31 @@ void aes_ssh2_decrypt_blk(void *handle, unsigned char *blk, int len)
     aes_decrypt_cbc(blk, len, ctx);
 }
 
-static void aes_ssh2_sdctr(void *handle, unsigned char *blk, int len)
+void aes_ssh2_sdctr(void *handle, unsigned char *blk, int len)
 {
     AESContext *ctx = (AESContext *)handle;
     aes_sdctr(blk, len, ctx);
 }
 
+/*
+ * Top up the keystream buffer, so that the next few small packets
+ * (keystrokes, mostly) cost only an XOR. ssh.c calls this when
+ * nothing else is happening.
+ */
+void aes_ssh2_sdctr_precompute(void *handle)
+{
+    AESContext *ctx = (AESContext *)handle;
+    int have = ctx->kslen - ctx->kspos;
+
+    if (have == KSBUF)
+	return;
+    memmove(ctx->ks, ctx->ks + ctx->kspos, have);
+    memset(ctx->ks + have, 0, KSBUF - have);
+    ctx->kspos = ctx->kslen = 0;
+    aes_sdctr(ctx->ks + have, KSBUF - have, ctx);
+    ctx->kslen = KSBUF;
+}
+
 void aes256_encrypt_pubkey(unsigned char *key, unsigned char *blk, int len)
 {
     AESContext ctx;
@@ -1169,25 +1552,505 @@ void aes256_decrypt_pubkey(unsigned char *key, unsigned char *blk, int len)
     memset(&ctx, 0, sizeof(ctx));
 }
 
+/* ----------------------------------------------------------------------
+ * AES-GCM (RFC 5647, in the form OpenSSH calls aes*-gcm@openssh.com).
+ *
+ * The packet length field is the additional authenticated data and
+ * is sent in clear; the rest of the packet is encrypted in counter
+ * mode and hashed with GHASH, a block at a time, in the same loop.
+ * The 12-byte IV is a 4-byte fixed field and an 8-byte big-endian
+ * invocation counter which goes up by one per packet.
+ *
+ * GHASH is done with PCLMULQDQ where the processor has it (along with
+ * AES-NI), and otherwise with Shoup's 4-bit table method.
+ */
+
+typedef struct AESGCMContext AESGCMContext;
+
+struct AESGCMContext {
+    AESContext aes;
+    unsigned char iv[12];
+    /* htab[i] is the hash key H times the 4-bit polynomial i. */
+    word32 htab[16][4];
+#ifdef AES_NI
+    /* H, H^2, H^3, H^4, byte-reversed, for four-block aggregation. */
+    unsigned char hpow[4][16];
+    int clmul;
+#endif
+};
+
+/* Reduction constants for shifting a GHASH value right by four bits. */
+static const word32 gcm_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void gcm_setup_table(AESGCMContext *ctx, const word32 *h)
+{
+    word32 v[4], t;
+    int i, j, k;
+
+    memset(ctx->htab, 0, sizeof(ctx->htab));
+    memcpy(v, h, sizeof(v));
+    memcpy(ctx->htab[8], v, sizeof(v));
+    for (i = 4; i > 0; i >>= 1) {
+	/* v *= x: a right shift in GCM's reflected bit order. */
+	t = (v[3] & 1) ? 0xe1000000 : 0;
+	v[3] = (v[3] >> 1) | (v[2] << 31);
+	v[2] = (v[2] >> 1) | (v[1] << 31);
+	v[1] = (v[1] >> 1) | (v[0] << 31);
+	v[0] = (v[0] >> 1) ^ t;
+	memcpy(ctx->htab[i], v, sizeof(v));
+    }
+    for (i = 2; i <= 8; i *= 2)
+	for (j = 1; j < i; j++)
+	    for (k = 0; k < 4; k++)
+		ctx->htab[i + j][k] = ctx->htab[i][k] ^ ctx->htab[j][k];
+}
+
+/* x *= H, with x as four big-endian words. */
+static void gcm_mult(AESGCMContext *ctx, word32 *x)
+{
+    word32 z[4], rem;
+    const word32 *m;
+    int i, byte;
+
+#define GCM_SHIFT4 ( \
+	rem = z[3] & 15, \
+	z[3] = (z[3] >> 4) | (z[2] << 28), \
+	z[2] = (z[2] >> 4) | (z[1] << 28), \
+	z[1] = (z[1] >> 4) | (z[0] << 28), \
+	z[0] = (z[0] >> 4) ^ (gcm_last4[rem] << 16) )
+#define GCM_ADD(m) ( z[0] ^= (m)[0], z[1] ^= (m)[1], \
+		     z[2] ^= (m)[2], z[3] ^= (m)[3] )
+
+    /* Horner's rule, four bits at a time from the far end. */
+    byte = x[3] & 0xFF;
+    memcpy(z, ctx->htab[byte & 15], sizeof(z));
+    m = ctx->htab[byte >> 4];
+    GCM_SHIFT4;
+    GCM_ADD(m);
+    for (i = 14; i >= 0; i--) {
+	byte = (x[i >> 2] >> (8 * (3 - (i & 3)))) & 0xFF;
+	GCM_SHIFT4;
+	GCM_ADD(ctx->htab[byte & 15]);
+	GCM_SHIFT4;
+	GCM_ADD(ctx->htab[byte >> 4]);
+    }
+
+#undef GCM_SHIFT4
+#undef GCM_ADD
+
+    memcpy(x, z, sizeof(z));
+}
+
+/*
+ * Encrypt or decrypt a packet in place, putting the tag in `tag'.
+ * `blk' points at the 4-byte length field and `len' runs to the end
+ * of the padding, so len-4 is a whole number of blocks.
+ */
+static void aesgcm_sw_crypt(AESGCMContext *ctx, unsigned char *blk, int len,
+			    int encrypt, unsigned char *tag)
+{
+    word32 x[4], ctr[4], ks[4], w;
+    unsigned char *p;
+    int i, n;
+
+    /* The length field, padded out to a block, is hashed first. */
+    x[0] = GET_32BIT_MSB_FIRST(blk);
+    x[1] = x[2] = x[3] = 0;
+    gcm_mult(ctx, x);
+
+    for (i = 0; i < 3; i++)
+	ctr[i] = GET_32BIT_MSB_FIRST(ctx->iv + 4 * i);
+    ctr[3] = 1;
+
+    for (p = blk + 4, n = len - 4; n > 0; p += 16, n -= 16) {
+	ctr[3]++;
+	memcpy(ks, ctr, sizeof(ks));
+	aes_encrypt(&ctx->aes, ks);
+	for (i = 0; i < 4; i++) {
+	    w = GET_32BIT_MSB_FIRST(p + 4 * i);
+	    if (!encrypt)
+		x[i] ^= w;
+	    w ^= ks[i];
+	    PUT_32BIT_MSB_FIRST(p + 4 * i, w);
+	    if (encrypt)
+		x[i] ^= w;
+	}
+	gcm_mult(ctx, x);
+    }
+
+    /* Then the bit lengths of the length field and the ciphertext. */
+    x[1] ^= 32;
+    x[3] ^= (word32)(len - 4) << 3;
+    gcm_mult(ctx, x);
+
+    ctr[3] = 1;
+    aes_encrypt(&ctx->aes, ctr);
+    for (i = 0; i < 4; i++)
+	PUT_32BIT_MSB_FIRST(tag + 4 * i, x[i] ^ ctr[i]);
+
+    memset(ks, 0, sizeof(ks));
+}
+
+#ifdef AES_NI
+
+/*
+ * GHASH with PCLMULQDQ, following Gueron and Kounavis's "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing
+ * the GCM Mode". Values are kept byte-reversed, so that GCM's
+ * reflected bit order becomes a one-bit shift of the 256-bit product
+ * before reduction.
+ */
+
+/* Accumulate the 256-bit carry-less product of a and b. */
+#define GCM_CLMUL_ACC(a, b, lo, mid, hi) do {				\
+	lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));	\
+	hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));	\
+	mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));	\
+	mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));	\
+    } while (0)
+
+/* Reduce an accumulated product modulo the GCM polynomial. */
+static AES_NI_GCM_FUNC __m128i gcm_clmul_reduce(__m128i lo, __m128i mid,
+						__m128i hi)
+{
+    __m128i t7, t8, t9;
+
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    /* Shift the whole product left by one bit. */
+    t7 = _mm_srli_epi32(lo, 31);
+    t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    /* Fold the low half into the high half. */
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+    t9 = _mm_srli_epi32(lo, 1);
+    t7 = _mm_srli_epi32(lo, 2);
+    t9 = _mm_xor_si128(t9, t7);
+    t7 = _mm_srli_epi32(lo, 7);
+    t9 = _mm_xor_si128(t9, t7);
+    t9 = _mm_xor_si128(t9, t8);
+    lo = _mm_xor_si128(lo, t9);
+    return _mm_xor_si128(hi, lo);
+}
+
+static AES_NI_GCM_FUNC __m128i gcm_clmul_mult(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+    GCM_CLMUL_ACC(a, b, lo, mid, hi);
+    return gcm_clmul_reduce(lo, mid, hi);
+}
+
+static AES_NI_GCM_FUNC void aes_ni_gcm_setup(AESGCMContext *ctx,
+					     const unsigned char *h)
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				       8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h1, hn;
+    int i;
+
+    h1 = hn = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), bswap);
+    _mm_storeu_si128((__m128i *)ctx->hpow[0], h1);
+    for (i = 1; i < 4; i++) {
+	hn = gcm_clmul_mult(hn, h1);
+	_mm_storeu_si128((__m128i *)ctx->hpow[i], hn);
+    }
+}
+
+static AES_NI_GCM_FUNC void aes_ni_gcm_crypt(AESGCMContext *ctx,
+					     unsigned char *blk, int len,
+					     int encrypt, unsigned char *tag)
+{
+    const unsigned char *keys = ctx->aes.hwkeys;
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				       8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i h1, h2, h3, h4, x, ctr, j0, k, lo, mid, hi;
+    __m128i b0, b1, b2, b3, c0, c1, c2, c3;
+    unsigned char cb[16];
+    unsigned char *p;
+    int r, n, Nr = ctx->aes.Nr;
+
+    h1 = _mm_loadu_si128((const __m128i *)ctx->hpow[0]);
+    h2 = _mm_loadu_si128((const __m128i *)ctx->hpow[1]);
+    h3 = _mm_loadu_si128((const __m128i *)ctx->hpow[2]);
+    h4 = _mm_loadu_si128((const __m128i *)ctx->hpow[3]);
+
+    /* The length field, padded out to a block, is hashed first. */
+    memset(cb, 0, sizeof(cb));
+    memcpy(cb, blk, 4);
+    x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cb), bswap);
+    x = gcm_clmul_mult(x, h1);
+
+    /*
+     * The counter block is kept byte-reversed too, which puts its
+     * big-endian 32-bit counter in the bottom lane for _mm_add_epi32.
+     */
+    memcpy(cb, ctx->iv, 12);
+    PUT_32BIT_MSB_FIRST(cb + 12, 1);
+    j0 = ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cb), bswap);
+
+#define GCM_CTR_NEXT(b) do {						\
+	ctr = _mm_add_epi32(ctr, one);					\
+	b = _mm_shuffle_epi8(ctr, bswap);				\
+    } while (0)
+#define GCM_CRYPT(b, c, i) do {						\
+	__m128i d = _mm_loadu_si128((const __m128i *)(p + 16 * (i)));	\
+	__m128i e = _mm_xor_si128(d, b);				\
+	_mm_storeu_si128((__m128i *)(p + 16 * (i)), e);			\
+	c = _mm_shuffle_epi8(encrypt ? e : d, bswap);			\
+    } while (0)
+
+    /* Four blocks at a time: AES in parallel, then one GHASH reduction. */
+    for (p = blk + 4, n = len - 4; n >= 64; p += 64, n -= 64) {
+	GCM_CTR_NEXT(b0); GCM_CTR_NEXT(b1);
+	GCM_CTR_NEXT(b2); GCM_CTR_NEXT(b3);
+	k = _mm_loadu_si128((const __m128i *)keys);
+	b0 = _mm_xor_si128(b0, k); b1 = _mm_xor_si128(b1, k);
+	b2 = _mm_xor_si128(b2, k); b3 = _mm_xor_si128(b3, k);
+	for (r = 1; r < Nr; r++) {
+	    k = _mm_loadu_si128((const __m128i *)(keys + 16 * r));
+	    b0 = _mm_aesenc_si128(b0, k); b1 = _mm_aesenc_si128(b1, k);
+	    b2 = _mm_aesenc_si128(b2, k); b3 = _mm_aesenc_si128(b3, k);
+	}
+	k = _mm_loadu_si128((const __m128i *)(keys + 16 * Nr));
+	b0 = _mm_aesenclast_si128(b0, k); b1 = _mm_aesenclast_si128(b1, k);
+	b2 = _mm_aesenclast_si128(b2, k); b3 = _mm_aesenclast_si128(b3, k);
+
+	GCM_CRYPT(b0, c0, 0); GCM_CRYPT(b1, c1, 1);
+	GCM_CRYPT(b2, c2, 2); GCM_CRYPT(b3, c3, 3);
+
+	/* x = (x + c0) H^4 + c1 H^3 + c2 H^2 + c3 H */
+	c0 = _mm_xor_si128(c0, x);
+	lo = mid = hi = _mm_setzero_si128();
+	GCM_CLMUL_ACC(c0, h4, lo, mid, hi);
+	GCM_CLMUL_ACC(c1, h3, lo, mid, hi);
+	GCM_CLMUL_ACC(c2, h2, lo, mid, hi);
+	GCM_CLMUL_ACC(c3, h1, lo, mid, hi);
+	x = gcm_clmul_reduce(lo, mid, hi);
+    }
+    for (; n > 0; p += 16, n -= 16) {
+	GCM_CTR_NEXT(b0);
+	b0 = aes_ni_encrypt_block(keys, Nr, b0);
+	GCM_CRYPT(b0, c0, 0);
+	x = gcm_clmul_mult(_mm_xor_si128(x, c0), h1);
+    }
+
+#undef GCM_CTR_NEXT
+#undef GCM_CRYPT
+
+    /* Then the bit lengths of the length field and the ciphertext. */
+    x = _mm_xor_si128(x, _mm_set_epi32(0, 32, 0, (len - 4) << 3));
+    x = gcm_clmul_mult(x, h1);
+
+    b0 = aes_ni_encrypt_block(keys, Nr, _mm_shuffle_epi8(j0, bswap));
+    _mm_storeu_si128((__m128i *)tag,
+		     _mm_xor_si128(_mm_shuffle_epi8(x, bswap), b0));
+}
+
+#undef GCM_CLMUL_ACC
+
+static int aes_ni_gcm_cpu_supported(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return ((info[2] >> 1) & 1) && ((info[2] >> 9) & 1);
+#else
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+	return FALSE;
+    return (c & bit_PCLMUL) && (c & bit_SSSE3);
+#endif
+}
+
+/*
+ * Use the PCLMULQDQ code only if it agrees with the table code on a
+ * sample packet, checked the first time anyone asks.
+ */
+static int aes_ni_gcm_enabled(void)
+{
+    static int state = -1;
+    AESGCMContext ctx;
+    unsigned char key[32], h[16], a[4 + 112], b[4 + 112], ta[16], tb[16];
+    word32 hw[4];
+    int i;
+
+    if (state >= 0)
+	return state;
+
+    state = 0;
+    if (!aes_ni_enabled() || !aes_ni_gcm_cpu_supported())
+	return state;
+
+    for (i = 0; i < 32; i++)
+	key[i] = i;
+    aes_setup(&ctx.aes, 16, key, 32);
+    memset(hw, 0, sizeof(hw));
+    aes_encrypt(&ctx.aes, hw);
+    for (i = 0; i < 4; i++)
+	PUT_32BIT_MSB_FIRST(h + 4 * i, hw[i]);
+    gcm_setup_table(&ctx, hw);
+    aes_ni_gcm_setup(&ctx, h);
+    for (i = 0; i < 12; i++)
+	ctx.iv[i] = 0xF0 + i;
+    for (i = 0; i < (int)sizeof(a); i++)
+	a[i] = b[i] = (unsigned char)(i * 7);
+
+    aesgcm_sw_crypt(&ctx, a, sizeof(a), TRUE, ta);
+    aes_ni_gcm_crypt(&ctx, b, sizeof(b), TRUE, tb);
+    state = !memcmp(a, b, sizeof(a)) && !memcmp(ta, tb, sizeof(ta));
+    memset(&ctx, 0, sizeof(ctx));
+    return state;
+}
+
+#endif /* AES_NI */
+
+static void *aesgcm_make_context(void)
+{
+    return snew(AESGCMContext);
+}
+
+static void aesgcm_free_context(void *handle)
+{
+    AESGCMContext *ctx = (AESGCMContext *)handle;
+    memset(ctx, 0, sizeof(*ctx));
+    sfree(ctx);
+}
+
+static void aesgcm_setup(AESGCMContext *ctx, unsigned char *key, int keylen)
+{
+    word32 hw[4];
+
+    aes_setup(&ctx->aes, 16, key, keylen);
+
+    /* The hash key H is the encryption of the zero block. */
+    memset(hw, 0, sizeof(hw));
+    aes_encrypt(&ctx->aes, hw);
+    gcm_setup_table(ctx, hw);
+#ifdef AES_NI
+    ctx->clmul = (ctx->aes.hw && aes_ni_gcm_enabled());
+    if (ctx->clmul) {
+	unsigned char h[16];
+	int i;
+	for (i = 0; i < 4; i++)
+	    PUT_32BIT_MSB_FIRST(h + 4 * i, hw[i]);
+	aes_ni_gcm_setup(ctx, h);
+	memset(h, 0, sizeof(h));
+    }
+#endif
+    memset(hw, 0, sizeof(hw));
+}
+
+static void aes128gcm_key(void *handle, unsigned char *key)
+{
+    aesgcm_setup((AESGCMContext *)handle, key, 16);
+}
+
+static void aes256gcm_key(void *handle, unsigned char *key)
+{
+    aesgcm_setup((AESGCMContext *)handle, key, 32);
+}
+
+static void aesgcm_iv(void *handle, unsigned char *iv)
+{
+    AESGCMContext *ctx = (AESGCMContext *)handle;
+    memcpy(ctx->iv, iv, 12);
+}
+
+static void aesgcm_crypt(AESGCMContext *ctx, unsigned char *blk, int len,
+			 int encrypt, unsigned char *tag)
+{
+    int i;
+
+    assert(((len - 4) & 15) == 0);
+
+#ifdef AES_NI
+    if (ctx->clmul)
+	aes_ni_gcm_crypt(ctx, blk, len, encrypt, tag);
+    else
+#endif
+	aesgcm_sw_crypt(ctx, blk, len, encrypt, tag);
+
+    /* Step the invocation counter for the next packet. */
+    for (i = 11; i >= 4; i--)
+	if (++ctx->iv[i] != 0)
+	    break;
+}
+
+static unsigned long aesgcm_length(void *handle, unsigned char *blk,
+				   unsigned long seq)
+{
+    /* The length is authenticated, but not encrypted. */
+    return GET_32BIT_MSB_FIRST(blk);
+}
+
+static void aesgcm_encrypt(void *handle, unsigned char *blk, int len,
+			   unsigned long seq)
+{
+    aesgcm_crypt((AESGCMContext *)handle, blk, len, TRUE, blk + len);
+}
+
+static int aesgcm_decrypt(void *handle, unsigned char *blk, int len,
+			  unsigned long seq)
+{
+    unsigned char tag[16];
+    int i, diff;
+
+    aesgcm_crypt((AESGCMContext *)handle, blk, len, FALSE, tag);
+
+    /* Compare the whole tag, so the time taken doesn't depend on where
+     * it differs. */
+    diff = 0;
+    for (i = 0; i < 16; i++)
+	diff |= tag[i] ^ blk[len + i];
+    if (diff) {
+	memset(blk, 0, len);	       /* don't leave forged plaintext about */
+	return FALSE;
+    }
+    return TRUE;
+}
+
 static const struct ssh2_cipher ssh_aes128_ctr = {
     aes_make_context, aes_free_context, aes_iv, aes128_key,
     aes_ssh2_sdctr, aes_ssh2_sdctr,
     "aes128-ctr",
-    16, 128, 0, "AES-128 SDCTR"
+    16, 128, 0, "AES-128 SDCTR",
+    0, NULL, NULL, NULL, aes_ssh2_sdctr_precompute
 };
 
 static const struct ssh2_cipher ssh_aes192_ctr = {
     aes_make_context, aes_free_context, aes_iv, aes192_key,
     aes_ssh2_sdctr, aes_ssh2_sdctr,
     "aes192-ctr",
-    16, 192, 0, "AES-192 SDCTR"
+    16, 192, 0, "AES-192 SDCTR",
+    0, NULL, NULL, NULL, aes_ssh2_sdctr_precompute
 };
 
 static const struct ssh2_cipher ssh_aes256_ctr = {
     aes_make_context, aes_free_context, aes_iv, aes256_key,
     aes_ssh2_sdctr, aes_ssh2_sdctr,
     "aes256-ctr",
-    16, 256, 0, "AES-256 SDCTR"
+    16, 256, 0, "AES-256 SDCTR",
+    0, NULL, NULL, NULL, aes_ssh2_sdctr_precompute
 };
 
 static const struct ssh2_cipher ssh_aes128 = {
@@ -1232,3 +2095,412 @@ const struct ssh2_ciphers ssh2_aes = {
     sizeof(aes_list) / sizeof(*aes_list),
     aes_list
 };
+
+static const struct ssh2_cipher ssh_aes128_gcm = {
+    aesgcm_make_context, aesgcm_free_context, aesgcm_iv, aes128gcm_key,
+    NULL, NULL,
+    "aes128-gcm@openssh.com",
+    16, 128, SSH_CIPHER_IS_AEAD, "AES-128 GCM",
+    16, aesgcm_length, aesgcm_encrypt, aesgcm_decrypt
+};
+
+static const struct ssh2_cipher ssh_aes256_gcm = {
+    aesgcm_make_context, aesgcm_free_context, aesgcm_iv, aes256gcm_key,
+    NULL, NULL,
+    "aes256-gcm@openssh.com",
+    16, 256, SSH_CIPHER_IS_AEAD, "AES-256 GCM",
+    16, aesgcm_length, aesgcm_encrypt, aesgcm_decrypt
+};
+
+static const struct ssh2_cipher *const aesgcm_list[] = {
+    &ssh_aes256_gcm,
+    &ssh_aes128_gcm,
+};
+
+const struct ssh2_ciphers ssh2_aesgcm = {
+    sizeof(aesgcm_list) / sizeof(*aesgcm_list),
+    aesgcm_list
+};
+
+#ifdef TESTAES
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * gcc -O2 -DTESTAES -o testaes sshaes.c misc.c
+ *
+ * Runs every cipher in this file over known-answer vectors, first
+ * with the table code and then (where the processor has it) with
+ * AES-NI and PCLMULQDQ, and then checks the two backends against
+ * each other on a run of random packets.
+ *
+ * Run it as 'testaes -b' to time both backends instead.
+ */
+
+/* Where modalfatalbox() and assert() end up; see QtStuff.h. */
+void qt_message_box_no_frontend(const char *title, const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "%s: ", title);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+/*
+ * The CBC and CTR vectors are FIPS-197 appendix C and SP 800-38A
+ * sections F.2 and F.5. There are no published GCM vectors with a
+ * four-byte AAD and a 12-byte IV, which is how SSH lays out a packet,
+ * so those were made with OpenSSL. For GCM, `pt' and `ct' both start
+ * with the packet length, and `ct' ends with the tag.
+ */
+struct aes_kat {
+    const char *cipher;
+    const char *key, *iv, *pt, *ct;
+};
+
+#define SP800_38A_PT "6bc1bee22e409f96e93d7e117393172a" \
+    "ae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52ef" \
+    "f69f2445df4f9b17ad2b417be66c3710"
+#define SP800_38A_KEY128 "2b7e151628aed2a6abf7158809cf4f3c"
+#define SP800_38A_KEY192 "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b"
+#define SP800_38A_KEY256 "603deb1015ca71be2b73aef0857d7781" \
+    "1f352c073b6108d72d9810a30914dff4"
+
+static const struct aes_kat kats[] = {
+    { "aes128-cbc", "000102030405060708090a0b0c0d0e0f",
+      "00000000000000000000000000000000",
+      "00112233445566778899aabbccddeeff",
+      "69c4e0d86a7b0430d8cdb78070b4c55a" },
+    { "aes192-cbc", "000102030405060708090a0b0c0d0e0f1011121314151617",
+      "00000000000000000000000000000000",
+      "00112233445566778899aabbccddeeff",
+      "dda97ca4864cdfe06eaf70a0ec0d7191" },
+    { "aes256-cbc",
+      "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+      "00000000000000000000000000000000",
+      "00112233445566778899aabbccddeeff",
+      "8ea2b7ca516745bfeafc49904b496089" },
+    { "aes128-cbc", SP800_38A_KEY128, "000102030405060708090a0b0c0d0e0f",
+      SP800_38A_PT,
+      "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+      "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7" },
+    { "aes192-cbc", SP800_38A_KEY192, "000102030405060708090a0b0c0d0e0f",
+      SP800_38A_PT,
+      "4f021db243bc633d7178183a9fa071e8b4d9ada9ad7dedf4e5e738763f69145a"
+      "571b242012fb7ae07fa9baac3df102e008b0e27988598881d920a9e64f5615cd" },
+    { "aes256-cbc", SP800_38A_KEY256, "000102030405060708090a0b0c0d0e0f",
+      SP800_38A_PT,
+      "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"
+      "39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b" },
+    { "aes128-ctr", SP800_38A_KEY128, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+      SP800_38A_PT,
+      "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+      "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee" },
+    { "aes192-ctr", SP800_38A_KEY192, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+      SP800_38A_PT,
+      "1abc932417521ca24f2b0459fe7e6e0b090339ec0aa6faefd5ccc2c6f4ce8e94"
+      "1e36b26bd1ebc670d1bd1d665620abf74f78a7f6d29809585a97daec58c6b050" },
+    { "aes256-ctr", SP800_38A_KEY256, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+      SP800_38A_PT,
+      "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+      "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6" },
+    { "aes128-gcm@openssh.com", "404142434445464748494a4b4c4d4e4f",
+      "a0a1a2a3a4a5a6a7a8a9aaab",
+      "00000030"
+      "01080f161d242b323940474e555c636a71787f868d949ba2a9b0b7bec5ccd3da"
+      "e1e8eff6fd040b121920272e353c434a",
+      "00000030"
+      "17607324cf72aee022dab3b88296f62b5322454391d11a32bfb8d7512fbb3885"
+      "43c136411a3a2042706218ddc55b2752"
+      "373c9cd6b568aaf5c476fdc462619f44" },
+    { "aes256-gcm@openssh.com",
+      "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f",
+      "a0a1a2a3a4a5a6a7a8a9aaab",
+      "00000030"
+      "01080f161d242b323940474e555c636a71787f868d949ba2a9b0b7bec5ccd3da"
+      "e1e8eff6fd040b121920272e353c434a",
+      "00000030"
+      "d6870929ffcfb71f402f06b0dce0539c9e6f8a4161fb1e8f4b6c59242c0ead22"
+      "bb7f9db53d542fb3f17a8fb06bd06483"
+      "61505800900d2bcc951e016a515c1afe" },
+};
+
+static const char *const backend_names[] = { "tables", "AES-NI" };
+
+static const struct ssh2_cipher *find_cipher(const char *name)
+{
+    const struct ssh2_ciphers *const lists[] = { &ssh2_aes, &ssh2_aesgcm };
+    int i, j;
+
+    for (i = 0; i < lenof(lists); i++)
+	for (j = 0; j < lists[i]->nciphers; j++)
+	    if (!strcmp(lists[i]->list[j]->name, name))
+		return lists[i]->list[j];
+    return NULL;
+}
+
+/*
+ * Set up a context for the given backend: 0 for the tables, 1 for
+ * AES-NI. Returns NULL if the latter was asked for and isn't there.
+ */
+static void *new_context(const struct ssh2_cipher *c, int hw,
+			 unsigned char *key, unsigned char *iv)
+{
+    void *ctx = c->make_context();
+    int have_hw = FALSE;
+
+    c->setkey(ctx, key);
+#ifdef AES_NI
+    if (c->flags & SSH_CIPHER_IS_AEAD) {
+	AESGCMContext *gctx = (AESGCMContext *)ctx;
+	have_hw = gctx->aes.hw;
+	if (!hw)
+	    gctx->aes.hw = gctx->clmul = 0;
+    } else {
+	AESContext *actx = (AESContext *)ctx;
+	have_hw = actx->hw;
+	if (!hw)
+	    actx->hw = 0;
+    }
+#endif
+    if (hw && !have_hw) {
+	c->free_context(ctx);
+	return NULL;
+    }
+    c->setiv(ctx, iv);
+    return ctx;
+}
+
+static int unhex(const char *hex, unsigned char *out)
+{
+    int n;
+
+    for (n = 0; hex[2 * n]; n++) {
+	unsigned v;
+	sscanf(hex + 2 * n, "%2x", &v);
+	out[n] = v;
+    }
+    return n;
+}
+
+static int run_kat(const struct aes_kat *t, int hw)
+{
+    const struct ssh2_cipher *c = find_cipher(t->cipher);
+    unsigned char key[32], iv[16], pt[256], ct[256], buf[256];
+    int len, ctlen, ok = TRUE;
+    void *ctx;
+
+    unhex(t->key, key);
+    unhex(t->iv, iv);
+    len = unhex(t->pt, pt);
+    ctlen = unhex(t->ct, ct);
+
+    ctx = new_context(c, hw, key, iv);
+    if (!ctx)
+	return -1;
+    memcpy(buf, pt, len);
+    if (c->flags & SSH_CIPHER_IS_AEAD)
+	c->aead_encrypt(ctx, buf, len, 0);
+    else
+	c->encrypt(ctx, buf, len);
+    if (memcmp(buf, ct, ctlen))
+	ok = FALSE;
+    c->free_context(ctx);
+
+    ctx = new_context(c, hw, key, iv);
+    memcpy(buf, ct, ctlen);
+    if (c->flags & SSH_CIPHER_IS_AEAD) {
+	if (!c->aead_decrypt(ctx, buf, len, 0))
+	    ok = FALSE;
+    } else
+	c->decrypt(ctx, buf, len);
+    if (memcmp(buf, pt, len))
+	ok = FALSE;
+
+    /* A GCM packet with one bit of its tag flipped must be refused. */
+    if (c->flags & SSH_CIPHER_IS_AEAD) {
+	memcpy(buf, ct, ctlen);
+	buf[ctlen - 1] ^= 1;
+	if (c->aead_decrypt(ctx, buf, len, 1))
+	    ok = FALSE;
+    }
+    c->free_context(ctx);
+
+    return ok;
+}
+
+static void fill_random(unsigned char *p, int len, unsigned long *seed)
+{
+    while (len-- > 0) {
+	*seed = *seed * 1103515245 + 12345;
+	*p++ = (unsigned char)(*seed >> 16);
+    }
+}
+
+/*
+ * Push the same run of packets, of assorted lengths, through a table
+ * context and an AES-NI one in each direction and check they agree
+ * throughout. Odd-numbered runs start the counter just short of
+ * wrapping round, to check the carry. Returns -1 if there's no AES-NI.
+ */
+static int cross_check(const struct ssh2_cipher *c, unsigned long *seed)
+{
+    int aead = (c->flags & SSH_CIPHER_IS_AEAD) != 0;
+    unsigned char key[32], iv[16], pt[4 + 1024 + 16];
+    unsigned char out[2][4 + 1024 + 16];
+    void *enc[2], *dec[2];
+    int run, pkt, b, len, ok = TRUE;
+
+    for (run = 0; run < 4 && ok; run++) {
+	fill_random(key, sizeof(key), seed);
+	fill_random(iv, sizeof(iv), seed);
+	if (run & 1)
+	    memset(aead ? iv + 4 : iv + 8, 0xff, 8);
+	for (b = 0; b < 2; b++) {
+	    enc[b] = new_context(c, b, key, iv);
+	    dec[b] = new_context(c, b, key, iv);
+	}
+	if (!enc[1]) {
+	    c->free_context(enc[0]);
+	    c->free_context(dec[0]);
+	    return -1;
+	}
+
+	for (pkt = 0; pkt < 64 && ok; pkt++) {
+	    fill_random(pt, 4, seed);
+	    len = 16 * (1 + (pt[0] & 63));
+	    if (aead)
+		len += 4;
+	    fill_random(pt, len, seed);
+
+	    for (b = 0; b < 2; b++) {
+		memcpy(out[b], pt, len);
+		if (aead)
+		    c->aead_encrypt(enc[b], out[b], len, pkt);
+		else
+		    c->encrypt(enc[b], out[b], len);
+		/* Exercise the keystream the SDCTR code makes in advance. */
+		if (c->precompute && (pkt & 1) == b)
+		    c->precompute(enc[b]);
+	    }
+	    if (memcmp(out[0], out[1], len + (aead ? c->authlen : 0)))
+		ok = FALSE;
+
+	    for (b = 0; b < 2; b++) {
+		if (aead) {
+		    if (!c->aead_decrypt(dec[b], out[b], len, pkt))
+			ok = FALSE;
+		} else
+		    c->decrypt(dec[b], out[b], len);
+		if (memcmp(out[b], pt, len))
+		    ok = FALSE;
+	    }
+	}
+
+	for (b = 0; b < 2; b++) {
+	    c->free_context(enc[b]);
+	    c->free_context(dec[b]);
+	}
+    }
+    return ok;
+}
+
+static int aes_benchmark(void)
+{
+    const struct ssh2_ciphers *const lists[] = { &ssh2_aes, &ssh2_aesgcm };
+    static unsigned char buf[4 + 32768 + 16];
+    unsigned char key[32], iv[16];
+    unsigned long seed = 1;
+    int i, j, b, n, iters, len;
+
+    fill_random(key, sizeof(key), &seed);
+    fill_random(iv, sizeof(iv), &seed);
+    fill_random(buf, sizeof(buf), &seed);
+
+    printf("%-24s %-8s %10s\n", "cipher", "backend", "MB/s");
+    for (i = 0; i < lenof(lists); i++) {
+	for (j = 0; j < lists[i]->nciphers; j++) {
+	    const struct ssh2_cipher *c = lists[i]->list[j];
+	    int aead = (c->flags & SSH_CIPHER_IS_AEAD) != 0;
+
+	    len = aead ? 4 + 32768 : 32768;
+	    for (b = 0; b < 2; b++) {
+		void *ctx = new_context(c, b, key, iv);
+		clock_t start, elapsed;
+
+		if (!ctx)
+		    continue;
+		for (iters = 1 ;; iters *= 2) {
+		    start = clock();
+		    for (n = 0; n < iters; n++) {
+			if (aead)
+			    c->aead_encrypt(ctx, buf, len, n);
+			else
+			    c->encrypt(ctx, buf, len);
+		    }
+		    elapsed = clock() - start;
+		    if (elapsed >= CLOCKS_PER_SEC / 2)
+			break;
+		}
+		printf("%-24s %-8s %10.1f\n", c->name, backend_names[b],
+		       (double)len * iters / 1048576.0 /
+		       ((double)elapsed / CLOCKS_PER_SEC));
+		c->free_context(ctx);
+	    }
+	}
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const struct ssh2_ciphers *const lists[] = { &ssh2_aes, &ssh2_aesgcm };
+    unsigned long seed = 1;
+    int passes = 0, fails = 0;
+    int i, j, b, ret;
+
+    if (argc > 1 && !strcmp(argv[1], "-b"))
+	return aes_benchmark();
+
+    for (b = 0; b < 2; b++) {
+	for (i = 0; i < lenof(kats); i++) {
+	    ret = run_kat(&kats[i], b);
+	    if (ret < 0)
+		break;
+	    if (ret) {
+		passes++;
+	    } else {
+		printf("FAIL: %s vector %d with %s\n",
+		       kats[i].cipher, i, backend_names[b]);
+		fails++;
+	    }
+	}
+	if (ret < 0)
+	    printf("%s: not available, skipped\n", backend_names[b]);
+    }
+
+    for (i = 0; i < lenof(lists); i++) {
+	for (j = 0; j < lists[i]->nciphers; j++) {
+	    const struct ssh2_cipher *c = lists[i]->list[j];
+	    ret = cross_check(c, &seed);
+	    if (ret < 0)
+		break;
+	    if (ret) {
+		passes++;
+	    } else {
+		printf("FAIL: %s tables and AES-NI disagree\n", c->name);
+		fails++;
+	    }
+	}
+    }
+
+    printf("passed %d failed %d total %d\n", passes, fails, passes+fails);
+    return fails != 0;
+}
+
+#endif
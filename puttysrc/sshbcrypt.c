@@ -0,0 +1,102 @@
+/*
+ * bcrypt_pbkdf: the password-based key derivation function OpenSSH
+ * uses to encrypt its own ("openssh-key-v1") private key files.
+ *
+ * Each output block is the XOR of `rounds' iterations of a bcrypt
+ * style hash keyed on SHA-512 of the passphrase, and the blocks are
+ * interleaved byte by byte into the output so that no part of the
+ * key can be recovered without doing all of the work.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "ssh.h"
+
+#define BCRYPT_WORDS 8
+#define BCRYPT_HASHSIZE (BCRYPT_WORDS * 4)
+
+static void bcrypt_hash(const unsigned char *sha2pass,
+			const unsigned char *sha2salt, unsigned char *out)
+{
+    static const char magic[] = "OxychromaticBlowfishSwatDynamite";
+    unsigned char cdata[BCRYPT_HASHSIZE];
+    void *ctx;
+    int i;
+
+    ctx = blowfish_make_context();
+    blowfish_initkey(ctx);
+    blowfish_expandkey(ctx, sha2pass, 64, sha2salt, 64);
+    for (i = 0; i < 64; i++) {
+	blowfish_expandkey(ctx, sha2salt, 64, NULL, 0);
+	blowfish_expandkey(ctx, sha2pass, 64, NULL, 0);
+    }
+
+    memcpy(cdata, magic, BCRYPT_HASHSIZE);
+    for (i = 0; i < 64; i++)
+	blowfish_msb_encrypt_ecb(cdata, BCRYPT_HASHSIZE, ctx);
+
+    /* OpenSSH emits each 32-bit word least significant byte first. */
+    for (i = 0; i < BCRYPT_HASHSIZE; i += 4) {
+	out[i + 0] = cdata[i + 3];
+	out[i + 1] = cdata[i + 2];
+	out[i + 2] = cdata[i + 1];
+	out[i + 3] = cdata[i + 0];
+    }
+
+    memset(cdata, 0, sizeof(cdata));
+    blowfish_free_context(ctx);
+}
+
+void bcrypt_pbkdf(const char *passphrase, int passlen,
+		  const unsigned char *salt, int saltlen, int rounds,
+		  unsigned char *out, int outlen)
+{
+    unsigned char sha2pass[64], sha2salt[64];
+    unsigned char block[BCRYPT_HASHSIZE], tmp[BCRYPT_HASHSIZE];
+    unsigned char countbuf[4];
+    SHA512_State s;
+    int stride, amt, count, remaining, i, j;
+
+    assert(outlen > 0 && outlen <= BCRYPT_HASHSIZE * BCRYPT_HASHSIZE);
+
+    stride = (outlen + BCRYPT_HASHSIZE - 1) / BCRYPT_HASHSIZE;
+    amt = (outlen + stride - 1) / stride;
+
+    SHA512_Simple(passphrase, passlen, sha2pass);
+
+    remaining = outlen;
+    for (count = 1; remaining > 0; count++) {
+	PUT_32BIT_MSB_FIRST(countbuf, count);
+	SHA512_Init(&s);
+	SHA512_Bytes(&s, salt, saltlen);
+	SHA512_Bytes(&s, countbuf, 4);
+	SHA512_Final(&s, sha2salt);
+
+	bcrypt_hash(sha2pass, sha2salt, tmp);
+	memcpy(block, tmp, BCRYPT_HASHSIZE);
+
+	for (i = 1; i < rounds; i++) {
+	    SHA512_Simple(tmp, BCRYPT_HASHSIZE, sha2salt);
+	    bcrypt_hash(sha2pass, sha2salt, tmp);
+	    for (j = 0; j < BCRYPT_HASHSIZE; j++)
+		block[j] ^= tmp[j];
+	}
+
+	if (amt > remaining)
+	    amt = remaining;
+	for (i = 0; i < amt; i++) {
+	    int dest = i * stride + (count - 1);
+	    if (dest >= outlen)
+		break;
+	    out[dest] = block[i];
+	}
+	remaining -= i;
+    }
+
+    memset(sha2pass, 0, sizeof(sha2pass));
+    memset(sha2salt, 0, sizeof(sha2salt));
+    memset(block, 0, sizeof(block));
+    memset(tmp, 0, sizeof(tmp));
+    memset(&s, 0, sizeof(s));
+}
@@ -415,70 +415,100 @@ static void blowfish_msb_sdctr(unsigned char *blk, int len,
     ctx->iv1 = iv1;
 }
 
-static void blowfish_setkey(BlowfishContext * ctx,
-			    const unsigned char *key, short keybytes)
+static void blowfish_initkey_ctx(BlowfishContext * ctx)
 {
-    word32 *S0 = ctx->S0;
-    word32 *S1 = ctx->S1;
-    word32 *S2 = ctx->S2;
-    word32 *S3 = ctx->S3;
-    word32 *P = ctx->P;
-    word32 str[2];
     int i;
 
-    for (i = 0; i < 18; i++) {
-	P[i] = parray[i];
-	P[i] ^=
-	    ((word32) (unsigned char) (key[(i * 4 + 0) % keybytes])) << 24;
-	P[i] ^=
-	    ((word32) (unsigned char) (key[(i * 4 + 1) % keybytes])) << 16;
-	P[i] ^=
-	    ((word32) (unsigned char) (key[(i * 4 + 2) % keybytes])) << 8;
-	P[i] ^= ((word32) (unsigned char) (key[(i * 4 + 3) % keybytes]));
-    }
+    for (i = 0; i < 18; i++)
+	ctx->P[i] = parray[i];
 
     for (i = 0; i < 256; i++) {
-	S0[i] = sbox0[i];
-	S1[i] = sbox1[i];
-	S2[i] = sbox2[i];
-	S3[i] = sbox3[i];
+	ctx->S0[i] = sbox0[i];
+	ctx->S1[i] = sbox1[i];
+	ctx->S2[i] = sbox2[i];
+	ctx->S3[i] = sbox3[i];
+    }
+}
+
+/*
+ * Fetch the next big-endian word from a byte string, wrapping round
+ * to the start whenever the end is reached.
+ */
+static word32 blowfish_stream_word(const unsigned char *data, int len,
+				   int *pos)
+{
+    word32 ret = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	ret = (ret << 8) | data[*pos];
+	if (++*pos >= len)
+	    *pos = 0;
     }
+    return ret;
+}
+
+/*
+ * Mix a key into the current state. With no salt this is the
+ * ordinary Blowfish key schedule (after blowfish_initkey_ctx); with
+ * one it is the salted variant used by bcrypt's "expensive key
+ * schedule", which XORs successive salt words into each block before
+ * it is re-encrypted.
+ */
+static void blowfish_expandkey_ctx(BlowfishContext * ctx,
+				   const unsigned char *key, short keybytes,
+				   const unsigned char *salt, short saltbytes)
+{
+    word32 *S[4];
+    word32 *P = ctx->P;
+    word32 str[2];
+    int i, j, keypos = 0, saltpos = 0;
+
+    S[0] = ctx->S0;
+    S[1] = ctx->S1;
+    S[2] = ctx->S2;
+    S[3] = ctx->S3;
+
+    for (i = 0; i < 18; i++)
+	P[i] ^= blowfish_stream_word(key, keybytes, &keypos);
 
     str[0] = str[1] = 0;
 
     for (i = 0; i < 18; i += 2) {
+	if (saltbytes) {
+	    str[0] ^= blowfish_stream_word(salt, saltbytes, &saltpos);
+	    str[1] ^= blowfish_stream_word(salt, saltbytes, &saltpos);
+	}
 	blowfish_encrypt(str[0], str[1], str, ctx);
 	P[i] = str[0];
 	P[i + 1] = str[1];
     }
 
-    for (i = 0; i < 256; i += 2) {
-	blowfish_encrypt(str[0], str[1], str, ctx);
-	S0[i] = str[0];
-	S0[i + 1] = str[1];
-    }
-    for (i = 0; i < 256; i += 2) {
-	blowfish_encrypt(str[0], str[1], str, ctx);
-	S1[i] = str[0];
-	S1[i + 1] = str[1];
-    }
-    for (i = 0; i < 256; i += 2) {
-	blowfish_encrypt(str[0], str[1], str, ctx);
-	S2[i] = str[0];
-	S2[i + 1] = str[1];
-    }
-    for (i = 0; i < 256; i += 2) {
-	blowfish_encrypt(str[0], str[1], str, ctx);
-	S3[i] = str[0];
-	S3[i + 1] = str[1];
+    for (j = 0; j < 4; j++) {
+	for (i = 0; i < 256; i += 2) {
+	    if (saltbytes) {
+		str[0] ^= blowfish_stream_word(salt, saltbytes, &saltpos);
+		str[1] ^= blowfish_stream_word(salt, saltbytes, &saltpos);
+	    }
+	    blowfish_encrypt(str[0], str[1], str, ctx);
+	    S[j][i] = str[0];
+	    S[j][i + 1] = str[1];
+	}
     }
 }
 
+static void blowfish_setkey(BlowfishContext * ctx,
+			    const unsigned char *key, short keybytes)
+{
+    blowfish_initkey_ctx(ctx);
+    blowfish_expandkey_ctx(ctx, key, keybytes, NULL, 0);
+}
+
 /* -- Interface with PuTTY -- */
 
 #define SSH_SESSION_KEY_LENGTH	32
 
-static void *blowfish_make_context(void)
+void *blowfish_make_context(void)
 {
     return snew(BlowfishContext);
 }
@@ -489,8 +519,9 @@ static void *blowfish_ssh1_make_context(void)
     return snewn(2, BlowfishContext);
 }
 
-static void blowfish_free_context(void *handle)
+void blowfish_free_context(void *handle)
 {
+    memset(handle, 0, sizeof(BlowfishContext));
     sfree(handle);
 }
 
@@ -557,6 +588,40 @@ static void blowfish_ssh2_sdctr(void *handle, unsigned char *blk,
     blowfish_msb_sdctr(blk, len, ctx);
 }
 
+/*
+ * Entry points for bcrypt_pbkdf (sshbcrypt.c), which drives the key
+ * schedule directly rather than through an ssh2_cipher.
+ */
+void blowfish_initkey(void *handle)
+{
+    blowfish_initkey_ctx((BlowfishContext *) handle);
+}
+
+void blowfish_expandkey(void *handle,
+			const unsigned char *key, short keybytes,
+			const unsigned char *salt, short saltbytes)
+{
+    blowfish_expandkey_ctx((BlowfishContext *) handle,
+			   key, keybytes, salt, saltbytes);
+}
+
+void blowfish_msb_encrypt_ecb(unsigned char *blk, int len, void *handle)
+{
+    BlowfishContext *ctx = (BlowfishContext *) handle;
+    word32 out[2];
+
+    assert((len & 7) == 0);
+
+    while (len > 0) {
+	blowfish_encrypt(GET_32BIT_MSB_FIRST(blk),
+			 GET_32BIT_MSB_FIRST(blk + 4), out, ctx);
+	PUT_32BIT_MSB_FIRST(blk, out[0]);
+	PUT_32BIT_MSB_FIRST(blk + 4, out[1]);
+	blk += 8;
+	len -= 8;
+    }
+}
+
 const struct ssh_cipher ssh_blowfish_ssh1 = {
     blowfish_ssh1_make_context, blowfish_free_context, blowfish_sesskey,
     blowfish_ssh1_encrypt_blk, blowfish_ssh1_decrypt_blk,
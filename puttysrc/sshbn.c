@@ -23,7 +23,27 @@
  *    The C variant won't give the right answer, either.
  */
 
-#if defined __GNUC__ && defined __i386__
+#if defined __GNUC__ && defined __SIZEOF_INT128__
+/* 64-bit gcc and clang (including MinGW-w64) can do 64x64->128 */
+typedef unsigned long long BignumInt;
+typedef unsigned __int128 BignumDblInt;
+#define BIGNUM_INT_MASK  0xFFFFFFFFFFFFFFFFULL
+#define BIGNUM_TOP_BIT   0x8000000000000000ULL
+#define BIGNUM_INT_BITS  64
+#define MUL_WORD(w1, w2) ((BignumDblInt)w1 * w2)
+#if defined __x86_64__
+#define DIVMOD_WORD(q, r, hi, lo, w) \
+    __asm__("div %2" : \
+	    "=d" (r), "=a" (q) : \
+	    "r" (w), "d" (hi), "a" (lo))
+#else
+#define DIVMOD_WORD(q, r, hi, lo, w) do { \
+    BignumDblInt n = (((BignumDblInt)hi) << BIGNUM_INT_BITS) | lo; \
+    q = n / w; \
+    r = n % w; \
+} while (0)
+#endif
+#elif defined __GNUC__ && defined __i386__
 typedef unsigned long BignumInt;
 typedef unsigned long long BignumDblInt;
 #define BIGNUM_INT_MASK  0xFFFFFFFFUL
@@ -527,6 +547,61 @@ static void internal_mul_low(const BignumInt *a, const BignumInt *b,
     }
 }
 
+/*
+ * Compute c = a * a, in the same format as internal_mul. Each cross
+ * product a_i a_j (i != j) is only computed once and then doubled,
+ * which nearly halves the work. Above the Karatsuba threshold we
+ * just hand over to internal_mul.
+ */
+static void internal_square(const BignumInt *a, BignumInt *c, int len,
+                            BignumInt *scratch)
+{
+    int i, j;
+    BignumInt carry, w;
+    BignumDblInt t;
+
+    if (len > KARATSUBA_THRESHOLD) {
+        internal_mul(a, a, c, len, scratch);
+        return;
+    }
+
+    for (i = 0; i < 2 * len; i++)
+        c[i] = 0;
+
+    /*
+     * Cross products. a[i] * a[j] lands at c[i+j+1] (remembering
+     * everything is big-endian), so working from the bottom of both
+     * loops keeps the carries moving upwards.
+     */
+    for (i = len - 1; i > 0; i--) {
+        carry = 0;
+        for (j = i - 1; j >= 0; j--) {
+            t = (MUL_WORD(a[i], a[j]) + carry) + c[i + j + 1];
+            c[i + j + 1] = (BignumInt) t;
+            carry = (BignumInt)(t >> BIGNUM_INT_BITS);
+        }
+        c[i] = carry;
+    }
+
+    /* Double them. */
+    carry = 0;
+    for (i = 2 * len - 1; i >= 0; i--) {
+        w = c[i];
+        c[i] = (BignumInt)(w << 1) | carry;
+        carry = w >> (BIGNUM_INT_BITS - 1);
+    }
+
+    /* And add in the squares a[i]^2, which land at c[2i+1]. */
+    carry = 0;
+    for (i = len - 1; i >= 0; i--) {
+        t = (MUL_WORD(a[i], a[i]) + carry) + c[2 * i + 1];
+        c[2 * i + 1] = (BignumInt) t;
+        t = (t >> BIGNUM_INT_BITS) + c[2 * i];
+        c[2 * i] = (BignumInt) t;
+        carry = (BignumInt)(t >> BIGNUM_INT_BITS);
+    }
+}
+
 /*
  * Montgomery reduction. Expects x to be a big-endian array of 2*len
  * BignumInts whose value satisfies 0 <= x < rn (where r = 2^(len *
@@ -589,7 +664,7 @@ static void monty_reduce(BignumInt *x, const BignumInt *n,
 }
 
 static void internal_add_shifted(BignumInt *number,
-				 unsigned n, int shift)
+				 BignumInt n, int shift)
 {
     int word = 1 + (shift / BIGNUM_INT_BITS);
     int bshift = shift % BIGNUM_INT_BITS;
@@ -620,7 +695,7 @@ static void internal_mod(BignumInt *a, int alen,
 			 BignumInt *quot, int qshift)
 {
     BignumInt m0, m1;
-    unsigned int h;
+    BignumInt h;
     int i, k;
 
     m0 = m[0];
@@ -631,7 +706,7 @@ static void internal_mod(BignumInt *a, int alen,
 
     for (i = 0; i <= alen - mlen; i++) {
 	BignumDblInt t;
-	unsigned int q, r, c, ai1;
+	BignumInt q, r, c, ai1;
 
 	if (i == 0) {
 	    h = 0;
@@ -686,7 +761,7 @@ static void internal_mod(BignumInt *a, int alen,
 	for (k = mlen - 1; k >= 0; k--) {
 	    t = MUL_WORD(q, m[k]);
 	    t += c;
-	    c = (unsigned)(t >> BIGNUM_INT_BITS);
+	    c = (BignumInt)(t >> BIGNUM_INT_BITS);
 	    if ((BignumInt) t > a[i + k])
 		c++;
 	    a[i + k] -= (BignumInt) t;
@@ -769,7 +844,7 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
     /* Skip leading zero bits of exp. */
     i = 0;
     j = BIGNUM_INT_BITS-1;
-    while (i < (int)exp[0] && (exp[exp[0] - i] & (1 << j)) == 0) {
+    while (i < (int)exp[0] && (exp[exp[0] - i] & ((BignumInt)1 << j)) == 0) {
 	j--;
 	if (j < 0) {
 	    i++;
@@ -782,7 +857,7 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
 	while (j >= 0) {
 	    internal_mul(a + mlen, a + mlen, b, mlen, scratch);
 	    internal_mod(b, mlen * 2, m, mlen, NULL, 0);
-	    if ((exp[exp[0] - i] & (1 << j)) != 0) {
+	    if ((exp[exp[0] - i] & ((BignumInt)1 << j)) != 0) {
 		internal_mul(b + mlen, n, a, mlen, scratch);
 		internal_mod(a, mlen * 2, m, mlen, NULL, 0);
 	    } else {
@@ -836,14 +911,55 @@ Bignum modpow_simple(Bignum base_in, Bignum exp, Bignum mod)
     return result;
 }
 
+/*
+ * Choose the window size for modpow's fixed-window exponentiation:
+ * a window of w bits needs a table of 2^w powers, which only pays
+ * for itself once the exponent is long enough. (These thresholds
+ * are the usual ones, as used by e.g. OpenSSL.)
+ */
+static int modpow_window_bits(int ebits)
+{
+    if (ebits > 671)
+        return 6;
+    if (ebits > 239)
+        return 5;
+    if (ebits > 79)
+        return 4;
+    if (ebits > 23)
+        return 3;
+    return 1;
+}
+
+/*
+ * Copy entry 'index' of a table of 'tablesize' numbers of 'len'
+ * words each into 'out', touching every entry on the way so that the
+ * memory access pattern doesn't reveal which one we wanted.
+ */
+static void modpow_table_select(BignumInt *out, const BignumInt *table,
+                                int tablesize, int len, int index)
+{
+    int i, j;
+    BignumInt mask;
+
+    for (j = 0; j < len; j++)
+        out[j] = 0;
+    for (i = 0; i < tablesize; i++) {
+        /* all ones if i == index, else zero */
+        mask = (BignumInt)0 -
+            (BignumInt)(((unsigned)(i ^ index) - 1) >> (sizeof(unsigned)*8 - 1));
+        for (j = 0; j < len; j++)
+            out[j] |= table[i * len + j] & mask;
+    }
+}
+
 /*
  * Compute (base ^ exp) % mod. Uses the Montgomery multiplication
  * technique where possible, falling back to modpow_simple otherwise.
  */
 Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
 {
-    BignumInt *a, *b, *x, *n, *mninv, *scratch;
-    int len, scratchlen, i, j;
+    BignumInt *a, *b, *x, *n, *mninv, *scratch, *table;
+    int len, scratchlen, i, j, ebits, winbits, tablesize, bit;
     Bignum base, base2, r, rn, inv, result;
 
     /*
@@ -914,41 +1030,66 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
     b = snewn(2*len, BignumInt);
     for (j = 0; j < len; j++)
 	a[2*len - 1 - j] = (j < (int)rn[0] ? rn[j + 1] : 0);
+    for (j = 0; j < len; j++)
+	a[j] = 0;                      /* in case exp == 0 */
     freebn(rn);
 
     /* Scratch space for multiplies */
     scratchlen = 3*len + mul_compute_scratch(len);
     scratch = snewn(scratchlen, BignumInt);
 
-    /* Skip leading zero bits of exp. */
-    i = 0;
-    j = BIGNUM_INT_BITS-1;
-    while (i < (int)exp[0] && (exp[exp[0] - i] & (1 << j)) == 0) {
-	j--;
-	if (j < 0) {
-	    i++;
-	    j = BIGNUM_INT_BITS-1;
-	}
+    /*
+     * Fixed-window exponentiation. Precompute base^k (in Montgomery
+     * form) for every k below 2^winbits; then take the exponent
+     * winbits at a time from the top, squaring winbits times and
+     * multiplying by one table entry per window. Every window costs
+     * the same whatever the exponent bits are, and the table entry
+     * is fetched by reading the whole table, so neither the sequence
+     * of operations nor the memory access pattern depends on the
+     * exponent.
+     */
+    ebits = bignum_bitcount(exp);
+    winbits = modpow_window_bits(ebits);
+    tablesize = 1 << winbits;
+    table = snewn(tablesize * len, BignumInt);
+    for (j = 0; j < len; j++) {
+        table[j] = a[len + j];         /* base^0 = 1 */
+        table[len + j] = x[j];         /* base^1 */
+    }
+    for (i = 2; i < tablesize; i++) {
+        internal_mul(table + (i - 1) * len, x, b, len, scratch);
+        monty_reduce(b, n, mninv, scratch, len);
+        for (j = 0; j < len; j++)
+            table[i * len + j] = b[len + j];
     }
 
     /* Main computation */
-    while (i < (int)exp[0]) {
-	while (j >= 0) {
-	    internal_mul(a + len, a + len, b, len, scratch);
-            monty_reduce(b, n, mninv, scratch, len);
-	    if ((exp[exp[0] - i] & (1 << j)) != 0) {
-                internal_mul(b + len, x, a, len,  scratch);
-                monty_reduce(a, n, mninv, scratch, len);
-	    } else {
-		BignumInt *t;
-		t = a;
-		a = b;
-		b = t;
-	    }
-	    j--;
-	}
-	i++;
-	j = BIGNUM_INT_BITS-1;
+    for (bit = (ebits + winbits - 1) / winbits * winbits; bit > 0 ;) {
+        BignumInt *t;
+        int digit;
+
+        bit -= winbits;
+        if (bit + winbits < ebits) {
+            /* (No need to square on the first window, since a == 1.) */
+            for (i = 0; i < winbits; i++) {
+                internal_square(a + len, b, len, scratch);
+                monty_reduce(b, n, mninv, scratch, len);
+                t = a;
+                a = b;
+                b = t;
+            }
+        }
+
+        digit = 0;
+        for (i = winbits; i-- > 0 ;)
+            digit = (digit << 1) | bignum_bit(exp, bit + i);
+        modpow_table_select(x, table, tablesize, len, digit);
+
+        internal_mul(a + len, x, b, len, scratch);
+        monty_reduce(b, n, mninv, scratch, len);
+        t = a;
+        a = b;
+        b = t;
     }
 
     /*
@@ -983,6 +1124,9 @@ Bignum modpow(Bignum base_in, Bignum exp, Bignum mod)
     for (i = 0; i < len; i++)
 	x[i] = 0;
     sfree(x);
+    for (i = 0; i < tablesize * len; i++)
+	table[i] = 0;
+    sfree(table);
 
     return result;
 }
@@ -1178,7 +1322,8 @@ Bignum bignum_from_bytes(const unsigned char *data, int nbytes)
 	result[i] = 0;
     for (i = nbytes; i--;) {
 	unsigned char byte = *data++;
-	result[1 + i / BIGNUM_INT_BYTES] |= byte << (8*i % BIGNUM_INT_BITS);
+	result[1 + i / BIGNUM_INT_BYTES] |=
+	    (BignumInt)byte << (8*i % BIGNUM_INT_BITS);
     }
 
     while (result[0] > 1 && result[result[0]] == 0)
@@ -1274,7 +1419,7 @@ void bignum_set_bit(Bignum bn, int bitnum, int value)
 	abort();		       /* beyond the end */
     else {
 	int v = bitnum / BIGNUM_INT_BITS + 1;
-	int mask = 1 << (bitnum % BIGNUM_INT_BITS);
+	BignumInt mask = (BignumInt)1 << (bitnum % BIGNUM_INT_BITS);
 	if (value)
 	    bn[v] |= mask;
 	else
@@ -1564,7 +1709,7 @@ void diagbn(char *prefix, Bignum md)
     nibbles = (3 + bignum_bitcount(md)) / 4;
     if (nibbles < 1)
 	nibbles = 1;
-    morenibbles = 4 * md[0] - nibbles;
+    morenibbles = BIGNUM_INT_BYTES * 2 * md[0] - nibbles;
     for (i = 0; i < morenibbles; i++)
 	debug(("-"));
     for (i = nibbles; i--;)
@@ -1759,12 +1904,17 @@ char *bignum_decimal(Bignum x)
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
 
 /*
  * gcc -g -O0 -DTESTBN -o testbn sshbn.c misc.c -I unix -I charset
  *
  * Then feed to this program's standard input the output of
  * testdata/bignum.py .
+ *
+ * Alternatively, run it as 'testbn -b' (built with optimisation
+ * turned on, for meaningful numbers) to time modpow with full-length
+ * exponents at the usual DH and RSA modulus sizes.
  */
 
 void modalfatalbox(char *p, ...)
@@ -1780,12 +1930,69 @@ void modalfatalbox(char *p, ...)
 
 #define fromxdigit(c) ( (c)>'9' ? ((c)&0xDF) - 'A' + 10 : (c) - '0' )
 
+/*
+ * Make a pseudo-random number of exactly the given number of bits.
+ * (This needn't be any good, so we don't involve the real RNG.)
+ */
+static Bignum bench_random(int bits, unsigned long *seed)
+{
+    Bignum ret = newbn((bits + BIGNUM_INT_BITS - 1) / BIGNUM_INT_BITS);
+    int i;
+
+    for (i = 0; i < bits; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        bignum_set_bit(ret, i, (*seed >> 16) & 1);
+    }
+    bignum_set_bit(ret, bits - 1, 1);
+    return ret;
+}
+
+static int modpow_benchmark(void)
+{
+    static const int sizes[] = { 1024, 2048, 4096 };
+    unsigned long seed = 1;
+    int i, iters, n;
+
+    printf("%8s %10s %12s\n", "bits", "iters", "ms/modpow");
+    for (i = 0; i < lenof(sizes); i++) {
+        Bignum base = bench_random(sizes[i] - 1, &seed);
+        Bignum exp = bench_random(sizes[i], &seed);
+        Bignum mod = bench_random(sizes[i], &seed);
+        clock_t start, elapsed;
+
+        bignum_set_bit(mod, 0, 1);     /* Montgomery needs it odd */
+
+        /*
+         * Keep doubling the iteration count until a run takes long
+         * enough to time with clock()'s resolution.
+         */
+        for (iters = 1 ;; iters *= 2) {
+            start = clock();
+            for (n = 0; n < iters; n++)
+                freebn(modpow(base, exp, mod));
+            elapsed = clock() - start;
+            if (elapsed >= CLOCKS_PER_SEC / 2)
+                break;
+        }
+        printf("%8d %10d %12.3f\n", sizes[i], iters,
+               1000.0 * elapsed / CLOCKS_PER_SEC / iters);
+
+        freebn(base);
+        freebn(exp);
+        freebn(mod);
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     char *buf;
     int line = 0;
     int passes = 0, fails = 0;
 
+    if (argc > 1 && !strcmp(argv[1], "-b"))
+        return modpow_benchmark();
+
     while ((buf = fgetline(stdin)) != NULL) {
         int maxlen = strlen(buf);
         unsigned char *data = snewn(maxlen, unsigned char);
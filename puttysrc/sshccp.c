@@ -0,0 +1,592 @@
+/*
+ * ChaCha20-Poly1305 for SSH-2, as OpenSSH's
+ * "chacha20-poly1305@openssh.com" (described in the file
+ * PROTOCOL.chacha20poly1305 in the OpenSSH sources).
+ *
+ * ChaCha20 here is Bernstein's original variant, with a 64-bit block
+ * counter and a 64-bit nonce; SSH uses the packet sequence number as
+ * the nonce. The 64 bytes of key material are split in two: the first
+ * 32 key the payload cipher (whose block 0 also supplies the one-time
+ * Poly1305 key) and the last 32 are only used to encrypt the 4-byte
+ * packet length, so that a receiver can learn the length before it
+ * has the whole packet. The Poly1305 tag covers the encrypted length
+ * and the encrypted payload.
+ *
+ * Encryption and authentication are done in a single pass over the
+ * packet: each chunk is encrypted and MACed (or MACed and decrypted)
+ * while it is still in cache.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "ssh.h"
+
+/*
+ * On x86 we generate four ChaCha20 blocks at a time with SSE2. As
+ * with AES-NI in sshaes.c, the vector code gets a per-function target
+ * attribute and is only called once CPUID has said SSE2 exists (which
+ * on x86-64 it always does). Define NO_CCP_SSE2 to leave it out.
+ */
+#if !defined(NO_CCP_SSE2) && \
+    ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+#define CCP_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CCP_SSE2_FUNC
+#else
+#include <cpuid.h>
+#define CCP_SSE2_FUNC __attribute__((target("sse2")))
+#endif
+#endif
+
+#ifdef _MSC_VER
+typedef unsigned __int64 ccp_u64;
+#else
+typedef unsigned long long ccp_u64;
+#endif
+
+/* Bytes processed per step of the single-pass loops; a multiple of 64. */
+#define CCP_CHUNK 256
+
+/* ----------------------------------------------------------------------
+ * ChaCha20.
+ */
+
+#define ROTL32(x, n) ( ((x) << (n)) | ((x) >> (32 - (n))) )
+
+#define QUARTERROUND(a, b, c, d) ( \
+    a += b, d ^= a, d = ROTL32(d, 16), \
+    c += d, b ^= c, b = ROTL32(b, 12), \
+    a += b, d ^= a, d = ROTL32(d, 8), \
+    c += d, b ^= c, b = ROTL32(b, 7) )
+
+/*
+ * Set up a ChaCha20 input block for the given key (as eight
+ * little-endian words) and sequence number, with the block counter
+ * at zero.
+ */
+static void chacha20_init(word32 *st, const word32 *key, unsigned long seq)
+{
+    unsigned char nonce[8];
+    int i;
+
+    st[0] = 0x61707865;		       /* "expand 32-byte k" */
+    st[1] = 0x3320646e;
+    st[2] = 0x79622d32;
+    st[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+	st[4 + i] = key[i];
+    st[12] = st[13] = 0;
+
+    /* The nonce is the sequence number as a 64-bit big-endian integer. */
+    PUT_32BIT_MSB_FIRST(nonce, 0);
+    PUT_32BIT_MSB_FIRST(nonce + 4, seq);
+    st[14] = GET_32BIT_LSB_FIRST(nonce);
+    st[15] = GET_32BIT_LSB_FIRST(nonce + 4);
+}
+
+static void chacha20_block(const word32 *st, unsigned char *out)
+{
+    word32 x[16];
+    int i;
+
+    memcpy(x, st, sizeof(x));
+    for (i = 0; i < 10; i++) {
+	QUARTERROUND(x[0], x[4], x[8], x[12]);
+	QUARTERROUND(x[1], x[5], x[9], x[13]);
+	QUARTERROUND(x[2], x[6], x[10], x[14]);
+	QUARTERROUND(x[3], x[7], x[11], x[15]);
+	QUARTERROUND(x[0], x[5], x[10], x[15]);
+	QUARTERROUND(x[1], x[6], x[11], x[12]);
+	QUARTERROUND(x[2], x[7], x[8], x[13]);
+	QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (i = 0; i < 16; i++)
+	PUT_32BIT_LSB_FIRST(out + 4 * i, (word32)(x[i] + st[i]));
+    memset(x, 0, sizeof(x));
+}
+
+static void chacha20_next_block(word32 *st)
+{
+    st[12] = (st[12] + 1) & 0xFFFFFFFF;
+    if (st[12] == 0)
+	st[13] = (st[13] + 1) & 0xFFFFFFFF;
+}
+
+#ifdef CCP_SSE2
+
+#define CCP_ADD(a, b) _mm_add_epi32(a, b)
+#define CCP_XOR(a, b) _mm_xor_si128(a, b)
+#define CCP_ROTL(x, n) \
+    _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+/* A rotate by 16 is just a swap of the 16-bit halves of each word. */
+#define CCP_ROTL16(x) \
+    _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1)
+
+#define CCP_QR(a, b, c, d) do {						\
+	a = CCP_ADD(a, b); d = CCP_XOR(d, a); d = CCP_ROTL16(d);	\
+	c = CCP_ADD(c, d); b = CCP_XOR(b, c); b = CCP_ROTL(b, 12);	\
+	a = CCP_ADD(a, b); d = CCP_XOR(d, a); d = CCP_ROTL(d, 8);	\
+	c = CCP_ADD(c, d); b = CCP_XOR(b, c); b = CCP_ROTL(b, 7);	\
+    } while (0)
+
+/*
+ * Transpose four state vectors (word i of blocks 0..3 in each) back
+ * into four 16-byte pieces of consecutive blocks, and XOR them into
+ * the data.
+ */
+#define CCP_OUT4(a, b, c, d, off) do {					\
+	__m128i t0 = _mm_unpacklo_epi32(a, b);				\
+	__m128i t1 = _mm_unpacklo_epi32(c, d);				\
+	__m128i t2 = _mm_unpackhi_epi32(a, b);				\
+	__m128i t3 = _mm_unpackhi_epi32(c, d);				\
+	CCP_XORSTORE(blk + (off), _mm_unpacklo_epi64(t0, t1));		\
+	CCP_XORSTORE(blk + 64 + (off), _mm_unpackhi_epi64(t0, t1));	\
+	CCP_XORSTORE(blk + 128 + (off), _mm_unpacklo_epi64(t2, t3));	\
+	CCP_XORSTORE(blk + 192 + (off), _mm_unpackhi_epi64(t2, t3));	\
+    } while (0)
+#define CCP_XORSTORE(p, v) _mm_storeu_si128((__m128i *)(p),		\
+	_mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(p))))
+
+/*
+ * XOR four consecutive blocks (256 bytes) of keystream into blk,
+ * with each vector holding the same state word of all four blocks.
+ */
+static CCP_SSE2_FUNC void chacha20_sse2_xor4(word32 *st, unsigned char *blk)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7;
+    __m128i x8, x9, x10, x11, x12, x13, x14, x15;
+    __m128i c12, c13;
+    ccp_u64 ctr = st[12] | ((ccp_u64)st[13] << 32);
+    int i;
+
+    x0 = _mm_set1_epi32(st[0]); x1 = _mm_set1_epi32(st[1]);
+    x2 = _mm_set1_epi32(st[2]); x3 = _mm_set1_epi32(st[3]);
+    x4 = _mm_set1_epi32(st[4]); x5 = _mm_set1_epi32(st[5]);
+    x6 = _mm_set1_epi32(st[6]); x7 = _mm_set1_epi32(st[7]);
+    x8 = _mm_set1_epi32(st[8]); x9 = _mm_set1_epi32(st[9]);
+    x10 = _mm_set1_epi32(st[10]); x11 = _mm_set1_epi32(st[11]);
+    c12 = x12 = _mm_set_epi32((int)(word32)(ctr + 3), (int)(word32)(ctr + 2),
+			      (int)(word32)(ctr + 1), (int)(word32)ctr);
+    c13 = x13 = _mm_set_epi32((int)(word32)((ctr + 3) >> 32),
+			      (int)(word32)((ctr + 2) >> 32),
+			      (int)(word32)((ctr + 1) >> 32),
+			      (int)(word32)(ctr >> 32));
+    x14 = _mm_set1_epi32(st[14]); x15 = _mm_set1_epi32(st[15]);
+
+    for (i = 0; i < 10; i++) {
+	CCP_QR(x0, x4, x8, x12);
+	CCP_QR(x1, x5, x9, x13);
+	CCP_QR(x2, x6, x10, x14);
+	CCP_QR(x3, x7, x11, x15);
+	CCP_QR(x0, x5, x10, x15);
+	CCP_QR(x1, x6, x11, x12);
+	CCP_QR(x2, x7, x8, x13);
+	CCP_QR(x3, x4, x9, x14);
+    }
+
+    x0 = CCP_ADD(x0, _mm_set1_epi32(st[0]));
+    x1 = CCP_ADD(x1, _mm_set1_epi32(st[1]));
+    x2 = CCP_ADD(x2, _mm_set1_epi32(st[2]));
+    x3 = CCP_ADD(x3, _mm_set1_epi32(st[3]));
+    x4 = CCP_ADD(x4, _mm_set1_epi32(st[4]));
+    x5 = CCP_ADD(x5, _mm_set1_epi32(st[5]));
+    x6 = CCP_ADD(x6, _mm_set1_epi32(st[6]));
+    x7 = CCP_ADD(x7, _mm_set1_epi32(st[7]));
+    x8 = CCP_ADD(x8, _mm_set1_epi32(st[8]));
+    x9 = CCP_ADD(x9, _mm_set1_epi32(st[9]));
+    x10 = CCP_ADD(x10, _mm_set1_epi32(st[10]));
+    x11 = CCP_ADD(x11, _mm_set1_epi32(st[11]));
+    x12 = CCP_ADD(x12, c12);
+    x13 = CCP_ADD(x13, c13);
+    x14 = CCP_ADD(x14, _mm_set1_epi32(st[14]));
+    x15 = CCP_ADD(x15, _mm_set1_epi32(st[15]));
+
+    CCP_OUT4(x0, x1, x2, x3, 0);
+    CCP_OUT4(x4, x5, x6, x7, 16);
+    CCP_OUT4(x8, x9, x10, x11, 32);
+    CCP_OUT4(x12, x13, x14, x15, 48);
+
+    ctr += 4;
+    st[12] = (word32)ctr;
+    st[13] = (word32)(ctr >> 32);
+}
+
+#undef CCP_ADD
+#undef CCP_XOR
+#undef CCP_ROTL
+#undef CCP_ROTL16
+#undef CCP_QR
+#undef CCP_OUT4
+#undef CCP_XORSTORE
+
+static int chacha20_sse2_supported(void)
+{
+    static int state = -1;
+    if (state < 0) {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	state = (info[3] >> 26) & 1;
+#else
+	unsigned a, b, c, d;
+	state = __get_cpuid(1, &a, &b, &c, &d) && (d & bit_SSE2);
+#endif
+    }
+    return state;
+}
+
+#endif /* CCP_SSE2 */
+
+/*
+ * XOR keystream into blk, starting at the state's current block
+ * counter and advancing it past every block used. Only the final
+ * call for a given state may have a length that isn't a multiple of
+ * the 64-byte block size.
+ */
+static void chacha20_xor(word32 *st, unsigned char *blk, int len)
+{
+    unsigned char ks[64];
+    int i, n;
+
+#ifdef CCP_SSE2
+    if (len >= 256 && chacha20_sse2_supported()) {
+	for (; len >= 256; blk += 256, len -= 256)
+	    chacha20_sse2_xor4(st, blk);
+    }
+#endif
+
+    for (; len > 0; blk += n, len -= n) {
+	chacha20_block(st, ks);
+	chacha20_next_block(st);
+	n = (len < 64 ? len : 64);
+	for (i = 0; i < n; i++)
+	    blk[i] ^= ks[i];
+    }
+    memset(ks, 0, sizeof(ks));
+}
+
+/* ----------------------------------------------------------------------
+ * Poly1305, with the accumulator and key held in five 26-bit limbs so
+ * that all the products fit in 64 bits.
+ */
+
+typedef struct {
+    word32 r[5], h[5], pad[4];
+    unsigned char buf[16];
+    int buflen;
+} Poly1305;
+
+static void poly1305_init(Poly1305 *p, const unsigned char *key)
+{
+    /* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+    p->r[0] = (GET_32BIT_LSB_FIRST(key + 0)) & 0x3ffffff;
+    p->r[1] = (GET_32BIT_LSB_FIRST(key + 3) >> 2) & 0x3ffff03;
+    p->r[2] = (GET_32BIT_LSB_FIRST(key + 6) >> 4) & 0x3ffc0ff;
+    p->r[3] = (GET_32BIT_LSB_FIRST(key + 9) >> 6) & 0x3f03fff;
+    p->r[4] = (GET_32BIT_LSB_FIRST(key + 12) >> 8) & 0x00fffff;
+
+    p->h[0] = p->h[1] = p->h[2] = p->h[3] = p->h[4] = 0;
+
+    p->pad[0] = GET_32BIT_LSB_FIRST(key + 16);
+    p->pad[1] = GET_32BIT_LSB_FIRST(key + 20);
+    p->pad[2] = GET_32BIT_LSB_FIRST(key + 24);
+    p->pad[3] = GET_32BIT_LSB_FIRST(key + 28);
+
+    p->buflen = 0;
+}
+
+/*
+ * Absorb whole 16-byte blocks. `hibit' is the 2^128 bit appended to
+ * each block: set for full blocks, clear for the padded final one.
+ */
+static void poly1305_blocks(Poly1305 *p, const unsigned char *m, int len,
+			    int hibit)
+{
+    word32 r0 = p->r[0], r1 = p->r[1], r2 = p->r[2];
+    word32 r3 = p->r[3], r4 = p->r[4];
+    word32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    word32 h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+    word32 h3 = p->h[3], h4 = p->h[4];
+    word32 hi = hibit ? 1 << 24 : 0;
+    ccp_u64 d0, d1, d2, d3, d4;
+    word32 c;
+
+    for (; len >= 16; m += 16, len -= 16) {
+	/* h += m[i] */
+	h0 += (GET_32BIT_LSB_FIRST(m + 0)) & 0x3ffffff;
+	h1 += (GET_32BIT_LSB_FIRST(m + 3) >> 2) & 0x3ffffff;
+	h2 += (GET_32BIT_LSB_FIRST(m + 6) >> 4) & 0x3ffffff;
+	h3 += (GET_32BIT_LSB_FIRST(m + 9) >> 6) & 0x3ffffff;
+	h4 += (GET_32BIT_LSB_FIRST(m + 12) >> 8) | hi;
+
+	/* h *= r */
+	d0 = (ccp_u64)h0 * r0 + (ccp_u64)h1 * s4 + (ccp_u64)h2 * s3 +
+	    (ccp_u64)h3 * s2 + (ccp_u64)h4 * s1;
+	d1 = (ccp_u64)h0 * r1 + (ccp_u64)h1 * r0 + (ccp_u64)h2 * s4 +
+	    (ccp_u64)h3 * s3 + (ccp_u64)h4 * s2;
+	d2 = (ccp_u64)h0 * r2 + (ccp_u64)h1 * r1 + (ccp_u64)h2 * r0 +
+	    (ccp_u64)h3 * s4 + (ccp_u64)h4 * s3;
+	d3 = (ccp_u64)h0 * r3 + (ccp_u64)h1 * r2 + (ccp_u64)h2 * r1 +
+	    (ccp_u64)h3 * r0 + (ccp_u64)h4 * s4;
+	d4 = (ccp_u64)h0 * r4 + (ccp_u64)h1 * r3 + (ccp_u64)h2 * r2 +
+	    (ccp_u64)h3 * r1 + (ccp_u64)h4 * r0;
+
+	/* (partial) h %= p */
+	c = (word32)(d0 >> 26); h0 = (word32)d0 & 0x3ffffff;
+	d1 += c; c = (word32)(d1 >> 26); h1 = (word32)d1 & 0x3ffffff;
+	d2 += c; c = (word32)(d2 >> 26); h2 = (word32)d2 & 0x3ffffff;
+	d3 += c; c = (word32)(d3 >> 26); h3 = (word32)d3 & 0x3ffffff;
+	d4 += c; c = (word32)(d4 >> 26); h4 = (word32)d4 & 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += c;
+    }
+
+    p->h[0] = h0; p->h[1] = h1; p->h[2] = h2; p->h[3] = h3; p->h[4] = h4;
+}
+
+static void poly1305_finish(Poly1305 *p, unsigned char *tag)
+{
+    word32 h0, h1, h2, h3, h4, c;
+    word32 g0, g1, g2, g3, g4, mask;
+    ccp_u64 f;
+
+    /* Fully carry h. */
+    h0 = p->h[0]; h1 = p->h[1]; h2 = p->h[2]; h3 = p->h[3]; h4 = p->h[4];
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    /* Compute h - p, and keep it instead of h if it didn't go negative. */
+    g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    g4 = (h4 + c - (1 << 26)) & 0xFFFFFFFF;
+
+    mask = ((g4 >> 31) - 1) & 0xFFFFFFFF;
+    g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    /* h = h % 2^128, then add the pad. */
+    h0 = ((h0) | (h1 << 26)) & 0xFFFFFFFF;
+    h1 = ((h1 >> 6) | (h2 << 20)) & 0xFFFFFFFF;
+    h2 = ((h2 >> 12) | (h3 << 14)) & 0xFFFFFFFF;
+    h3 = ((h3 >> 18) | (h4 << 8)) & 0xFFFFFFFF;
+
+    f = (ccp_u64)h0 + p->pad[0]; h0 = (word32)f;
+    f = (ccp_u64)h1 + p->pad[1] + (f >> 32); h1 = (word32)f;
+    f = (ccp_u64)h2 + p->pad[2] + (f >> 32); h2 = (word32)f;
+    f = (ccp_u64)h3 + p->pad[3] + (f >> 32); h3 = (word32)f;
+
+    PUT_32BIT_LSB_FIRST(tag + 0, h0);
+    PUT_32BIT_LSB_FIRST(tag + 4, h1);
+    PUT_32BIT_LSB_FIRST(tag + 8, h2);
+    PUT_32BIT_LSB_FIRST(tag + 12, h3);
+}
+
+static void poly1305_update(Poly1305 *p, const unsigned char *m, int len)
+{
+    int n;
+
+    if (p->buflen) {
+	n = 16 - p->buflen;
+	if (n > len)
+	    n = len;
+	memcpy(p->buf + p->buflen, m, n);
+	p->buflen += n;
+	m += n;
+	len -= n;
+	if (p->buflen < 16)
+	    return;
+	poly1305_blocks(p, p->buf, 16, TRUE);
+	p->buflen = 0;
+    }
+
+    n = len & ~15;
+    if (n) {
+	poly1305_blocks(p, m, n, TRUE);
+	m += n;
+	len -= n;
+    }
+
+    if (len) {
+	memcpy(p->buf, m, len);
+	p->buflen = len;
+    }
+}
+
+static void poly1305_final(Poly1305 *p, unsigned char *tag)
+{
+    /* Pad out a final partial block with a 1 and then zeroes. */
+    if (p->buflen) {
+	p->buf[p->buflen] = 1;
+	memset(p->buf + p->buflen + 1, 0, 16 - p->buflen - 1);
+	poly1305_blocks(p, p->buf, 16, FALSE);
+    }
+    poly1305_finish(p, tag);
+    memset(p, 0, sizeof(*p));
+}
+
+/* ----------------------------------------------------------------------
+ * The SSH-2 cipher.
+ */
+
+typedef struct {
+    word32 main_key[8];		       /* K_2: payload and Poly1305 key */
+    word32 hdr_key[8];		       /* K_1: packet length only */
+} CCPContext;
+
+static void *ccp_make_context(void)
+{
+    return snew(CCPContext);
+}
+
+static void ccp_free_context(void *handle)
+{
+    CCPContext *ctx = (CCPContext *)handle;
+    memset(ctx, 0, sizeof(*ctx));
+    sfree(ctx);
+}
+
+static void ccp_iv(void *handle, unsigned char *iv)
+{
+    /* The nonce is the sequence number; there is no IV. */
+}
+
+static void ccp_key(void *handle, unsigned char *key)
+{
+    CCPContext *ctx = (CCPContext *)handle;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	ctx->main_key[i] = GET_32BIT_LSB_FIRST(key + 4 * i);
+	ctx->hdr_key[i] = GET_32BIT_LSB_FIRST(key + 32 + 4 * i);
+    }
+}
+
+/*
+ * Set up the payload cipher state for one packet: generate block 0
+ * for the Poly1305 key and leave the counter at 1, ready for the
+ * payload.
+ */
+static void ccp_start(CCPContext *ctx, unsigned long seq, word32 *st,
+		      Poly1305 *mac)
+{
+    unsigned char polykey[64];
+
+    chacha20_init(st, ctx->main_key, seq);
+    chacha20_block(st, polykey);
+    chacha20_next_block(st);
+    poly1305_init(mac, polykey);
+    memset(polykey, 0, sizeof(polykey));
+}
+
+static void ccp_crypt_length(CCPContext *ctx, const unsigned char *in,
+			     unsigned char *out, unsigned long seq)
+{
+    word32 st[16];
+    unsigned char ks[64];
+    int i;
+
+    chacha20_init(st, ctx->hdr_key, seq);
+    chacha20_block(st, ks);
+    for (i = 0; i < 4; i++)
+	out[i] = in[i] ^ ks[i];
+    memset(st, 0, sizeof(st));
+    memset(ks, 0, sizeof(ks));
+}
+
+static unsigned long ccp_length(void *handle, unsigned char *blk,
+				unsigned long seq)
+{
+    CCPContext *ctx = (CCPContext *)handle;
+    unsigned char len[4];
+
+    ccp_crypt_length(ctx, blk, len, seq);
+    return GET_32BIT_MSB_FIRST(len);
+}
+
+static void ccp_encrypt(void *handle, unsigned char *blk, int len,
+			unsigned long seq)
+{
+    CCPContext *ctx = (CCPContext *)handle;
+    word32 st[16];
+    Poly1305 mac;
+    int n;
+
+    ccp_start(ctx, seq, st, &mac);
+    ccp_crypt_length(ctx, blk, blk, seq);
+    poly1305_update(&mac, blk, 4);
+
+    for (blk += 4, len -= 4; len > 0; blk += n, len -= n) {
+	n = (len < CCP_CHUNK ? len : CCP_CHUNK);
+	chacha20_xor(st, blk, n);
+	poly1305_update(&mac, blk, n);
+    }
+    poly1305_final(&mac, blk);
+    memset(st, 0, sizeof(st));
+}
+
+static int ccp_decrypt(void *handle, unsigned char *blk, int len,
+		       unsigned long seq)
+{
+    CCPContext *ctx = (CCPContext *)handle;
+    word32 st[16];
+    Poly1305 mac;
+    unsigned char tag[16];
+    unsigned char *p;
+    int i, n, diff;
+
+    ccp_start(ctx, seq, st, &mac);
+    poly1305_update(&mac, blk, 4);
+
+    for (p = blk + 4, n = len - 4; n > 0; p += i, n -= i) {
+	i = (n < CCP_CHUNK ? n : CCP_CHUNK);
+	poly1305_update(&mac, p, i);
+	chacha20_xor(st, p, i);
+    }
+    poly1305_final(&mac, tag);
+    memset(st, 0, sizeof(st));
+
+    /* Compare the whole tag, so the time taken doesn't depend on where
+     * it differs. */
+    diff = 0;
+    for (i = 0; i < 16; i++)
+	diff |= tag[i] ^ blk[len + i];
+    if (diff) {
+	memset(blk, 0, len);	       /* don't leave forged plaintext about */
+	return FALSE;
+    }
+
+    ccp_crypt_length(ctx, blk, blk, seq);
+    return TRUE;
+}
+
+static const struct ssh2_cipher ssh2_chacha20_poly1305 = {
+    ccp_make_context, ccp_free_context, ccp_iv, ccp_key,
+    NULL, NULL,
+    "chacha20-poly1305@openssh.com",
+    8, 512, SSH_CIPHER_IS_AEAD, "ChaCha20-Poly1305",
+    16, ccp_length, ccp_encrypt, ccp_decrypt
+};
+
+static const struct ssh2_cipher *const ccp_list[] = {
+    &ssh2_chacha20_poly1305,
+};
+
+const struct ssh2_ciphers ssh2_ccp = {
+    sizeof(ccp_list) / sizeof(*ccp_list),
+    ccp_list
+};
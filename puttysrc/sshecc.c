@@ -0,0 +1,2227 @@
+/*
+ * Elliptic-curve cryptography for PuTTY:
+ *
+ *  - Diffie-Hellman key exchange: "curve25519-sha256" (RFC 8731,
+ *    also known by its older name "curve25519-sha256@libssh.org")
+ *    and "ecdh-sha2-nistp256" (RFC 5656).
+ *
+ *  - Signatures: "ssh-ed25519" (RFC 8709) and "ecdsa-sha2-nistp256"
+ *    (RFC 5656).
+ *
+ * None of it uses the general-purpose bignum code in sshbn.c. Each curve
+ * has its own fixed-size field arithmetic, written so that the
+ * sequence of operations and memory accesses never depends on secret
+ * data: there are no data-dependent branches or table indices, and
+ * conditional operations are done with masks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ssh.h"
+
+#ifdef _MSC_VER
+typedef unsigned __int64 ecc_u64;
+#else
+typedef unsigned long long ecc_u64;
+#endif
+
+/* ----------------------------------------------------------------------
+ * Arithmetic modulo 2^255-19.
+ *
+ * An element is held in ten limbs of alternately 26 and 25 bits (so
+ * limb i has weight 2^ceil(25.5*i)). Every function here returns its
+ * result with each limb at most a few bits over its nominal width,
+ * which keeps all the products in f25519_mul comfortably inside 64
+ * bits.
+ */
+
+typedef word32 f25519[10];
+
+#define F25519_WIDTH(i) (((i) & 1) ? 25 : 26)
+
+/*
+ * Propagate carries through a set of 64-bit limb accumulators and
+ * store the result, folding the carry out of the top limb back into
+ * the bottom one (since 2^255 = 19).
+ */
+static void f25519_carry(f25519 h, ecc_u64 *t)
+{
+    ecc_u64 c;
+    int i;
+
+    for (i = 0; i < 9; i++) {
+	c = t[i] >> F25519_WIDTH(i);
+	t[i] &= ((ecc_u64)1 << F25519_WIDTH(i)) - 1;
+	t[i+1] += c;
+    }
+    c = t[9] >> 25;
+    t[9] &= 0x1FFFFFF;
+    t[0] += 19 * c;
+    c = t[0] >> 26;
+    t[0] &= 0x3FFFFFF;
+    t[1] += c;
+
+    for (i = 0; i < 10; i++)
+	h[i] = (word32)t[i];
+}
+
+static void f25519_copy(f25519 h, const f25519 f)
+{
+    memcpy(h, f, sizeof(f25519));
+}
+
+static void f25519_set(f25519 h, word32 n)
+{
+    memset(h, 0, sizeof(f25519));
+    h[0] = n;
+}
+
+static void f25519_add(f25519 h, const f25519 f, const f25519 g)
+{
+    ecc_u64 t[10];
+    int i;
+
+    for (i = 0; i < 10; i++)
+	t[i] = (ecc_u64)f[i] + g[i];
+    f25519_carry(h, t);
+}
+
+static void f25519_sub(f25519 h, const f25519 f, const f25519 g)
+{
+    /* Add 2p first, limb by limb, so that no limb goes negative. */
+    static const word32 twop[10] = {
+	0x7FFFFDA, 0x3FFFFFE, 0x7FFFFFE, 0x3FFFFFE, 0x7FFFFFE,
+	0x3FFFFFE, 0x7FFFFFE, 0x3FFFFFE, 0x7FFFFFE, 0x3FFFFFE
+    };
+    ecc_u64 t[10];
+    int i;
+
+    for (i = 0; i < 10; i++)
+	t[i] = (ecc_u64)f[i] + twop[i] - g[i];
+    f25519_carry(h, t);
+}
+
+static void f25519_mul(f25519 h, const f25519 f, const f25519 g)
+{
+    ecc_u64 t[10];
+    word32 f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    word32 f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+    word32 g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    word32 g5 = g[5], g6 = g[6], g7 = g[7], g8 = g[8], g9 = g[9];
+    /*
+     * Product limbs that wrap past 2^255 pick up a factor of 19, and
+     * the product of two odd (25-bit) limbs sits one bit above the
+     * nominal weight of its destination, so picks up a factor of 2.
+     */
+    word32 f1_2 = 2*f1, f3_2 = 2*f3, f5_2 = 2*f5, f7_2 = 2*f7, f9_2 = 2*f9;
+    word32 g1_19 = 19*g1, g2_19 = 19*g2, g3_19 = 19*g3, g4_19 = 19*g4;
+    word32 g5_19 = 19*g5, g6_19 = 19*g6, g7_19 = 19*g7, g8_19 = 19*g8;
+    word32 g9_19 = 19*g9;
+
+    t[0] = (ecc_u64)f0 * g0 + (ecc_u64)f1_2 * g9_19 + (ecc_u64)f2 * g8_19
+	+ (ecc_u64)f3_2 * g7_19 + (ecc_u64)f4 * g6_19 + (ecc_u64)f5_2 * g5_19
+	+ (ecc_u64)f6 * g4_19 + (ecc_u64)f7_2 * g3_19 + (ecc_u64)f8 * g2_19
+	+ (ecc_u64)f9_2 * g1_19;
+    t[1] = (ecc_u64)f0 * g1 + (ecc_u64)f1 * g0 + (ecc_u64)f2 * g9_19
+	+ (ecc_u64)f3 * g8_19 + (ecc_u64)f4 * g7_19 + (ecc_u64)f5 * g6_19
+	+ (ecc_u64)f6 * g5_19 + (ecc_u64)f7 * g4_19 + (ecc_u64)f8 * g3_19
+	+ (ecc_u64)f9 * g2_19;
+    t[2] = (ecc_u64)f0 * g2 + (ecc_u64)f1_2 * g1 + (ecc_u64)f2 * g0
+	+ (ecc_u64)f3_2 * g9_19 + (ecc_u64)f4 * g8_19 + (ecc_u64)f5_2 * g7_19
+	+ (ecc_u64)f6 * g6_19 + (ecc_u64)f7_2 * g5_19 + (ecc_u64)f8 * g4_19
+	+ (ecc_u64)f9_2 * g3_19;
+    t[3] = (ecc_u64)f0 * g3 + (ecc_u64)f1 * g2 + (ecc_u64)f2 * g1
+	+ (ecc_u64)f3 * g0 + (ecc_u64)f4 * g9_19 + (ecc_u64)f5 * g8_19
+	+ (ecc_u64)f6 * g7_19 + (ecc_u64)f7 * g6_19 + (ecc_u64)f8 * g5_19
+	+ (ecc_u64)f9 * g4_19;
+    t[4] = (ecc_u64)f0 * g4 + (ecc_u64)f1_2 * g3 + (ecc_u64)f2 * g2
+	+ (ecc_u64)f3_2 * g1 + (ecc_u64)f4 * g0 + (ecc_u64)f5_2 * g9_19
+	+ (ecc_u64)f6 * g8_19 + (ecc_u64)f7_2 * g7_19 + (ecc_u64)f8 * g6_19
+	+ (ecc_u64)f9_2 * g5_19;
+    t[5] = (ecc_u64)f0 * g5 + (ecc_u64)f1 * g4 + (ecc_u64)f2 * g3
+	+ (ecc_u64)f3 * g2 + (ecc_u64)f4 * g1 + (ecc_u64)f5 * g0
+	+ (ecc_u64)f6 * g9_19 + (ecc_u64)f7 * g8_19 + (ecc_u64)f8 * g7_19
+	+ (ecc_u64)f9 * g6_19;
+    t[6] = (ecc_u64)f0 * g6 + (ecc_u64)f1_2 * g5 + (ecc_u64)f2 * g4
+	+ (ecc_u64)f3_2 * g3 + (ecc_u64)f4 * g2 + (ecc_u64)f5_2 * g1
+	+ (ecc_u64)f6 * g0 + (ecc_u64)f7_2 * g9_19 + (ecc_u64)f8 * g8_19
+	+ (ecc_u64)f9_2 * g7_19;
+    t[7] = (ecc_u64)f0 * g7 + (ecc_u64)f1 * g6 + (ecc_u64)f2 * g5
+	+ (ecc_u64)f3 * g4 + (ecc_u64)f4 * g3 + (ecc_u64)f5 * g2 + (ecc_u64)f6 * g1
+	+ (ecc_u64)f7 * g0 + (ecc_u64)f8 * g9_19 + (ecc_u64)f9 * g8_19;
+    t[8] = (ecc_u64)f0 * g8 + (ecc_u64)f1_2 * g7 + (ecc_u64)f2 * g6
+	+ (ecc_u64)f3_2 * g5 + (ecc_u64)f4 * g4 + (ecc_u64)f5_2 * g3
+	+ (ecc_u64)f6 * g2 + (ecc_u64)f7_2 * g1 + (ecc_u64)f8 * g0
+	+ (ecc_u64)f9_2 * g9_19;
+    t[9] = (ecc_u64)f0 * g9 + (ecc_u64)f1 * g8 + (ecc_u64)f2 * g7
+	+ (ecc_u64)f3 * g6 + (ecc_u64)f4 * g5 + (ecc_u64)f5 * g4 + (ecc_u64)f6 * g3
+	+ (ecc_u64)f7 * g2 + (ecc_u64)f8 * g1 + (ecc_u64)f9 * g0;
+
+    f25519_carry(h, t);
+}
+
+/* As f25519_mul(h, f, f), but with the symmetric products merged. */
+static void f25519_sqr(f25519 h, const f25519 f)
+{
+    ecc_u64 t[10];
+    word32 f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    word32 f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+    word32 f0_2 = 2*f0, f1_2 = 2*f1, f2_2 = 2*f2, f3_2 = 2*f3, f4_2 = 2*f4;
+    word32 f5_2 = 2*f5, f7_2 = 2*f7, f1_4 = 4*f1, f3_4 = 4*f3;
+    word32 f6_19 = 19*f6, f8_19 = 19*f8;
+    word32 f5_38 = 38*f5, f6_38 = 38*f6, f7_38 = 38*f7, f8_38 = 38*f8;
+    word32 f9_38 = 38*f9;
+
+    t[0] = (ecc_u64)f0 * f0 + (ecc_u64)f1_2 * f9_38 + (ecc_u64)f2 * f8_38
+	+ (ecc_u64)f3_2 * f7_38 + (ecc_u64)f4 * f6_38 + (ecc_u64)f5 * f5_38;
+    t[1] = (ecc_u64)f0_2 * f1 + (ecc_u64)f2 * f9_38 + (ecc_u64)f3 * f8_38
+	+ (ecc_u64)f4 * f7_38 + (ecc_u64)f5 * f6_38;
+    t[2] = (ecc_u64)f0_2 * f2 + (ecc_u64)f1_2 * f1 + (ecc_u64)f3_2 * f9_38
+	+ (ecc_u64)f4 * f8_38 + (ecc_u64)f5_2 * f7_38 + (ecc_u64)f6 * f6_19;
+    t[3] = (ecc_u64)f0_2 * f3 + (ecc_u64)f1_2 * f2 + (ecc_u64)f4 * f9_38
+	+ (ecc_u64)f5 * f8_38 + (ecc_u64)f6 * f7_38;
+    t[4] = (ecc_u64)f0_2 * f4 + (ecc_u64)f1_4 * f3 + (ecc_u64)f2 * f2
+	+ (ecc_u64)f5_2 * f9_38 + (ecc_u64)f6 * f8_38 + (ecc_u64)f7 * f7_38;
+    t[5] = (ecc_u64)f0_2 * f5 + (ecc_u64)f1_2 * f4 + (ecc_u64)f2_2 * f3
+	+ (ecc_u64)f6 * f9_38 + (ecc_u64)f7 * f8_38;
+    t[6] = (ecc_u64)f0_2 * f6 + (ecc_u64)f1_4 * f5 + (ecc_u64)f2_2 * f4
+	+ (ecc_u64)f3_2 * f3 + (ecc_u64)f7_2 * f9_38 + (ecc_u64)f8 * f8_19;
+    t[7] = (ecc_u64)f0_2 * f7 + (ecc_u64)f1_2 * f6 + (ecc_u64)f2_2 * f5
+	+ (ecc_u64)f3_2 * f4 + (ecc_u64)f8 * f9_38;
+    t[8] = (ecc_u64)f0_2 * f8 + (ecc_u64)f1_4 * f7 + (ecc_u64)f2_2 * f6
+	+ (ecc_u64)f3_4 * f5 + (ecc_u64)f4 * f4 + (ecc_u64)f9 * f9_38;
+    t[9] = (ecc_u64)f0_2 * f9 + (ecc_u64)f1_2 * f8 + (ecc_u64)f2_2 * f7
+	+ (ecc_u64)f3_2 * f6 + (ecc_u64)f4_2 * f5;
+
+    f25519_carry(h, t);
+}
+
+/* Raise f to the power 2^n. */
+static void f25519_sqr_n(f25519 h, const f25519 f, int n)
+{
+    f25519_sqr(h, f);
+    while (--n > 0)
+	f25519_sqr(h, h);
+}
+
+static void f25519_mul_small(f25519 h, const f25519 f, word32 n)
+{
+    ecc_u64 t[10];
+    int i;
+
+    for (i = 0; i < 10; i++)
+	t[i] = (ecc_u64)f[i] * n;
+    f25519_carry(h, t);
+}
+
+/*
+ * Compute f^(p-2) = 1/f, by the usual addition chain for 2^255-21.
+ */
+static void f25519_invert(f25519 h, const f25519 f)
+{
+    f25519 t0, t1, t2, t3;
+
+    f25519_sqr(t0, f);			/* 2 */
+    f25519_sqr_n(t1, t0, 2);		/* 8 */
+    f25519_mul(t1, f, t1);		/* 9 */
+    f25519_mul(t0, t0, t1);		/* 11 */
+    f25519_sqr(t2, t0);			/* 22 */
+    f25519_mul(t1, t1, t2);		/* 2^5 - 1 */
+    f25519_sqr_n(t2, t1, 5);
+    f25519_mul(t1, t2, t1);		/* 2^10 - 1 */
+    f25519_sqr_n(t2, t1, 10);
+    f25519_mul(t2, t2, t1);		/* 2^20 - 1 */
+    f25519_sqr_n(t3, t2, 20);
+    f25519_mul(t2, t3, t2);		/* 2^40 - 1 */
+    f25519_sqr_n(t2, t2, 10);
+    f25519_mul(t1, t2, t1);		/* 2^50 - 1 */
+    f25519_sqr_n(t2, t1, 50);
+    f25519_mul(t2, t2, t1);		/* 2^100 - 1 */
+    f25519_sqr_n(t3, t2, 100);
+    f25519_mul(t2, t3, t2);		/* 2^200 - 1 */
+    f25519_sqr_n(t2, t2, 50);
+    f25519_mul(t1, t2, t1);		/* 2^250 - 1 */
+    f25519_sqr_n(t1, t1, 5);		/* 2^255 - 32 */
+    f25519_mul(h, t1, t0);		/* 2^255 - 21 */
+
+    memset(t0, 0, sizeof(t0));
+    memset(t1, 0, sizeof(t1));
+    memset(t2, 0, sizeof(t2));
+    memset(t3, 0, sizeof(t3));
+}
+
+/*
+ * Compute f^((p-5)/8) = f^(2^252-3), for square roots. The chain is
+ * the same as f25519_invert's up to 2^250-1.
+ */
+static void f25519_pow22523(f25519 h, const f25519 f)
+{
+    f25519 t0, t1, t2;
+
+    f25519_sqr(t0, f);			/* 2 */
+    f25519_sqr_n(t1, t0, 2);		/* 8 */
+    f25519_mul(t1, f, t1);		/* 9 */
+    f25519_mul(t0, t0, t1);		/* 11 */
+    f25519_sqr(t0, t0);			/* 22 */
+    f25519_mul(t0, t1, t0);		/* 2^5 - 1 */
+    f25519_sqr_n(t1, t0, 5);
+    f25519_mul(t0, t1, t0);		/* 2^10 - 1 */
+    f25519_sqr_n(t1, t0, 10);
+    f25519_mul(t1, t1, t0);		/* 2^20 - 1 */
+    f25519_sqr_n(t2, t1, 20);
+    f25519_mul(t1, t2, t1);		/* 2^40 - 1 */
+    f25519_sqr_n(t1, t1, 10);
+    f25519_mul(t0, t1, t0);		/* 2^50 - 1 */
+    f25519_sqr_n(t1, t0, 50);
+    f25519_mul(t1, t1, t0);		/* 2^100 - 1 */
+    f25519_sqr_n(t2, t1, 100);
+    f25519_mul(t1, t2, t1);		/* 2^200 - 1 */
+    f25519_sqr_n(t1, t1, 50);
+    f25519_mul(t0, t1, t0);		/* 2^250 - 1 */
+    f25519_sqr_n(t0, t0, 2);		/* 2^252 - 4 */
+    f25519_mul(h, t0, f);		/* 2^252 - 3 */
+
+    memset(t0, 0, sizeof(t0));
+    memset(t1, 0, sizeof(t1));
+    memset(t2, 0, sizeof(t2));
+}
+
+/*
+ * Swap f and g if swap is 1; leave them alone if it is 0.
+ */
+static void f25519_cswap(f25519 f, f25519 g, word32 swap)
+{
+    word32 mask = 0 - swap, x;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+	x = mask & (f[i] ^ g[i]);
+	f[i] ^= x;
+	g[i] ^= x;
+    }
+}
+
+/*
+ * Read a field element from 32 little-endian bytes, ignoring the top
+ * bit as RFC 7748 requires.
+ */
+static void f25519_from_bytes(f25519 h, const unsigned char *in)
+{
+    ecc_u64 acc = 0;
+    int bits = 0, k = 0, i;
+
+    for (i = 0; i < 10; i++) {
+	while (bits < F25519_WIDTH(i)) {
+	    acc |= (ecc_u64)in[k++] << bits;
+	    bits += 8;
+	}
+	h[i] = (word32)acc & ((1UL << F25519_WIDTH(i)) - 1);
+	acc >>= F25519_WIDTH(i);
+	bits -= F25519_WIDTH(i);
+    }
+}
+
+/*
+ * Write out the fully reduced (i.e. canonical) value of a field
+ * element as 32 little-endian bytes.
+ */
+static void f25519_to_bytes(unsigned char *out, const f25519 f)
+{
+    ecc_u64 t[10], acc;
+    word32 h[10], w[10], c, mask;
+    int i, pass, bits, k;
+
+    /*
+     * Two passes of carrying leave every limb strictly inside its
+     * width, so h holds some value v in [0, 2^255).
+     */
+    for (i = 0; i < 10; i++)
+	t[i] = f[i];
+    for (pass = 0; pass < 2; pass++) {
+	for (i = 0; i < 9; i++) {
+	    t[i+1] += t[i] >> F25519_WIDTH(i);
+	    t[i] &= ((ecc_u64)1 << F25519_WIDTH(i)) - 1;
+	}
+	t[0] += 19 * (t[9] >> 25);
+	t[9] &= 0x1FFFFFF;
+    }
+    for (i = 0; i < 10; i++)
+	h[i] = (word32)t[i];
+
+    /*
+     * v is at most 18 too big, which happens exactly when v+19
+     * reaches 2^255; in that case v+19-2^255 is the answer.
+     */
+    c = 19;
+    for (i = 0; i < 10; i++) {
+	w[i] = h[i] + c;
+	c = w[i] >> F25519_WIDTH(i);
+	w[i] &= (1UL << F25519_WIDTH(i)) - 1;
+    }
+    mask = 0 - c;
+    for (i = 0; i < 10; i++)
+	h[i] = (h[i] & ~mask) | (w[i] & mask);
+
+    acc = 0;
+    bits = k = 0;
+    for (i = 0; i < 10; i++) {
+	acc |= (ecc_u64)h[i] << bits;
+	bits += F25519_WIDTH(i);
+	while (bits >= 8) {
+	    out[k++] = (unsigned char)acc;
+	    acc >>= 8;
+	    bits -= 8;
+	}
+    }
+    out[k] = (unsigned char)acc;
+    assert(k == 31);
+
+    memset(t, 0, sizeof(t));
+    memset(h, 0, sizeof(h));
+    memset(w, 0, sizeof(w));
+}
+
+/* ----------------------------------------------------------------------
+ * X25519 (RFC 7748 section 5).
+ */
+
+static void x25519(unsigned char *out, const unsigned char *scalar,
+		   const unsigned char *point)
+{
+    f25519 x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb;
+    unsigned char k[32];
+    word32 swap, bit;
+    int t;
+
+    memcpy(k, scalar, 32);
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    f25519_from_bytes(x1, point);
+    f25519_set(x2, 1);
+    f25519_set(z2, 0);
+    f25519_copy(x3, x1);
+    f25519_set(z3, 1);
+
+    swap = 0;
+    for (t = 254; t >= 0; t--) {
+	bit = (k[t >> 3] >> (t & 7)) & 1;
+	swap ^= bit;
+	f25519_cswap(x2, x3, swap);
+	f25519_cswap(z2, z3, swap);
+	swap = bit;
+
+	f25519_add(a, x2, z2);
+	f25519_sqr(aa, a);
+	f25519_sub(b, x2, z2);
+	f25519_sqr(bb, b);
+	f25519_sub(e, aa, bb);
+	f25519_add(c, x3, z3);
+	f25519_sub(d, x3, z3);
+	f25519_mul(da, d, a);
+	f25519_mul(cb, c, b);
+	f25519_add(x3, da, cb);
+	f25519_sqr(x3, x3);
+	f25519_sub(z3, da, cb);
+	f25519_sqr(z3, z3);
+	f25519_mul(z3, z3, x1);
+	f25519_mul(x2, aa, bb);
+	f25519_mul_small(z2, e, 121665);
+	f25519_add(z2, z2, aa);
+	f25519_mul(z2, z2, e);
+    }
+    f25519_cswap(x2, x3, swap);
+    f25519_cswap(z2, z3, swap);
+
+    f25519_invert(z2, z2);
+    f25519_mul(x2, x2, z2);
+    f25519_to_bytes(out, x2);
+
+    memset(k, 0, sizeof(k));
+    memset(x2, 0, sizeof(x2));
+    memset(z2, 0, sizeof(z2));
+    memset(x3, 0, sizeof(x3));
+    memset(z3, 0, sizeof(z3));
+}
+
+/* ----------------------------------------------------------------------
+ * The twisted Edwards curve -x^2 + y^2 = 1 + d x^2 y^2 used by
+ * Ed25519 (RFC 8032), birationally equivalent to curve25519.
+ *
+ * Points are in extended coordinates (X:Y:Z:T) with x = X/Z, y = Y/Z
+ * and xy = T/Z. The addition formula (Hisil, Wong, Carter and
+ * Dawson, 2008) is complete on this curve, so it needs no special
+ * cases for doubling or the neutral element (0:1:1:0).
+ */
+
+struct ed_point {
+    f25519 x, y, z, t;
+};
+
+/* d = -121665/121666, and 2d */
+static const f25519 ed25519_d = {
+    0x35978A3, 0x0D37284, 0x3156EBD, 0x06A0A0E, 0x001C029,
+    0x179E898, 0x3A03CBB, 0x1CE7198, 0x2E2B6FF, 0x1480DB3
+};
+static const f25519 ed25519_d2 = {
+    0x2B2F159, 0x1A6E509, 0x22ADD7A, 0x0D4141D, 0x0038052,
+    0x0F3D130, 0x3407977, 0x19CE331, 0x1C56DFF, 0x0901B67
+};
+
+/* A square root of -1 */
+static const f25519 f25519_sqrtm1 = {
+    0x20EA0B0, 0x186C9D2, 0x08F189D, 0x035697F, 0x0BD0C60,
+    0x1FBD7A7, 0x2804C9E, 0x1E16569, 0x004FC1D, 0x0AE0C92
+};
+
+/* The base point, (x, 4/5) with x even */
+static const struct ed_point ed25519_base = {
+    { 0x325D51A, 0x18B5823, 0x0F6592A, 0x104A92D, 0x1A4B31D,
+      0x1D6DC5C, 0x27118FE, 0x07FD814, 0x13CD6E5, 0x085A4DB },
+    { 0x2666658, 0x1999999, 0x0CCCCCC, 0x1333333, 0x1999999,
+      0x0666666, 0x3333333, 0x0CCCCCC, 0x2666666, 0x1999999 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0x1B7DDA3, 0x1A2ACE9, 0x25EADBB, 0x003BA8A, 0x083C27E,
+      0x0ABE37D, 0x1274732, 0x0CCACDD, 0x0FD78B7, 0x19E1D7C }
+};
+
+static void ed_neutral(struct ed_point *r)
+{
+    f25519_set(r->x, 0);
+    f25519_set(r->y, 1);
+    f25519_set(r->z, 1);
+    f25519_set(r->t, 0);
+}
+
+/* r = p + q. r may alias either input. */
+static void ed_add(struct ed_point *r, const struct ed_point *p,
+		   const struct ed_point *q)
+{
+    f25519 a, b, c, d, e, f, g, h;
+
+    f25519_sub(a, p->y, p->x);
+    f25519_sub(e, q->y, q->x);
+    f25519_mul(a, a, e);
+    f25519_add(b, p->y, p->x);
+    f25519_add(e, q->y, q->x);
+    f25519_mul(b, b, e);
+    f25519_mul(c, p->t, q->t);
+    f25519_mul(c, c, ed25519_d2);
+    f25519_mul(d, p->z, q->z);
+    f25519_add(d, d, d);
+    f25519_sub(e, b, a);
+    f25519_sub(f, d, c);
+    f25519_add(g, d, c);
+    f25519_add(h, b, a);
+
+    f25519_mul(r->x, e, f);
+    f25519_mul(r->y, g, h);
+    f25519_mul(r->t, e, h);
+    f25519_mul(r->z, f, g);
+}
+
+/* r = 2p. r may alias p. */
+static void ed_double(struct ed_point *r, const struct ed_point *p)
+{
+    f25519 a, b, c, e, f, g, h;
+
+    f25519_sqr(a, p->x);
+    f25519_sqr(b, p->y);
+    f25519_sqr(c, p->z);
+    f25519_add(c, c, c);
+    f25519_add(h, a, b);
+    f25519_add(e, p->x, p->y);
+    f25519_sqr(e, e);
+    f25519_sub(e, h, e);
+    f25519_sub(g, a, b);
+    f25519_add(f, c, g);
+
+    f25519_mul(r->x, e, f);
+    f25519_mul(r->y, g, h);
+    f25519_mul(r->t, e, h);
+    f25519_mul(r->z, f, g);
+}
+
+static void ed_negate(struct ed_point *r, const struct ed_point *p)
+{
+    f25519 zero;
+
+    f25519_set(zero, 0);
+    f25519_sub(r->x, zero, p->x);
+    f25519_copy(r->y, p->y);
+    f25519_copy(r->z, p->z);
+    f25519_sub(r->t, zero, p->t);
+}
+
+static int f25519_equal(const f25519 f, const f25519 g)
+{
+    unsigned char a[32], b[32];
+
+    f25519_to_bytes(a, f);
+    f25519_to_bytes(b, g);
+    return !memcmp(a, b, 32);
+}
+
+/*
+ * Decode a point from its 32-byte encoding: y, little-endian, with
+ * the low bit of x in the top bit. Returns 0 if the encoding is not
+ * canonical or there is no such point. Only ever used on public
+ * data, so it is free to branch.
+ */
+static int ed_from_bytes(struct ed_point *r, const unsigned char *in)
+{
+    unsigned char buf[32];
+    f25519 u, v, v3, vx2;
+    int sign = in[31] >> 7;
+
+    f25519_from_bytes(r->y, in);
+    f25519_to_bytes(buf, r->y);
+    buf[31] |= sign << 7;
+    if (memcmp(buf, in, 32))
+	return 0;			/* y >= p */
+
+    /* x^2 = (y^2 - 1) / (d y^2 + 1) = u/v */
+    f25519_set(r->z, 1);
+    f25519_sqr(u, r->y);
+    f25519_mul(v, u, ed25519_d);
+    f25519_sub(u, u, r->z);
+    f25519_add(v, v, r->z);
+
+    /* candidate root x = u v^3 (u v^7)^((p-5)/8) */
+    f25519_sqr(v3, v);
+    f25519_mul(v3, v3, v);
+    f25519_sqr(r->x, v3);
+    f25519_mul(r->x, r->x, v);
+    f25519_mul(r->x, r->x, u);
+    f25519_pow22523(r->x, r->x);
+    f25519_mul(r->x, r->x, v3);
+    f25519_mul(r->x, r->x, u);
+
+    f25519_sqr(vx2, r->x);
+    f25519_mul(vx2, vx2, v);
+    if (!f25519_equal(vx2, u)) {
+	f25519_set(v3, 0);
+	f25519_sub(u, v3, u);
+	if (!f25519_equal(vx2, u))
+	    return 0;
+	f25519_mul(r->x, r->x, f25519_sqrtm1);
+    }
+
+    f25519_to_bytes(buf, r->x);
+    if ((buf[0] & 1) != sign) {
+	f25519_set(v3, 0);
+	if (f25519_equal(r->x, v3))
+	    return 0;			/* -0 */
+	f25519_sub(r->x, v3, r->x);
+    }
+    f25519_mul(r->t, r->x, r->y);
+    return 1;
+}
+
+static void ed_to_bytes(unsigned char *out, const struct ed_point *p)
+{
+    f25519 zinv, t;
+    unsigned char xb[32];
+
+    f25519_invert(zinv, p->z);
+    f25519_mul(t, p->y, zinv);
+    f25519_to_bytes(out, t);
+    f25519_mul(t, p->x, zinv);
+    f25519_to_bytes(xb, t);
+    out[31] |= (xb[0] & 1) << 7;
+}
+
+/* Fill in table[i] = i * p for i = 0..15. */
+static void ed_mktable(struct ed_point *table, const struct ed_point *p)
+{
+    int i;
+
+    ed_neutral(&table[0]);
+    table[1] = *p;
+    for (i = 2; i < 16; i++) {
+	if (i & 1)
+	    ed_add(&table[i], &table[i-1], p);
+	else
+	    ed_double(&table[i], &table[i/2]);
+    }
+}
+
+/* sel = table[digit], read without a secret-dependent address. */
+static void ed_select(struct ed_point *sel, const struct ed_point *table,
+		      word32 digit)
+{
+    word32 mask;
+    int i, j;
+
+    memset(sel, 0, sizeof(*sel));
+    for (i = 0; i < 16; i++) {
+	mask = 0 - (word32)(((digit ^ i) - 1) >> 31);
+	for (j = 0; j < 10; j++) {
+	    sel->x[j] |= table[i].x[j] & mask;
+	    sel->y[j] |= table[i].y[j] & mask;
+	    sel->z[j] |= table[i].z[j] & mask;
+	    sel->t[j] |= table[i].t[j] & mask;
+	}
+    }
+}
+
+/* The 4-bit digit w of a 32-byte little-endian scalar, from the bottom */
+#define ED_DIGIT(k, w) (((k)[(w) >> 1] >> (((w) & 1) ? 4 : 0)) & 15)
+
+/*
+ * r = k * p, for a 32-byte little-endian scalar k, using a fixed
+ * 4-bit window in the same way as p256_mul below.
+ */
+static void ed_mul(struct ed_point *r, const unsigned char *k,
+		   const struct ed_point *p)
+{
+    struct ed_point table[16], acc, sel;
+    int i, w;
+
+    ed_mktable(table, p);
+    ed_neutral(&acc);
+    for (w = 63; w >= 0; w--) {
+	for (i = 0; i < 4; i++)
+	    ed_double(&acc, &acc);
+	ed_select(&sel, table, ED_DIGIT(k, w));
+	ed_add(&acc, &acc, &sel);
+    }
+
+    *r = acc;
+    memset(table, 0, sizeof(table));
+    memset(&acc, 0, sizeof(acc));
+    memset(&sel, 0, sizeof(sel));
+}
+
+/*
+ * r = a * p + b * q, sharing the doublings between the two scalars
+ * (Shamir's trick), which makes signature verification cost little
+ * more than one scalar multiplication.
+ */
+static void ed_mul2(struct ed_point *r, const unsigned char *a,
+		    const struct ed_point *p, const unsigned char *b,
+		    const struct ed_point *q)
+{
+    struct ed_point ptable[16], qtable[16], acc, sel;
+    int i, w;
+
+    ed_mktable(ptable, p);
+    ed_mktable(qtable, q);
+    ed_neutral(&acc);
+    for (w = 63; w >= 0; w--) {
+	for (i = 0; i < 4; i++)
+	    ed_double(&acc, &acc);
+	ed_select(&sel, ptable, ED_DIGIT(a, w));
+	ed_add(&acc, &acc, &sel);
+	ed_select(&sel, qtable, ED_DIGIT(b, w));
+	ed_add(&acc, &acc, &sel);
+    }
+    *r = acc;
+}
+
+#undef ED_DIGIT
+
+/* ----------------------------------------------------------------------
+ * Montgomery arithmetic modulo a 256-bit odd number, in eight 32-bit
+ * limbs (least significant first). Values are kept reduced, i.e. in
+ * [0, m), and in Montgomery form (scaled by R = 2^256 mod m).
+ */
+
+typedef word32 mont256[8];
+
+struct mont256_modulus {
+    mont256 m;
+    word32 minv;		       /* -1/m mod 2^32 */
+    mont256 r2;			       /* R^2 mod m */
+    mont256 one;		       /* R mod m, i.e. 1 in Montgomery form */
+};
+
+/*
+ * r = t - m if that doesn't go negative (taking 'hi' as a 257th bit
+ * of t), else r = t.
+ */
+static void mont256_condsub(mont256 r, const word32 *t, word32 hi,
+			    const struct mont256_modulus *mod)
+{
+    mont256 u;
+    ecc_u64 d;
+    word32 borrow = 0, mask;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	d = (ecc_u64)t[i] - mod->m[i] - borrow;
+	u[i] = (word32)d;
+	borrow = (word32)(d >> 32) & 1;
+    }
+    mask = 0 - ((hi | (borrow ^ 1)) & 1);
+    for (i = 0; i < 8; i++)
+	r[i] = (u[i] & mask) | (t[i] & ~mask);
+}
+
+static void mont256_mul(mont256 r, const mont256 a, const mont256 b,
+			const struct mont256_modulus *mod)
+{
+    word32 t[10], m;
+    ecc_u64 c;
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 8; i++) {
+	c = 0;
+	for (j = 0; j < 8; j++) {
+	    c = (ecc_u64)a[j] * b[i] + t[j] + (c >> 32);
+	    t[j] = (word32)c;
+	}
+	c = (ecc_u64)t[8] + (c >> 32);
+	t[8] = (word32)c;
+	t[9] = (word32)(c >> 32);
+
+	m = t[0] * mod->minv;
+	c = (ecc_u64)m * mod->m[0] + t[0];
+	for (j = 1; j < 8; j++) {
+	    c = (ecc_u64)m * mod->m[j] + t[j] + (c >> 32);
+	    t[j-1] = (word32)c;
+	}
+	c = (ecc_u64)t[8] + (c >> 32);
+	t[7] = (word32)c;
+	t[8] = t[9] + (word32)(c >> 32);
+    }
+    mont256_condsub(r, t, t[8], mod);
+}
+
+static void mont256_add(mont256 r, const mont256 a, const mont256 b,
+			const struct mont256_modulus *mod)
+{
+    word32 t[8];
+    ecc_u64 c = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	c = (ecc_u64)a[i] + b[i] + (c >> 32);
+	t[i] = (word32)c;
+    }
+    mont256_condsub(r, t, (word32)(c >> 32), mod);
+}
+
+static void mont256_sub(mont256 r, const mont256 a, const mont256 b,
+			const struct mont256_modulus *mod)
+{
+    ecc_u64 d, c;
+    word32 borrow = 0, mask;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	d = (ecc_u64)a[i] - b[i] - borrow;
+	r[i] = (word32)d;
+	borrow = (word32)(d >> 32) & 1;
+    }
+    mask = 0 - borrow;
+    c = 0;
+    for (i = 0; i < 8; i++) {
+	c = (ecc_u64)r[i] + (mod->m[i] & mask) + (c >> 32);
+	r[i] = (word32)c;
+    }
+}
+
+/*
+ * Convert 32 big-endian bytes into Montgomery form. Returns 0 (and
+ * leaves r undefined) if the number is not less than the modulus.
+ */
+static int mont256_from_bytes(mont256 r, const unsigned char *in,
+			      const struct mont256_modulus *mod)
+{
+    mont256 t;
+    int i;
+
+    for (i = 0; i < 8; i++)
+	t[i] = GET_32BIT(in + 28 - 4*i);
+    for (i = 7; i >= 0; i--)
+	if (t[i] != mod->m[i])
+	    break;
+    if (i < 0 || t[i] > mod->m[i])
+	return 0;
+    mont256_mul(r, t, mod->r2, mod);
+    return 1;
+}
+
+/* Convert out of Montgomery form into 32 big-endian bytes. */
+static void mont256_to_bytes(unsigned char *out, const mont256 a,
+			     const struct mont256_modulus *mod)
+{
+    static const mont256 one = { 1, 0, 0, 0, 0, 0, 0, 0 };
+    mont256 t;
+    int i;
+
+    mont256_mul(t, a, one, mod);
+    for (i = 0; i < 8; i++)
+	PUT_32BIT(out + 28 - 4*i, t[i]);
+}
+
+/*
+ * Compute a^(m-2), which for prime m is 1/a. The exponent is public,
+ * so plain square-and-multiply is fine.
+ */
+static void mont256_invert(mont256 r, const mont256 a,
+			   const struct mont256_modulus *mod)
+{
+    mont256 e, acc;
+    ecc_u64 d;
+    word32 borrow = 2;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	d = (ecc_u64)mod->m[i] - borrow;
+	e[i] = (word32)d;
+	borrow = (word32)(d >> 32) & 1;
+    }
+    memcpy(acc, mod->one, sizeof(acc));
+    for (i = 255; i >= 0; i--) {
+	mont256_mul(acc, acc, acc, mod);
+	if ((e[i >> 5] >> (i & 31)) & 1)
+	    mont256_mul(acc, acc, a, mod);
+    }
+    memcpy(r, acc, sizeof(acc));
+}
+
+/* ----------------------------------------------------------------------
+ * The NIST P-256 curve, y^2 = x^3 - 3x + b.
+ *
+ * Points are in homogeneous projective coordinates (X:Y:Z), and are
+ * combined with the complete formulae of Renes, Costello and Batina
+ * ("Complete addition formulas for prime order elliptic curves",
+ * 2015), which handle doubling and the point at infinity (0:1:0)
+ * without special cases.
+ */
+
+static const struct mont256_modulus p256_p = {
+    { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
+      0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF },
+    0x00000001,
+    { 0x00000003, 0x00000000, 0xFFFFFFFF, 0xFFFFFFFB,
+      0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFD, 0x00000004 },
+    { 0x00000001, 0x00000000, 0x00000000, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFE, 0x00000000 },
+};
+
+/* The group order, big-endian. */
+static const unsigned char p256_n[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xBC, 0xE6, 0xFA, 0xAD, 0xA7, 0x17, 0x9E, 0x84,
+    0xF3, 0xB9, 0xCA, 0xC2, 0xFC, 0x63, 0x25, 0x51
+};
+
+/* b, in Montgomery form. */
+static const mont256 p256_b = {
+    0x29C4BDDF, 0xD89CDF62, 0x78843090, 0xACF005CD,
+    0xF7212ED6, 0xE5A220AB, 0x04874834, 0xDC30061D
+};
+
+/* The base point, in the uncompressed wire format. */
+static const unsigned char p256_g[65] = {
+    0x04,
+    0x6B, 0x17, 0xD1, 0xF2, 0xE1, 0x2C, 0x42, 0x47,
+    0xF8, 0xBC, 0xE6, 0xE5, 0x63, 0xA4, 0x40, 0xF2,
+    0x77, 0x03, 0x7D, 0x81, 0x2D, 0xEB, 0x33, 0xA0,
+    0xF4, 0xA1, 0x39, 0x45, 0xD8, 0x98, 0xC2, 0x96,
+    0x4F, 0xE3, 0x42, 0xE2, 0xFE, 0x1A, 0x7F, 0x9B,
+    0x8E, 0xE7, 0xEB, 0x4A, 0x7C, 0x0F, 0x9E, 0x16,
+    0x2B, 0xCE, 0x33, 0x57, 0x6B, 0x31, 0x5E, 0xCE,
+    0xCB, 0xB6, 0x40, 0x68, 0x37, 0xBF, 0x51, 0xF5
+};
+
+struct p256_point {
+    mont256 x, y, z;
+};
+
+#define FMUL(r, a, b) mont256_mul(r, a, b, &p256_p)
+#define FADD(r, a, b) mont256_add(r, a, b, &p256_p)
+#define FSUB(r, a, b) mont256_sub(r, a, b, &p256_p)
+
+/* r = p + q. r may alias either input. (RCB algorithm 4.) */
+static void p256_add(struct p256_point *r, const struct p256_point *p,
+		     const struct p256_point *q)
+{
+    mont256 t0, t1, t2, t3, t4, x3, y3, z3;
+
+    FMUL(t0, p->x, q->x);
+    FMUL(t1, p->y, q->y);
+    FMUL(t2, p->z, q->z);
+    FADD(t3, p->x, p->y);
+    FADD(t4, q->x, q->y);
+    FMUL(t3, t3, t4);
+    FADD(t4, t0, t1);
+    FSUB(t3, t3, t4);
+    FADD(t4, p->y, p->z);
+    FADD(x3, q->y, q->z);
+    FMUL(t4, t4, x3);
+    FADD(x3, t1, t2);
+    FSUB(t4, t4, x3);
+    FADD(x3, p->x, p->z);
+    FADD(y3, q->x, q->z);
+    FMUL(x3, x3, y3);
+    FADD(y3, t0, t2);
+    FSUB(y3, x3, y3);
+    FMUL(z3, p256_b, t2);
+    FSUB(x3, y3, z3);
+    FADD(z3, x3, x3);
+    FADD(x3, x3, z3);
+    FSUB(z3, t1, x3);
+    FADD(x3, t1, x3);
+    FMUL(y3, p256_b, y3);
+    FADD(t1, t2, t2);
+    FADD(t2, t1, t2);
+    FSUB(y3, y3, t2);
+    FSUB(y3, y3, t0);
+    FADD(t1, y3, y3);
+    FADD(y3, t1, y3);
+    FADD(t1, t0, t0);
+    FADD(t0, t1, t0);
+    FSUB(t0, t0, t2);
+    FMUL(t1, t4, y3);
+    FMUL(t2, t0, y3);
+    FMUL(y3, x3, z3);
+    FADD(y3, y3, t2);
+    FMUL(x3, t3, x3);
+    FSUB(x3, x3, t1);
+    FMUL(z3, t4, z3);
+    FMUL(t1, t3, t0);
+    FADD(z3, z3, t1);
+
+    memcpy(r->x, x3, sizeof(mont256));
+    memcpy(r->y, y3, sizeof(mont256));
+    memcpy(r->z, z3, sizeof(mont256));
+}
+
+/* r = 2p. r may alias p. (RCB algorithm 6.) */
+static void p256_double(struct p256_point *r, const struct p256_point *p)
+{
+    mont256 t0, t1, t2, t3, x3, y3, z3;
+
+    FMUL(t0, p->x, p->x);
+    FMUL(t1, p->y, p->y);
+    FMUL(t2, p->z, p->z);
+    FMUL(t3, p->x, p->y);
+    FADD(t3, t3, t3);
+    FMUL(z3, p->x, p->z);
+    FADD(z3, z3, z3);
+    FMUL(y3, p256_b, t2);
+    FSUB(y3, y3, z3);
+    FADD(x3, y3, y3);
+    FADD(y3, x3, y3);
+    FSUB(x3, t1, y3);
+    FADD(y3, t1, y3);
+    FMUL(y3, x3, y3);
+    FMUL(x3, x3, t3);
+    FADD(t3, t2, t2);
+    FADD(t2, t2, t3);
+    FMUL(z3, p256_b, z3);
+    FSUB(z3, z3, t2);
+    FSUB(z3, z3, t0);
+    FADD(t3, z3, z3);
+    FADD(z3, z3, t3);
+    FADD(t3, t0, t0);
+    FADD(t0, t3, t0);
+    FSUB(t0, t0, t2);
+    FMUL(t0, t0, z3);
+    FADD(y3, y3, t0);
+    FMUL(t0, p->y, p->z);
+    FADD(t0, t0, t0);
+    FMUL(z3, t0, z3);
+    FSUB(x3, x3, z3);
+    FMUL(z3, t0, t1);
+    FADD(z3, z3, z3);
+    FADD(z3, z3, z3);
+
+    memcpy(r->x, x3, sizeof(mont256));
+    memcpy(r->y, y3, sizeof(mont256));
+    memcpy(r->z, z3, sizeof(mont256));
+}
+
+/*
+ * Decode an uncompressed point and check that it is on the curve.
+ * Returns 0 if it isn't (or isn't well formed).
+ */
+static int p256_from_bytes(struct p256_point *r, const unsigned char *in,
+			   int len)
+{
+    mont256 lhs, rhs, t;
+
+    if (len != 65 || in[0] != 0x04)
+	return 0;
+    if (!mont256_from_bytes(r->x, in + 1, &p256_p) ||
+	!mont256_from_bytes(r->y, in + 33, &p256_p))
+	return 0;
+    memcpy(r->z, p256_p.one, sizeof(mont256));
+
+    FMUL(lhs, r->y, r->y);
+    FMUL(rhs, r->x, r->x);
+    FMUL(rhs, rhs, r->x);
+    FADD(t, r->x, r->x);
+    FADD(t, t, r->x);
+    FSUB(rhs, rhs, t);
+    FADD(rhs, rhs, p256_b);
+    return !memcmp(lhs, rhs, sizeof(mont256));
+}
+
+/*
+ * Encode a point in uncompressed form. Returns 0 if it is the point
+ * at infinity, which has no such encoding.
+ */
+static int p256_to_bytes(unsigned char *out, const struct p256_point *p)
+{
+    static const mont256 zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    mont256 zinv, t;
+
+    if (!memcmp(p->z, zero, sizeof(mont256)))
+	return 0;
+    mont256_invert(zinv, p->z, &p256_p);
+    out[0] = 0x04;
+    FMUL(t, p->x, zinv);
+    mont256_to_bytes(out + 1, t, &p256_p);
+    FMUL(t, p->y, zinv);
+    mont256_to_bytes(out + 33, t, &p256_p);
+    return 1;
+}
+
+/* Fill in table[i] = i * p for i = 0..15. */
+static void p256_mktable(struct p256_point *table, const struct p256_point *p)
+{
+    int i;
+
+    memset(&table[0], 0, sizeof(table[0]));
+    memcpy(table[0].y, p256_p.one, sizeof(mont256));
+    table[1] = *p;
+    for (i = 2; i < 16; i++) {
+	if (i & 1)
+	    p256_add(&table[i], &table[i-1], p);
+	else
+	    p256_double(&table[i], &table[i/2]);
+    }
+}
+
+/* sel = table[digit], read without a secret-dependent address. */
+static void p256_select(struct p256_point *sel,
+			const struct p256_point *table, word32 digit)
+{
+    word32 mask;
+    int i, j;
+
+    memset(sel, 0, sizeof(*sel));
+    for (i = 0; i < 16; i++) {
+	mask = 0 - (word32)(((digit ^ i) - 1) >> 31);
+	for (j = 0; j < 8; j++) {
+	    sel->x[j] |= table[i].x[j] & mask;
+	    sel->y[j] |= table[i].y[j] & mask;
+	    sel->z[j] |= table[i].z[j] & mask;
+	}
+    }
+}
+
+/* The 4-bit digit w of a 32-byte big-endian scalar, from the top */
+#define P256_DIGIT(k, w) (((k)[(w) >> 1] >> (((w) & 1) ? 0 : 4)) & 15)
+
+/*
+ * r = k * p, for a 32-byte big-endian scalar k, using a fixed 4-bit
+ * window. Every window does the same four doublings and one
+ * addition, and the table entry is picked out by reading all of
+ * them.
+ */
+static void p256_mul(struct p256_point *r, const unsigned char *k,
+		     const struct p256_point *p)
+{
+    struct p256_point table[16], acc, sel;
+    int i, w;
+
+    p256_mktable(table, p);
+    acc = table[0];
+    for (w = 0; w < 64; w++) {
+	for (i = 0; i < 4; i++)
+	    p256_double(&acc, &acc);
+	p256_select(&sel, table, P256_DIGIT(k, w));
+	p256_add(&acc, &acc, &sel);
+    }
+
+    *r = acc;
+    memset(table, 0, sizeof(table));
+    memset(&acc, 0, sizeof(acc));
+    memset(&sel, 0, sizeof(sel));
+}
+
+/* r = a * p + b * q, with shared doublings as in ed_mul2. */
+static void p256_mul2(struct p256_point *r, const unsigned char *a,
+		      const struct p256_point *p, const unsigned char *b,
+		      const struct p256_point *q)
+{
+    struct p256_point ptable[16], qtable[16], acc, sel;
+    int i, w;
+
+    p256_mktable(ptable, p);
+    p256_mktable(qtable, q);
+    acc = ptable[0];
+    for (w = 0; w < 64; w++) {
+	for (i = 0; i < 4; i++)
+	    p256_double(&acc, &acc);
+	p256_select(&sel, ptable, P256_DIGIT(a, w));
+	p256_add(&acc, &acc, &sel);
+	p256_select(&sel, qtable, P256_DIGIT(b, w));
+	p256_add(&acc, &acc, &sel);
+    }
+    *r = acc;
+}
+
+#undef P256_DIGIT
+#undef FMUL
+#undef FADD
+#undef FSUB
+
+/* ----------------------------------------------------------------------
+ * The key exchange methods themselves.
+ */
+
+struct ecdh_curve {
+    int privlen, publen;
+    /* Fill in pub from priv, which has been filled with random bytes
+     * (and may be adjusted). */
+    void (*genkey)(unsigned char *priv, unsigned char *pub);
+    /* Compute the shared secret; returns 0 if the peer's key is bad. */
+    int (*agree)(const unsigned char *priv, const unsigned char *remote,
+		 int remotelen, unsigned char *out, int *outlen);
+};
+
+struct ecdh_key {
+    const struct ecdh_curve *curve;
+    unsigned char priv[32];
+    unsigned char pub[65];
+};
+
+static void curve25519_genkey(unsigned char *priv, unsigned char *pub)
+{
+    static const unsigned char basepoint[32] = { 9 };
+    x25519(pub, priv, basepoint);
+}
+
+static int curve25519_agree(const unsigned char *priv,
+			    const unsigned char *remote, int remotelen,
+			    unsigned char *out, int *outlen)
+{
+    unsigned char zero = 0;
+    int i;
+
+    if (remotelen != 32)
+	return 0;
+    x25519(out, priv, remote);
+    /* Reject an all-zero result, as RFC 8731 requires. */
+    for (i = 0; i < 32; i++)
+	zero |= out[i];
+    *outlen = 32;
+    return zero != 0;
+}
+
+static const struct ecdh_curve ecdh_curve25519 = {
+    32, 32, curve25519_genkey, curve25519_agree
+};
+
+static void nistp256_genkey(unsigned char *priv, unsigned char *pub)
+{
+    struct p256_point g, q;
+    int i, ok;
+
+    /*
+     * Reject private keys outside [1, n-1] and try again. (The
+     * caller's random bytes are only replaced when that happens,
+     * which it does with probability around 2^-32.)
+     */
+    while (1) {
+	for (i = 0; i < 32 && priv[i] == p256_n[i]; i++);
+	if (i < 32 && priv[i] < p256_n[i]) {
+	    for (i = 0; i < 32 && !priv[i]; i++);
+	    if (i < 32)
+		break;
+	}
+	for (i = 0; i < 32; i++)
+	    priv[i] = random_byte();
+    }
+
+    ok = p256_from_bytes(&g, p256_g, sizeof(p256_g));
+    assert(ok);
+    p256_mul(&q, priv, &g);
+    ok = p256_to_bytes(pub, &q);
+    assert(ok);
+    memset(&q, 0, sizeof(q));
+}
+
+static int nistp256_agree(const unsigned char *priv,
+			  const unsigned char *remote, int remotelen,
+			  unsigned char *out, int *outlen)
+{
+    struct p256_point q, s;
+    unsigned char buf[65];
+    int ok;
+
+    if (!p256_from_bytes(&q, remote, remotelen))
+	return 0;
+    p256_mul(&s, priv, &q);
+    ok = p256_to_bytes(buf, &s);
+    /* The shared secret is just the x coordinate. */
+    memcpy(out, buf + 1, 32);
+    *outlen = 32;
+    memset(buf, 0, sizeof(buf));
+    memset(&s, 0, sizeof(s));
+    return ok;
+}
+
+static const struct ecdh_curve ecdh_nistp256 = {
+    32, 65, nistp256_genkey, nistp256_agree
+};
+
+void *ssh_ecdhkex_newkey(const struct ssh_kex *kex)
+{
+    const struct ecdh_curve *curve = (const struct ecdh_curve *)kex->extra;
+    struct ecdh_key *key;
+    int i;
+
+    assert(kex->main_type == KEXTYPE_ECDH && curve);
+    key = snew(struct ecdh_key);
+    key->curve = curve;
+    for (i = 0; i < curve->privlen; i++)
+	key->priv[i] = random_byte();
+    curve->genkey(key->priv, key->pub);
+    return key;
+}
+
+void ssh_ecdhkex_freekey(void *handle)
+{
+    struct ecdh_key *key = (struct ecdh_key *)handle;
+    memset(key, 0, sizeof(*key));
+    sfree(key);
+}
+
+/*
+ * Return our public value, as it goes on the wire (without the
+ * string length). The pointer is valid until the key is freed.
+ */
+char *ssh_ecdhkex_getpublic(void *handle, int *len)
+{
+    struct ecdh_key *key = (struct ecdh_key *)handle;
+    *len = key->curve->publen;
+    return (char *)key->pub;
+}
+
+/*
+ * Combine our private key with the server's public value to produce
+ * the shared secret K. Returns NULL if the server's value is invalid.
+ */
+Bignum ssh_ecdhkex_getkey(void *handle, char *remote, int remotelen)
+{
+    struct ecdh_key *key = (struct ecdh_key *)handle;
+    unsigned char out[32];
+    int outlen;
+    Bignum ret;
+
+    if (!key->curve->agree(key->priv, (unsigned char *)remote, remotelen,
+			   out, &outlen)) {
+	memset(out, 0, sizeof(out));
+	return NULL;
+    }
+    /*
+     * Both methods encode K as an mpint made from the shared secret
+     * bytes taken as a big-endian number, even for curve25519 whose
+     * natural byte order is the other way round.
+     */
+    ret = bignum_from_bytes(out, outlen);
+    memset(out, 0, sizeof(out));
+    return ret;
+}
+
+static const struct ssh_kex ssh_ec_kex_curve25519 = {
+    "curve25519-sha256", "curve25519",
+    KEXTYPE_ECDH, NULL, NULL, 0, 0, &ssh_sha256, &ecdh_curve25519
+};
+
+static const struct ssh_kex ssh_ec_kex_curve25519_libssh = {
+    "curve25519-sha256@libssh.org", "curve25519",
+    KEXTYPE_ECDH, NULL, NULL, 0, 0, &ssh_sha256, &ecdh_curve25519
+};
+
+static const struct ssh_kex ssh_ec_kex_nistp256 = {
+    "ecdh-sha2-nistp256", "nistp256",
+    KEXTYPE_ECDH, NULL, NULL, 0, 0, &ssh_sha256, &ecdh_nistp256
+};
+
+static const struct ssh_kex *const ec_kex_list[] = {
+    &ssh_ec_kex_curve25519,
+    &ssh_ec_kex_curve25519_libssh,
+    &ssh_ec_kex_nistp256
+};
+
+const struct ssh_kexes ssh_ecdh_kex = {
+    sizeof(ec_kex_list) / sizeof(*ec_kex_list),
+    ec_kex_list
+};
+
+/* ----------------------------------------------------------------------
+ * Arithmetic modulo the orders of the two base points, for
+ * signatures. Both fit the mont256 code.
+ */
+
+/* l = 2^252 + 27742317777372353535851937790883648493 (Ed25519) */
+static const struct mont256_modulus ed25519_l = {
+    { 0x5CF5D3ED, 0x5812631A, 0xA2F79CD6, 0x14DEF9DE,
+      0x00000000, 0x00000000, 0x00000000, 0x10000000 },
+    0x12547E1B,
+    { 0x449C0F01, 0xA40611E3, 0x68859347, 0xD00E1BA7,
+      0x17F5BE65, 0xCEEC73D2, 0x7C309A3D, 0x0399411B },
+    { 0x8D98951D, 0xD6EC3174, 0x737DCF70, 0xC6EF5BF4,
+      0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0x0FFFFFFF },
+};
+
+/* n, the order of the P-256 group (p256_n in limb form) */
+static const struct mont256_modulus p256_order = {
+    { 0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+      0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF },
+    0xEE00BC4F,
+    { 0xBE79EEA2, 0x83244C95, 0x49BD6FA6, 0x4699799C,
+      0x2B6BEC59, 0x2845B239, 0xF3D95620, 0x66E12D94 },
+    { 0x039CDAAF, 0x0C46353D, 0x58E8617B, 0x43190552,
+      0x00000000, 0x00000000, 0xFFFFFFFF, 0x00000000 },
+};
+
+/*
+ * Load 32 bytes (big-endian if be, else little-endian) as a raw
+ * 256-bit number, without reducing it.
+ */
+static void mont256_load(word32 *t, const unsigned char *in, int be)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+	t[i] = be ? GET_32BIT(in + 28 - 4*i) : GET_32BIT_LSB_FIRST(in + 4*i);
+}
+
+/*
+ * Convert any number below 2^256 into Montgomery form. (mont256_mul
+ * copes with one operand being unreduced, as long as it is below R.)
+ */
+static void mont256_from_raw(mont256 r, const word32 *t,
+			     const struct mont256_modulus *mod)
+{
+    mont256_mul(r, t, mod->r2, mod);
+}
+
+/*
+ * Reduce a 64-byte number modulo m, into Montgomery form: with the
+ * number split as hi * 2^256 + lo, that is lo*R + (hi*R)*R.
+ */
+static void mont256_from_wide(mont256 r, const unsigned char *in, int be,
+			      const struct mont256_modulus *mod)
+{
+    word32 hi[8], lo[8];
+    mont256 t;
+
+    mont256_load(hi, be ? in : in + 32, be);
+    mont256_load(lo, be ? in + 32 : in, be);
+    mont256_from_raw(t, hi, mod);
+    mont256_from_raw(t, t, mod);
+    mont256_from_raw(r, lo, mod);
+    mont256_add(r, r, t, mod);
+
+    memset(hi, 0, sizeof(hi));
+    memset(lo, 0, sizeof(lo));
+    memset(t, 0, sizeof(t));
+}
+
+/* As mont256_to_bytes, but little-endian. */
+static void mont256_to_le_bytes(unsigned char *out, const mont256 a,
+				const struct mont256_modulus *mod)
+{
+    static const mont256 one = { 1, 0, 0, 0, 0, 0, 0, 0 };
+    mont256 t;
+    int i;
+
+    mont256_mul(t, a, one, mod);
+    for (i = 0; i < 8; i++)
+	PUT_32BIT_LSB_FIRST(out + 4*i, t[i]);
+}
+
+/* ----------------------------------------------------------------------
+ * Helpers for the SSH-2 wire encodings of keys and signatures.
+ */
+
+static void getstring(char **data, int *datalen, char **p, int *length)
+{
+    *p = NULL;
+    if (*datalen < 4)
+	return;
+    *length = GET_32BIT(*data);
+    *datalen -= 4;
+    *data += 4;
+    if (*length < 0 || *datalen < *length)
+	return;
+    *p = *data;
+    *data += *length;
+    *datalen -= *length;
+}
+
+/* Check the next string is exactly the given text. */
+static int getstring_is(char **data, int *datalen, const char *text)
+{
+    char *p;
+    int len;
+
+    getstring(data, datalen, &p, &len);
+    return p && len == (int)strlen(text) && !memcmp(p, text, len);
+}
+
+/*
+ * Read an mpint of up to 256 bits into 32 big-endian bytes. Returns
+ * 0 if it is missing, negative or too big.
+ */
+static int get_mp256(char **data, int *datalen, unsigned char *out)
+{
+    char *p;
+    int len;
+
+    getstring(data, datalen, &p, &len);
+    if (!p || (len > 0 && (p[0] & 0x80)))
+	return 0;
+    while (len > 0 && p[0] == 0)
+	p++, len--;
+    if (len > 32)
+	return 0;
+    memset(out, 0, 32 - len);
+    memcpy(out + 32 - len, p, len);
+    return 1;
+}
+
+static unsigned char *put_string(unsigned char *p, const void *data, int len)
+{
+    PUT_32BIT(p, len);
+    memcpy(p + 4, data, len);
+    return p + 4 + len;
+}
+
+/* Write 32 big-endian bytes as an mpint, which takes at most 37 bytes. */
+static unsigned char *put_mp256(unsigned char *p, const unsigned char *in)
+{
+    int i;
+
+    for (i = 0; i < 32 && !in[i]; i++);
+    if (i < 32 && (in[i] & 0x80)) {
+	PUT_32BIT(p, 33 - i);
+	p[4] = 0;
+	memcpy(p + 5, in + i, 32 - i);
+	return p + 5 + 32 - i;
+    }
+    return put_string(p, in + i, 32 - i);
+}
+
+static int mp256_length(const unsigned char *in)
+{
+    unsigned char buf[37];
+    return put_mp256(buf, in) - buf;
+}
+
+/*
+ * Format two big-endian numbers as "0x<a>,0x<b>" for the host key
+ * cache, in the same style as the RSA and DSA keys.
+ */
+static char *fmt_hex_pair(const unsigned char *a, const unsigned char *b,
+			  int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *nums[2];
+    char *ret, *q;
+    int i, j, started;
+
+    ret = snewn(2 * (2 + 2 * len) + 2, char);
+    nums[0] = a;
+    nums[1] = b;
+    q = ret;
+    for (j = 0; j < 2; j++) {
+	if (j)
+	    *q++ = ',';
+	*q++ = '0';
+	*q++ = 'x';
+	started = 0;
+	for (i = 0; i < 2 * len; i++) {
+	    int nibble = (nums[j][i / 2] >> ((i & 1) ? 0 : 4)) & 15;
+	    if (nibble || started || i == 2 * len - 1) {
+		*q++ = hex[nibble];
+		started = 1;
+	    }
+	}
+    }
+    *q = '\0';
+    return ret;
+}
+
+/* "<name> <bits> xx:xx:...", the MD5 of the public blob. */
+static char *ecc_fingerprint(const char *name, int bits,
+			     unsigned char *blob, int bloblen)
+{
+    struct MD5Context md5c;
+    unsigned char digest[16];
+    char buffer[16 * 3 + 40];
+    int i;
+
+    MD5Init(&md5c);
+    MD5Update(&md5c, blob, bloblen);
+    MD5Final(digest, &md5c);
+
+    sprintf(buffer, "%s %d ", name, bits);
+    for (i = 0; i < 16; i++)
+	sprintf(buffer + strlen(buffer), "%s%02x", i ? ":" : "",
+		digest[i]);
+    return dupstr(buffer);
+}
+
+/* ----------------------------------------------------------------------
+ * Ed25519 signatures (RFC 8032, as used in SSH by RFC 8709).
+ *
+ * The private key is the 32-byte seed; the secret scalar a and the
+ * nonce prefix are both derived from SHA-512(seed).
+ */
+
+struct ed25519_key {
+    struct ed_point a;			/* public point A */
+    unsigned char pub[32];		/* and its encoding */
+    unsigned char seed[32];
+    int has_private;
+};
+
+static void *ed25519_newkey(char *data, int len)
+{
+    struct ed25519_key *key;
+    char *p;
+    int plen;
+
+    if (!getstring_is(&data, &len, "ssh-ed25519"))
+	return NULL;
+    getstring(&data, &len, &p, &plen);
+    if (!p || plen != 32)
+	return NULL;
+
+    key = snew(struct ed25519_key);
+    memcpy(key->pub, p, 32);
+    key->has_private = 0;
+    if (!ed_from_bytes(&key->a, key->pub)) {
+	sfree(key);
+	return NULL;
+    }
+    return key;
+}
+
+static void ed25519_freekey(void *vkey)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    memset(key, 0, sizeof(*key));
+    sfree(key);
+}
+
+/*
+ * Expand the seed into the clamped secret scalar and the nonce
+ * prefix, and (if pub is non-NULL) work out the public key encoding
+ * that goes with it.
+ */
+static void ed25519_expand(const unsigned char *seed, unsigned char *scalar,
+			   unsigned char *prefix, unsigned char *pub)
+{
+    unsigned char h[64];
+    struct ed_point a;
+
+    SHA512_Simple(seed, 32, h);
+    h[0] &= 248;
+    h[31] &= 127;
+    h[31] |= 64;
+    memcpy(scalar, h, 32);
+    if (prefix)
+	memcpy(prefix, h + 32, 32);
+    if (pub) {
+	ed_mul(&a, scalar, &ed25519_base);
+	ed_to_bytes(pub, &a);
+    }
+
+    memset(h, 0, sizeof(h));
+    memset(&a, 0, sizeof(a));
+}
+
+/* Set the seed, checking it matches the public key. */
+static int ed25519_setprivate(struct ed25519_key *key,
+			      const unsigned char *seed)
+{
+    unsigned char scalar[32], pub[32];
+    int ok;
+
+    ed25519_expand(seed, scalar, NULL, pub);
+    ok = !memcmp(pub, key->pub, 32);
+    if (ok) {
+	memcpy(key->seed, seed, 32);
+	key->has_private = 1;
+    }
+    memset(scalar, 0, sizeof(scalar));
+    return ok;
+}
+
+static char *ed25519_fmtkey(void *vkey)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    unsigned char xle[32], yle[32], x[32], y[32];
+    int i;
+
+    f25519_to_bytes(xle, key->a.x);
+    f25519_to_bytes(yle, key->a.y);
+    for (i = 0; i < 32; i++) {
+	x[i] = xle[31 - i];
+	y[i] = yle[31 - i];
+    }
+    return fmt_hex_pair(x, y, 32);
+}
+
+static unsigned char *ed25519_public_blob(void *vkey, int *len)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    unsigned char *blob, *p;
+
+    *len = 4 + 11 + 4 + 32;
+    blob = snewn(*len, unsigned char);
+    p = put_string(blob, "ssh-ed25519", 11);
+    p = put_string(p, key->pub, 32);
+    assert(p == blob + *len);
+    return blob;
+}
+
+static unsigned char *ed25519_private_blob(void *vkey, int *len)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    unsigned char *blob;
+
+    if (!key->has_private)
+	return NULL;
+    *len = 4 + 32;
+    blob = snewn(*len, unsigned char);
+    put_string(blob, key->seed, 32);
+    return blob;
+}
+
+static void *ed25519_createkey(unsigned char *pub_blob, int pub_len,
+			       unsigned char *priv_blob, int priv_len)
+{
+    struct ed25519_key *key;
+    char *pb = (char *) priv_blob, *p;
+    int plen;
+
+    key = ed25519_newkey((char *) pub_blob, pub_len);
+    if (!key)
+	return NULL;
+    getstring(&pb, &priv_len, &p, &plen);
+    if (!p || plen != 32 || !ed25519_setprivate(key, (unsigned char *)p)) {
+	ed25519_freekey(key);
+	return NULL;
+    }
+    return key;
+}
+
+/*
+ * The OpenSSH private key format holds the public key, then the seed
+ * and public key again, end to end.
+ */
+static void *ed25519_openssh_createkey(unsigned char **blob, int *len)
+{
+    char **b = (char **) blob;
+    struct ed25519_key *key;
+    char *pub, *priv;
+    int publen, privlen;
+
+    getstring(b, len, &pub, &publen);
+    getstring(b, len, &priv, &privlen);
+    if (!pub || publen != 32 || !priv || privlen != 64 ||
+	memcmp(pub, priv + 32, 32))
+	return NULL;
+
+    key = snew(struct ed25519_key);
+    memcpy(key->pub, pub, 32);
+    if (!ed_from_bytes(&key->a, key->pub) ||
+	!ed25519_setprivate(key, (unsigned char *)priv)) {
+	ed25519_freekey(key);
+	return NULL;
+    }
+    return key;
+}
+
+static int ed25519_openssh_fmtkey(void *vkey, unsigned char *blob, int len)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    unsigned char priv[64], *p;
+    int bloblen = 4 + 32 + 4 + 64;
+
+    if (bloblen > len)
+	return bloblen;
+    memcpy(priv, key->seed, 32);
+    memcpy(priv + 32, key->pub, 32);
+    p = put_string(blob, key->pub, 32);
+    put_string(p, priv, 64);
+    memset(priv, 0, sizeof(priv));
+    return bloblen;
+}
+
+static int ed25519_pubkey_bits(void *blob, int len)
+{
+    return 255;
+}
+
+static char *ed25519_fingerprint(void *vkey)
+{
+    unsigned char *blob;
+    int bloblen;
+    char *ret;
+
+    blob = ed25519_public_blob(vkey, &bloblen);
+    ret = ecc_fingerprint("ssh-ed25519", 255, blob, bloblen);
+    sfree(blob);
+    return ret;
+}
+
+/* k = SHA-512(R || A || M) mod l */
+static void ed25519_challenge(mont256 k, const unsigned char *r,
+			      const unsigned char *pub,
+			      const char *data, int datalen)
+{
+    SHA512_State s;
+    unsigned char h[64];
+
+    SHA512_Init(&s);
+    SHA512_Bytes(&s, r, 32);
+    SHA512_Bytes(&s, pub, 32);
+    SHA512_Bytes(&s, data, datalen);
+    SHA512_Final(&s, h);
+    mont256_from_wide(k, h, 0, &ed25519_l);
+}
+
+static int ed25519_verifysig(void *vkey, char *sig, int siglen,
+			     char *data, int datalen)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    struct ed_point nega, check;
+    unsigned char *r, *s, kb[32], checkb[32];
+    mont256 k;
+    word32 t[8];
+    char *p;
+    int len, i;
+
+    if (!getstring_is(&sig, &siglen, "ssh-ed25519"))
+	return 0;
+    getstring(&sig, &siglen, &p, &len);
+    if (!p || len != 64)
+	return 0;
+    r = (unsigned char *)p;
+    s = (unsigned char *)p + 32;
+
+    /* Reject S >= l, so that signatures can't be trivially altered. */
+    mont256_load(t, s, 0);
+    for (i = 7; i >= 0; i--)
+	if (t[i] != ed25519_l.m[i])
+	    break;
+    if (i < 0 || t[i] > ed25519_l.m[i])
+	return 0;
+
+    /* Check that R == S*B - k*A. */
+    ed25519_challenge(k, r, key->pub, data, datalen);
+    mont256_to_le_bytes(kb, k, &ed25519_l);
+    ed_negate(&nega, &key->a);
+    ed_mul2(&check, s, &ed25519_base, kb, &nega);
+    ed_to_bytes(checkb, &check);
+    return !memcmp(checkb, r, 32);
+}
+
+static unsigned char *ed25519_sign(void *vkey, char *data, int datalen,
+				   int *siglen)
+{
+    struct ed25519_key *key = (struct ed25519_key *) vkey;
+    SHA512_State ss;
+    unsigned char scalar[32], prefix[32], h[64];
+    unsigned char rb[32], sb[32], *sig, *p;
+    struct ed_point rp;
+    mont256 r, k, a;
+    word32 t[8];
+
+    if (!key->has_private)
+	return NULL;
+    ed25519_expand(key->seed, scalar, prefix, NULL);
+
+    /* r = SHA-512(prefix || M) mod l, and R = rB */
+    SHA512_Init(&ss);
+    SHA512_Bytes(&ss, prefix, 32);
+    SHA512_Bytes(&ss, data, datalen);
+    SHA512_Final(&ss, h);
+    mont256_from_wide(r, h, 0, &ed25519_l);
+    mont256_to_le_bytes(rb, r, &ed25519_l);
+    ed_mul(&rp, rb, &ed25519_base);
+    ed_to_bytes(rb, &rp);
+
+    /* S = r + k*a mod l */
+    ed25519_challenge(k, rb, key->pub, data, datalen);
+    mont256_load(t, scalar, 0);
+    mont256_from_raw(a, t, &ed25519_l);
+    mont256_mul(k, k, a, &ed25519_l);
+    mont256_add(r, r, k, &ed25519_l);
+    mont256_to_le_bytes(sb, r, &ed25519_l);
+
+    *siglen = 4 + 11 + 4 + 64;
+    sig = snewn(*siglen, unsigned char);
+    p = put_string(sig, "ssh-ed25519", 11);
+    PUT_32BIT(p, 64);
+    memcpy(p + 4, rb, 32);
+    memcpy(p + 36, sb, 32);
+
+    memset(&ss, 0, sizeof(ss));
+    memset(scalar, 0, sizeof(scalar));
+    memset(prefix, 0, sizeof(prefix));
+    memset(h, 0, sizeof(h));
+    memset(&rp, 0, sizeof(rp));
+    memset(r, 0, sizeof(r));
+    memset(a, 0, sizeof(a));
+    memset(t, 0, sizeof(t));
+    return sig;
+}
+
+const struct ssh_signkey ssh_ecdsa_ed25519 = {
+    ed25519_newkey,
+    ed25519_freekey,
+    ed25519_fmtkey,
+    ed25519_public_blob,
+    ed25519_private_blob,
+    ed25519_createkey,
+    ed25519_openssh_createkey,
+    ed25519_openssh_fmtkey,
+    ed25519_pubkey_bits,
+    ed25519_fingerprint,
+    ed25519_verifysig,
+    ed25519_sign,
+    "ssh-ed25519",
+    "ssh-ed25519"
+};
+
+/* ----------------------------------------------------------------------
+ * ECDSA signatures over P-256 with SHA-256 (RFC 5656).
+ */
+
+struct ecdsa_key {
+    struct p256_point q;		/* public point Q */
+    unsigned char pub[65];		/* and its encoding */
+    unsigned char d[32];		/* big-endian private scalar */
+    int has_private;
+};
+
+static int ecdsa_decode_public(struct ecdsa_key *key, char *p, int len)
+{
+    if (!p || len != 65)
+	return 0;
+    memcpy(key->pub, p, 65);
+    key->has_private = 0;
+    return p256_from_bytes(&key->q, key->pub, 65);
+}
+
+static void *ecdsa_newkey(char *data, int len)
+{
+    struct ecdsa_key *key;
+    char *p;
+    int plen;
+
+    if (!getstring_is(&data, &len, "ecdsa-sha2-nistp256") ||
+	!getstring_is(&data, &len, "nistp256"))
+	return NULL;
+    getstring(&data, &len, &p, &plen);
+
+    key = snew(struct ecdsa_key);
+    if (!ecdsa_decode_public(key, p, plen)) {
+	sfree(key);
+	return NULL;
+    }
+    return key;
+}
+
+static void ecdsa_freekey(void *vkey)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    memset(key, 0, sizeof(*key));
+    sfree(key);
+}
+
+/* Set the private scalar, checking it is in range and matches Q. */
+static int ecdsa_setprivate(struct ecdsa_key *key, const unsigned char *d)
+{
+    struct p256_point g, q;
+    unsigned char pub[65];
+    mont256 t;
+    int ok, i;
+
+    for (i = 0; i < 32 && !d[i]; i++);
+    if (i == 32 || !mont256_from_bytes(t, d, &p256_order))
+	return 0;
+    ok = p256_from_bytes(&g, p256_g, sizeof(p256_g));
+    assert(ok);
+    p256_mul(&q, d, &g);
+    ok = p256_to_bytes(pub, &q) && !memcmp(pub, key->pub, 65);
+    if (ok) {
+	memcpy(key->d, d, 32);
+	key->has_private = 1;
+    }
+    memset(t, 0, sizeof(t));
+    memset(&q, 0, sizeof(q));
+    return ok;
+}
+
+static char *ecdsa_fmtkey(void *vkey)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    return fmt_hex_pair(key->pub + 1, key->pub + 33, 32);
+}
+
+static unsigned char *ecdsa_public_blob(void *vkey, int *len)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    unsigned char *blob, *p;
+
+    *len = 4 + 19 + 4 + 8 + 4 + 65;
+    blob = snewn(*len, unsigned char);
+    p = put_string(blob, "ecdsa-sha2-nistp256", 19);
+    p = put_string(p, "nistp256", 8);
+    p = put_string(p, key->pub, 65);
+    assert(p == blob + *len);
+    return blob;
+}
+
+static unsigned char *ecdsa_private_blob(void *vkey, int *len)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    unsigned char *blob;
+
+    if (!key->has_private)
+	return NULL;
+    blob = snewn(37, unsigned char);
+    *len = put_mp256(blob, key->d) - blob;
+    return blob;
+}
+
+static void *ecdsa_createkey(unsigned char *pub_blob, int pub_len,
+			     unsigned char *priv_blob, int priv_len)
+{
+    struct ecdsa_key *key;
+    char *pb = (char *) priv_blob;
+    unsigned char d[32];
+
+    key = ecdsa_newkey((char *) pub_blob, pub_len);
+    if (!key)
+	return NULL;
+    if (!get_mp256(&pb, &priv_len, d) || !ecdsa_setprivate(key, d)) {
+	ecdsa_freekey(key);
+	key = NULL;
+    }
+    memset(d, 0, sizeof(d));
+    return key;
+}
+
+/* The OpenSSH private key format: curve name, Q, then d. */
+static void *ecdsa_openssh_createkey(unsigned char **blob, int *len)
+{
+    char **b = (char **) blob;
+    struct ecdsa_key *key;
+    unsigned char d[32];
+    char *p;
+    int plen;
+
+    if (!getstring_is(b, len, "nistp256"))
+	return NULL;
+    getstring(b, len, &p, &plen);
+
+    key = snew(struct ecdsa_key);
+    if (!ecdsa_decode_public(key, p, plen) ||
+	!get_mp256(b, len, d) || !ecdsa_setprivate(key, d)) {
+	ecdsa_freekey(key);
+	key = NULL;
+    }
+    memset(d, 0, sizeof(d));
+    return key;
+}
+
+static int ecdsa_openssh_fmtkey(void *vkey, unsigned char *blob, int len)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    unsigned char *p;
+    int bloblen = 4 + 8 + 4 + 65 + mp256_length(key->d);
+
+    if (bloblen > len)
+	return bloblen;
+    p = put_string(blob, "nistp256", 8);
+    p = put_string(p, key->pub, 65);
+    put_mp256(p, key->d);
+    return bloblen;
+}
+
+static int ecdsa_pubkey_bits(void *blob, int len)
+{
+    return 256;
+}
+
+static char *ecdsa_fingerprint(void *vkey)
+{
+    unsigned char *blob;
+    int bloblen;
+    char *ret;
+
+    blob = ecdsa_public_blob(vkey, &bloblen);
+    ret = ecc_fingerprint("ecdsa-sha2-nistp256", 256, blob, bloblen);
+    sfree(blob);
+    return ret;
+}
+
+/* The x coordinate of a point, reduced mod n, as 32 big-endian bytes. */
+static int ecdsa_x_mod_n(unsigned char *out, const struct p256_point *pt)
+{
+    unsigned char buf[65];
+    word32 t[8];
+    mont256 x;
+
+    if (!p256_to_bytes(buf, pt))
+	return 0;
+    mont256_load(t, buf + 1, 1);
+    mont256_from_raw(x, t, &p256_order);
+    mont256_to_bytes(out, x, &p256_order);
+    return 1;
+}
+
+static int ecdsa_verifysig(void *vkey, char *sig, int siglen,
+			   char *data, int datalen)
+{
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    struct p256_point g, x;
+    unsigned char rb[32], sb[32], hash[32], u1b[32], u2b[32], xb[32];
+    mont256 r, s, e, w;
+    word32 t[8];
+    char *p;
+    int len, i, ok;
+
+    if (!getstring_is(&sig, &siglen, "ecdsa-sha2-nistp256"))
+	return 0;
+    getstring(&sig, &siglen, &p, &len);
+    if (!p || !get_mp256(&p, &len, rb) || !get_mp256(&p, &len, sb))
+	return 0;
+
+    /* r and s must both be in [1, n-1]. */
+    for (i = 0; i < 32 && !rb[i]; i++);
+    if (i == 32 || !mont256_from_bytes(r, rb, &p256_order))
+	return 0;
+    for (i = 0; i < 32 && !sb[i]; i++);
+    if (i == 32 || !mont256_from_bytes(s, sb, &p256_order))
+	return 0;
+
+    /* u1 = e/s, u2 = r/s, and the x coordinate of u1*G + u2*Q is r. */
+    SHA256_Simple(data, datalen, hash);
+    mont256_load(t, hash, 1);
+    mont256_from_raw(e, t, &p256_order);
+    mont256_invert(w, s, &p256_order);
+    mont256_mul(e, e, w, &p256_order);
+    mont256_to_bytes(u1b, e, &p256_order);
+    mont256_mul(r, r, w, &p256_order);
+    mont256_to_bytes(u2b, r, &p256_order);
+
+    ok = p256_from_bytes(&g, p256_g, sizeof(p256_g));
+    assert(ok);
+    p256_mul2(&x, u1b, &g, u2b, &key->q);
+    return ecdsa_x_mod_n(xb, &x) && !memcmp(xb, rb, 32);
+}
+
+static unsigned char *ecdsa_sign(void *vkey, char *data, int datalen,
+				 int *siglen)
+{
+    /*
+     * As in dss_sign, the per-signature secret k is derived from a
+     * hash of the private key and the message, rather than trusting
+     * the random number generator with it:
+     *
+     *   k = SHA512( SHA512(text || d) || SHA256(message) ) mod n
+     */
+    struct ecdsa_key *key = (struct ecdsa_key *) vkey;
+    SHA512_State ss;
+    unsigned char hash[32], digest512[64], kb[32], rb[32], sb[32];
+    unsigned char *sig, *p;
+    struct p256_point g, rp;
+    mont256 k, r, s, d;
+    word32 t[8];
+    int ok, innerlen;
+
+    if (!key->has_private)
+	return NULL;
+    SHA256_Simple(data, datalen, hash);
+
+    SHA512_Init(&ss);
+    SHA512_Bytes(&ss, "ECDSA deterministic k generator", 31);
+    SHA512_Bytes(&ss, key->d, 32);
+    SHA512_Final(&ss, digest512);
+    SHA512_Init(&ss);
+    SHA512_Bytes(&ss, digest512, sizeof(digest512));
+    SHA512_Bytes(&ss, hash, sizeof(hash));
+    SHA512_Final(&ss, digest512);
+    mont256_from_wide(k, digest512, 1, &p256_order);
+    mont256_to_bytes(kb, k, &p256_order);
+
+    /* r = x(kG) mod n */
+    ok = p256_from_bytes(&g, p256_g, sizeof(p256_g));
+    assert(ok);
+    p256_mul(&rp, kb, &g);
+    ok = ecdsa_x_mod_n(rb, &rp);
+    assert(ok);
+
+    /* s = (e + r*d) / k mod n */
+    ok = mont256_from_bytes(r, rb, &p256_order);
+    assert(ok);
+    ok = mont256_from_bytes(d, key->d, &p256_order);
+    assert(ok);
+    mont256_load(t, hash, 1);
+    mont256_from_raw(s, t, &p256_order);
+    mont256_mul(r, r, d, &p256_order);
+    mont256_add(s, s, r, &p256_order);
+    mont256_invert(k, k, &p256_order);
+    mont256_mul(s, s, k, &p256_order);
+    mont256_to_bytes(sb, s, &p256_order);
+
+    innerlen = mp256_length(rb) + mp256_length(sb);
+    *siglen = 4 + 19 + 4 + innerlen;
+    sig = snewn(*siglen, unsigned char);
+    p = put_string(sig, "ecdsa-sha2-nistp256", 19);
+    PUT_32BIT(p, innerlen);
+    p = put_mp256(p + 4, rb);
+    p = put_mp256(p, sb);
+    assert(p == sig + *siglen);
+
+    memset(&ss, 0, sizeof(ss));
+    memset(digest512, 0, sizeof(digest512));
+    memset(kb, 0, sizeof(kb));
+    memset(&rp, 0, sizeof(rp));
+    memset(k, 0, sizeof(k));
+    memset(d, 0, sizeof(d));
+    memset(r, 0, sizeof(r));
+    return sig;
+}
+
+const struct ssh_signkey ssh_ecdsa_nistp256 = {
+    ecdsa_newkey,
+    ecdsa_freekey,
+    ecdsa_fmtkey,
+    ecdsa_public_blob,
+    ecdsa_private_blob,
+    ecdsa_createkey,
+    ecdsa_openssh_createkey,
+    ecdsa_openssh_fmtkey,
+    ecdsa_pubkey_bits,
+    ecdsa_fingerprint,
+    ecdsa_verifysig,
+    ecdsa_sign,
+    "ecdsa-sha2-nistp256",
+    "ecdsa-sha2-nistp256"
+};
@@ -122,7 +122,7 @@ static void sha512_mpint(SHA512_State * s, Bignum b)
 Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
                   Bignum p, Bignum q, Bignum iqmp)
 {
-    Bignum pm1, qm1, pexp, qexp, presult, qresult, diff, multiplier, ret0, ret;
+    Bignum pm1, qm1, pexp, qexp, presult, qresult, qmodp, diff, h, ret;
 
     /*
      * Reduce the exponent mod phi(p) and phi(q), to save time when
@@ -143,32 +143,30 @@ Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
     qresult = modpow(base, qexp, q);
 
     /*
-     * Recombine the results. We want a value which is congruent to
-     * qresult mod q, and to presult mod p.
+     * Recombine the results (Garner's formula). We want a value
+     * which is congruent to qresult mod q, and to presult mod p.
      *
-     * We know that iqmp * q is congruent to 1 * mod p (by definition
+     * We know that iqmp * q is congruent to 1 mod p (by definition
      * of iqmp) and to 0 mod q (obviously). So we start with qresult
      * (which is congruent to qresult mod both primes), and add on
-     * (presult-qresult) * (iqmp * q) which adjusts it to be congruent
-     * to presult mod p without affecting its value mod q.
+     * h * q, where h = (presult-qresult) * iqmp mod p. That adjusts
+     * it to be congruent to presult mod p without affecting its
+     * value mod q, and since h < p the sum is already less than n,
+     * so no reduction of the full-size result is needed.
      */
-    if (bignum_cmp(presult, qresult) < 0) {
+    qmodp = bigmod(qresult, p);
+    if (bignum_cmp(presult, qmodp) < 0) {
         /*
-         * Can't subtract presult from qresult without first adding on
-         * p.
+         * Can't subtract qresult from presult without first adding
+         * on p.
          */
         Bignum tmp = presult;
         presult = bigadd(presult, p);
         freebn(tmp);
     }
-    diff = bigsub(presult, qresult);
-    multiplier = bigmul(iqmp, q);
-    ret0 = bigmuladd(multiplier, diff, qresult);
-
-    /*
-     * Finally, reduce the result mod n.
-     */
-    ret = bigmod(ret0, mod);
+    diff = bigsub(presult, qmodp);
+    h = modmul(diff, iqmp, p);
+    ret = bigmuladd(h, q, qresult);
 
     /*
      * Free all the intermediate results before returning.
@@ -179,9 +177,9 @@ Bignum crt_modpow(Bignum base, Bignum exp, Bignum mod,
     freebn(qexp);
     freebn(presult);
     freebn(qresult);
+    freebn(qmodp);
     freebn(diff);
-    freebn(multiplier);
-    freebn(ret0);
+    freebn(h);
 
     return ret;
 }
@@ -6,6 +6,21 @@
 
 #include "ssh.h"
 
+/*
+ * SHA-NI support, as in sshsha.c, which also owns the CPUID check.
+ */
+#if !defined(NO_SHA_NI) && \
+    ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+#define SHA_NI
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SHA_NI_FUNC
+#else
+#define SHA_NI_FUNC __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
 /* ----------------------------------------------------------------------
  * Core SHA256 algorithm: processes 16-word blocks into a message digest.
  */
@@ -30,32 +45,32 @@ void SHA256_Core_Init(SHA256_State *s) {
     s->h[7] = 0x5be0cd19;
 }
 
-void SHA256_Block(SHA256_State *s, uint32 *block) {
+static const uint32 sha256_k[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void SHA256_Block(SHA256_State *s, const unsigned char *block) {
     uint32 w[80];
     uint32 a,b,c,d,e,f,g,h;
-    static const int k[] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
-    };
-
     int t;
 
     for (t = 0; t < 16; t++)
-        w[t] = block[t];
+        w[t] = GET_32BIT_MSB_FIRST(block + t*4);
 
     for (t = 16; t < 64; t++)
 	w[t] = smallsigma1(w[t-2]) + w[t-7] + smallsigma0(w[t-15]) + w[t-16];
@@ -67,7 +82,7 @@ void SHA256_Block(SHA256_State *s, uint32 *block) {
         uint32 t1, t2;
 
 #define ROUND(j,a,b,c,d,e,f,g,h) \
-	t1 = h + bigsigma1(e) + Ch(e,f,g) + k[j] + w[j]; \
+	t1 = h + bigsigma1(e) + Ch(e,f,g) + sha256_k[j] + w[j]; \
 	t2 = bigsigma0(a) + Maj(a,b,c); \
         d = d + t1; h = t1 + t2;
 
@@ -85,6 +100,127 @@ void SHA256_Block(SHA256_State *s, uint32 *block) {
     s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
 }
 
+#ifdef SHA_NI
+
+/*
+ * SHA-256 on the SHA extensions. The state lives in two registers
+ * in the order SHA256RNDS2 wants (ABEF and CDGH); each SHA256RNDS2
+ * does two rounds, and SHA256MSG1/SHA256MSG2 with an ALIGNR between
+ * them expand the message schedule four words at a time.
+ */
+#define SHA256_NI_ROUNDS(g, Mcur, Mnext, Mprev) \
+    msg = _mm_add_epi32(Mcur, \
+	_mm_loadu_si128((const __m128i *) (sha256_k + 4 * (g)))); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    tmp = _mm_alignr_epi8(Mcur, Mprev, 4); \
+    Mnext = _mm_add_epi32(Mnext, tmp); \
+    Mnext = _mm_sha256msg2_epu32(Mnext, Mcur); \
+    msg = _mm_shuffle_epi32(msg, 0x0E); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+    Mprev = _mm_sha256msg1_epu32(Mprev, Mcur)
+
+#define SHA256_NI_ROUNDS_LOAD(g, Mcur) \
+    Mcur = _mm_shuffle_epi8( \
+	_mm_loadu_si128((const __m128i *) (data + 16 * (g))), mask); \
+    msg = _mm_add_epi32(Mcur, \
+	_mm_loadu_si128((const __m128i *) (sha256_k + 4 * (g)))); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    msg = _mm_shuffle_epi32(msg, 0x0E); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg)
+
+static SHA_NI_FUNC void sha256_ni_blocks(uint32 *h, const unsigned char *data,
+					 int nblocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					0x0405060700010203ULL);
+    __m128i state0, state1, save0, save1, msg, tmp;
+    __m128i m0, m1, m2, m3;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (h + 4)),
+			       0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);	       /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       /* CDGH */
+
+    while (nblocks-- > 0) {
+	save0 = state0;
+	save1 = state1;
+
+	SHA256_NI_ROUNDS_LOAD(0, m0);
+	SHA256_NI_ROUNDS_LOAD(1, m1);
+	m0 = _mm_sha256msg1_epu32(m0, m1);
+	SHA256_NI_ROUNDS_LOAD(2, m2);
+	m1 = _mm_sha256msg1_epu32(m1, m2);
+	m3 = _mm_shuffle_epi8(
+	    _mm_loadu_si128((const __m128i *) (data + 48)), mask);
+	SHA256_NI_ROUNDS(3, m3, m0, m2);
+	SHA256_NI_ROUNDS(4, m0, m1, m3);
+	SHA256_NI_ROUNDS(5, m1, m2, m0);
+	SHA256_NI_ROUNDS(6, m2, m3, m1);
+	SHA256_NI_ROUNDS(7, m3, m0, m2);
+	SHA256_NI_ROUNDS(8, m0, m1, m3);
+	SHA256_NI_ROUNDS(9, m1, m2, m0);
+	SHA256_NI_ROUNDS(10, m2, m3, m1);
+	SHA256_NI_ROUNDS(11, m3, m0, m2);
+	SHA256_NI_ROUNDS(12, m0, m1, m3);
+
+	/* The last three groups need no further schedule words. */
+	msg = _mm_add_epi32(m1,
+	    _mm_loadu_si128((const __m128i *) (sha256_k + 52)));
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+	tmp = _mm_alignr_epi8(m1, m0, 4);
+	m2 = _mm_add_epi32(m2, tmp);
+	m2 = _mm_sha256msg2_epu32(m2, m1);
+	msg = _mm_shuffle_epi32(msg, 0x0E);
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+	msg = _mm_add_epi32(m2,
+	    _mm_loadu_si128((const __m128i *) (sha256_k + 56)));
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+	tmp = _mm_alignr_epi8(m2, m1, 4);
+	m3 = _mm_add_epi32(m3, tmp);
+	m3 = _mm_sha256msg2_epu32(m3, m2);
+	msg = _mm_shuffle_epi32(msg, 0x0E);
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+	msg = _mm_add_epi32(m3,
+	    _mm_loadu_si128((const __m128i *) (sha256_k + 60)));
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+	msg = _mm_shuffle_epi32(msg, 0x0E);
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+	state0 = _mm_add_epi32(state0, save0);
+	state1 = _mm_add_epi32(state1, save1);
+
+	data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);	       /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);	       /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);       /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);	       /* HGFE */
+    _mm_storeu_si128((__m128i *) h, state0);
+    _mm_storeu_si128((__m128i *) (h + 4), state1);
+}
+
+#endif /* SHA_NI */
+
+static void sha256_blocks(SHA256_State *s, const unsigned char *data,
+			  int nblocks)
+{
+#ifdef SHA_NI
+    if (sha_ni_available()) {
+	sha256_ni_blocks(s->h, data, nblocks);
+	return;
+    }
+#endif
+
+    while (nblocks-- > 0) {
+	SHA256_Block(s, data);
+	data += 64;
+    }
+}
+
 /* ----------------------------------------------------------------------
  * Outer SHA256 algorithm: take an arbitrary length byte string,
  * convert it into 16-word blocks with the prescribed padding at
@@ -101,9 +237,7 @@ void SHA256_Init(SHA256_State *s) {
 
 void SHA256_Bytes(SHA256_State *s, const void *p, int len) {
     unsigned char *q = (unsigned char *)p;
-    uint32 wordblock[16];
     uint32 lenw = len;
-    int i;
 
     /*
      * Update the length field.
@@ -111,7 +245,7 @@ void SHA256_Bytes(SHA256_State *s, const void *p, int len) {
     s->lenlo += lenw;
     s->lenhi += (s->lenlo < lenw);
 
-    if (s->blkused && s->blkused+len < BLKSIZE) {
+    if (s->blkused+len < BLKSIZE) {
         /*
          * Trivial case: just add to the block.
          */
@@ -119,22 +253,19 @@ void SHA256_Bytes(SHA256_State *s, const void *p, int len) {
         s->blkused += len;
     } else {
         /*
-         * We must complete and process at least one block.
+         * Complete and process any partial block, then process
+         * whole blocks directly from the input without copying.
          */
-        while (s->blkused + len >= BLKSIZE) {
+        if (s->blkused) {
             memcpy(s->block + s->blkused, q, BLKSIZE - s->blkused);
             q += BLKSIZE - s->blkused;
             len -= BLKSIZE - s->blkused;
-            /* Now process the block. Gather bytes big-endian into words */
-            for (i = 0; i < 16; i++) {
-                wordblock[i] =
-                    ( ((uint32)s->block[i*4+0]) << 24 ) |
-                    ( ((uint32)s->block[i*4+1]) << 16 ) |
-                    ( ((uint32)s->block[i*4+2]) <<  8 ) |
-                    ( ((uint32)s->block[i*4+3]) <<  0 );
-            }
-            SHA256_Block(s, wordblock);
-            s->blkused = 0;
+            sha256_blocks(s, s->block, 1);
+        }
+        if (len >= BLKSIZE) {
+            sha256_blocks(s, q, len / BLKSIZE);
+            q += len & ~(BLKSIZE-1);
+            len &= BLKSIZE-1;
         }
         memcpy(s->block, q, len);
         s->blkused = len;
@@ -218,6 +349,117 @@ const struct ssh_hash ssh_sha256 = {
     sha256_init, sha256_bytes, sha256_final, 32, "SHA-256"
 };
 
+/* ----------------------------------------------------------------------
+ * The above is the SHA-256 algorithm itself. Now we implement the
+ * HMAC wrapper on it, for hmac-sha2-256 (RFC 6668).
+ */
+
+static void *sha256_make_context(void)
+{
+    return snewn(3, SHA256_State);
+}
+
+static void sha256_free_context(void *handle)
+{
+    memset(handle, 0, 3 * sizeof(SHA256_State));
+    sfree(handle);
+}
+
+static void sha256_key_internal(void *handle, unsigned char *key, int len)
+{
+    SHA256_State *keys = (SHA256_State *)handle;
+    unsigned char foo[64];
+    int i;
+
+    memset(foo, 0x36, 64);
+    for (i = 0; i < len && i < 64; i++)
+	foo[i] ^= key[i];
+    SHA256_Init(&keys[0]);
+    SHA256_Bytes(&keys[0], foo, 64);
+
+    memset(foo, 0x5C, 64);
+    for (i = 0; i < len && i < 64; i++)
+	foo[i] ^= key[i];
+    SHA256_Init(&keys[1]);
+    SHA256_Bytes(&keys[1], foo, 64);
+
+    memset(foo, 0, 64);		       /* burn the evidence */
+}
+
+static void sha256_key(void *handle, unsigned char *key)
+{
+    sha256_key_internal(handle, key, 32);
+}
+
+static void hmacsha256_start(void *handle)
+{
+    SHA256_State *keys = (SHA256_State *)handle;
+
+    keys[2] = keys[0];		      /* structure copy */
+}
+
+static void hmacsha256_bytes(void *handle, unsigned char const *blk, int len)
+{
+    SHA256_State *keys = (SHA256_State *)handle;
+    SHA256_Bytes(&keys[2], (void *)blk, len);
+}
+
+static void hmacsha256_genresult(void *handle, unsigned char *hmac)
+{
+    SHA256_State *keys = (SHA256_State *)handle;
+    SHA256_State s;
+    unsigned char intermediate[32];
+
+    s = keys[2];		       /* structure copy */
+    SHA256_Final(&s, intermediate);
+    s = keys[1];		       /* structure copy */
+    SHA256_Bytes(&s, intermediate, 32);
+    SHA256_Final(&s, hmac);
+}
+
+static void sha256_do_hmac(void *handle, unsigned char *blk, int len,
+			   unsigned long seq, unsigned char *hmac)
+{
+    unsigned char seqbuf[4];
+
+    PUT_32BIT_MSB_FIRST(seqbuf, seq);
+    hmacsha256_start(handle);
+    hmacsha256_bytes(handle, seqbuf, 4);
+    hmacsha256_bytes(handle, blk, len);
+    hmacsha256_genresult(handle, hmac);
+}
+
+static void sha256_generate(void *handle, unsigned char *blk, int len,
+			    unsigned long seq)
+{
+    sha256_do_hmac(handle, blk, len, seq, blk + len);
+}
+
+static int hmacsha256_verresult(void *handle, unsigned char const *hmac)
+{
+    unsigned char correct[32];
+    hmacsha256_genresult(handle, correct);
+    return !memcmp(correct, hmac, 32);
+}
+
+static int sha256_verify(void *handle, unsigned char *blk, int len,
+			 unsigned long seq)
+{
+    unsigned char correct[32];
+    sha256_do_hmac(handle, blk, len, seq, correct);
+    return !memcmp(correct, blk + len, 32);
+}
+
+const struct ssh_mac ssh_hmac_sha2_256 = {
+    sha256_make_context, sha256_free_context, sha256_key,
+    sha256_generate, sha256_verify,
+    hmacsha256_start, hmacsha256_bytes,
+    hmacsha256_genresult, hmacsha256_verresult,
+    "hmac-sha2-256", "hmac-sha2-256-etm@openssh.com",
+    32,
+    "HMAC-SHA-256"
+};
+
 #ifdef TEST
 
 #include <stdio.h>
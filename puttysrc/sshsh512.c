@@ -9,44 +9,30 @@
 #define BLKSIZE 128
 
 /*
- * Arithmetic implementations. Note that AND, XOR and NOT can
- * overlap destination with one source, but the others can't.
+ * The state and schedule are native 64-bit words; every compiler we
+ * build with has a 64-bit integer type, and on 64-bit targets this
+ * is several times faster than the old pairs of 32-bit halves.
  */
-#define add(r,x,y) ( r.lo = y.lo + x.lo, \
-		     r.hi = y.hi + x.hi + ((uint32)r.lo < (uint32)y.lo) )
-#define rorB(r,x,y) ( r.lo = ((uint32)x.hi >> ((y)-32)) | ((uint32)x.lo << (64-(y))), \
-		      r.hi = ((uint32)x.lo >> ((y)-32)) | ((uint32)x.hi << (64-(y))) )
-#define rorL(r,x,y) ( r.lo = ((uint32)x.lo >> (y)) | ((uint32)x.hi << (32-(y))), \
-		      r.hi = ((uint32)x.hi >> (y)) | ((uint32)x.lo << (32-(y))) )
-#define shrB(r,x,y) ( r.lo = (uint32)x.hi >> ((y)-32), r.hi = 0 )
-#define shrL(r,x,y) ( r.lo = ((uint32)x.lo >> (y)) | ((uint32)x.hi << (32-(y))), \
-		      r.hi = (uint32)x.hi >> (y) )
-#define and(r,x,y) ( r.lo = x.lo & y.lo, r.hi = x.hi & y.hi )
-#define xor(r,x,y) ( r.lo = x.lo ^ y.lo, r.hi = x.hi ^ y.hi )
-#define not(r,x) ( r.lo = ~x.lo, r.hi = ~x.hi )
-#define INIT(h,l) { h, l }
-#define BUILD(r,h,l) ( r.hi = h, r.lo = l )
-#define EXTRACT(h,l,r) ( h = r.hi, l = r.lo )
+typedef unsigned long long sha512_word;
+
+#define INIT(h,l) ( ((sha512_word)(h) << 32) | (l) )
 
 /* ----------------------------------------------------------------------
  * Core SHA512 algorithm: processes 16-doubleword blocks into a
  * message digest.
  */
 
-#define Ch(r,t,x,y,z) ( not(t,x), and(r,t,z), and(t,x,y), xor(r,r,t) )
-#define Maj(r,t,x,y,z) ( and(r,x,y), and(t,x,z), xor(r,r,t), \
-			 and(t,y,z), xor(r,r,t) )
-#define bigsigma0(r,t,x) ( rorL(r,x,28), rorB(t,x,34), xor(r,r,t), \
-			   rorB(t,x,39), xor(r,r,t) )
-#define bigsigma1(r,t,x) ( rorL(r,x,14), rorL(t,x,18), xor(r,r,t), \
-			   rorB(t,x,41), xor(r,r,t) )
-#define smallsigma0(r,t,x) ( rorL(r,x,1), rorL(t,x,8), xor(r,r,t), \
-			     shrL(t,x,7), xor(r,r,t) )
-#define smallsigma1(r,t,x) ( rorL(r,x,19), rorB(t,x,61), xor(r,r,t), \
-			     shrL(t,x,6), xor(r,r,t) )
+#define ror(x,y) ( ((x) >> (y)) | ((x) << (64-(y))) )
+#define shr(x,y) ( (x) >> (y) )
+#define Ch(x,y,z) ( ((x) & (y)) ^ (~(x) & (z)) )
+#define Maj(x,y,z) ( ((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)) )
+#define bigsigma0(x) ( ror((x),28) ^ ror((x),34) ^ ror((x),39) )
+#define bigsigma1(x) ( ror((x),14) ^ ror((x),18) ^ ror((x),41) )
+#define smallsigma0(x) ( ror((x),1) ^ ror((x),8) ^ shr((x),7) )
+#define smallsigma1(x) ( ror((x),19) ^ ror((x),61) ^ shr((x),6) )
 
 static void SHA512_Core_Init(SHA512_State *s) {
-    static const uint64 iv[] = {
+    static const sha512_word iv[] = {
 	INIT(0x6a09e667, 0xf3bcc908),
 	INIT(0xbb67ae85, 0x84caa73b),
 	INIT(0x3c6ef372, 0xfe94f82b),
@@ -61,10 +47,10 @@ static void SHA512_Core_Init(SHA512_State *s) {
 	s->h[i] = iv[i];
 }
 
-static void SHA512_Block(SHA512_State *s, uint64 *block) {
-    uint64 w[80];
-    uint64 a,b,c,d,e,f,g,h;
-    static const uint64 k[] = {
+static void SHA512_Block(SHA512_State *s, const unsigned char *block) {
+    sha512_word w[80];
+    sha512_word a,b,c,d,e,f,g,h;
+    static const sha512_word k[] = {
 	INIT(0x428a2f98, 0xd728ae22), INIT(0x71374491, 0x23ef65cd),
 	INIT(0xb5c0fbcf, 0xec4d3b2f), INIT(0xe9b5dba5, 0x8189dbbc),
 	INIT(0x3956c25b, 0xf348b538), INIT(0x59f111f1, 0xb605d019),
@@ -110,36 +96,22 @@ static void SHA512_Block(SHA512_State *s, uint64 *block) {
     int t;
 
     for (t = 0; t < 16; t++)
-        w[t] = block[t];
-
-    for (t = 16; t < 80; t++) {
-	uint64 p, q, r, tmp;
-	smallsigma1(p, tmp, w[t-2]);
-	smallsigma0(q, tmp, w[t-15]);
-	add(r, p, q);
-	add(p, r, w[t-7]);
-	add(w[t], p, w[t-16]);
-    }
+        w[t] = INIT(GET_32BIT_MSB_FIRST(block + t*8),
+                    GET_32BIT_MSB_FIRST(block + t*8 + 4));
+
+    for (t = 16; t < 80; t++)
+	w[t] = smallsigma1(w[t-2]) + w[t-7] + smallsigma0(w[t-15]) + w[t-16];
 
     a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
     e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
 
     for (t = 0; t < 80; t+=8) {
-        uint64 tmp, p, q, r;
+        sha512_word t1, t2;
 
 #define ROUND(j,a,b,c,d,e,f,g,h) \
-	bigsigma1(p, tmp, e); \
-	Ch(q, tmp, e, f, g); \
-	add(r, p, q); \
-	add(p, r, k[j]) ; \
-	add(q, p, w[j]); \
-	add(r, q, h); \
-	bigsigma0(p, tmp, a); \
-	Maj(tmp, q, a, b, c); \
-	add(q, tmp, p); \
-	add(p, r, d); \
-	d = p; \
-	add(h, q, r);
+	t1 = h + bigsigma1(e) + Ch(e,f,g) + k[j] + w[j]; \
+	t2 = bigsigma0(a) + Maj(a,b,c); \
+        d = d + t1; h = t1 + t2;
 
 	ROUND(t+0, a,b,c,d,e,f,g,h);
 	ROUND(t+1, h,a,b,c,d,e,f,g);
@@ -151,14 +123,8 @@ static void SHA512_Block(SHA512_State *s, uint64 *block) {
 	ROUND(t+7, b,c,d,e,f,g,h,a);
     }
 
-    {
-	uint64 tmp;
-#define UPDATE(state, local) ( tmp = state, add(state, tmp, local) )
-	UPDATE(s->h[0], a); UPDATE(s->h[1], b);
-	UPDATE(s->h[2], c); UPDATE(s->h[3], d);
-	UPDATE(s->h[4], e); UPDATE(s->h[5], f);
-	UPDATE(s->h[6], g); UPDATE(s->h[7], h);
-    }
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
 }
 
 /* ----------------------------------------------------------------------
@@ -177,7 +143,6 @@ void SHA512_Init(SHA512_State *s) {
 
 void SHA512_Bytes(SHA512_State *s, const void *p, int len) {
     unsigned char *q = (unsigned char *)p;
-    uint64 wordblock[16];
     uint32 lenw = len;
     int i;
 
@@ -189,7 +154,7 @@ void SHA512_Bytes(SHA512_State *s, const void *p, int len) {
 	lenw = (s->len[i] < lenw);
     }
 
-    if (s->blkused && s->blkused+len < BLKSIZE) {
+    if (s->blkused+len < BLKSIZE) {
         /*
          * Trivial case: just add to the block.
          */
@@ -197,27 +162,19 @@ void SHA512_Bytes(SHA512_State *s, const void *p, int len) {
         s->blkused += len;
     } else {
         /*
-         * We must complete and process at least one block.
+         * Complete and process any partial block, then process
+         * whole blocks directly from the input without copying.
          */
-        while (s->blkused + len >= BLKSIZE) {
+        if (s->blkused) {
             memcpy(s->block + s->blkused, q, BLKSIZE - s->blkused);
             q += BLKSIZE - s->blkused;
             len -= BLKSIZE - s->blkused;
-            /* Now process the block. Gather bytes big-endian into words */
-            for (i = 0; i < 16; i++) {
-		uint32 h, l;
-                h = ( ((uint32)s->block[i*8+0]) << 24 ) |
-                    ( ((uint32)s->block[i*8+1]) << 16 ) |
-                    ( ((uint32)s->block[i*8+2]) <<  8 ) |
-                    ( ((uint32)s->block[i*8+3]) <<  0 );
-                l = ( ((uint32)s->block[i*8+4]) << 24 ) |
-                    ( ((uint32)s->block[i*8+5]) << 16 ) |
-                    ( ((uint32)s->block[i*8+6]) <<  8 ) |
-                    ( ((uint32)s->block[i*8+7]) <<  0 );
-		BUILD(wordblock[i], h, l);
-            }
-            SHA512_Block(s, wordblock);
-            s->blkused = 0;
+            SHA512_Block(s, s->block);
+        }
+        while (len >= BLKSIZE) {
+            SHA512_Block(s, q);
+            q += BLKSIZE;
+            len -= BLKSIZE;
         }
         memcpy(s->block, q, len);
         s->blkused = len;
@@ -255,16 +212,8 @@ void SHA512_Final(SHA512_State *s, unsigned char *digest) {
     SHA512_Bytes(s, &c, 16);
 
     for (i = 0; i < 8; i++) {
-	uint32 h, l;
-	EXTRACT(h, l, s->h[i]);
-	digest[i*8+0] = (h >> 24) & 0xFF;
-	digest[i*8+1] = (h >> 16) & 0xFF;
-	digest[i*8+2] = (h >>  8) & 0xFF;
-	digest[i*8+3] = (h >>  0) & 0xFF;
-	digest[i*8+4] = (l >> 24) & 0xFF;
-	digest[i*8+5] = (l >> 16) & 0xFF;
-	digest[i*8+6] = (l >>  8) & 0xFF;
-	digest[i*8+7] = (l >>  0) & 0xFF;
+	PUT_32BIT_MSB_FIRST(digest + i*8, (uint32)(s->h[i] >> 32));
+	PUT_32BIT_MSB_FIRST(digest + i*8 + 4, (uint32)s->h[i]);
     }
 }
 
@@ -276,6 +225,117 @@ void SHA512_Simple(const void *p, int len, unsigned char *output) {
     SHA512_Final(&s, output);
 }
 
+/* ----------------------------------------------------------------------
+ * The above is the SHA-512 algorithm itself. Now we implement the
+ * HMAC wrapper on it, for hmac-sha2-512 (RFC 6668).
+ */
+
+static void *sha512_make_context(void)
+{
+    return snewn(3, SHA512_State);
+}
+
+static void sha512_free_context(void *handle)
+{
+    memset(handle, 0, 3 * sizeof(SHA512_State));
+    sfree(handle);
+}
+
+static void sha512_key_internal(void *handle, unsigned char *key, int len)
+{
+    SHA512_State *keys = (SHA512_State *)handle;
+    unsigned char foo[128];
+    int i;
+
+    memset(foo, 0x36, 128);
+    for (i = 0; i < len && i < 128; i++)
+	foo[i] ^= key[i];
+    SHA512_Init(&keys[0]);
+    SHA512_Bytes(&keys[0], foo, 128);
+
+    memset(foo, 0x5C, 128);
+    for (i = 0; i < len && i < 128; i++)
+	foo[i] ^= key[i];
+    SHA512_Init(&keys[1]);
+    SHA512_Bytes(&keys[1], foo, 128);
+
+    memset(foo, 0, 128);		       /* burn the evidence */
+}
+
+static void sha512_key(void *handle, unsigned char *key)
+{
+    sha512_key_internal(handle, key, 64);
+}
+
+static void hmacsha512_start(void *handle)
+{
+    SHA512_State *keys = (SHA512_State *)handle;
+
+    keys[2] = keys[0];		      /* structure copy */
+}
+
+static void hmacsha512_bytes(void *handle, unsigned char const *blk, int len)
+{
+    SHA512_State *keys = (SHA512_State *)handle;
+    SHA512_Bytes(&keys[2], (void *)blk, len);
+}
+
+static void hmacsha512_genresult(void *handle, unsigned char *hmac)
+{
+    SHA512_State *keys = (SHA512_State *)handle;
+    SHA512_State s;
+    unsigned char intermediate[64];
+
+    s = keys[2];		       /* structure copy */
+    SHA512_Final(&s, intermediate);
+    s = keys[1];		       /* structure copy */
+    SHA512_Bytes(&s, intermediate, 64);
+    SHA512_Final(&s, hmac);
+}
+
+static void sha512_do_hmac(void *handle, unsigned char *blk, int len,
+			   unsigned long seq, unsigned char *hmac)
+{
+    unsigned char seqbuf[4];
+
+    PUT_32BIT_MSB_FIRST(seqbuf, seq);
+    hmacsha512_start(handle);
+    hmacsha512_bytes(handle, seqbuf, 4);
+    hmacsha512_bytes(handle, blk, len);
+    hmacsha512_genresult(handle, hmac);
+}
+
+static void sha512_generate(void *handle, unsigned char *blk, int len,
+			    unsigned long seq)
+{
+    sha512_do_hmac(handle, blk, len, seq, blk + len);
+}
+
+static int hmacsha512_verresult(void *handle, unsigned char const *hmac)
+{
+    unsigned char correct[64];
+    hmacsha512_genresult(handle, correct);
+    return !memcmp(correct, hmac, 64);
+}
+
+static int sha512_verify(void *handle, unsigned char *blk, int len,
+			 unsigned long seq)
+{
+    unsigned char correct[64];
+    sha512_do_hmac(handle, blk, len, seq, correct);
+    return !memcmp(correct, blk + len, 64);
+}
+
+const struct ssh_mac ssh_hmac_sha2_512 = {
+    sha512_make_context, sha512_free_context, sha512_key,
+    sha512_generate, sha512_verify,
+    hmacsha512_start, hmacsha512_bytes,
+    hmacsha512_genresult, hmacsha512_verresult,
+    "hmac-sha2-512", "hmac-sha2-512-etm@openssh.com",
+    64,
+    "HMAC-SHA-512"
+};
+
 #ifdef TEST
 
 #include <stdio.h>
@@ -7,6 +7,27 @@
 
 #include "ssh.h"
 
+/*
+ * On x86 we can use the SHA extensions (SHA-NI) when the processor
+ * has them. As with AES-NI in sshaes.c, the code is compiled with a
+ * per-function target attribute (GCC, clang) or unconditionally
+ * (MSVC), and only called once CPUID has said the instructions
+ * exist. Define NO_SHA_NI to leave it out altogether.
+ */
+#if !defined(NO_SHA_NI) && \
+    ((defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
+#define SHA_NI
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA_NI_FUNC
+#else
+#include <cpuid.h>
+#define SHA_NI_FUNC __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
 /* ----------------------------------------------------------------------
  * Core SHA algorithm: processes 16-word blocks into a message digest.
  */
@@ -85,6 +106,154 @@ void SHATransform(word32 * digest, word32 * block)
     digest[4] += e;
 }
 
+#ifdef SHA_NI
+
+/*
+ * SHA-1 on the SHA extensions, processing whole 64-byte blocks
+ * straight from the input. SHA1RNDS4 does four rounds at a time;
+ * SHA1MSG1, SHA1MSG2 and an XOR between them expand the message
+ * schedule four words at a time, in step with the rounds.
+ */
+#define SHA1_NI_ROUNDS(g, Ein, Eout, Mcur, Mnext, Mnext2, Mprev) \
+    Ein = _mm_sha1nexte_epu32(Ein, Mcur); \
+    Eout = abcd; \
+    Mnext = _mm_sha1msg2_epu32(Mnext, Mcur); \
+    abcd = _mm_sha1rnds4_epu32(abcd, Ein, (g) / 5); \
+    Mprev = _mm_sha1msg1_epu32(Mprev, Mcur); \
+    Mnext2 = _mm_xor_si128(Mnext2, Mcur)
+
+static SHA_NI_FUNC void sha1_ni_blocks(uint32 *h, const unsigned char *data,
+				       int nblocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0x1B);
+    e0 = _mm_set_epi32(h[4], 0, 0, 0);
+
+    while (nblocks-- > 0) {
+	abcd_save = abcd;
+	e0_save = e0;
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) data), mask);
+	e0 = _mm_add_epi32(e0, m0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)),
+			      mask);
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+	m0 = _mm_sha1msg1_epu32(m0, m1);
+
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)),
+			      mask);
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+	m1 = _mm_sha1msg1_epu32(m1, m2);
+	m0 = _mm_xor_si128(m0, m2);
+
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)),
+			      mask);
+	SHA1_NI_ROUNDS(3, e1, e0, m3, m0, m1, m2);
+	SHA1_NI_ROUNDS(4, e0, e1, m0, m1, m2, m3);
+	SHA1_NI_ROUNDS(5, e1, e0, m1, m2, m3, m0);
+	SHA1_NI_ROUNDS(6, e0, e1, m2, m3, m0, m1);
+	SHA1_NI_ROUNDS(7, e1, e0, m3, m0, m1, m2);
+	SHA1_NI_ROUNDS(8, e0, e1, m0, m1, m2, m3);
+	SHA1_NI_ROUNDS(9, e1, e0, m1, m2, m3, m0);
+	SHA1_NI_ROUNDS(10, e0, e1, m2, m3, m0, m1);
+	SHA1_NI_ROUNDS(11, e1, e0, m3, m0, m1, m2);
+	SHA1_NI_ROUNDS(12, e0, e1, m0, m1, m2, m3);
+	SHA1_NI_ROUNDS(13, e1, e0, m1, m2, m3, m0);
+	SHA1_NI_ROUNDS(14, e0, e1, m2, m3, m0, m1);
+	SHA1_NI_ROUNDS(15, e1, e0, m3, m0, m1, m2);
+	SHA1_NI_ROUNDS(16, e0, e1, m0, m1, m2, m3);
+
+	/* The last three groups need no further schedule words. */
+	e1 = _mm_sha1nexte_epu32(e1, m1);
+	e0 = abcd;
+	m2 = _mm_sha1msg2_epu32(m2, m1);
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+	m3 = _mm_xor_si128(m3, m1);
+
+	e0 = _mm_sha1nexte_epu32(e0, m2);
+	e1 = abcd;
+	m3 = _mm_sha1msg2_epu32(m3, m2);
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+	e1 = _mm_sha1nexte_epu32(e1, m3);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	data += 64;
+    }
+
+    _mm_storeu_si128((__m128i *) h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = _mm_extract_epi32(e0, 3);
+}
+
+static int sha_ni_cpu_supported(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+	return FALSE;
+    __cpuid(info, 1);
+    if (!((info[2] >> 19) & 1) || !((info[2] >> 9) & 1))
+	return FALSE;		       /* SSE4.1, SSSE3 */
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 29) & 1;	       /* SHA */
+#else
+    unsigned a, b, c, d;
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &a, &b, &c, &d))
+	return FALSE;
+    if (!(c & bit_SSE4_1) || !(c & bit_SSSE3))
+	return FALSE;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 29) & 1;	       /* SHA */
+#endif
+}
+
+int sha_ni_available(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+	supported = sha_ni_cpu_supported();
+    return supported;
+}
+
+#endif /* SHA_NI */
+
+static void sha1_blocks(uint32 *h, const unsigned char *data, int nblocks)
+{
+    uint32 wordblock[16];
+    int i;
+
+#ifdef SHA_NI
+    if (sha_ni_available()) {
+	sha1_ni_blocks(h, data, nblocks);
+	return;
+    }
+#endif
+
+    while (nblocks-- > 0) {
+	/* Gather bytes big-endian into words */
+	for (i = 0; i < 16; i++)
+	    wordblock[i] = GET_32BIT_MSB_FIRST(data + i * 4);
+	SHATransform(h, wordblock);
+	data += 64;
+    }
+}
+
 /* ----------------------------------------------------------------------
  * Outer SHA algorithm: take an arbitrary length byte string,
  * convert it into 16-word blocks with the prescribed padding at
@@ -101,9 +270,7 @@ void SHA_Init(SHA_State * s)
 void SHA_Bytes(SHA_State * s, void *p, int len)
 {
     unsigned char *q = (unsigned char *) p;
-    uint32 wordblock[16];
     uint32 lenw = len;
-    int i;
 
     /*
      * Update the length field.
@@ -111,7 +278,7 @@ void SHA_Bytes(SHA_State * s, void *p, int len)
     s->lenlo += lenw;
     s->lenhi += (s->lenlo < lenw);
 
-    if (s->blkused && s->blkused + len < 64) {
+    if (s->blkused + len < 64) {
 	/*
 	 * Trivial case: just add to the block.
 	 */
@@ -119,22 +286,19 @@ void SHA_Bytes(SHA_State * s, void *p, int len)
 	s->blkused += len;
     } else {
 	/*
-	 * We must complete and process at least one block.
+	 * Complete and process any partial block, then process
+	 * whole blocks directly from the input without copying.
 	 */
-	while (s->blkused + len >= 64) {
+	if (s->blkused) {
 	    memcpy(s->block + s->blkused, q, 64 - s->blkused);
 	    q += 64 - s->blkused;
 	    len -= 64 - s->blkused;
-	    /* Now process the block. Gather bytes big-endian into words */
-	    for (i = 0; i < 16; i++) {
-		wordblock[i] =
-		    (((uint32) s->block[i * 4 + 0]) << 24) |
-		    (((uint32) s->block[i * 4 + 1]) << 16) |
-		    (((uint32) s->block[i * 4 + 2]) << 8) |
-		    (((uint32) s->block[i * 4 + 3]) << 0);
-	    }
-	    SHATransform(s->h, wordblock);
-	    s->blkused = 0;
+	    sha1_blocks(s->h, s->block, 1);
+	}
+	if (len >= 64) {
+	    sha1_blocks(s->h, q, len / 64);
+	    q += len & ~63;
+	    len &= 63;
 	}
 	memcpy(s->block, q, len);
 	s->blkused = len;
@@ -376,7 +540,7 @@ const struct ssh_mac ssh_hmac_sha1 = {
     sha1_make_context, sha1_free_context, sha1_key,
     sha1_generate, sha1_verify,
     hmacsha1_start, hmacsha1_bytes, hmacsha1_genresult, hmacsha1_verresult,
-    "hmac-sha1",
+    "hmac-sha1", "hmac-sha1-etm@openssh.com",
     20,
     "HMAC-SHA1"
 };
@@ -386,7 +550,7 @@ const struct ssh_mac ssh_hmac_sha1_96 = {
     sha1_96_generate, sha1_96_verify,
     hmacsha1_start, hmacsha1_bytes,
     hmacsha1_96_genresult, hmacsha1_96_verresult,
-    "hmac-sha1-96",
+    "hmac-sha1-96", "hmac-sha1-96-etm@openssh.com",
     12,
     "HMAC-SHA1-96"
 };
@@ -395,7 +559,7 @@ const struct ssh_mac ssh_hmac_sha1_buggy = {
     sha1_make_context, sha1_free_context, sha1_key_buggy,
     sha1_generate, sha1_verify,
     hmacsha1_start, hmacsha1_bytes, hmacsha1_genresult, hmacsha1_verresult,
-    "hmac-sha1",
+    "hmac-sha1", NULL,
     20,
     "bug-compatible HMAC-SHA1"
 };
@@ -405,7 +569,7 @@ const struct ssh_mac ssh_hmac_sha1_96_buggy = {
     sha1_96_generate, sha1_96_verify,
     hmacsha1_start, hmacsha1_bytes,
     hmacsha1_96_genresult, hmacsha1_96_verresult,
-    "hmac-sha1-96",
+    "hmac-sha1-96", NULL,
     12,
     "bug-compatible HMAC-SHA1-96"
 };
@@ -38,6 +38,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #ifdef ZLIB_STANDALONE
@@ -55,6 +56,7 @@
 #define snewn(n, type) ( (type *) malloc((n) * sizeof(type)) )
 #define sresize(x, n, type) ( (type *) realloc((x), (n) * sizeof(type)) )
 #define sfree(x) ( free((x)) )
+#define lenof(x) ( (sizeof((x))) / (sizeof(*(x))))
 
 #else
 #include "ssh.h"
@@ -85,11 +87,21 @@ struct LZ77Context {
  */
 static int lz77_init(struct LZ77Context *ctx);
 
+/*
+ * Choose how hard the compressor works, from 1 (fastest) to 9
+ * (smallest output). lz77_init() sets level 6.
+ */
+static void lz77_level(struct LZ77Context *ctx, int level);
+
 /*
  * Supply data to be compressed. Will update the private fields of
  * the LZ77Context, and will call literal() and match() to output.
  * If `compress' is FALSE, it will never emit a match, but will
  * instead call literal() for everything.
+ *
+ * Every byte supplied is output before this returns: SSH needs
+ * each packet flushed, so nothing is held back waiting for the
+ * next call.
  */
 static void lz77_compress(struct LZ77Context *ctx,
 			  unsigned char *data, int len, int compress);
@@ -98,51 +110,62 @@ static void lz77_compress(struct LZ77Context *ctx,
  * Modifiable parameters.
  */
 #define WINSIZE 32768		       /* window size. Must be power of 2! */
-#define HASHMAX 2039		       /* one more than max hash value */
-#define MAXMATCH 32		       /* how many matches we track */
-#define HASHCHARS 3		       /* how many chars make a hash */
+#define HASHBITS 15		       /* log2 of the hash table size */
+#define MINMATCH 3		       /* how many chars make a hash */
+#define MAXMATCHLEN 258		       /* longest match Deflate can send */
+#define TOO_FAR 4096		       /* 3-char matches further off lose */
+
+#define HASHSIZE (1 << HASHBITS)
+#define NIL 0			       /* no position (so 0 is never matched) */
 
 /*
- * This compressor takes a less slapdash approach than the
- * gzip/zlib one. Rather than allowing our hash chains to fall into
- * disuse near the far end, we keep them doubly linked so we can
- * _find_ the far end, and then every time we add a new byte to the
- * window (thus rolling round by one and removing the previous
- * byte), we can carefully remove the hash chain entry.
+ * This is the scheme zlib uses. Incoming data goes into a buffer
+ * twice the size of the window, which slides down by a window's
+ * worth when it fills. head[] holds the latest position at which
+ * each hash value was seen, and prev[] (indexed by position modulo
+ * the window size) holds the one before that, so following prev[]
+ * from head[] walks back through every earlier position with the
+ * same hash. Entries further back than the window are just left
+ * to be overwritten; the walk stops before it reaches them.
+ *
+ * The tuning table is zlib's too. Levels 1-3 take the first good
+ * match they find; from level 4 up, before committing to a match
+ * we look for a longer one starting at the next byte (`lazy'
+ * matching), and the chains are searched harder.
  */
-
-#define INVALID -1		       /* invalid hash _and_ invalid offset */
-struct WindowEntry {
-    short next, prev;		       /* array indices within the window */
-    short hashval;
+struct lz77_config {
+    int good;			       /* prev match this long: search less */
+    int lazy;			       /* match this long: don't try lazily */
+    int nice;			       /* match this long: stop searching */
+    int chain;			       /* max hash chain entries to try */
 };
 
-struct HashEntry {
-    short first;		       /* window index of first in chain */
-};
-
-struct Match {
-    int distance, len;
+static const struct lz77_config lz77_configs[] = {
+    {0, 0, 0, 0},		       /* 0: not used */
+    {4, 4, 8, 4},		       /* 1-3: greedy; `lazy' limits */
+    {4, 5, 16, 8},		       /*   insertion of long matches */
+    {4, 6, 32, 32},
+    {4, 4, 16, 16},		       /* 4-9: lazy */
+    {8, 16, 32, 32},
+    {8, 16, 128, 128},
+    {8, 32, 128, 256},
+    {32, 128, 258, 1024},
+    {32, 258, 258, 4096},
 };
 
 struct LZ77InternalContext {
-    struct WindowEntry win[WINSIZE];
-    unsigned char data[WINSIZE];
-    int winpos;
-    struct HashEntry hashtab[HASHMAX];
-    unsigned char pending[HASHCHARS];
-    int npending;
+    unsigned char win[2 * WINSIZE];
+    unsigned short head[HASHSIZE];
+    unsigned short prev[WINSIZE];
+    int pos;			       /* bytes of win[] in use */
+    int hashed;			       /* first position not yet hashed */
+    int level;
+    const struct lz77_config *cfg;
 };
 
-static int lz77_hash(unsigned char *data)
-{
-    return (257 * data[0] + 263 * data[1] + 269 * data[2]) % HASHMAX;
-}
-
 static int lz77_init(struct LZ77Context *ctx)
 {
     struct LZ77InternalContext *st;
-    int i;
 
     st = snew(struct LZ77InternalContext);
     if (!st)
@@ -150,212 +173,251 @@ static int lz77_init(struct LZ77Context *ctx)
 
     ctx->ictx = st;
 
-    for (i = 0; i < WINSIZE; i++)
-	st->win[i].next = st->win[i].prev = st->win[i].hashval = INVALID;
-    for (i = 0; i < HASHMAX; i++)
-	st->hashtab[i].first = INVALID;
-    st->winpos = 0;
-
-    st->npending = 0;
+    memset(st->head, 0, sizeof(st->head));
+    memset(st->prev, 0, sizeof(st->prev));
+    st->pos = st->hashed = 0;
+    lz77_level(ctx, 6);
 
     return 1;
 }
 
-static void lz77_advance(struct LZ77InternalContext *st,
-			 unsigned char c, int hash)
+static void lz77_level(struct LZ77Context *ctx, int level)
 {
-    int off;
+    struct LZ77InternalContext *st = ctx->ictx;
 
-    /*
-     * Remove the hash entry at winpos from the tail of its chain,
-     * or empty the chain if it's the only thing on the chain.
-     */
-    if (st->win[st->winpos].prev != INVALID) {
-	st->win[st->win[st->winpos].prev].next = INVALID;
-    } else if (st->win[st->winpos].hashval != INVALID) {
-	st->hashtab[st->win[st->winpos].hashval].first = INVALID;
-    }
+    if (level < 1)
+	level = 1;
+    if (level > 9)
+	level = 9;
+    st->level = level;
+    st->cfg = &lz77_configs[level];
+}
 
-    /*
-     * Create a new entry at winpos and add it to the head of its
-     * hash chain.
-     */
-    st->win[st->winpos].hashval = hash;
-    st->win[st->winpos].prev = INVALID;
-    off = st->win[st->winpos].next = st->hashtab[hash].first;
-    st->hashtab[hash].first = st->winpos;
-    if (off != INVALID)
-	st->win[off].prev = st->winpos;
-    st->data[st->winpos] = c;
+#define LZ77_HASH(p) \
+    ((((p)[0] | ((p)[1] << 8) | ((unsigned long)(p)[2] << 16)) * \
+      0x9E3779B1UL & 0xFFFFFFFFUL) >> (32 - HASHBITS))
 
-    /*
-     * Advance the window pointer.
-     */
-    st->winpos = (st->winpos + 1) & (WINSIZE - 1);
+/*
+ * Add position p to its hash chain, and return the previous head
+ * of the chain. There must be MINMATCH bytes of data at p.
+ */
+static int lz77_insert(struct LZ77InternalContext *st, int p)
+{
+    int h = (int)LZ77_HASH(st->win + p);
+    int cand = st->head[h];
+    st->prev[p & (WINSIZE - 1)] = cand;
+    st->head[h] = p;
+    return cand;
 }
 
-#define CHARAT(k) ( (k)<0 ? st->data[(st->winpos+k)&(WINSIZE-1)] : data[k] )
-
-static void lz77_compress(struct LZ77Context *ctx,
-			  unsigned char *data, int len, int compress)
+/*
+ * Slide the buffer down by a window's worth, so that there's room
+ * for up to WINSIZE more bytes.
+ */
+static void lz77_slide(struct LZ77InternalContext *st)
 {
-    struct LZ77InternalContext *st = ctx->ictx;
-    int i, hash, distance, off, nmatch, matchlen, advance;
-    struct Match defermatch, matches[MAXMATCH];
-    int deferchr;
+    int i;
 
-    /*
-     * Add any pending characters from last time to the window. (We
-     * might not be able to.)
-     */
-    for (i = 0; i < st->npending; i++) {
-	unsigned char foo[HASHCHARS];
-	int j;
-	if (len + st->npending - i < HASHCHARS) {
-	    /* Update the pending array. */
-	    for (j = i; j < st->npending; j++)
-		st->pending[j - i] = st->pending[j];
-	    break;
+    memmove(st->win, st->win + WINSIZE, st->pos - WINSIZE);
+    st->pos -= WINSIZE;
+    st->hashed -= WINSIZE;
+    if (st->hashed < 0)
+	st->hashed = 0;
+    for (i = 0; i < HASHSIZE; i++)
+	st->head[i] = (st->head[i] >= WINSIZE ? st->head[i] - WINSIZE : NIL);
+    for (i = 0; i < WINSIZE; i++)
+	st->prev[i] = (st->prev[i] >= WINSIZE ? st->prev[i] - WINSIZE : NIL);
+}
+
+/*
+ * Walk the hash chain from `cand' looking for the longest match
+ * for the data at `cur', which mustn't run past `end'. Only
+ * matches longer than `prevlen' are of interest; returns the
+ * length of the best one found (with its distance in *dist), or 0.
+ */
+static int lz77_longest(struct LZ77InternalContext *st, int cur, int end,
+			int cand, int prevlen, int *dist)
+{
+    const struct lz77_config *cfg = st->cfg;
+    unsigned char *s = st->win + cur;
+    int limit = cur - WINSIZE;
+    int maxlen = end - cur;
+    int chain = cfg->chain;
+    int best = prevlen, bestdist = 0;
+
+    if (maxlen > MAXMATCHLEN)
+	maxlen = MAXMATCHLEN;
+    if (best >= maxlen)
+	return 0;
+    if (prevlen >= cfg->good)
+	chain >>= 2;
+
+    while (cand > limit && cand != NIL && chain-- > 0) {
+	unsigned char *m = st->win + cand;
+	int len;
+
+	/* Check the byte that would make this beat `best' first. */
+	if (m[best] == s[best] && m[0] == s[0] && m[1] == s[1]) {
+	    for (len = 2; len < maxlen && m[len] == s[len]; len++);
+	    if (len > best) {
+		best = len;
+		bestdist = cur - cand;
+		if (len >= cfg->nice || len >= maxlen)
+		    break;
+	    }
 	}
-	for (j = 0; j < HASHCHARS; j++)
-	    foo[j] = (i + j < st->npending ? st->pending[i + j] :
-		      data[i + j - st->npending]);
-	lz77_advance(st, foo[0], lz77_hash(foo));
+	cand = st->prev[cand & (WINSIZE - 1)];
     }
-    st->npending -= i;
-
-    defermatch.distance = 0; /* appease compiler */
-    defermatch.len = 0;
-    deferchr = '\0';
-    while (len > 0) {
 
-	/* Don't even look for a match, if we're not compressing. */
-	if (compress && len >= HASHCHARS) {
-	    /*
-	     * Hash the next few characters.
-	     */
-	    hash = lz77_hash(data);
+    if (bestdist == 0)
+	return 0;
+    *dist = bestdist;
+    return best;
+}
 
-	    /*
-	     * Look the hash up in the corresponding hash chain and see
-	     * what we can find.
-	     */
-	    nmatch = 0;
-	    for (off = st->hashtab[hash].first;
-		 off != INVALID; off = st->win[off].next) {
-		/* distance = 1       if off == st->winpos-1 */
-		/* distance = WINSIZE if off == st->winpos   */
-		distance =
-		    WINSIZE - (off + WINSIZE - st->winpos) % WINSIZE;
-		for (i = 0; i < HASHCHARS; i++)
-		    if (CHARAT(i) != CHARAT(i - distance))
-			break;
-		if (i == HASHCHARS) {
-		    matches[nmatch].distance = distance;
-		    matches[nmatch].len = 3;
-		    if (++nmatch >= MAXMATCH)
-			break;
-		}
-	    }
-	} else {
-	    nmatch = 0;
-	    hash = INVALID;
+/*
+ * Compress win[p..end), which has just been added to the buffer.
+ */
+static void lz77_run(struct LZ77Context *ctx, int p, int end, int compress)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+    const struct lz77_config *cfg = st->cfg;
+    int cand, len, dist;
+
+    if (!compress) {
+	for (; p < end; p++) {
+	    if (p + MINMATCH <= end)
+		lz77_insert(st, p);
+	    ctx->literal(ctx, st->win[p]);
 	}
-
-	if (nmatch > 0) {
-	    /*
-	     * We've now filled up matches[] with nmatch potential
-	     * matches. Follow them down to find the longest. (We
-	     * assume here that it's always worth favouring a
-	     * longer match over a shorter one.)
-	     */
-	    matchlen = HASHCHARS;
-	    while (matchlen < len) {
-		int j;
-		for (i = j = 0; i < nmatch; i++) {
-		    if (CHARAT(matchlen) ==
-			CHARAT(matchlen - matches[i].distance)) {
-			matches[j++] = matches[i];
-		    }
-		}
-		if (j == 0)
-		    break;
-		matchlen++;
-		nmatch = j;
+    } else if (st->level <= 3) {
+	/*
+	 * Greedy matching: take any match we find. Only hash the
+	 * positions inside a match if it's a short one.
+	 */
+	while (p < end) {
+	    len = 0;
+	    if (p + MINMATCH <= end) {
+		cand = lz77_insert(st, p);
+		len = lz77_longest(st, p, end, cand, MINMATCH - 1, &dist);
+		if (len == MINMATCH && dist > TOO_FAR)
+		    len = 0;
 	    }
-
-	    /*
-	     * We've now got all the longest matches. We favour the
-	     * shorter distances, which means we go with matches[0].
-	     * So see if we want to defer it or throw it away.
-	     */
-	    matches[0].len = matchlen;
-	    if (defermatch.len > 0) {
-		if (matches[0].len > defermatch.len + 1) {
-		    /* We have a better match. Emit the deferred char,
-		     * and defer this match. */
-		    ctx->literal(ctx, (unsigned char) deferchr);
-		    defermatch = matches[0];
-		    deferchr = data[0];
-		    advance = 1;
+	    if (len >= MINMATCH) {
+		ctx->match(ctx, dist, len);
+		if (len <= cfg->lazy) {
+		    while (--len > 0) {
+			p++;
+			if (p + MINMATCH <= end)
+			    lz77_insert(st, p);
+		    }
+		    p++;
 		} else {
-		    /* We don't have a better match. Do the deferred one. */
-		    ctx->match(ctx, defermatch.distance, defermatch.len);
-		    advance = defermatch.len - 1;
-		    defermatch.len = 0;
+		    p += len;
 		}
 	    } else {
-		/* There was no deferred match. Defer this one. */
-		defermatch = matches[0];
-		deferchr = data[0];
-		advance = 1;
-	    }
-	} else {
-	    /*
-	     * We found no matches. Emit the deferred match, if
-	     * any; otherwise emit a literal.
-	     */
-	    if (defermatch.len > 0) {
-		ctx->match(ctx, defermatch.distance, defermatch.len);
-		advance = defermatch.len - 1;
-		defermatch.len = 0;
-	    } else {
-		ctx->literal(ctx, data[0]);
-		advance = 1;
+		ctx->literal(ctx, st->win[p]);
+		p++;
 	    }
 	}
-
+    } else {
 	/*
-	 * Now advance the position by `advance' characters,
-	 * keeping the window and hash chains consistent.
+	 * Lazy matching: having found a match at p-1, see if p
+	 * offers a longer one before deciding which to use.
 	 */
-	while (advance > 0) {
-	    if (len >= HASHCHARS) {
-		lz77_advance(st, *data, lz77_hash(data));
+	int prevlen, prevdist = 0, pending = FALSE;
+
+	len = MINMATCH - 1;
+	while (p < end) {
+	    prevlen = len;
+	    len = MINMATCH - 1;
+	    if (p + MINMATCH <= end) {
+		cand = lz77_insert(st, p);
+		if (prevlen < cfg->lazy) {
+		    int l = lz77_longest(st, p, end, cand, prevlen, &dist);
+		    if (l > prevlen && !(l == MINMATCH && dist > TOO_FAR))
+			len = l;
+		}
+	    }
+	    if (prevlen >= MINMATCH && len <= prevlen) {
+		/*
+		 * The match at p-1 is at least as good as anything
+		 * here, so use it, hashing the positions it covers.
+		 */
+		int stop = p - 1 + prevlen;
+		ctx->match(ctx, prevdist, prevlen);
+		for (p++; p < stop; p++)
+		    if (p + MINMATCH <= end)
+			lz77_insert(st, p);
+		pending = FALSE;
+		len = MINMATCH - 1;
 	    } else {
-		st->pending[st->npending++] = *data;
+		if (pending)
+		    ctx->literal(ctx, st->win[p - 1]);
+		if (len >= MINMATCH)
+		    prevdist = dist;
+		pending = TRUE;
+		p++;
 	    }
-	    data++;
-	    len--;
-	    advance--;
 	}
+	if (pending)
+	    ctx->literal(ctx, st->win[p - 1]);
+    }
+}
+
+static void lz77_compress(struct LZ77Context *ctx,
+			  unsigned char *data, int len, int compress)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+
+    while (len > 0) {
+	int chunk = (len < WINSIZE ? len : WINSIZE);
+	int start, end;
+
+	if (st->pos + chunk > 2 * WINSIZE)
+	    lz77_slide(st);
+	start = st->pos;
+	end = start + chunk;
+	memcpy(st->win + start, data, chunk);
+	st->pos = end;
+
+	/*
+	 * The last couple of positions from last time couldn't be
+	 * hashed until we had the bytes after them.
+	 */
+	while (st->hashed < start && st->hashed + MINMATCH <= end)
+	    lz77_insert(st, st->hashed++);
+
+	lz77_run(ctx, start, end, compress);
+
+	if (st->hashed < end - (MINMATCH - 1))
+	    st->hashed = end - (MINMATCH - 1);
+
+	data += chunk;
+	len -= chunk;
     }
 }
 
 /* ----------------------------------------------------------------------
- * Zlib compression. We always use the static Huffman tree option.
- * Mostly this is because it's hard to scan a block in advance to
- * work out better trees; dynamic trees are great when you're
- * compressing a large file under no significant time constraint,
- * but when you're compressing little bits in real time, things get
- * hairier.
- * 
- * I suppose it's possible that I could compute Huffman trees based
- * on the frequencies in the _previous_ block, as a sort of
- * heuristic, but I'm not confident that the gain would balance out
- * having to transmit the trees.
+ * Zlib compression. Each call to zlib_compress_block() produces a
+ * Deflate block (or several, for a lot of data) followed by a zlib
+ * partial flush, so the far end can decode the whole packet as
+ * soon as it arrives.
+ *
+ * Symbols are buffered until the end of the block, and then sent
+ * using whichever is smaller out of the static Huffman trees and
+ * dynamic trees built from the block's own symbol frequencies
+ * (counting the cost of transmitting the trees). Small blocks -
+ * keystrokes, mostly - don't get the choice: the trees would never
+ * pay for themselves, and there's no point spending time finding
+ * that out.
  */
 
+#define SYMBUFSIZE 16384	       /* symbols buffered per block */
+#define DYNMIN 64		       /* fewer symbols: static trees only */
+#define NLITLEN 286		       /* literal/length codes in use */
+#define NDIST 30		       /* distance codes in use */
+
 struct Outbuf {
     unsigned char *outbuf;
     int outlen, outsize;
@@ -363,6 +425,21 @@ struct Outbuf {
     int noutbits;
     int firstblock;
     int comp_disabled;
+    int level;
+
+    /* The block in progress. */
+    unsigned short symdist[SYMBUFSIZE]; /* 0 for a literal */
+    unsigned short symval[SYMBUFSIZE];  /* the literal, or match length */
+    int nsyms;
+    unsigned litfreq[NLITLEN], distfreq[NDIST];
+
+    /* Match length and distance to index in lencodes / distcodes. */
+    unsigned char lcode[MAXMATCHLEN + 1];
+    unsigned char dcode[512];
+
+    /* The static trees. */
+    unsigned short fixlitcode[288], fixdistcode[NDIST];
+    unsigned char fixlitlen[288], fixdistlen[NDIST];
 };
 
 static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
@@ -372,7 +449,7 @@ static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
     out->noutbits += nbits;
     while (out->noutbits >= 8) {
 	if (out->outlen >= out->outsize) {
-	    out->outsize = out->outlen + 64;
+	    out->outsize = out->outlen * 3 / 2 + 64;
 	    out->outbuf = sresize(out->outbuf, out->outsize, unsigned char);
 	}
 	out->outbuf[out->outlen++] = (unsigned char) (out->outbits & 0xFF);
@@ -381,40 +458,17 @@ static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
     }
 }
 
-static const unsigned char mirrorbytes[256] = {
-    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
-    0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
-    0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8,
-    0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
-    0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4,
-    0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
-    0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec,
-    0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
-    0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2,
-    0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
-    0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea,
-    0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
-    0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6,
-    0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
-    0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee,
-    0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
-    0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1,
-    0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
-    0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9,
-    0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
-    0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5,
-    0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
-    0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed,
-    0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
-    0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3,
-    0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
-    0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb,
-    0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
-    0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7,
-    0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
-    0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef,
-    0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff,
-};
+/*
+ * Make sure there's room for at least `n' more bytes of output, so
+ * that outbits() needn't keep growing the buffer a little at a time.
+ */
+static void outreserve(struct Outbuf *out, int n)
+{
+    if (out->outsize < out->outlen + n) {
+	out->outsize = out->outlen + n;
+	out->outbuf = sresize(out->outbuf, out->outsize, unsigned char);
+    }
+}
 
 typedef struct {
     short code, extrabits;
@@ -486,6 +540,291 @@ static const coderecord distcodes[] = {
     {29, 13, 24577, 32768},
 };
 
+/* Order in which the code length code lengths are sent. */
+static const unsigned char lenlenmap[] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+#define DISTCODE(out, d) \
+    ((d) <= 256 ? (out)->dcode[(d) - 1] : (out)->dcode[256 + (((d) - 1) >> 7)])
+
+/*
+ * Assign canonical Huffman codes (RFC1951 3.2.2) to a set of code
+ * lengths. Deflate sends Huffman codes starting from the top bit,
+ * and outbits() works from the bottom, so the codes are returned
+ * bit-reversed.
+ */
+static void zlib_mkcodes(const unsigned char *lens, int n,
+			 unsigned short *codes)
+{
+    int count[16], next[16];
+    int i, j, code;
+
+    for (i = 0; i < 16; i++)
+	count[i] = 0;
+    for (i = 0; i < n; i++)
+	count[lens[i]]++;
+    count[0] = 0;
+    code = 0;
+    for (i = 1; i < 16; i++) {
+	code = (code + count[i - 1]) << 1;
+	next[i] = code;
+    }
+    for (i = 0; i < n; i++) {
+	int c = 0;
+	if (!lens[i])
+	    continue;
+	code = next[lens[i]]++;
+	for (j = 0; j < lens[i]; j++) {
+	    c = (c << 1) | (code & 1);
+	    code >>= 1;
+	}
+	codes[i] = c;
+    }
+}
+
+/*
+ * Work out Huffman code lengths, no longer than `maxbits', for n
+ * symbols with the given frequencies. If the plain Huffman tree is
+ * too deep, the frequencies are flattened a bit and we try again;
+ * that gives up a little compression in a case that hardly ever
+ * comes up, in exchange for being short and obviously right.
+ *
+ * Deflate wants at least two codes in every tree (a one-code tree
+ * would have a zero-length code), so unused symbols are promoted
+ * to make up the numbers.
+ */
+static void zlib_huflengths(const unsigned *freq, int n, int maxbits,
+			    unsigned char *lens)
+{
+    unsigned f[NLITLEN], w[2 * NLITLEN];
+    int parent[2 * NLITLEN], depth[2 * NLITLEN], leaves[NLITLEN];
+    int nleaves, i, j;
+
+    assert(n <= NLITLEN);
+
+    for (i = nleaves = 0; i < n; i++)
+	if ((f[i] = freq[i]) != 0)
+	    nleaves++;
+    for (i = 0; nleaves < 2 && i < n; i++)
+	if (!f[i]) {
+	    f[i] = 1;
+	    nleaves++;
+	}
+
+    while (1) {
+	int li, ni, nn, maxlen;
+
+	/* Sort the leaves by weight (insertion sort; n is small). */
+	for (i = nleaves = 0; i < n; i++) {
+	    if (!f[i])
+		continue;
+	    w[i] = f[i];
+	    for (j = nleaves++; j > 0 && f[leaves[j - 1]] > f[i]; j--)
+		leaves[j] = leaves[j - 1];
+	    leaves[j] = i;
+	}
+
+	/*
+	 * Build the tree by the two-queue method: the internal nodes
+	 * are created in increasing order of weight, so the two
+	 * lightest nodes are always at the front of one queue or the
+	 * other. Internal nodes are numbered from n upwards.
+	 */
+	li = 0;
+	ni = nn = n;
+	while (nn < n + nleaves - 1) {
+	    int pick[2], k;
+	    for (k = 0; k < 2; k++) {
+		if (li < nleaves && (ni >= nn || w[leaves[li]] <= w[ni]))
+		    pick[k] = leaves[li++];
+		else
+		    pick[k] = ni++;
+	    }
+	    w[nn] = w[pick[0]] + w[pick[1]];
+	    parent[pick[0]] = parent[pick[1]] = nn;
+	    nn++;
+	}
+
+	/* Parents always come after their children. */
+	depth[nn - 1] = 0;
+	for (i = nn - 2; i >= n; i--)
+	    depth[i] = depth[parent[i]] + 1;
+	maxlen = 0;
+	for (i = 0; i < n; i++) {
+	    lens[i] = (f[i] ? depth[parent[i]] + 1 : 0);
+	    if (maxlen < lens[i])
+		maxlen = lens[i];
+	}
+	if (maxlen <= maxbits)
+	    break;
+
+	for (i = 0; i < n; i++)
+	    if (f[i])
+		f[i] = (f[i] + 1) / 2;
+    }
+}
+
+/*
+ * Send the symbols of the current block using the given trees,
+ * and end the block.
+ */
+static void zlib_sendsyms(struct Outbuf *out,
+			  const unsigned short *litcode,
+			  const unsigned char *litlen,
+			  const unsigned short *distcode,
+			  const unsigned char *distlen)
+{
+    int i;
+
+    for (i = 0; i < out->nsyms; i++) {
+	int v = out->symval[i], d = out->symdist[i];
+	if (d == 0) {
+	    outbits(out, litcode[v], litlen[v]);
+	} else {
+	    const coderecord *l = &lencodes[out->lcode[v]];
+	    const coderecord *dr = &distcodes[DISTCODE(out, d)];
+	    outbits(out, litcode[l->code], litlen[l->code]);
+	    if (l->extrabits)
+		outbits(out, v - l->min, l->extrabits);
+	    outbits(out, distcode[dr->code], distlen[dr->code]);
+	    if (dr->extrabits)
+		outbits(out, d - dr->min, dr->extrabits);
+	}
+    }
+    outbits(out, litcode[256], litlen[256]);
+}
+
+/*
+ * Output the buffered symbols as a complete (non-final) Deflate
+ * block, and start a new one.
+ */
+static void zlib_endblock(struct Outbuf *out)
+{
+    unsigned char litlen[NLITLEN], distlen[NDIST], cllen[19];
+    unsigned short litcode[NLITLEN], distcode[NDIST], clcode[19];
+    unsigned char lens[NLITLEN + NDIST];
+    unsigned char rle[NLITLEN + NDIST], rlextra[NLITLEN + NDIST];
+    unsigned clfreq[19];
+    int hlit, hdist, hclen, nrle, i, j;
+    long dyncost, fixcost;
+
+    out->litfreq[256] = 1;	       /* end of block */
+
+    /* Worst case is 48 bits per symbol, plus trees. */
+    outreserve(out, out->nsyms * 6 + 512);
+
+    if (out->nsyms < DYNMIN)
+	goto fixed;
+
+    zlib_huflengths(out->litfreq, NLITLEN, 15, litlen);
+    zlib_huflengths(out->distfreq, NDIST, 15, distlen);
+    for (hlit = NLITLEN; hlit > 257 && !litlen[hlit - 1]; hlit--);
+    for (hdist = NDIST; hdist > 1 && !distlen[hdist - 1]; hdist--);
+
+    /*
+     * Run-length encode the code lengths, with the code length
+     * alphabet's repeat codes: 16 repeats the previous length 3-6
+     * times, 17 and 18 give runs of 3-10 and 11-138 zeroes.
+     */
+    memcpy(lens, litlen, hlit);
+    memcpy(lens + hlit, distlen, hdist);
+    for (i = 0; i < 19; i++)
+	clfreq[i] = 0;
+    nrle = 0;
+    for (i = 0; i < hlit + hdist; ) {
+	int v = lens[i], run = 1, r;
+	while (i + run < hlit + hdist && lens[i + run] == v)
+	    run++;
+	i += run;
+	if (v == 0) {
+	    while (run >= 11) {
+		r = (run < 138 ? run : 138);
+		rle[nrle] = 18, rlextra[nrle++] = r - 11;
+		run -= r;
+	    }
+	    if (run >= 3) {
+		rle[nrle] = 17, rlextra[nrle++] = run - 3;
+		run = 0;
+	    }
+	} else {
+	    rle[nrle] = v, rlextra[nrle++] = 0;
+	    run--;
+	    while (run >= 3) {
+		r = (run < 6 ? run : 6);
+		rle[nrle] = 16, rlextra[nrle++] = r - 3;
+		run -= r;
+	    }
+	}
+	while (run-- > 0)
+	    rle[nrle] = v, rlextra[nrle++] = 0;
+    }
+    for (i = 0; i < nrle; i++)
+	clfreq[rle[i]]++;
+    zlib_huflengths(clfreq, 19, 7, cllen);
+    for (hclen = 19; hclen > 4 && !cllen[lenlenmap[hclen - 1]]; hclen--);
+
+    /*
+     * Compare costs, in bits. The extra bits on lengths and
+     * distances are the same either way, so leave them out.
+     */
+    dyncost = 5 + 5 + 4 + 3 * hclen;
+    for (i = 0; i < nrle; i++)
+	dyncost += cllen[rle[i]] +
+	    (rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : rle[i] == 18 ? 7 : 0);
+    fixcost = 0;
+    for (i = 0; i < NLITLEN; i++) {
+	dyncost += (long)out->litfreq[i] * litlen[i];
+	fixcost += (long)out->litfreq[i] * out->fixlitlen[i];
+    }
+    for (i = 0; i < NDIST; i++) {
+	dyncost += (long)out->distfreq[i] * distlen[i];
+	fixcost += (long)out->distfreq[i] * 5;
+    }
+    if (dyncost >= fixcost)
+	goto fixed;
+
+    zlib_mkcodes(litlen, NLITLEN, litcode);
+    zlib_mkcodes(distlen, NDIST, distcode);
+    zlib_mkcodes(cllen, 19, clcode);
+
+    /*
+     * Start a Deflate (RFC1951) dynamic-trees block: BFINAL=0,
+     * BTYPE=10. Then the sizes of the three trees, the code length
+     * tree itself, and the run-length encoded lengths of the other
+     * two.
+     */
+    outbits(out, 4, 3);
+    outbits(out, hlit - 257, 5);
+    outbits(out, hdist - 1, 5);
+    outbits(out, hclen - 4, 4);
+    for (i = 0; i < hclen; i++)
+	outbits(out, cllen[lenlenmap[i]], 3);
+    for (i = 0; i < nrle; i++) {
+	j = rle[i];
+	outbits(out, clcode[j], cllen[j]);
+	if (j >= 16)
+	    outbits(out, rlextra[i], j == 16 ? 2 : j == 17 ? 3 : 7);
+    }
+    zlib_sendsyms(out, litcode, litlen, distcode, distlen);
+    goto done;
+
+  fixed:
+    /*
+     * Start a Deflate (RFC1951) fixed-trees block. We transmit a
+     * zero bit (BFINAL=0), followed by a zero bit and a one bit
+     * (BTYPE=01). Of course these are in the wrong order (01 0).
+     */
+    outbits(out, 2, 3);
+    zlib_sendsyms(out, out->fixlitcode, out->fixlitlen,
+		  out->fixdistcode, out->fixdistlen);
+
+  done:
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
+}
+
 static void zlib_literal(struct LZ77Context *ectx, unsigned char c)
 {
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
@@ -498,19 +837,15 @@ static void zlib_literal(struct LZ77Context *ectx, unsigned char c)
 	return;
     }
 
-    if (c <= 143) {
-	/* 0 through 143 are 8 bits long starting at 00110000. */
-	outbits(out, mirrorbytes[0x30 + c], 8);
-    } else {
-	/* 144 through 255 are 9 bits long starting at 110010000. */
-	outbits(out, 1 + 2 * mirrorbytes[0x90 - 144 + c], 9);
-    }
+    out->symdist[out->nsyms] = 0;
+    out->symval[out->nsyms] = c;
+    out->litfreq[c]++;
+    if (++out->nsyms == SYMBUFSIZE)
+	zlib_endblock(out);
 }
 
 static void zlib_match(struct LZ77Context *ectx, int distance, int len)
 {
-    const coderecord *d, *l;
-    int i, j, k;
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
 
     assert(!out->comp_disabled);
@@ -531,71 +866,12 @@ static void zlib_match(struct LZ77Context *ectx, int distance, int len)
 	thislen = (len > 260 ? 258 : len <= 258 ? len : len - 3);
 	len -= thislen;
 
-	/*
-	 * Binary-search to find which length code we're
-	 * transmitting.
-	 */
-	i = -1;
-	j = sizeof(lencodes) / sizeof(*lencodes);
-	while (1) {
-	    assert(j - i >= 2);
-	    k = (j + i) / 2;
-	    if (thislen < lencodes[k].min)
-		j = k;
-	    else if (thislen > lencodes[k].max)
-		i = k;
-	    else {
-		l = &lencodes[k];
-		break;		       /* found it! */
-	    }
-	}
-
-	/*
-	 * Transmit the length code. 256-279 are seven bits
-	 * starting at 0000000; 280-287 are eight bits starting at
-	 * 11000000.
-	 */
-	if (l->code <= 279) {
-	    outbits(out, mirrorbytes[(l->code - 256) * 2], 7);
-	} else {
-	    outbits(out, mirrorbytes[0xc0 - 280 + l->code], 8);
-	}
-
-	/*
-	 * Transmit the extra bits.
-	 */
-	if (l->extrabits)
-	    outbits(out, thislen - l->min, l->extrabits);
-
-	/*
-	 * Binary-search to find which distance code we're
-	 * transmitting.
-	 */
-	i = -1;
-	j = sizeof(distcodes) / sizeof(*distcodes);
-	while (1) {
-	    assert(j - i >= 2);
-	    k = (j + i) / 2;
-	    if (distance < distcodes[k].min)
-		j = k;
-	    else if (distance > distcodes[k].max)
-		i = k;
-	    else {
-		d = &distcodes[k];
-		break;		       /* found it! */
-	    }
-	}
-
-	/*
-	 * Transmit the distance code. Five bits starting at 00000.
-	 */
-	outbits(out, mirrorbytes[d->code * 8], 5);
-
-	/*
-	 * Transmit the extra bits.
-	 */
-	if (d->extrabits)
-	    outbits(out, distance - d->min, d->extrabits);
+	out->symdist[out->nsyms] = distance;
+	out->symval[out->nsyms] = thislen;
+	out->litfreq[lencodes[out->lcode[thislen]].code]++;
+	out->distfreq[DISTCODE(out, distance)]++;
+	if (++out->nsyms == SYMBUFSIZE)
+	    zlib_endblock(out);
     }
 }
 
@@ -603,6 +879,7 @@ void *zlib_compress_init(void)
 {
     struct Outbuf *out;
     struct LZ77Context *ectx = snew(struct LZ77Context);
+    int i, j;
 
     lz77_init(ectx);
     ectx->literal = zlib_literal;
@@ -612,6 +889,29 @@ void *zlib_compress_init(void)
     out->outbits = out->noutbits = 0;
     out->firstblock = 1;
     out->comp_disabled = FALSE;
+    out->level = 6;
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
+
+    for (i = 0; i < lenof(lencodes); i++)
+	for (j = lencodes[i].min; j <= lencodes[i].max; j++)
+	    out->lcode[j] = i;
+    for (i = 0; i < lenof(distcodes); i++)
+	for (j = distcodes[i].min; j <= distcodes[i].max; j++)
+	    if (j <= 256)
+		out->dcode[j - 1] = i;
+	    else
+		out->dcode[256 + ((j - 1) >> 7)] = i;
+
+    memset(out->fixlitlen, 8, 144);
+    memset(out->fixlitlen + 144, 9, 256 - 144);
+    memset(out->fixlitlen + 256, 7, 280 - 256);
+    memset(out->fixlitlen + 280, 8, 288 - 280);
+    zlib_mkcodes(out->fixlitlen, 288, out->fixlitcode);
+    memset(out->fixdistlen, 5, NDIST);
+    zlib_mkcodes(out->fixdistlen, NDIST, out->fixdistcode);
+
     ectx->userdata = out;
 
     return ectx;
@@ -620,11 +920,25 @@ void *zlib_compress_init(void)
 void zlib_compress_cleanup(void *handle)
 {
     struct LZ77Context *ectx = (struct LZ77Context *)handle;
-    sfree(ectx->userdata);
+    struct Outbuf *out = (struct Outbuf *) ectx->userdata;
+    sfree(out);
     sfree(ectx->ictx);
     sfree(ectx);
 }
 
+/*
+ * Set the compression level, from 1 (fastest) to 9 (best). The
+ * default is 6.
+ */
+void zlib_compress_level(void *handle, int level)
+{
+    struct LZ77Context *ectx = (struct LZ77Context *)handle;
+    struct Outbuf *out = (struct Outbuf *) ectx->userdata;
+
+    lz77_level(ectx, level);
+    out->level = ectx->ictx->level;
+}
+
 /*
  * Turn off actual LZ77 analysis for one block, to facilitate
  * construction of a precise-length IGNORE packet. Returns the
@@ -650,10 +964,10 @@ static int zlib_disable_compression(void *handle)
 	n = 3;
     } else {
 	/*
-	 * Otherwise, we will output seven bits to close the
-	 * previous static block, and _then_ three bits to begin an
-	 * uncompressed block, and then flush the current byte.
-	 * This may cost two bytes or three, depending on noutbits.
+	 * Otherwise, we will output three bits to begin an
+	 * uncompressed block after whatever is left over from the
+	 * last partial flush, and then flush the current byte.
+	 * This may cost one byte or two, depending on noutbits.
 	 */
 	n += (out->noutbits + 10) / 8;
     }
@@ -672,28 +986,23 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
 {
     struct LZ77Context *ectx = (struct LZ77Context *)handle;
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
-    int in_block;
 
     out->outbuf = NULL;
     out->outlen = out->outsize = 0;
 
     /*
      * If this is the first block, output the Zlib (RFC1950) header
-     * bytes 78 9C. (Deflate compression, 32K window size, default
-     * algorithm.)
+     * bytes: 78 (Deflate compression, 32K window size) and then a
+     * byte giving the compression level in its top two bits, and
+     * a check value.
      */
     if (out->firstblock) {
-	outbits(out, 0x9C78, 16);
+	outbits(out, (out->level <= 1 ? 0x0178 : out->level <= 5 ? 0x5E78 :
+		      out->level == 6 ? 0x9C78 : 0xDA78), 16);
 	out->firstblock = 0;
-
-	in_block = FALSE;
-    } else
-	in_block = TRUE;
+    }
 
     if (out->comp_disabled) {
-	if (in_block)
-	    outbits(out, 0, 7);	       /* close static block */
-
 	while (len > 0) {
 	    int blen = (len < 65535 ? len : 65535);
 
@@ -735,49 +1044,34 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
 	    len -= blen;
 	    block += blen;
 	}
-	outbits(out, 2, 3);	       /* open new block */
     } else {
-	if (!in_block) {
-	    /*
-	     * Start a Deflate (RFC1951) fixed-trees block. We
-	     * transmit a zero bit (BFINAL=0), followed by a zero
-	     * bit and a one bit (BTYPE=01). Of course these are in
-	     * the wrong order (01 0).
-	     */
-	    outbits(out, 2, 3);
-	}
-
 	/*
-	 * Do the compression.
+	 * Do the compression, and send the block.
 	 */
 	lz77_compress(ectx, block, len, TRUE);
+	zlib_endblock(out);
 
 	/*
-	 * End the block (by transmitting code 256, which is
-	 * 0000000 in fixed-tree mode), and transmit some empty
-	 * blocks to ensure we have emitted the byte containing the
-	 * last piece of genuine data. There are three ways we can
-	 * do this:
+	 * Now we must make sure we have emitted the byte containing
+	 * the last piece of genuine data. There are three ways we
+	 * can do this:
 	 *
-	 *  - Minimal flush. Output end-of-block and then open a
-	 *    new static block. This takes 9 bits, which is
-	 *    guaranteed to flush out the last genuine code in the
-	 *    closed block; but allegedly zlib can't handle it.
+	 *  - Minimal flush. Open a new static block and leave it
+	 *    open. Those three bits would be enough to flush out
+	 *    the end-of-block code, but allegedly zlib can't handle
+	 *    it.
 	 *
-	 *  - Zlib partial flush. Output EOB, open and close an
-	 *    empty static block, and _then_ open the new block.
-	 *    This is the best zlib can handle.
+	 *  - Zlib partial flush. Open and close an empty static
+	 *    block. This is the best zlib can handle.
 	 *
-	 *  - Zlib sync flush. Output EOB, then an empty
-	 *    _uncompressed_ block (000, then sync to byte
-	 *    boundary, then send bytes 00 00 FF FF). Then open the
-	 *    new block.
+	 *  - Zlib sync flush. Output an empty _uncompressed_ block
+	 *    (000, then sync to byte boundary, then send bytes 00
+	 *    00 FF FF).
 	 *
-	 * For the moment, we will use Zlib partial flush.
+	 * For the moment, we will use Zlib partial flush. The next
+	 * call starts a new block of its own.
 	 */
-	outbits(out, 0, 7);	       /* close block */
 	outbits(out, 2, 3 + 7);	       /* empty static block */
-	outbits(out, 2, 3);	       /* open new block */
     }
 
     out->comp_disabled = FALSE;
@@ -789,9 +1083,7 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
 }
 
 /* ----------------------------------------------------------------------
- * Zlib decompression. Of course, even though our compressor always
- * uses static trees, our _decompressor_ has to be capable of
- * handling dynamic trees if it sees them.
+ * Zlib decompression.
  */
 
 /*
@@ -800,10 +1092,25 @@ int zlib_compress_block(void *handle, unsigned char *block, int len,
  * of course, i.e. the first bit of the Huffman code is in bit 0).
  * Each table entry lists the number of bits to consume, plus
  * either an output code or a pointer to a secondary table.
+ *
+ * That's a loop per symbol, though, so literal/length tables also
+ * get a flat `fast' table indexed by the next FASTBITS bits, which
+ * decodes any code that fits in one lookup, and where a literal's
+ * code is short enough for the next symbol to fit as well, gives
+ * that too. Compressible text is mostly literals with codes of
+ * well under FASTBITS/2 bits, so this often halves the lookups.
  */
 struct zlib_table;
 struct zlib_tableentry;
 
+#define FASTBITS 10
+
+struct zlib_fastentry {
+    unsigned char nbits;	       /* total bits for the symbols below */
+    unsigned char nsyms;	       /* 0 (use the slow tables), 1 or 2 */
+    short sym[2];
+};
+
 struct zlib_tableentry {
     unsigned char nbits;
     short code;
@@ -813,6 +1120,7 @@ struct zlib_tableentry {
 struct zlib_table {
     int mask;			       /* mask applied to input bit stream */
     struct zlib_tableentry *table;
+    struct zlib_fastentry *fast;       /* or NULL */
 };
 
 #define MAXCODELEN 16
@@ -833,6 +1141,7 @@ static struct zlib_table *zlib_mkonetab(int *codes, unsigned char *lengths,
 
     tab->table = snewn(1 << bits, struct zlib_tableentry);
     tab->mask = (1 << bits) - 1;
+    tab->fast = NULL;
 
     for (code = 0; code <= tab->mask; code++) {
 	tab->table[code].code = -1;
@@ -931,6 +1240,7 @@ static int zlib_freetable(struct zlib_table **ztab)
 
     sfree(tab->table);
     tab->table = NULL;
+    sfree(tab->fast);
 
     sfree(tab);
     *ztab = NULL;
@@ -938,6 +1248,68 @@ static int zlib_freetable(struct zlib_table **ztab)
     return (0);
 }
 
+static int zlib_huflookup(unsigned long *bitsp, int *nbitsp,
+		   struct zlib_table *tab)
+{
+    unsigned long bits = *bitsp;
+    int nbits = *nbitsp;
+    while (1) {
+	struct zlib_tableentry *ent;
+	ent = &tab->table[bits & tab->mask];
+	if (ent->nbits > nbits)
+	    return -1;		       /* not enough data */
+	bits >>= ent->nbits;
+	nbits -= ent->nbits;
+	if (ent->code == -1)
+	    tab = ent->nexttable;
+	else {
+	    *bitsp = bits;
+	    *nbitsp = nbits;
+	    return ent->code;
+	}
+
+	if (!tab) {
+	    /*
+	     * There was a missing entry in the table, presumably
+	     * due to an invalid Huffman table description, and the
+	     * subsequent data has attempted to use the missing
+	     * entry. Return a decoding failure.
+	     */
+	    return -2;
+	}
+    }
+}
+
+/*
+ * Build the fast table for a literal/length decode table.
+ */
+static void zlib_mkfast(struct zlib_table *tab)
+{
+    int i;
+
+    tab->fast = snewn(1 << FASTBITS, struct zlib_fastentry);
+    for (i = 0; i < (1 << FASTBITS); i++) {
+	struct zlib_fastentry *ent = &tab->fast[i];
+	unsigned long bits = i;
+	int nbits = FASTBITS;
+	int code;
+
+	ent->nbits = ent->nsyms = 0;
+	code = zlib_huflookup(&bits, &nbits, tab);
+	if (code < 0)
+	    continue;		       /* too long; or invalid */
+	ent->sym[ent->nsyms++] = code;
+	ent->nbits = FASTBITS - nbits;
+	if (code < 256) {
+	    code = zlib_huflookup(&bits, &nbits, tab);
+	    if (code >= 0 && code < 256) {
+		ent->sym[ent->nsyms++] = code;
+		ent->nbits = FASTBITS - nbits;
+	    }
+	}
+    }
+}
+
 struct zlib_decompress_ctx {
     struct zlib_table *staticlentable, *staticdisttable;
     struct zlib_table *currlentable, *currdisttable, *lenlentable;
@@ -970,6 +1342,7 @@ void *zlib_decompress_init(void)
     memset(lengths + 256, 7, 280 - 256);
     memset(lengths + 280, 8, 288 - 280);
     dctx->staticlentable = zlib_mktable(lengths, 288);
+    zlib_mkfast(dctx->staticlentable);
     memset(lengths, 5, 32);
     dctx->staticdisttable = zlib_mktable(lengths, 32);
     dctx->state = START;		       /* even before header */
@@ -996,50 +1369,139 @@ void zlib_decompress_cleanup(void *handle)
     sfree(dctx);
 }
 
-static int zlib_huflookup(unsigned long *bitsp, int *nbitsp,
-		   struct zlib_table *tab)
-{
-    unsigned long bits = *bitsp;
-    int nbits = *nbitsp;
-    while (1) {
-	struct zlib_tableentry *ent;
-	ent = &tab->table[bits & tab->mask];
-	if (ent->nbits > nbits)
-	    return -1;		       /* not enough data */
-	bits >>= ent->nbits;
-	nbits -= ent->nbits;
-	if (ent->code == -1)
-	    tab = ent->nexttable;
-	else {
-	    *bitsp = bits;
-	    *nbitsp = nbits;
-	    return ent->code;
-	}
-
-	if (!tab) {
-	    /*
-	     * There was a missing entry in the table, presumably
-	     * due to an invalid Huffman table description, and the
-	     * subsequent data has attempted to use the missing
-	     * entry. Return a decoding failure.
-	     */
-	    return -2;
-	}
-    }
-}
-
 static void zlib_emit_char(struct zlib_decompress_ctx *dctx, int c)
 {
     dctx->window[dctx->winpos] = c;
     dctx->winpos = (dctx->winpos + 1) & (WINSIZE - 1);
     if (dctx->outlen >= dctx->outsize) {
-	dctx->outsize = dctx->outlen + 512;
+	dctx->outsize = dctx->outlen * 3 / 2 + 512;
 	dctx->outblk = sresize(dctx->outblk, dctx->outsize, unsigned char);
     }
     dctx->outblk[dctx->outlen++] = c;
 }
 
+/*
+ * Copy `len' bytes from `dist' back in the window. (They may
+ * overlap what we're writing, so this has to go a byte at a time.)
+ */
+static void zlib_emit_match(struct zlib_decompress_ctx *dctx,
+			    int dist, int len)
+{
+    unsigned char *out;
+    int winpos = dctx->winpos;
+
+    if (dctx->outlen + len > dctx->outsize) {
+	dctx->outsize = (dctx->outlen + len) * 3 / 2 + 512;
+	dctx->outblk = sresize(dctx->outblk, dctx->outsize, unsigned char);
+    }
+    out = dctx->outblk + dctx->outlen;
+    dctx->outlen += len;
+    while (len-- > 0) {
+	unsigned char c = dctx->window[(winpos - dist) & (WINSIZE - 1)];
+	dctx->window[winpos] = *out++ = c;
+	winpos = (winpos + 1) & (WINSIZE - 1);
+    }
+    dctx->winpos = winpos;
+}
+
+/*
+ * End-of-block code seen: go back to looking for a block header.
+ */
+static void zlib_blockdone(struct zlib_decompress_ctx *dctx)
+{
+    dctx->state = OUTSIDEBLK;
+    if (dctx->currlentable != dctx->staticlentable) {
+	zlib_freetable(&dctx->currlentable);
+	dctx->currlentable = NULL;
+    }
+    if (dctx->currdisttable != dctx->staticdisttable) {
+	zlib_freetable(&dctx->currdisttable);
+	dctx->currdisttable = NULL;
+    }
+}
+
 #define EATBITS(n) ( dctx->nbits -= (n), dctx->bits >>= (n) )
+#define FILLBITS() do { \
+    while (dctx->nbits <= 24) { \
+	dctx->bits |= (unsigned long)(*block++) << dctx->nbits; \
+	dctx->nbits += 8; \
+	len--; \
+    } \
+} while (0)
+
+/*
+ * Decode the body of a Huffman block in one go, as long as there's
+ * enough input that we needn't check for running out part way
+ * through a symbol: one literal/length/distance group takes at
+ * most 48 bits, plus up to 32 already buffered, so ten bytes in
+ * hand is enough. Returns when
+ * the block ends or the input runs low, leaving the state machine
+ * in zlib_decompress_block() to deal with whatever comes next; or
+ * returns FALSE on a decoding error.
+ */
+static int zlib_inflate_fast(struct zlib_decompress_ctx *dctx,
+			     unsigned char **blockp, int *lenp)
+{
+    unsigned char *block = *blockp;
+    int len = *lenp;
+    int ret = TRUE;
+
+    while (len >= 10 && dctx->state == INBLK) {
+	const struct zlib_fastentry *ent;
+	const coderecord *rec;
+	int code, mlen, dist;
+
+	FILLBITS();
+	ent = &dctx->currlentable->fast[dctx->bits & ((1 << FASTBITS) - 1)];
+	if (ent->nsyms) {
+	    EATBITS(ent->nbits);
+	    code = ent->sym[0];
+	    if (ent->nsyms == 2) {
+		zlib_emit_char(dctx, code);
+		zlib_emit_char(dctx, ent->sym[1]);
+		continue;
+	    }
+	} else {
+	    code = zlib_huflookup(&dctx->bits, &dctx->nbits,
+				  dctx->currlentable);
+	    if (code < 0) {
+		ret = FALSE;	       /* can't be short of bits here */
+		break;
+	    }
+	}
+
+	if (code < 256) {
+	    zlib_emit_char(dctx, code);
+	    continue;
+	} else if (code == 256) {
+	    zlib_blockdone(dctx);
+	    break;
+	} else if (code >= 286) {
+	    continue;		       /* static tree can give >285; ignore */
+	}
+
+	rec = &lencodes[code - 257];
+	mlen = rec->min + (dctx->bits & ((1 << rec->extrabits) - 1));
+	EATBITS(rec->extrabits);
+
+	FILLBITS();
+	code = zlib_huflookup(&dctx->bits, &dctx->nbits, dctx->currdisttable);
+	if (code < 0 || code >= lenof(distcodes)) {
+	    ret = FALSE;
+	    break;
+	}
+	rec = &distcodes[code];
+	FILLBITS();
+	dist = rec->min + (dctx->bits & ((1 << rec->extrabits) - 1));
+	EATBITS(rec->extrabits);
+
+	zlib_emit_match(dctx, dist, mlen);
+    }
+
+    *blockp = block;
+    *lenp = len;
+    return ret;
+}
 
 int zlib_decompress_block(void *handle, unsigned char *block, int len,
 			  unsigned char **outblock, int *outlen)
@@ -1047,9 +1509,6 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
     struct zlib_decompress_ctx *dctx = (struct zlib_decompress_ctx *)handle;
     const coderecord *rec;
     int code, blktype, rep, dist, nlen, header;
-    static const unsigned char lenlenmap[] = {
-	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-    };
 
     dctx->outblk = snewn(256, unsigned char);
     dctx->outsize = 256;
@@ -1147,6 +1606,7 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 	  case TREES_LEN:
 	    if (dctx->lenptr >= dctx->hlit + dctx->hdist) {
 		dctx->currlentable = zlib_mktable(dctx->lengths, dctx->hlit);
+		zlib_mkfast(dctx->currlentable);
 		dctx->currdisttable = zlib_mktable(dctx->lengths + dctx->hlit,
 						  dctx->hdist);
 		zlib_freetable(&dctx->lenlentable);
@@ -1185,6 +1645,11 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 	    dctx->state = TREES_LEN;
 	    break;
 	  case INBLK:
+	    if (len >= 10) {
+		if (!zlib_inflate_fast(dctx, &block, &len))
+		    goto decode_error;
+		break;
+	    }
 	    code =
 		zlib_huflookup(&dctx->bits, &dctx->nbits, dctx->currlentable);
 	    if (code == -1)
@@ -1193,17 +1658,9 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 		goto decode_error;
 	    if (code < 256)
 		zlib_emit_char(dctx, code);
-	    else if (code == 256) {
-		dctx->state = OUTSIDEBLK;
-		if (dctx->currlentable != dctx->staticlentable) {
-		    zlib_freetable(&dctx->currlentable);
-		    dctx->currlentable = NULL;
-		}
-		if (dctx->currdisttable != dctx->staticdisttable) {
-		    zlib_freetable(&dctx->currdisttable);
-		    dctx->currdisttable = NULL;
-		}
-	    } else if (code < 286) {   /* static tree can give >285; ignore */
+	    else if (code == 256)
+		zlib_blockdone(dctx);
+	    else if (code < 286) {   /* static tree can give >285; ignore */
 		dctx->state = GOTLENSYM;
 		dctx->sym = code;
 	    }
@@ -1223,7 +1680,7 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 			       dctx->currdisttable);
 	    if (code == -1)
 		goto finished;
-	    if (code == -2)
+	    if (code == -2 || code >= lenof(distcodes))
 		goto decode_error;
 	    dctx->state = GOTDISTSYM;
 	    dctx->sym = code;
@@ -1235,9 +1692,7 @@ int zlib_decompress_block(void *handle, unsigned char *block, int len,
 	    dist = rec->min + (dctx->bits & ((1 << rec->extrabits) - 1));
 	    EATBITS(rec->extrabits);
 	    dctx->state = INBLK;
-	    while (dctx->len--)
-		zlib_emit_char(dctx, dctx->window[(dctx->winpos - dist) &
-						  (WINSIZE - 1)]);
+	    zlib_emit_match(dctx, dist, dctx->len);
 	    break;
 	  case UNCOMP_LEN:
 	    /*
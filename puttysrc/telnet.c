@@ -626,6 +626,8 @@ static void telnet_log(Plug plug, int type, SockAddr addr, int port,
 
     if (type == 0)
 	msg = dupprintf("Connecting to %s port %d", addrbuf, port);
+    else if (type == 2)
+	msg = dupprintf("Connected to %s after %d ms", addrbuf, error_code);
     else
 	msg = dupprintf("Failed to connect to %s: %s", addrbuf, error_msg);
 
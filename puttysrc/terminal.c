@@ -11,6 +11,12 @@
 #include "putty.h"
 #include "terminal.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERM_OUT_SSE2
+#endif
+
 #define poslt(p1,p2) ( (p1).y < (p2).y || ( (p1).y == (p2).y && (p1).x < (p2).x ) )
 #define posle(p1,p2) ( (p1).y < (p2).y || ( (p1).y == (p2).y && (p1).x <= (p2).x ) )
 #define poseq(p1,p2) ( (p1).y == (p2).y && (p1).x == (p2).x )
@@ -48,6 +54,8 @@
 #define TM_PUTTY	(0xFFFF)
 
 #define UPDATE_DELAY    ((TICKSPERSEC+49)/50)/* ticks to defer window update */
+#define OUT_SLICE_TICKS ((TICKSPERSEC+99)/100)/* max ticks of one async term_out slice */
+#define OUT_SLICE_CHUNK 4096	       /* bytes parsed between clock checks */
 #define TBLINK_DELAY    ((TICKSPERSEC*9+19)/20)/* ticks between text blinks*/
 //#define CBLINK_DELAY    (CURSORBLINK) /* ticks between cursor blinks */
 //#define CBLINK_DELAY    (QApplication::cursorFlashTime()) /* ticks between cursor blinks */
@@ -1066,12 +1074,18 @@ static termline *lineptr(Terminal *term, int y, int lineno, int screen)
 
 static void term_schedule_tblink(Terminal *term);
 static void term_schedule_cblink(Terminal *term);
+static void term_out_slice(Terminal *term);
 
 static void term_timer(void *ctx, long now)
 {
     Terminal *term = (Terminal *)ctx;
     int update = FALSE;
 
+    if (term->out_pending && now - term->next_out >= 0) {
+	term->out_pending = FALSE;
+	term_out_slice(term);
+    }
+
     if (term->tblink_pending && now - term->next_tblink >= 0) {
 	term->tblinker = !term->tblinker;
 	term->tblink_pending = FALSE;
@@ -1096,6 +1110,18 @@ static void term_timer(void *ctx, long now)
 	term_update(term);
 }
 
+/*
+ * In async_term_out mode, queue the next slice of terminal output
+ * processing instead of doing it inside the network receive path.
+ */
+static void term_schedule_out(Terminal *term)
+{
+    if (!term->out_pending) {
+	term->out_pending = TRUE;
+	term->next_out = schedule_timer(1, term_timer, term);
+    }
+}
+
 static void term_schedule_update(Terminal *term)
 {
     if (!term->window_update_pending) {
@@ -1481,7 +1507,10 @@ Terminal *term_init(Config *mycfg, struct unicode_data *ucsdata,
     term->attr_mask = 0xffffffff;
     term->resize_fn = NULL;
     term->resize_ctx = NULL;
+    term->unthrottle_fn = NULL;
+    term->unthrottle_ctx = NULL;
     term->in_term_out = FALSE;
+    term->out_pending = FALSE;
     term->ltemp = NULL;
     term->ltemp_size = 0;
     term->wcFrom = NULL;
@@ -1761,6 +1790,19 @@ void term_provide_resize_fn(Terminal *term,
 	resize_fn(resize_ctx, term->cols, term->rows);
 }
 
+/*
+ * Hand a function and context pointer to the terminal which it can
+ * use to tell a back end that buffered output has been consumed.
+ * Only used when terminal output is processed asynchronously.
+ */
+void term_provide_unthrottle_fn(Terminal *term,
+				void (*unthrottle_fn)(void *, int),
+				void *unthrottle_ctx)
+{
+    term->unthrottle_fn = unthrottle_fn;
+    term->unthrottle_ctx = unthrottle_ctx;
+}
+
 /* Find the bottom line on the screen that has any content.
  * If only the top line has content, returns 0.
  * If no lines have content, return -1.
@@ -2531,41 +2573,169 @@ static void term_print_finish(Terminal *term)
 }
 
 /*
- * Remove everything currently in `inbuf' and stick it up on the
- * in-memory display. There's a big state machine in here to
- * process escape sequences...
+ * Return the length of the leading run of printable ASCII (0x20 to
+ * 0x7E) in buf, sixteen bytes at a time where SSE2 is available.
  */
-static void term_out(Terminal *term)
+static int printable_run(const unsigned char *buf, int len)
+{
+    int i = 0;
+#ifdef TERM_OUT_SSE2
+    const __m128i lo = _mm_set1_epi8(0x1F), hi = _mm_set1_epi8(0x7F);
+
+    /* Bytes >= 0x80 are negative as signed chars, so fail both tests. */
+    for (; i + 16 <= len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+	int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo),
+						   _mm_cmplt_epi8(v, hi)));
+	if (mask != 0xFFFF)
+	    break;
+    }
+#endif
+    while (i < len && buf[i] >= 0x20 && buf[i] < 0x7F)
+	i++;
+    return i;
+}
+
+/*
+ * Can term_out() hand printable ASCII straight to term_out_ascii()?
+ * Only in the plain state: no escape sequence or UTF-8 character in
+ * progress, no printer, G0 is plain ASCII, and none of the modes
+ * (insert, no-wrap, VT52) that change what a graphic character does.
+ */
+static int term_out_fastpath(Terminal *term)
+{
+    return term->termstate == TOPLEVEL && !term->printing &&
+	term->utf_state == 0 && term->wrap && !term->insert &&
+	!term->vt52_mode &&
+	(in_utf(term) || (!term->sco_acs &&
+			  term->cset_attr[term->cset] == CSET_ASCII));
+}
+
+/*
+ * Write a run of printable ASCII straight into the screen lines. This
+ * is the TOPLEVEL single-width case of term_out() applied a whole
+ * line segment at a time. Returns the number of bytes consumed, which
+ * can be short if the line codepage maps one of them to a control.
+ */
+static int term_out_ascii(Terminal *term, const unsigned char *buf, int len)
+{
+    int done = 0, i;
+
+    for (i = 0; i < len; i++)
+	if (term->ucsdata->unitab_ctrl[buf[i]] != 0xFF)
+	    break;
+    len = i;
+
+    /* LGTYP_DEBUG logging was done when the chunk was fetched */
+    if (term->logctx)
+	logtraffic_buf(term->logctx, buf, len, LGTYP_ASCII);
+
+    while (done < len) {
+	termline *cline;
+	int x0, seg;
+
+	if (term->wrapnext) {
+	    cline = scrlineptr(term->curs.y);
+	    cline->lattr |= LATTR_WRAPPED;
+	    if (term->curs.y == term->marg_b)
+		scroll(term, term->marg_t, term->marg_b, 1, TRUE);
+	    else if (term->curs.y < term->rows - 1)
+		term->curs.y++;
+	    term->curs.x = 0;
+	    term->wrapnext = FALSE;
+	}
+
+	cline = scrlineptr(term->curs.y);
+	x0 = term->curs.x;
+	seg = term->cols - x0;
+	if (seg > len - done)
+	    seg = len - done;
+
+	if (term->selstate != NO_SELECTION) {
+	    pos from = term->curs, to = term->curs;
+	    to.x += seg;
+	    check_selection(term, from, to);
+	}
+
+	/* Only the outer edges of the segment can split a wide char. */
+	check_boundary(term, x0, term->curs.y);
+	check_boundary(term, x0 + seg, term->curs.y);
+
+	for (i = 0; i < seg; i++) {
+	    /* FULL-TERMCHAR */
+	    clear_cc(cline, x0 + i);
+	    cline->chars[x0 + i].chr = buf[done + i] | CSET_ASCII;
+	    cline->chars[x0 + i].attr = term->curr_attr;
+	}
+	done += seg;
+
+	term->curs.x = x0 + seg;
+	if (term->curs.x == term->cols) {
+	    term->curs.x--;
+	    term->wrapnext = TRUE;
+	}
+    }
+
+    if (len > 0)
+	seen_disp_event(term);
+    return len;
+}
+
+/*
+ * Remove up to `limit' bytes (or everything, if `limit' is negative)
+ * currently in `inbuf' and stick it up on the in-memory display.
+ * There's a big state machine in here to process escape sequences...
+ */
+static void term_out(Terminal *term, int limit)
 {
     unsigned long c;
     int unget;
-    unsigned char localbuf[256], *chars;
+    unsigned char localbuf[4096], *chars;
     int nchars = 0;
 
     unget = -1;
 
     chars = NULL;		       /* placate compiler warnings */
-    while (nchars > 0 || unget != -1 || bufchain_size(&term->inbuf) > 0) {
+    while (nchars > 0 || unget != -1 ||
+	   (limit != 0 && bufchain_size(&term->inbuf) > 0)) {
 	if (unget == -1) {
 	    if (nchars == 0) {
 		void *ret;
 		bufchain_prefix(&term->inbuf, &ret, &nchars);
 		if (nchars > sizeof(localbuf))
 		    nchars = sizeof(localbuf);
+		if (limit > 0 && nchars > limit)
+		    nchars = limit;
+		if (limit > 0)
+		    limit -= nchars;
         memcpy(localbuf, ret, nchars);
 		bufchain_consume(&term->inbuf, nchars);
 		chars = localbuf;
 		assert(chars != NULL);
+
+		/*
+		 * Optionally log the session traffic to a file. Useful
+		 * for debugging and possibly also useful for actual
+		 * logging.
+		 */
+		if (term->cfg.logtype == LGTYP_DEBUG && term->logctx)
+		    logtraffic_buf(term->logctx, chars, nchars, LGTYP_DEBUG);
 	    }
-	    c = *chars++;
-	    nchars--;
 
 	    /*
-	     * Optionally log the session traffic to a file. Useful for
-	     * debugging and possibly also useful for actual logging.
+	     * Plain printable text needs none of the state machine
+	     * below, so lay the whole run down in one go.
 	     */
-	    if (term->cfg.logtype == LGTYP_DEBUG && term->logctx)
-		logtraffic(term->logctx, (unsigned char) c, LGTYP_DEBUG);
+	    if (term_out_fastpath(term)) {
+		int n = printable_run(chars, nchars);
+		if (n > 0 && (n = term_out_ascii(term, chars, n)) > 0) {
+		    chars += n;
+		    nchars -= n;
+		    continue;
+		}
+	    }
+	    c = *chars++;
+	    nchars--;
 	} else {
 	    c = unget;
 	    unget = -1;
@@ -4517,8 +4687,6 @@ static void term_out(Terminal *term)
     }
 
     term_print_flush(term);
-    if (term->cfg.logflush)
-    logflush(term->logctx);
 }
 
 /*
@@ -5690,6 +5858,24 @@ void term_do_paste(Terminal *term)
     get_clip(term->frontend, NULL, NULL);
 }
 
+/*
+ * Output is held back while a drag-select is in progress. Once it is
+ * over, deal with whatever arrived in the meantime.
+ */
+static void term_resume_out(Terminal *term)
+{
+    if (term->selstate == DRAGGING || bufchain_size(&term->inbuf) == 0)
+	return;
+    if (term->cfg.async_term_out) {
+	term_schedule_out(term);
+    } else if (!term->in_term_out) {
+	term->in_term_out = TRUE;
+	term_reset_cblink(term);
+	term_out(term, -1);
+	term->in_term_out = FALSE;
+    }
+}
+
 void term_mouse(Terminal *term, Mouse_Button braw, Mouse_Button bcooked,
 		Mouse_Action a, int x, int y, int shift, int ctrl, int alt)
 {
@@ -5914,6 +6100,7 @@ void term_mouse(Terminal *term, Mouse_Button braw, Mouse_Button bcooked,
 	request_paste(term->frontend);
     }
 
+    term_resume_out(term);
     term_update(term);
 }
 
@@ -6439,6 +6626,7 @@ static void deselect(Terminal *term)
 void term_deselect(Terminal *term)
 {
     deselect(term);
+    term_resume_out(term);
     term_update(term);
 }
 
@@ -6451,10 +6639,51 @@ int term_ldisc(Terminal *term, int option)
     return FALSE;
 }
 
+/*
+ * One bounded slice of asynchronous terminal output processing: parse
+ * for at most OUT_SLICE_TICKS, then go back to the event loop so the
+ * back end can keep servicing its other channels, and report the
+ * remaining backlog so it can reopen the flow-control window.
+ */
+static void term_out_slice(Terminal *term)
+{
+    long start = GETTICKCOUNT();
+    int backlog;
+
+    if (!term->in_term_out) {
+	term->in_term_out = TRUE;
+	term_reset_cblink(term);
+	while (term->selstate != DRAGGING &&
+	       bufchain_size(&term->inbuf) > 0 &&
+	       GETTICKCOUNT() - start < OUT_SLICE_TICKS)
+	    term_out(term, OUT_SLICE_CHUNK);
+	term->in_term_out = FALSE;
+    }
+
+    /* A drag-select restarts output itself when it finishes. */
+    backlog = bufchain_size(&term->inbuf);
+    if (backlog > 0 && term->selstate != DRAGGING)
+	term_schedule_out(term);
+    if (term->unthrottle_fn)
+	term->unthrottle_fn(term->unthrottle_ctx, backlog);
+}
+
 int term_data(Terminal *term, int is_stderr, const char *data, int len)
 {
     bufchain_add(&term->inbuf, data, len);
 
+    /*
+     * In async mode the data is only queued here; term_out_slice()
+     * works through it from the timer, and the size of the queue is
+     * returned so that the back end applies flow control to this
+     * session alone instead of stalling the whole connection.
+     */
+    if (term->cfg.async_term_out) {
+	if (term->selstate != DRAGGING)
+	    term_schedule_out(term);
+	return bufchain_size(&term->inbuf);
+    }
+
     if (!term->in_term_out) {
 	term->in_term_out = TRUE;
 	term_reset_cblink(term);
@@ -6464,7 +6693,7 @@ int term_data(Terminal *term, int is_stderr, const char *data, int len)
 	 * be selected.
 	 */
 	if (term->selstate != DRAGGING)
-	    term_out(term);
+	    term_out(term, -1);
 	term->in_term_out = FALSE;
     }
 
@@ -6486,6 +6715,7 @@ int term_data(Terminal *term, int is_stderr, const char *data, int len)
      * connection stops accepting data until it's ready.
      *
      * In practice, I can't imagine this causing serious trouble.
+     * (Where it does, async_term_out above takes the other route.)
      */
     return 0;
 }